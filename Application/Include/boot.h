@@ -0,0 +1,89 @@
+/*
+***************************************************************************************************
+*                                  Boot Stage Orchestration
+*
+* File   : boot.h
+* Author : Douglas Xie
+* Date   : 2018.03.23
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*/
+
+#ifndef BOOT_H
+#define BOOT_H
+
+/* Includes -------------------------------------------------------------------------------------*/
+#include "stdint.h"
+#include "stdbool.h"
+
+/* Macro defines --------------------------------------------------------------------------------*/
+/* Readiness bit of one stage in boot event group */
+#define BOOT_READY(stage)       (1UL << (stage))
+
+/* Data Type Define -----------------------------------------------------------------------------*/
+/* Boot stage, independent stages run in their own task and overlap,
+ * dependent stages wait for readiness instead of fixed delay */
+typedef enum
+{
+    BOOT_STAGE_CONFIG = 0,      /* app config read from flash */
+    BOOT_STAGE_PERIPH,          /* clock and peripherals initialized */
+    BOOT_STAGE_KERNEL,          /* scheduler running, tasks created */
+    BOOT_STAGE_LCD,             /* lcd initialized, launch info shown */
+    BOOT_STAGE_SENSOR,          /* camera sensor probed and registers preloaded */
+    BOOT_STAGE_MODULE,          /* wifi module answers at running baudrate */
+    BOOT_STAGE_NETWORK,         /* soft AP is up or station joined */
+    BOOT_STAGE_LINK,            /* tcp server started or cloud server connected */
+    BOOT_STAGE_NUM
+} Boot_Stage_t;
+
+/* Report is printed when last stage is done */
+#define BOOT_STAGE_LAST         BOOT_STAGE_LINK
+
+/* Function declaration -------------------------------------------------------------------------*/
+
+/*******************************************************************************
+* @Brief   Boot Initial
+* @Param
+* @Note    create readiness event group, call in default task before other tasks
+*          are created. Stages done before it are kept and set as ready
+* @Return
+*******************************************************************************/
+void Boot_Init(void);
+
+/*******************************************************************************
+* @Brief   Boot Stage Done
+* @Param   stage[in]: finished stage
+* @Note    first call records ms since reset and sets readiness, later calls
+*          (recovery) are ignored. Can be called before scheduler starts
+* @Return
+*******************************************************************************/
+void Boot_StageDone(Boot_Stage_t stage);
+
+/*******************************************************************************
+* @Brief   Boot Wait Stage
+* @Param   stage[in]: stage to wait for
+*          timeout[in]: ticks
+* @Note
+* @Return  true if stage is done
+*******************************************************************************/
+bool Boot_WaitStage(Boot_Stage_t stage, uint32_t timeout);
+
+/*******************************************************************************
+* @Brief   Boot Stage Time
+* @Param   stage[in]: stage
+* @Note
+* @Return  ms since reset when stage is done, 0 if not done yet
+*******************************************************************************/
+uint32_t Boot_StageTime(Boot_Stage_t stage);
+
+/*******************************************************************************
+* @Brief   Boot Report
+* @Param
+* @Note    print stage times to debug uart, called when last stage is done
+* @Return
+*******************************************************************************/
+void Boot_Report(void);
+
+
+#endif /* BOOT_H */
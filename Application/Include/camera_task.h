@@ -16,6 +16,7 @@
 
 /* Includes -------------------------------------------------------------------------------------*/
 #include "global_config.h"
+#include "image_adapt.h"
 
 /* Macro defines --------------------------------------------------------------------------------*/
 /* Task period */
@@ -42,6 +43,7 @@
 #define CAMERA_EVENT_PUSH_IMAGE     (1 << 3)
 #define CAMERA_EVENT_POST_S         (1 << 4)
 #define CAMERA_EVENT_POST_DO        (1 << 5)
+#define CAMERA_EVENT_PREVIEW        (1 << 6)    /* preview frame ready for udp stream */
 
 /* Camera event group max waiting time */
 #define CAMERA_EVENT_WAITING        (1000 / portTICK_PERIOD_MS)
@@ -65,6 +67,26 @@ typedef struct
     uint8_t  filename[CAMERA_FILENAME_SIZE+2];
 } Camera_FiFo_t;
 
+/* Live preview, frames go to udp stream instead of push image */
+typedef struct
+{
+    volatile bool     active;
+    volatile uint8_t  format;   /* ImageFormat_TypeDef */
+    volatile uint16_t interval; /* ms between two capture */
+    volatile bool     sending;  /* fifo is streamed by wifi task */
+    volatile uint8_t  fifo;
+} Camera_Preview_t;
+
+/* Last photo, kept for range request until the fifo is captured again */
+typedef struct
+{
+    volatile uint16_t id;       /* 1 ~ 0xFFFF, 0 before first photo */
+    volatile uint8_t  fifo;
+    volatile bool     valid;
+    volatile bool     reading;  /* range is sent by wifi task, fifo is not captured */
+    volatile uint16_t chunk;    /* chunk size of its push, base of chunk range */
+} Camera_Frame_t;
+
 /* Camera buffer struct */
 typedef struct
 {
@@ -81,6 +103,15 @@ extern EventGroupHandle_t  camera_event_group;
 /* Camera fifo buffer */
 extern Camera_Buffer_t     camera_info;
 
+/* Capture profile controller, link samples are fed by wifi task */
+extern Adapt_t             camera_adapt;
+
+/* Live preview, set by wifi task */
+extern Camera_Preview_t    camera_preview;
+
+/* Last photo for range request */
+extern Camera_Frame_t      camera_frame;
+
 /* Function declaration -------------------------------------------------------------------------*/
 
 /*******************************************************************************
@@ -26,11 +26,16 @@
 /* Macro Define ---------------------------------------------------------------------------------*/
 /*** Message Format:
  *  StartCode(5) + Command(1) + Index(2) + Length(2) + Payload(0~1024) + Checksum(1) + EndCode(5)
+ *  Protocol v2: StartCode(5) + Command(1) + Index(2) + Length(2) + Payload + CRC32(4) + EndCode(5)
  ***/
 #define MSG_CMD_SIZE            16      /* message command size without payload */
+#define MSG_CMD_SIZE_V2         19      /* protocol v2, crc32 in place of checksum */
 #define MSG_MAX_TX_PAYLOAD      1000
-#define MSG_MAX_RX_PAYLOAD      1000
-#define MSG_BUFFER_SIZE         (MSG_MAX_RX_PAYLOAD + MSG_CMD_SIZE)
+#define MSG_MAX_RX_PAYLOAD      4096    /* frame may span several +IPD, see wifi_reasm */
+#define MSG_BUFFER_SIZE         (MSG_MAX_RX_PAYLOAD + MSG_CMD_SIZE_V2)
+/* Protocol version, v1 after link connect, v2 by MSG_SET_PROTOCOL */
+#define MSG_PROTOCOL_V1         1       /* checksum8 */
+#define MSG_PROTOCOL_V2         2       /* crc32 */
 /* Recognize code */
 #define MSG_RECOGNIZE_CODE_LEN  5       /* 5 */
 #define MSG_START_CODE          0x7B    /* 123 */
@@ -42,6 +47,9 @@
 #define MSG_GET_STATE           (MSG_GET_BASE + 3)
 #define MSG_GET_VERSION         (MSG_GET_BASE + 4)
 #define MSG_GET_ID              (MSG_GET_BASE + 5)
+#define MSG_GET_RANGE           (MSG_GET_BASE + 6)
+#define MSG_GET_METRICS         (MSG_GET_BASE + 7)
+#define MSG_GET_LATENCY         (MSG_GET_BASE + 8)
 /* App set command code */
 #define MSG_SET_BASE            0x20
 #define MSG_SET_ACCOUNT         (MSG_SET_BASE + 1)
@@ -49,16 +57,24 @@
 #define MSG_SET_MOTOR           (MSG_SET_BASE + 3)
 #define MSG_SET_TIME            (MSG_SET_BASE + 4)
 #define MSG_SET_SCH             (MSG_SET_BASE + 5)
+#define MSG_SET_CHUNK           (MSG_SET_BASE + 6)
+#define MSG_SET_TARGET          (MSG_SET_BASE + 7)
+#define MSG_SET_PREVIEW         (MSG_SET_BASE + 8)
+#define MSG_SET_PROTOCOL        (MSG_SET_BASE + 9)
 /* Device push command code */
 #define MSG_PUSH_BASE           0x30
 #define MSG_PUSH_IMAGE          (MSG_PUSH_BASE + 1)
 #define MSG_PUSH_ACCOUNT        (MSG_PUSH_BASE + 2)
 #define MSG_PUSH_ALARM          (MSG_PUSH_BASE + 3)
+#define MSG_PUSH_RANGE          (MSG_PUSH_BASE + 4)
 /* App ota update code */
 #define MSG_OTA_BASE            0x40
 #define MSG_OTA_REQUEST         (MSG_OTA_BASE + 1)
 #define MSG_OTA_BIN             (MSG_OTA_BASE + 2)
 #define MSG_OTA_VERIFY          (MSG_OTA_BASE + 3)
+/* Batch of set commands, one respond */
+#define MSG_BATCH               0x50
+#define MSG_BATCH_MAX           16      /* sub commands in one batch */
 /* Factory new magic code */
 #define MSG_FACTORY_NEW         0xA5
 /* Feedback state code */
@@ -72,6 +88,17 @@
 #define CLIENT_QUEUE_ITEM_SIZE  (sizeof(Client_Message_t)) /* Item size is Client_Message_t type */
 #define CLIENT_QUEUE_TIMEUOT    (1000 / portTICK_PERIOD_MS)
 
+/* Command descriptor flags */
+#define CMD_FLAG_FLASH          0x01    /* may erase or write flash */
+#define CMD_FLAG_BATCH          0x02    /* can be sub command of a batch */
+#define CMD_FLAG_NO_RESPOND     0x04    /* feedback of a push, never responded */
+#define CMD_LENGTH_ANY          0xFFFF
+
+/* OTA write behind: bin packet is acked once queued, writer task programs flash.
+ * Client waits only when all buffers are in use, that is the flow control */
+#define OTA_WRITE_QUEUE_LENGTH  (1)     /* double buffer: one queued, one in flash write */
+#define OTA_WRITE_TIMEOUT       (3000 / portTICK_PERIOD_MS)
+
 
 /* Data Type Define -----------------------------------------------------------------------------*/
 #pragma  pack(1)
@@ -83,6 +110,7 @@ typedef struct
     uint16_t length;
     uint8_t *payload;
     uint8_t  checksum;
+    uint32_t tick;      /* queued tick, for wifi tx latency */
 
 } Client_Message_t;
 
@@ -91,8 +119,38 @@ typedef struct
     uint16_t fw_version;
     uint16_t fw_crc16;
     uint32_t fw_size;
-    uint32_t write_length;
+    uint32_t write_length;      /* bytes acked, flash write may be behind */
+    bool     write_error;       /* set by writer task, ota fails at next packet or verify */
 } Client_Ota_t;
+
+/* Flash write of one bin packet, data is inside message pool block */
+typedef struct
+{
+    uint32_t addr;
+    uint8_t  *data;
+    uint16_t length;
+    uint8_t  *block;            /* freed by writer task after write */
+} Client_OtaWrite_t;
+
+/* Command descriptor, payload length is checked before handler is called */
+typedef struct
+{
+    uint8_t  command;
+    uint8_t  flags;
+    uint16_t min_length;
+    uint16_t max_length;
+    void     (*handler)(void);
+} Client_Command_t;
+
+/* Batch in progress, set commands defer flash write and station reset */
+typedef struct
+{
+    bool     active;
+    bool     config_dirty;
+    bool     station_reset;
+    uint8_t  current;                   /* sub command in progress */
+    uint8_t  status[MSG_BATCH_MAX * 2]; /* command + respond state of each sub command */
+} Client_Batch_t;
 #pragma  pack()
 
 /* Function Declaration -------------------------------------------------------------------------*/
@@ -106,13 +164,13 @@ typedef struct
 void Client_CommTask(void * argument);
 
 /*******************************************************************************
-* @Brief   Receive Data Analyzer
-* @Param   data[in]: receive data from app
-* @Note    analyze data and fill message struct
-* @Return  true: analyze success
-*          false: analyze error
+* @Brief   Client OTA Write Task
+* @Param   
+* @Note    program bin packets of ota queue to flash, lower priority than
+*          client task so next packet is received while flash is written
+* @Return  
 *******************************************************************************/
-bool Client_DataAnalyzer(uint8_t *data, Client_Message_t *msg);
+void Client_OtaWriteTask(void * argument);
 
 /*******************************************************************************
 * @Brief   Command Request Handler
@@ -0,0 +1,57 @@
+/*
+***************************************************************************************************
+*                               Message Frame CRC32
+*
+* File   : crc32.h
+* Author : Douglas Xie
+* Date   : 2018.03.26
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*/
+
+#ifndef CRC32_H
+#define CRC32_H
+
+/* Includes -------------------------------------------------------------------------------------*/
+#include "stdint.h"
+#include "stdbool.h"
+
+/* Macro defines --------------------------------------------------------------------------------*/
+/* CRC-32/MPEG-2 of STM32 CRC unit: poly 0x04C11DB7, init 0xFFFFFFFF,
+ * MSB first, no final xor. Bytes are taken in frame order */
+#define CRC32_POLY              0x04C11DB7
+#define CRC32_INIT              0xFFFFFFFF
+
+/* Shorter data is done by table, CRC unit seed and tail cost more */
+#define CRC32_HW_MIN            16
+
+/* Host build has no CRC unit, define CRC32_HOST to use table only */
+#ifndef CRC32_HOST
+#include "stm32f4xx_hal.h"
+#endif
+
+/* Function declaration -------------------------------------------------------------------------*/
+
+/*******************************************************************************
+* @Brief   CRC32 Calculate
+* @Param   crc[in]: CRC32_INIT or result of previous part
+*          pdata[in]: data, any alignment
+*          length[in]: data length
+* @Note    CRC unit is used when it is free, else table, result is the same
+* @Return  crc of data
+*******************************************************************************/
+uint32_t CRC32_Calculate(uint32_t crc, const uint8_t *pdata, uint32_t length);
+
+/*******************************************************************************
+* @Brief   CRC32 Calculate by Table
+* @Param   crc[in]: CRC32_INIT or result of previous part
+*          pdata[in]: data
+*          length[in]: data length
+* @Note    portable, one table lookup per byte
+* @Return  crc of data
+*******************************************************************************/
+uint32_t CRC32_Software(uint32_t crc, const uint8_t *pdata, uint32_t length);
+
+
+#endif /* CRC32_H */
@@ -54,22 +54,26 @@
 #define CFG_STACK_DEFAULT       (128)   /* 512  bytes */
 #define	CFG_STACK_MONITOR       (128)   /* 512  bytes */
 #define	CFG_STACK_WIFI          (256)   /* 1024 bytes */
+#define	CFG_STACK_WIFI_RX       (256)   /* 1024 bytes */
 #define	CFG_STACK_CLIENT        (128)   /* 512  bytes */
 #define	CFG_STACK_MOTOR         (128)   /* 512  bytes */
 #define	CFG_STACK_DISPLAY       (128)   /* 512  bytes */
 #define	CFG_STACK_CAMERA        (128)   /* 512  bytes */
 #define	CFG_STACK_SAVE          (128)   /* 512  bytes */
 #define	CFG_STACK_DEBUG         (128)   /* 512  bytes */
+#define	CFG_STACK_OTA           (128)   /* 512  bytes */
 
 /*=======================================================*/
 /* Application task priority at which the tasks are created. */
 #define CFG_PRIORITY_DEFAULT    4   /* osPriorityNormal */
 #define	CFG_PRIORITY_MONITOR    9
 #define	CFG_PRIORITY_WIFI       8
+#define	CFG_PRIORITY_WIFI_RX    9
 #define	CFG_PRIORITY_CLIENT     8
 #define	CFG_PRIORITY_MOTOR      7
 #define	CFG_PRIORITY_CAMERA     6
 #define	CFG_PRIORITY_SAVE       5
+#define	CFG_PRIORITY_OTA        5   /* below client, flash write behind ack */
 #define	CFG_PRIORITY_DISPLAY    4
 #define	CFG_PRIORITY_DEBUG      3
   
@@ -0,0 +1,105 @@
+/*
+***************************************************************************************************
+*                               Adaptive Image Profile Controller
+*
+* File   : image_adapt.h
+* Author : Douglas Xie
+* Date   : 2018.03.22
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*/
+
+#ifndef IMAGE_ADAPT_H
+#define IMAGE_ADAPT_H
+
+/* Includes -------------------------------------------------------------------------------------*/
+#include "stdint.h"
+#include "stdbool.h"
+
+/* Macro defines --------------------------------------------------------------------------------*/
+#define ADAPT_PROFILE_NUM       5
+#define ADAPT_PROFILE_DEFAULT   (ADAPT_PROFILE_NUM - 1)     /* 640x480, used before link is measured */
+
+/* Target time to deliver one image */
+#define ADAPT_TARGET_DEFAULT    3000    /* ms */
+#define ADAPT_TARGET_MIN        500     /* ms */
+#define ADAPT_TARGET_MAX        30000   /* ms */
+
+#define ADAPT_RSSI_UNKNOWN      0       /* valid rssi is negative dBm */
+
+/* Data Type Define -----------------------------------------------------------------------------*/
+/* Capture profile, format is ImageFormat_TypeDef of ov7670.h */
+typedef struct
+{
+    uint8_t     format;
+    uint8_t     quality;    /* OV2640 DSP Qs, larger is smaller file */
+    uint16_t    size;       /* initial size estimate in bytes */
+} Adapt_Profile_t;
+
+/* Controller context */
+typedef struct
+{
+    uint32_t    size[ADAPT_PROFILE_NUM];    /* measured jpg size, moving average */
+    uint32_t    goodput;    /* delivered bytes per second, moving average, 0 means unknown */
+    int8_t      rssi;       /* dBm of last sample, ADAPT_RSSI_UNKNOWN if not sampled */
+    uint8_t     profile;    /* profile of next capture */
+} Adapt_t;
+
+/* Public variables ----------------------------------------------------------------------------*/
+extern const Adapt_Profile_t adapt_profile_table[ADAPT_PROFILE_NUM];
+
+/* Function declaration -------------------------------------------------------------------------*/
+
+/*******************************************************************************
+* @Brief   Adapt Initial
+* @Param   adapt[in]: controller object
+* @Note    link is unknown, default profile is used until first sample
+* @Return
+*******************************************************************************/
+void Adapt_Init(Adapt_t *adapt);
+
+/*******************************************************************************
+* @Brief   Adapt Link RSSI Sample
+* @Param   rssi[in]: dBm from AT+CWJAP?
+* @Note
+* @Return
+*******************************************************************************/
+void Adapt_LinkRssi(Adapt_t *adapt, int8_t rssi);
+
+/*******************************************************************************
+* @Brief   Adapt Link Delivery Sample
+* @Param   length[in]: image bytes delivered
+*          elapsed_ms[in]: time from first chunk to last SEND OK
+* @Note
+* @Return
+*******************************************************************************/
+void Adapt_LinkDelivery(Adapt_t *adapt, uint32_t length, uint32_t elapsed_ms);
+
+/*******************************************************************************
+* @Brief   Adapt Link Failure
+* @Param
+* @Note    image is not delivered, goodput estimate is halved
+* @Return
+*******************************************************************************/
+void Adapt_LinkFail(Adapt_t *adapt);
+
+/*******************************************************************************
+* @Brief   Adapt Image Size Sample
+* @Param   profile[in]: profile of the capture
+*          length[in]: jpg size
+* @Note
+* @Return
+*******************************************************************************/
+void Adapt_ImageSize(Adapt_t *adapt, uint8_t profile, uint32_t length);
+
+/*******************************************************************************
+* @Brief   Adapt Select Profile
+* @Param   target_ms[in]: target time to deliver one image
+* @Note    call before each capture
+* @Return  profile index of adapt_profile_table
+*******************************************************************************/
+uint8_t Adapt_Select(Adapt_t *adapt, uint32_t target_ms);
+
+
+#endif /* IMAGE_ADAPT_H */
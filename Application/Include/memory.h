@@ -64,6 +64,11 @@
 #define APP_ESP8266_SoftAP      ((uint32_t)0)           /* ap , default mode */
 #define APP_ESP8266_STATION     ((uint32_t)0xABEA8266)  /* station */
 #define APP_CONFIG_OK           ((uint8_t) 0x0755)
+#define APP_CONFIG_LEGACY_WORDS 78      /* config size before wifi uart fields, checksum follows */
+
+/* Flash writer: program and erase are retried, then reported as failed */
+#define MEM_PROGRAM_RETRY       3
+#define MEM_ERASE_RETRY         3
 
 /* Data Type Define -----------------------------------------------------------------------------*/
 typedef union APP_STATUS
@@ -103,6 +108,16 @@ typedef struct CFG_MOTOR
     /* total 25 bytes */
 } MotorCfg_t;
 
+typedef struct CFG_JOIN
+{
+    uint8_t bssid[6];
+    uint8_t channel;        /* 0 means not cached */
+    uint8_t ip[4];
+    uint8_t gateway[4];
+    uint8_t netmask[4];
+    /* total 19 bytes */
+} JoinCfg_t;
+
 typedef union APP_CONFIG
 {
     struct
@@ -120,13 +135,29 @@ typedef union APP_CONFIG
         MotorCfg_t  motor_cfg;      //25
         SchCfg_t    schedule[12];   //84
         uint8_t     sch_count;      //1  
+        /* wifi uart link, 0 means not negotiated */
+        uint32_t    wifi_baudrate;  //4
+        uint8_t     wifi_flow_ctrl; //1   1: RTS/CTS enabled
+        JoinCfg_t   wifi_join;      //19  station fast join, cached from last join
+        uint16_t    image_target;   //2   ms to deliver one image, 0 means default
+        uint8_t     reserved[42];   //42  keep zero, for new config
         uint32_t    checksum;
     };
-    uint32_t array32[77];
-    uint8_t  array[308];
+    uint32_t array32[96];
+    uint8_t  array[384];
 } App_Config_t;
 #pragma   pack()
 
+/* Flash writer, combines bytes to aligned words and programs by word (x32 at
+ * VOLTAGE_RANGE_3). Bytes of a word not complete wait for next put or flush */
+typedef struct
+{
+    uint32_t address;       /* flash address of pending[0] or of next byte */
+    uint8_t  pending[4];    /* head of next word, address is word aligned */
+    uint8_t  count;         /* bytes in pending */
+    bool     error;         /* program or read back failed, kept until begin */
+} Mem_Writer_t;
+
 /* Public variables ----------------------------------------------------------------------------*/
 extern App_Info_t app_info;
 extern App_Config_t app_config;
@@ -134,12 +165,16 @@ extern App_Config_t app_config;
 /* Function declaration -------------------------------------------------------------------------*/
 
 void Mem_ReadInfo(void);
-void Mem_WriteInfo(void);
+bool Mem_WriteInfo(void);
 void Mem_ResetConfig(void);
 void Mem_ReadConfig(void);
-void Mem_WriteConfig(void);
-void Mem_EraseApp(uint32_t start_addr, uint32_t end_addr);
-void Mem_WriteApp(uint32_t start_addr, uint8_t *data_buf, uint32_t data_len);
+bool Mem_WriteConfig(void);
+bool Mem_EraseApp(uint32_t start_addr, uint32_t end_addr);
+bool Mem_WriteApp(uint32_t start_addr, uint8_t *data_buf, uint32_t data_len);
+bool Mem_FlushApp(void);
+void Mem_WriterBegin(Mem_Writer_t *writer, uint32_t address);
+bool Mem_WriterPut(Mem_Writer_t *writer, const uint8_t *data, uint32_t length);
+bool Mem_WriterFlush(Mem_Writer_t *writer);
 uint16_t CRC16_CCITT(const uint8_t* pdata, uint16_t length);
 uint32_t Mem_GetChecksum32(uint32_t *pdata, uint32_t length);
 uint8_t Mem_GetChecksum8(uint8_t init_value, uint8_t *pdata, uint32_t length);
@@ -0,0 +1,123 @@
+/*
+***************************************************************************************************
+*                               Runtime Metrics Registry
+*
+* File   : metrics.h
+* Author : Douglas Xie
+* Date   : 2018.03.27
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+/* Includes -------------------------------------------------------------------------------------*/
+#include "stdint.h"
+#include "stdbool.h"
+
+#include "boot.h"
+
+/* Macro defines --------------------------------------------------------------------------------*/
+/* Snapshot layout version, decoder: script/metrics_decode.py */
+#define METRICS_VERSION         1
+
+/* Histogram bucket n counts [2^n, 2^(n+1)) ms, first is 0~1ms, last is open (>= 2s) */
+#define METRICS_BUCKETS         12
+
+/* Counter is written by one task only, so update is a plain add without lock.
+ * Snapshot reads words, a value is never torn */
+#define METRIC_INC(id)          (metrics_counter[(id)]++)
+#define METRIC_ADD(id, n)       (metrics_counter[(id)] += (n))
+#define METRIC_SET(id, value)   (metrics_gauge[(id)] = (uint32_t)(value))
+
+/* Data Type Define -----------------------------------------------------------------------------*/
+/* Counter, only grows and wraps at 32bit. Writer task in comment */
+typedef enum
+{
+    METRIC_WIFI_TX_BYTES = 0,   /* wifi control: bytes to module by uart dma */
+    METRIC_WIFI_IMAGES,         /* wifi control: images delivered */
+    METRIC_WIFI_IMAGE_FAIL,     /* wifi control: images not delivered to a link */
+    METRIC_WIFI_RETRY,          /* wifi control: chunk resent after send window fallback */
+    METRIC_WIFI_RECOVER,        /* wifi control: module recovered */
+    METRIC_WIFI_RX_FRAMES,      /* wifi receive: client frames decoded */
+    METRIC_WIFI_RX_DROP,        /* wifi receive: broken frame or garbage dropped */
+    METRIC_CAMERA_PHOTOS,       /* camera: photos captured */
+    METRIC_CAMERA_PREVIEWS,     /* camera: preview frames captured */
+    METRIC_CAMERA_ERRORS,       /* camera: capture without data */
+    METRIC_CLIENT_REQUESTS,     /* client: requests handled */
+    METRIC_CLIENT_ERRORS,       /* client: error responds */
+    METRIC_MOTOR_FEEDS,         /* motor: schedule entries run */
+    METRIC_WIFI_RX_LAP,         /* wifi receive: circular dma lapped unread ring data */
+    METRIC_COUNTER_NUM
+} Metric_Counter_t;
+
+/* Gauge, last value. Set by owner task or sampled when snapshot is taken */
+typedef enum
+{
+    METRIC_HEAP_FREE = 0,       /* sampled: kernel heap bytes free */
+    METRIC_HEAP_MIN,            /* sampled: kernel heap bytes free, lowest ever */
+    METRIC_POOL_SMALL_HIGH,     /* sampled: message pool blocks used, highest */
+    METRIC_POOL_MEDIUM_HIGH,
+    METRIC_POOL_LARGE_HIGH,
+    METRIC_POOL_FAIL,           /* sampled: message pool alloc fail of all pools */
+    METRIC_LINK_RSSI,           /* sampled: dBm, signed */
+    METRIC_LINK_GOODPUT,        /* sampled: delivered bytes per second */
+    METRIC_IMAGE_PROFILE,       /* sampled: capture profile of next photo */
+    METRIC_IMAGE_SIZE,          /* camera: jpg bytes of last photo */
+    METRIC_CHUNK_SIZE,          /* wifi control: chunk size of last image */
+    METRIC_GAUGE_NUM
+} Metric_Gauge_t;
+
+/* Latency histogram in ms, same order as WiFi_TxClass_t for the tx classes */
+typedef enum
+{
+    METRIC_HIST_TX_CONTROL = 0, /* wifi control: respond queued to sent */
+    METRIC_HIST_TX_IMAGE,       /* wifi control: image chunk CIPSEND to accepted */
+    METRIC_HIST_CAPTURE,        /* camera: dma start to frame done */
+    METRIC_HIST_DELIVERY,       /* wifi control: first chunk to last SEND OK of image */
+    METRIC_HIST_NUM
+} Metric_Hist_t;
+
+/* Snapshot bytes: version(1) + uptime(4) + counters + gauges + histograms + boot stage times,
+ * each section starts with its item count, histogram section also with bucket count */
+#define METRICS_SNAPSHOT_SIZE   (5 + (1 + METRIC_COUNTER_NUM * 4) + (1 + METRIC_GAUGE_NUM * 4) + \
+                                 (2 + METRIC_HIST_NUM * METRICS_BUCKETS * 2) + (1 + BOOT_STAGE_NUM * 4))
+
+/* Public variables ----------------------------------------------------------------------------*/
+extern uint32_t metrics_counter[METRIC_COUNTER_NUM];
+extern uint32_t metrics_gauge[METRIC_GAUGE_NUM];
+extern uint16_t metrics_hist[METRIC_HIST_NUM][METRICS_BUCKETS];
+
+/* Function declaration -------------------------------------------------------------------------*/
+
+/*******************************************************************************
+* @Brief   Metrics Record Latency
+* @Param   hist[in]: histogram
+*          value_ms[in]: latency in ms
+* @Note    
+* @Return
+*******************************************************************************/
+void Metrics_Record(Metric_Hist_t hist, uint32_t value_ms);
+
+/*******************************************************************************
+* @Brief   Metrics Histogram Add
+* @Param   hist[in]: METRICS_BUCKETS buckets, may be owned by other module
+*          value_ms[in]: latency in ms
+* @Note    one count leading zeros for the bucket, bucket saturates at 0xFFFF
+* @Return
+*******************************************************************************/
+void Metrics_HistAdd(uint16_t *hist, uint32_t value_ms);
+
+/*******************************************************************************
+* @Brief   Metrics Snapshot
+* @Param   buffer[out]: snapshot, little endian
+*          size[in]: buffer size, METRICS_SNAPSHOT_SIZE
+* @Note    sampled gauges are refreshed first
+* @Return  bytes of snapshot, 0 if buffer is too small
+*******************************************************************************/
+uint16_t Metrics_Snapshot(uint8_t *buffer, uint16_t size);
+
+
+#endif /* METRICS_H */
@@ -0,0 +1,118 @@
+/*
+***************************************************************************************************
+*                               Message Payload Block Pool
+*
+* File   : msg_pool.h
+* Author : Douglas Xie
+* Date   : 2018.03.25
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*/
+
+#ifndef MSG_POOL_H
+#define MSG_POOL_H
+
+/* Includes -------------------------------------------------------------------------------------*/
+#include "stdint.h"
+#include "stdbool.h"
+
+/* Macro defines --------------------------------------------------------------------------------*/
+/* Small block: responds and set commands */
+#define MSG_POOL_SMALL_SIZE     64
+#define MSG_POOL_SMALL_NUM      8
+
+/* Medium block: larger responds, e.g. metrics snapshot */
+#define MSG_POOL_MEDIUM_SIZE    256
+#define MSG_POOL_MEDIUM_NUM     2
+
+/* Large block: ota bin packet, one in receive, one in client task and two owned by
+ * ota write task (queued and in flash write). Same as MSG_MAX_RX_PAYLOAD of client_task.h */
+#define MSG_POOL_LARGE_SIZE     4096
+#define MSG_POOL_LARGE_NUM      4
+
+/* Host build has no kernel, define POOL_HOST to drop the critical section */
+#ifdef POOL_HOST
+#define POOL_LOCK()             0
+#define POOL_UNLOCK(state)      ((void)(state))
+#else
+#include "FreeRTOS.h"
+#include "task.h"
+/* interrupt mask works from task and ISR */
+#define POOL_LOCK()             taskENTER_CRITICAL_FROM_ISR()
+#define POOL_UNLOCK(state)      taskEXIT_CRITICAL_FROM_ISR(state)
+#endif
+
+/* Data Type Define -----------------------------------------------------------------------------*/
+/* Pool of same size blocks, free block holds the link of free list */
+typedef struct
+{
+    uint8_t     *storage;
+    uint16_t    block_size;     /* multiple of 4 */
+    uint16_t    block_num;
+    void        *free_list;
+    uint16_t    used;
+    uint16_t    high_water;     /* max used blocks */
+    uint32_t    fail;           /* alloc with no free block or too large */
+} Pool_t;
+
+/* Public variables ----------------------------------------------------------------------------*/
+extern Pool_t msg_pool_small;
+extern Pool_t msg_pool_medium;
+extern Pool_t msg_pool_large;
+
+/* Function declaration -------------------------------------------------------------------------*/
+
+/*******************************************************************************
+* @Brief   Pool Initial
+* @Param   pool[in]: pool object
+*          storage[in]: block_size * block_num bytes, 4 bytes aligned
+*          block_size[in]: bytes of one block, multiple of 4
+*          block_num[in]: number of blocks
+* @Note
+* @Return
+*******************************************************************************/
+void Pool_Init(Pool_t *pool, void *storage, uint16_t block_size, uint16_t block_num);
+
+/*******************************************************************************
+* @Brief   Pool Allocate
+* @Param
+* @Note    O(1), callable from task and ISR
+* @Return  block, NULL if pool is empty
+*******************************************************************************/
+void *Pool_Alloc(Pool_t *pool);
+
+/*******************************************************************************
+* @Brief   Pool Free
+* @Param   block[in]: block from Pool_Alloc of this pool
+* @Note    O(1), callable from task and ISR
+* @Return  false if block is not of this pool
+*******************************************************************************/
+bool Pool_Free(Pool_t *pool, void *block);
+
+/*******************************************************************************
+* @Brief   Message Pool Initial
+* @Param
+* @Note    call once before tasks are created
+* @Return
+*******************************************************************************/
+void MsgPool_Init(void);
+
+/*******************************************************************************
+* @Brief   Message Pool Allocate
+* @Param   length[in]: payload bytes
+* @Note    smallest block that fits, replace pvPortMalloc of message payload
+* @Return  block, NULL if length is 0, too large or pool is empty
+*******************************************************************************/
+uint8_t *MsgPool_Alloc(uint16_t length);
+
+/*******************************************************************************
+* @Brief   Message Pool Free
+* @Param   payload[in]: block from MsgPool_Alloc or NULL
+* @Note    replace vPortFree of message payload
+* @Return
+*******************************************************************************/
+void MsgPool_Free(void *payload);
+
+
+#endif /* MSG_POOL_H */
@@ -54,6 +54,7 @@
 #define OV2640_SENSOR_COM2       0x09
 #define OV2640_SENSOR_PIDH       0x0A
 #define OV2640_SENSOR_PIDL       0x0B
+#define OV2640_PIDH              0x26    /* PIDL is 0x41 or 0x42 by revision */
 #define OV2640_SENSOR_COM3       0x0C
 #define OV2640_SENSOR_COM4       0x0D
 #define OV2640_SENSOR_AEC        0x10
@@ -124,6 +125,8 @@ void OV7670_Window_Set(uint16_t sx,uint16_t sy,uint16_t width,uint16_t height);
 uint8_t oV2670_ini(void);
 void OV2640_JPEGConfig(ImageFormat_TypeDef ImageFormat);
 void OV2640_Reset(void);
+uint16_t OV2640_ReadID(void);
+void OV2640_QualityConfig(uint8_t Quality);
 void OV2640_BrightnessConfig(uint8_t Brightness);
 void OV2640_AutoExposure(uint8_t level);
 #endif
@@ -0,0 +1,121 @@
+/*
+***************************************************************************************************
+*                               Byte Ring Buffer
+*
+* File   : ring_buffer.h
+* Author : Douglas Xie
+* Date   : 2018.03.05
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*/
+
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+/* Includes -------------------------------------------------------------------------------------*/
+#include "stdint.h"
+#include "stdbool.h"
+
+/* Macro defines --------------------------------------------------------------------------------*/
+
+/* Data Type Define -----------------------------------------------------------------------------*/
+/* Single producer / single consumer byte ring
+ * head: write index, moved by producer (software write or dma position)
+ * tail: read index, moved by consumer
+ * head == tail means empty, so one byte is kept free for software producer
+ * dma_events: half/full transfer events already matched to head moves */
+typedef struct
+{
+    uint8_t  *buffer;
+    uint16_t size;
+    volatile uint16_t head;
+    volatile uint16_t tail;
+    uint32_t dma_events;
+} Ring_Buffer_t;
+
+/* Function declaration -------------------------------------------------------------------------*/
+
+/*******************************************************************************
+* @Brief   Ring Buffer Initial
+* @Param   ring[in]: ring object
+*          buffer[in]: storage memory
+*          size[in]: storage size in bytes
+* @Note
+* @Return
+*******************************************************************************/
+void Ring_Init(Ring_Buffer_t *ring, uint8_t *buffer, uint16_t size);
+
+/*******************************************************************************
+* @Brief   Ring Buffer Reset
+* @Param
+* @Note    drop all data and move head and tail to start of storage
+* @Return
+*******************************************************************************/
+void Ring_Reset(Ring_Buffer_t *ring);
+
+/*******************************************************************************
+* @Brief   Ring Buffer Write
+* @Param   data[in]: input data
+*          length[in]: input data length
+* @Note    software producer, data is truncated when ring is full
+* @Return  number of bytes written
+*******************************************************************************/
+uint16_t Ring_Write(Ring_Buffer_t *ring, const uint8_t *data, uint16_t length);
+
+/*******************************************************************************
+* @Brief   Ring Buffer Set Head
+* @Param   head[in]: new write index
+* @Note    hardware producer, used when dma writes the storage directly
+* @Return
+*******************************************************************************/
+void Ring_SetHead(Ring_Buffer_t *ring, uint16_t head);
+
+/*******************************************************************************
+* @Brief   Ring Buffer Set Dma Head
+* @Param   head[in]: dma write index
+*          events[in]: half and full transfer events since Ring_Reset
+* @Note    circular dma producer. A move of head crosses a known number of
+*          half ring boundaries, two more events mean dma went round the
+*          whole ring. An event counted before its head move is carried to
+*          next call
+* @Return  true when dma lapped the ring or passed tail, unread data is lost
+*******************************************************************************/
+bool Ring_SetHeadDma(Ring_Buffer_t *ring, uint16_t head, uint32_t events);
+
+/*******************************************************************************
+* @Brief   Ring Buffer Data Count
+* @Param
+* @Note
+* @Return  number of bytes can be read
+*******************************************************************************/
+uint16_t Ring_Count(const Ring_Buffer_t *ring);
+
+/*******************************************************************************
+* @Brief   Ring Buffer Peek
+* @Param   data[out]: point to first unread byte
+* @Note    return the contiguous part only, call again after Ring_Skip()
+*          to get the wrapped part
+* @Return  number of contiguous bytes at *data
+*******************************************************************************/
+uint16_t Ring_Peek(const Ring_Buffer_t *ring, uint8_t **data);
+
+/*******************************************************************************
+* @Brief   Ring Buffer Skip
+* @Param   length[in]: bytes to drop
+* @Note
+* @Return
+*******************************************************************************/
+void Ring_Skip(Ring_Buffer_t *ring, uint16_t length);
+
+/*******************************************************************************
+* @Brief   Ring Buffer Read
+* @Param   data[out]: output buffer
+*          length[in]: output buffer size
+* @Note
+* @Return  number of bytes read
+*******************************************************************************/
+uint16_t Ring_Read(Ring_Buffer_t *ring, uint8_t *data, uint16_t length);
+
+
+#endif /* RING_BUFFER_H */
@@ -0,0 +1,115 @@
+/*
+***************************************************************************************************
+*                               ESP8266 AT Response Tokenizer
+*
+* File   : wifi_parser.h
+* Author : Douglas Xie
+* Date   : 2018.03.12
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*/
+
+#ifndef WIFI_PARSER_H
+#define WIFI_PARSER_H
+
+/* Includes -------------------------------------------------------------------------------------*/
+#include "stdint.h"
+#include "stdbool.h"
+
+/* Macro defines --------------------------------------------------------------------------------*/
+#define PARSER_LINE_SIZE        128     /* max length of one response line */
+#define PARSER_LINK_NONE        0xFF    /* event without link id */
+
+/* Data Type Define -----------------------------------------------------------------------------*/
+/* Parser event type */
+typedef enum
+{
+    PARSER_EVT_NONE = 0,
+    PARSER_EVT_LINE,            /* unknown line, echo, +CIPSTAMAC:... data is line text */
+    PARSER_EVT_OVERFLOW,        /* line longer than PARSER_LINE_SIZE, dropped */
+
+    /* AT command result */
+    PARSER_EVT_OK,              /* OK */
+    PARSER_EVT_ERROR,           /* ERROR */
+    PARSER_EVT_FAIL,            /* FAIL */
+    PARSER_EVT_BUSY,            /* busy s... / busy p... */
+    PARSER_EVT_READY,           /* ready, module boot finish */
+
+    /* Send data */
+    PARSER_EVT_SEND_READY,      /* > */
+    PARSER_EVT_RECV,            /* Recv n bytes */
+    PARSER_EVT_SEND_OK,         /* SEND OK */
+    PARSER_EVT_SEND_FAIL,       /* SEND FAIL */
+
+    /* Connection state */
+    PARSER_EVT_CLOSED,          /* CLOSED, single link mode */
+    PARSER_EVT_LINK_CONNECT,    /* n,CONNECT */
+    PARSER_EVT_LINK_CLOSED,     /* n,CLOSED */
+    PARSER_EVT_WIFI_CONNECTED,  /* WIFI CONNECTED */
+    PARSER_EVT_WIFI_GOT_IP,     /* WIFI GOT IP */
+    PARSER_EVT_WIFI_DISCONNECT, /* WIFI DISCONNECT */
+
+    /* Receive data, +IPD,n,m:xxxx or +IPD,m:xxxx */
+    PARSER_EVT_IPD_HEAD,        /* header parsed, length is payload size */
+    PARSER_EVT_IPD_DATA,        /* part of payload, data point to input buffer */
+    PARSER_EVT_IPD_DONE,        /* all payload received */
+
+} Parser_EventType_t;
+
+/* Parser event, data span is valid only in callback */
+typedef struct
+{
+    Parser_EventType_t  type;
+    uint8_t             link_id;    /* 0~4, or PARSER_LINK_NONE */
+    uint16_t            length;     /* span length, +IPD payload size for IPD_HEAD */
+    const uint8_t       *data;      /* span: line text or +IPD payload part */
+} Parser_Event_t;
+
+/* Parser event callback */
+typedef void (*Parser_Callback_t)(const Parser_Event_t *event, void *context);
+
+/* Parser context */
+typedef struct
+{
+    uint8_t             line[PARSER_LINE_SIZE];
+    uint16_t            line_length;
+    uint16_t            ipd_remain;
+    uint8_t             ipd_link;
+    uint8_t             state;
+    Parser_Callback_t   callback;
+    void                *context;
+} Parser_t;
+
+/* Function declaration -------------------------------------------------------------------------*/
+
+/*******************************************************************************
+* @Brief   Parser Initial
+* @Param   parser[in]: parser object
+*          callback[in]: event callback
+*          context[in]: user data for callback
+* @Note
+* @Return
+*******************************************************************************/
+void Parser_Init(Parser_t *parser, Parser_Callback_t callback, void *context);
+
+/*******************************************************************************
+* @Brief   Parser Reset
+* @Param
+* @Note    drop partial line and +IPD payload
+* @Return
+*******************************************************************************/
+void Parser_Reset(Parser_t *parser);
+
+/*******************************************************************************
+* @Brief   Parser Input
+* @Param   data[in]: bytes from wifi module
+*          length[in]: data length
+* @Note    events are emitted by callback before return, +IPD payload is
+*          emitted as spans of input buffer without copy
+* @Return
+*******************************************************************************/
+void Parser_Input(Parser_t *parser, const uint8_t *data, uint16_t length);
+
+
+#endif /* WIFI_PARSER_H */
@@ -0,0 +1,121 @@
+/*
+***************************************************************************************************
+*                               Client Message Frame Reassembly
+*
+* File   : wifi_reasm.h
+* Author : Douglas Xie
+* Date   : 2018.03.20
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*/
+
+#ifndef WIFI_REASM_H
+#define WIFI_REASM_H
+
+/* Includes -------------------------------------------------------------------------------------*/
+#include "stdint.h"
+#include "stdbool.h"
+
+/* Macro defines --------------------------------------------------------------------------------*/
+/* Frame layout, same as MSG_xxx of client_task.h
+ * start code(5) + command(1) + index(2) + length(2) + payload + checksum(1) + end code(5)
+ * protocol v2 has crc32(4, little endian) in place of checksum(1) */
+#define REASM_CODE_LEN          5
+#define REASM_START_CODE        0x7B
+#define REASM_END_CODE          0xA8
+#define REASM_HEAD_LEN          5       /* command + index + length */
+#define REASM_CRC_LEN           4
+#define REASM_FRAME_OVERHEAD    (REASM_CODE_LEN * 2 + REASM_HEAD_LEN + 1)
+#define REASM_FRAME_OVERHEAD_V2 (REASM_CODE_LEN * 2 + REASM_HEAD_LEN + REASM_CRC_LEN)
+
+/* Protocol version of link */
+#define REASM_VERSION_1         1       /* checksum8 */
+#define REASM_VERSION_2         2       /* crc32 */
+
+/* Data Type Define -----------------------------------------------------------------------------*/
+/* Validated frame, payload point to input data or reassembly buffer and is
+ * valid only in callback */
+typedef struct
+{
+    uint8_t         command;
+    uint16_t        index;
+    uint16_t        length;
+    const uint8_t   *payload;   /* NULL if length is 0 */
+    uint32_t        checksum;   /* checksum8 or crc32 by protocol version */
+} Reasm_Frame_t;
+
+/* Frame callback */
+typedef void (*Reasm_Callback_t)(const Reasm_Frame_t *frame, void *context);
+
+/* Decoder state, one byte at a time */
+typedef enum
+{
+    REASM_STATE_START = 0,      /* count start code */
+    REASM_STATE_HEAD,           /* command, index, length */
+    REASM_STATE_PAYLOAD,
+    REASM_STATE_CHECKSUM,
+    REASM_STATE_END,            /* count end code */
+} Reasm_State_t;
+
+/* Reassembly context of one link */
+typedef struct
+{
+    uint8_t             *buffer;    /* payload storage when frame spans segments */
+    uint16_t            size;       /* bounded memory, max payload size */
+    uint8_t             version;    /* REASM_VERSION_x */
+    Reasm_State_t       state;
+    uint8_t             count;      /* code, head or check bytes held */
+    uint8_t             head[REASM_HEAD_LEN];
+    uint8_t             sum;        /* checksum8 from command to payload end */
+    uint16_t            held;       /* payload bytes done */
+    uint16_t            taken;      /* bytes of frame in progress, dropped if broken */
+    uint32_t            dropped;    /* garbage and broken frame bytes */
+    Reasm_Frame_t       frame;
+    Reasm_Callback_t    callback;
+    void                *context;
+} Reasm_t;
+
+/* Function declaration -------------------------------------------------------------------------*/
+
+/*******************************************************************************
+* @Brief   Reassembly Initial
+* @Param   reasm[in]: reassembly object
+*          buffer[in]: payload storage, frame with larger payload is dropped
+*          size[in]: storage size in bytes
+*          callback[in]: complete frame callback
+*          context[in]: user data for callback
+* @Note
+* @Return
+*******************************************************************************/
+void Reasm_Init(Reasm_t *reasm, uint8_t *buffer, uint16_t size, Reasm_Callback_t callback, void *context);
+
+/*******************************************************************************
+* @Brief   Reassembly Reset
+* @Param
+* @Note    drop partial frame, call when link is connected or closed
+* @Return
+*******************************************************************************/
+void Reasm_Reset(Reasm_t *reasm);
+
+/*******************************************************************************
+* @Brief   Reassembly Set Version
+* @Param   version[in]: REASM_VERSION_x
+* @Note    next frame is checked by checksum8 or crc32, partial frame is dropped
+* @Return
+*******************************************************************************/
+void Reasm_SetVersion(Reasm_t *reasm, uint8_t version);
+
+/*******************************************************************************
+* @Brief   Reassembly Input
+* @Param   data[in]: one segment of link data, any size
+*          length[in]: data length
+* @Note    zero or more validated frames are emitted by callback before
+*          return. Payload of a frame complete in this segment is not copied,
+*          only a frame that spans segments is kept in buffer
+* @Return  false if any byte is dropped
+*******************************************************************************/
+bool Reasm_Input(Reasm_t *reasm, const uint8_t *data, uint16_t length);
+
+
+#endif /* WIFI_REASM_H */
@@ -0,0 +1,180 @@
+/*
+***************************************************************************************************
+*                               ESP8266 AT Send Window
+*
+* File   : wifi_send.h
+* Author : Douglas Xie
+* Date   : 2018.03.05
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*/
+
+#ifndef WIFI_SEND_H
+#define WIFI_SEND_H
+
+/* Includes -------------------------------------------------------------------------------------*/
+#include "stdint.h"
+#include "stdbool.h"
+
+/* Macro defines --------------------------------------------------------------------------------*/
+/* Image upload pipeline: max chunks accepted by module but waiting for SEND OK */
+#define WIFI_SEND_WINDOW        3
+
+/* AP mode fan-out: each captured frame is pushed to every connected link */
+#define WIFI_LINK_NUM           5       /* ESP8266 max links 0~4 */
+#define WIFI_LINK_WINDOW        2       /* max chunks in flight of one link, leave room for others */
+#define WIFI_LINK_BUSY_REPEAT   5       /* busy retries of one chunk */
+
+/* Data Type Define -----------------------------------------------------------------------------*/
+/* WiFi receive data type */
+typedef enum
+{
+    /* General feedback */
+    WIFI_RX_NONE,
+    WIFI_RX_ERROR,              /* ERROR */
+    WIFI_RX_CLOSED,             /* CLOSED */
+    WIFI_RX_OVERFLOW,           /* Receive buffer overflow */
+
+    /* WiFi config, AT command feedback */
+    WIFI_RX_ATFB,               /* ATE1, AT+GMR ... */
+    WIFI_RX_ATFB_OK,            /* OK */
+    WIFI_RX_ATFB_ERROR,         /* ERROR */
+    WIFI_RX_ATFB_FAIL,          /* FAIL */
+    WIFI_RX_ATFB_CLOSED,        /* CLOSED */
+
+    /* TCP client connect or closed */
+    WIFI_RX_ID,                 /* n,xxx  n is in range 0~4 */
+    WIFI_RX_ID_CONNECT,         /* n,CONNECT */
+    WIFI_RX_ID_CLOSED,          /* n,CLOSED */
+    WIFI_RX_AP_DISCONNECT,      /* WIFI DISCONNECT, station lost AP */
+
+    /* Receive data from TCP client */
+    WIFI_RX_IPD,                /* +IPD, */
+    WIFI_RX_IPD_RECEVING,       /* +IPD, receving */
+    WIFI_RX_IPD_OK,             /* +IPD,n,m:xxxxx(m bytes) */
+    WIFI_RX_IPD_ERROR,          /* Receive IPD error */
+
+    /* Send data to TCP client */
+    WIFI_RX_SEND_READY,         /* > */
+    WIFI_RX_RECV,               /* Recv mbytes */
+    WIFI_RX_SEND_OK,            /* SEND OK */
+    WIFI_RX_SEND_FAIL,          /* SEND FAIL */
+    WIFI_RX_BUSY,               /* busy s... or busy p... */
+
+} WiFi_RxState_t;
+
+/* Fan-out link state */
+typedef enum
+{
+    WIFI_LINK_NONE = 0,         /* not subscribed to this frame */
+    WIFI_LINK_SENDING,          /* has chunks to send */
+    WIFI_LINK_SENT,             /* all chunks sent, some may wait for SEND OK */
+    WIFI_LINK_FAIL,             /* link error or timeout, dropped from this frame */
+
+} WiFi_LinkState_t;
+
+/* Fan-out progress of one link */
+typedef struct
+{
+    WiFi_LinkState_t state;
+    uint32_t offset;            /* image bytes sent */
+    uint16_t packet_id;         /* next packet, 0 is file info */
+    uint8_t  inflight;          /* chunks waiting for SEND OK */
+    uint32_t start_tick;
+    uint32_t done_tick;         /* tick of last SEND OK */
+    uint32_t busy_tick;         /* ticks from send to SEND OK of all chunks */
+
+} WiFi_FanoutLink_t;
+
+/* Module and task hooks, context is the one given to Send_Init
+ * receive:  next event from receive task, false when none in WIFI_RX_FB_TIMEOUT
+ * command:  write AT+CIPSEND for packet of link, length is jpg bytes of it,
+ *           flush rx replies first when nothing is in flight
+ * data:     write frame of packet after '>', packet 0 is file info, else jpg
+ *           bytes at offset of image
+ * pending:  control respond waits to be sent
+ * preempt:  send waiting responds, window is empty
+ * tick:     current tick
+ * accepted: module took all bytes of a chunk started at tick
+ * connected: link is still open */
+typedef struct
+{
+    bool     (*receive)(WiFi_RxState_t *state, void *context);
+    void     (*command)(uint8_t link, uint16_t packet, uint16_t length, bool flush, void *context);
+    bool     (*data)(uint8_t link, uint16_t packet, uint32_t offset, uint16_t length, void *context);
+    bool     (*pending)(void *context);
+    void     (*preempt)(void *context);
+    uint32_t (*tick)(void *context);
+    void     (*accepted)(uint32_t tick, void *context);
+    bool     (*connected)(uint8_t link, void *context);
+} Send_Hook_t;
+
+/* Send window, one sender at a time */
+typedef struct
+{
+    uint32_t                fallback;   /* window fell back to stop and wait */
+    WiFi_FanoutLink_t       link[WIFI_LINK_NUM];
+    uint8_t                 fifo[WIFI_SEND_WINDOW];         /* link of each chunk waiting for SEND OK, oldest first */
+    uint32_t                fifo_tick[WIFI_SEND_WINDOW];    /* send tick of each chunk */
+    uint8_t                 fifo_head;
+    uint8_t                 fifo_count;
+    const Send_Hook_t       *hook;
+    void                    *context;
+} Send_t;
+
+/* Function declaration -------------------------------------------------------------------------*/
+
+/*******************************************************************************
+* @Brief   Send Window Initial
+* @Param   send[in]: send object
+*          hook[in]: module and task hooks
+*          context[in]: user data for hooks
+* @Note
+* @Return
+*******************************************************************************/
+void Send_Init(Send_t *send, const Send_Hook_t *hook, void *context);
+
+/*******************************************************************************
+* @Brief   Wait Send Event
+* @Param   target[in]: expect event
+*          outstanding[in/out]: chunks waiting for SEND OK
+* @Note    SEND OK of pipelined chunks is counted on the way, OK and other
+*          data are skipped. Waiting for '>' goes on after SEND OK of an
+*          earlier chunk, it normally comes first
+* @Return  target, SEND_OK when waiting for RECV, or the error event,
+*          WIFI_RX_NONE when timeout
+*******************************************************************************/
+WiFi_RxState_t Send_WaitEvent(Send_t *send, WiFi_RxState_t target, uint8_t *outstanding);
+
+/*******************************************************************************
+* @Brief   Send Image to One Link
+* @Param   link[in]: link of AT+CIPSEND
+*          length[in]: image bytes
+*          chunk_size[in]: jpg bytes of one packet
+*          window[in]: max chunks in flight, WIFI_SEND_WINDOW
+* @Note    Sliding window upload: next AT+CIPSEND is sent once module prints
+*          "Recv n bytes" for the previous chunk, up to window chunks wait for
+*          SEND OK at the same time. When module is busy the window falls
+*          back to 1 (stop and wait) for the rest of image. Packets start
+*          from 1, waiting respond is sent between chunks
+* @Return  true when every chunk got SEND OK
+*******************************************************************************/
+bool Send_Image(Send_t *send, uint8_t link, uint32_t length, uint16_t chunk_size, uint8_t window);
+
+/*******************************************************************************
+* @Brief   Fan-out Image to Links
+* @Param   links[in]: bit n set subscribes link n
+*          length[in]: image bytes
+*          chunk_size[in]: jpg bytes of one packet
+* @Note    Chunks of one frame are interleaved across links, packet 0 of each
+*          link is file info. Each link has its own progress and at most
+*          WIFI_LINK_WINDOW chunks in flight, the link with least send time
+*          goes first so a slow link does not stall others, a link with error
+*          or timeout is dropped. Result of each link is in send->link
+* @Return  true if at least one link got the whole frame
+*******************************************************************************/
+bool Send_Fanout(Send_t *send, uint8_t links, uint32_t length, uint16_t chunk_size);
+
+
+#endif /* WIFI_SEND_H */
@@ -21,10 +21,12 @@
 
 /* Includes -------------------------------------------------------------------------------------*/
 #include "global_config.h"
+#include "wifi_txchain.h"
+#include "wifi_send.h"
 
 /* Macro defines --------------------------------------------------------------------------------*/
 /* Task period */
-#define WIFI_TASK_PERIOD        (10 / portTICK_PERIOD_MS)
+#define WIFI_ALIVE_PERIOD       (5000 / portTICK_PERIOD_MS) /* alive test after idle time */
 #define WIFI_RESET_DELAY        (1000 / portTICK_PERIOD_MS)
 
 /* WiFi interface define */
@@ -34,16 +36,80 @@
 /* Wifi module uart baudrate */
 #define WIFI_BAUDRATE_DEFAULT   115200UL
 #define WIFI_BAUDRATE_RUNNING   921600UL
+#define WIFI_BAUDRATE_MAX       3000000UL
+#define WIFI_BAUDRATE_NOFLOW    WIFI_BAUDRATE_RUNNING       /* max rate without RTS/CTS */
+#define WIFI_BAUDRATE_NUM       4                           /* negotiate candidates */
+#define WIFI_BAUDRATE_SWITCH    (20 / portTICK_PERIOD_MS)   /* module change rate after OK */
+
+/* USART1 RTS/CTS on PA12/PA11, these pins drive leds on current board,
+ * define it only when they are wired to esp8266 GPIO15/GPIO13. Without it
+ * the rate is not stepped up above WIFI_BAUDRATE_NOFLOW: AT echo passes at
+ * 3 Mbaud but a full image chunk overruns the module rx buffer */
+//#define WIFI_FLOW_CONTROL
+
+/* Receive task max sleep time, drain ring even if no idle line event */
+#define WIFI_RX_POLL_PERIOD     (20 / portTICK_PERIOD_MS)
 
 /* UART transmit timeout */
 #define WIFI_RX_FB_TIMEOUT      (1000 / portTICK_PERIOD_MS)
 #define WIFI_RX_DATA_TIMEOUT    (2000 / portTICK_PERIOD_MS)
+#define WIFI_TX_TIMEOUT         (200 / portTICK_PERIOD_MS)  /* 16KB at 921600 */
 
 /* UART buffer size */
 #define WIFI_TX_BUF_SIZE        128//(MSG_RECOGNIZE_CODE_LEN*2+6)
 #define WIFI_RX_BUF_SIZE        128
+#define WIFI_RX_RING_SIZE       2048    /* circular dma buffer, half of it is ~11ms at 921600 */
 #define WIFI_DATA_BUF_SIZE      MSG_BUFFER_SIZE
-#define WIFI_PACKET_SIZE        MSG_MAX_TX_PAYLOAD
+#define WIFI_FILE_INFO_LEN      (4 + CAMERA_FILENAME_SIZE)  /* packet 0 payload: size + filename */
+#define WIFI_FILE_INFO_SIZE     (WIFI_FILE_INFO_LEN + MSG_CMD_SIZE)
+
+/* Image chunk size, runtime value is negotiated by client with MSG_SET_CHUNK.
+ * Default keeps old clients working, 0 from client selects one TCP segment per chunk */
+#define WIFI_CIPSEND_MAX        2048    /* max length of one AT+CIPSEND */
+#define WIFI_TCP_MSS            1460    /* esp8266 lwip TCP_MSS */
+#define WIFI_CHUNK_DEFAULT      MSG_MAX_TX_PAYLOAD
+#define WIFI_CHUNK_MSS          (WIFI_TCP_MSS - MSG_CMD_SIZE_V2)  /* fits frame of both versions */
+#define WIFI_CHUNK_MIN          256
+#define WIFI_CHUNK_MAX          (WIFI_CIPSEND_MAX - MSG_CMD_SIZE_V2)
+
+/* AP mode UDP live preview, last link is reserved for it and TCP server takes 
+ * the others. Datagram = header + jpg fragment, header (little endian):
+ * magic(1) format(1) frame id(2) fragment index(1) fragment count(1) length(2) */
+#define WIFI_PREVIEW_LINK       (WIFI_LINK_NUM - 1)
+#define WIFI_SERVER_MAX_CONN    (WIFI_LINK_NUM - 1)
+#define WIFI_PREVIEW_MAGIC      0xA5
+#define WIFI_PREVIEW_HEAD_SIZE  8
+#define WIFI_PREVIEW_PAYLOAD    (1472 - WIFI_PREVIEW_HEAD_SIZE)    /* datagram fits one 1500 MTU */
+#define WIFI_PREVIEW_FPS_MAX    10
+
+/* Range of last photo, MSG_GET_RANGE. Data is sent in MSG_PUSH_RANGE frames,
+ * index is frame id, payload is offset(4) + jpg data of one chunk at most */
+#define WIFI_RANGE_CHUNK        0       /* start is packet index of push image, 1 is first chunk */
+#define WIFI_RANGE_BYTE         1       /* start is byte offset */
+#define WIFI_RANGE_HEAD_SIZE    4       /* offset in payload */
+#define WIFI_RANGE_DATA_MAX     (WIFI_CHUNK_MAX - WIFI_RANGE_HEAD_SIZE)  /* frame fits one AT+CIPSEND */
+#define WIFI_RANGE_INFO_SIZE    (8 + CAMERA_FILENAME_SIZE)  /* id(2) + size(4) + chunk(2) + filename */
+
+/* Station mode transparent transmission (AT+CIPMODE=1), comment out to use AT+CIPSEND per packet */
+#define WIFI_PASSTHROUGH
+#define WIFI_ESCAPE_GUARD       (50 / portTICK_PERIOD_MS)   /* silence before "+++" */
+#define WIFI_ESCAPE_DELAY       (1000 / portTICK_PERIOD_MS) /* wait after "+++" */
+
+/* Station fast join: join cached BSSID of last connection, skip the AP scan */
+#define WIFI_FAST_JOIN
+/* Reuse the cached DHCP lease as static IP, skip DHCP handshake, enable it only 
+ * when the router reserves the address for this camera */
+//#define WIFI_STATIC_IP
+
+/* Task notify bits of wifi control task */
+#define WIFI_NOTIFY_TX_DONE     (1UL << 0)  /* uart tx chain finished */
+#define WIFI_NOTIFY_RX          (1UL << 1)  /* receive_queue has new item */
+#define WIFI_NOTIFY_RESPOND     (1UL << 2)  /* respond_queue has new item */
+#define WIFI_NOTIFY_PUSH        (1UL << 3)  /* camera push image event is set */
+#define WIFI_NOTIFY_PREVIEW     (1UL << 4)  /* preview link open or close requested */
+#define WIFI_NOTIFY_READY       (1UL << 5)  /* module printed ready, boot finish */
+#define WIFI_NOTIFY_RANGE       (1UL << 6)  /* range of last photo requested */
+#define WIFI_NOTIFY_EVENT       (WIFI_NOTIFY_RX | WIFI_NOTIFY_RESPOND | WIFI_NOTIFY_PUSH | WIFI_NOTIFY_PREVIEW | WIFI_NOTIFY_RANGE)
 
 /* New line code */
 #define NEW_LINE                "\r\n"
@@ -51,6 +117,7 @@
 /* WiFi queue parameter */
 #define WIFI_QUEUE_LENGTH        (5)                      /* Queue max item number */
 #define WIFI_QUEUE_ITEM_SIZE     (sizeof(WiFi_Receive_t)) /* Item size is WiFi_Receive_t type */
+#define WIFI_EVENT_QUEUE_LENGTH  (8)                      /* Unsolicited event max item number */
 
 /*------------------- WiFi Setup -------------------*/
 #define WIFI_SSID               "AniTech_"
@@ -68,6 +135,9 @@
 /* WiFi error repeat time */
 #define WIFI_ERROR_REPEAT       5
 
+/* Join AP and get IP tries before the join recovery tier */
+#define WIFI_JOIN_REPEAT        3
+
 
 /* Data Type Define -----------------------------------------------------------------------------*/
 /* WiFi main task state */
@@ -86,53 +156,29 @@ typedef enum
     WIFI_CTRL_GET_IP,
 
     WIFI_CTRL_CLIENT_MANAGE,
-    WIFI_CTRL_RECE_REQUEST,
     WIFI_CTRL_SEND_RESPOND,
     WIFI_CTRL_SEND_IMAGE,
     WIFI_CTRL_ALIVE_TEST,
+    WIFI_CTRL_PREVIEW_LINK,
+    WIFI_CTRL_SEND_PREVIEW,
+    WIFI_CTRL_SEND_RANGE,
     
     /* IDLE ---event--------> SEND DATA */
-    /* IDLE ---rx ipd-------> RECE DATA */
     /* IDLE ---rx id--------> CLIENT MANAGE */
     /* IDLE ---rx unknown---> IDLE */
     WIFI_CTRL_IDLE,
 
 } WiFi_CtrlState_t;
 
-/* WiFi receive data type */
+/* Link recovery tier, each failure moves to the next one */
 typedef enum
 {
-    /* General feedback */
-    WIFI_RX_NONE,
-    WIFI_RX_ERROR,              /* ERROR */
-    WIFI_RX_CLOSED,             /* CLOSED */
-    WIFI_RX_OVERFLOW,           /* Receive buffer overflow */
-    
-    /* WiFi config, AT command feedback */
-    WIFI_RX_ATFB,               /* ATE1, AT+GMR ... */
-    WIFI_RX_ATFB_OK,            /* OK */
-    WIFI_RX_ATFB_ERROR,         /* ERROR */
-    WIFI_RX_ATFB_FAIL,          /* FAIL */
-    WIFI_RX_ATFB_CLOSED,        /* CLOSED */
-    
-    /* TCP client connect or closed */
-    WIFI_RX_ID,                 /* n,xxx  n is in range 0~4 */
-    WIFI_RX_ID_CONNECT,         /* n,CONNECT */
-    WIFI_RX_ID_CLOSED,          /* n,CLOSED */
-    
-    /* Receive data from TCP client */
-    WIFI_RX_IPD,                /* +IPD, */
-    WIFI_RX_IPD_RECEVING,       /* +IPD, receving */
-    WIFI_RX_IPD_OK,             /* +IPD,n,m:xxxxx(m bytes) */
-    WIFI_RX_IPD_ERROR,          /* Receive IPD error */
-    
-    /* Send data to TCP client */
-    WIFI_RX_SEND_READY,         /* > */
-    WIFI_RX_RECV,               /* Recv mbytes */
-    WIFI_RX_SEND_OK,            /* SEND OK */
-    WIFI_RX_SEND_FAIL,          /* SEND FAIL */
-    
-} WiFi_RxState_t;
+    WIFI_RECOVER_NONE = 0,
+    WIFI_RECOVER_LINK,          /* reopen TCP server or client */
+    WIFI_RECOVER_JOIN,          /* rejoin AP or setup soft AP again */
+    WIFI_RECOVER_RESET,         /* reset module and setup from uart */
+    WIFI_RECOVER_TIER_NUM
+} WiFi_Recover_t;
 
 /* WiFi encrypt type */
 typedef enum
@@ -152,6 +198,40 @@ typedef struct
     
 } WiFi_Receive_t;
 
+/* UART transmit buffer descriptor */
+typedef TxChain_Desc_t WiFi_TxDesc_t;
+
+/* Transmit priority class, control respond preempts image chunks */
+typedef enum
+{
+    WIFI_TX_CONTROL = 0,        /* respond, queued to sent */
+    WIFI_TX_IMAGE,              /* image chunk, CIPSEND to accepted */
+    WIFI_TX_CLASS_NUM,
+    
+} WiFi_TxClass_t;
+
+/* Live preview viewer, request is copied by value between client and control task */
+typedef struct
+{
+    uint8_t  ip[4];
+    uint16_t port;              /* UDP port, 0 means preview is off */
+    uint16_t interval;          /* ms between two capture */
+    uint8_t  format;            /* ImageFormat_TypeDef */
+    
+} WiFi_Preview_t;
+
+/* Range of last photo to send */
+typedef struct
+{
+    volatile bool request;      /* set by client task, clear when sent */
+    uint8_t  link;
+    uint16_t frame_id;
+    uint16_t chunk;             /* bytes of one frame */
+    uint32_t offset;
+    uint32_t length;
+    
+} WiFi_Range_t;
+
 /* Public variables ----------------------------------------------------------------------------*/
 extern uint8_t wifi_mac_string[18];    /* string format: AA:BB:CC:DD:EE:FF\0 */
 extern uint8_t wifi_ip_string[16];     /* string format: 192.168.100.123\0 */
@@ -167,6 +247,74 @@ extern uint8_t wifi_ip_string[16];     /* string format: 192.168.100.123\0 */
 *******************************************************************************/
 void WiFi_ControlTask(void * argument);
 
+/*******************************************************************************
+* @Brief   WiFi UART Idle Line Callback
+* @Param   
+* @Note    call from USART1 interrupt when idle line flag is set
+* @Return  
+*******************************************************************************/
+void WiFi_UartIdleCallback(void);
+
+/*******************************************************************************
+* @Brief   WiFi Control Task Notify
+* @Param   event[in]: WIFI_NOTIFY_xxx bits
+* @Note    wake control task from idle after posting respond or push event
+* @Return  
+*******************************************************************************/
+void WiFi_Notify(uint32_t event);
+
+/*******************************************************************************
+* @Brief   Set Image Chunk Size
+* @Param   size[in]: payload bytes of one image packet, 0 to fit one TCP segment
+* @Note    limited to WIFI_CHUNK_MIN ~ WIFI_CHUNK_MAX, frame in progress keeps
+*          the old size
+* @Return  accepted chunk size
+*******************************************************************************/
+uint16_t WiFi_SetChunkSize(uint16_t size);
+
+/*******************************************************************************
+* @Brief   Set Live Preview
+* @Param   ip[in]: viewer address, 4 bytes
+*          port[in]: viewer UDP port, 0 to stop preview
+*          fps[in]: frame rate, 1 ~ WIFI_PREVIEW_FPS_MAX
+*          format[in]: JPEG_176x144 or JPEG_320x240
+* @Note    AP mode only, UDP link is opened by control task
+* @Return  false if request is not accepted
+*******************************************************************************/
+bool WiFi_SetPreview(const uint8_t *ip, uint16_t port, uint8_t fps, uint8_t format);
+
+/*******************************************************************************
+* @Brief   Set Link Protocol
+* @Param   client_id[in]: link of request
+*          version[in]: highest version client has
+* @Note    link switches after next respond to it is sent, back to v1 when
+*          link is connected or closed
+* @Return  version in use from next frame, 0 if link is not valid
+*******************************************************************************/
+uint8_t WiFi_SetProtocol(uint8_t client_id, uint8_t version);
+
+/*******************************************************************************
+* @Brief   Set Image Range
+* @Param   client_id[in]: link of request
+*          frame_id[in]: id of last photo, 0 for any
+*          unit[in]: WIFI_RANGE_CHUNK or WIFI_RANGE_BYTE
+*          start[in]: first chunk index or byte offset
+*          count[in]: chunks or bytes, 0 to the end of image
+*          info[out]: id(2) + size(4) + chunk(2) + filename, WIFI_RANGE_INFO_SIZE
+* @Note    photo is kept from capture until range is sent, call
+*          WiFi_StartRange after respond is queued
+* @Return  false if photo is gone or range is out of image
+*******************************************************************************/
+bool WiFi_SetRange(uint8_t client_id, uint16_t frame_id, uint8_t unit, uint32_t start, uint32_t count, uint8_t *info);
+
+/*******************************************************************************
+* @Brief   Start Image Range
+* @Param   
+* @Note    range set by WiFi_SetRange is sent after respond
+* @Return  
+*******************************************************************************/
+void WiFi_StartRange(void);
+
 
 
 #endif /* WIFI_API_H */
@@ -0,0 +1,95 @@
+/*
+***************************************************************************************************
+*                               UART DMA Transmit Chain
+*
+* File   : wifi_txchain.h
+* Author : Douglas Xie
+* Date   : 2018.03.05
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*/
+
+#ifndef WIFI_TXCHAIN_H
+#define WIFI_TXCHAIN_H
+
+/* Includes -------------------------------------------------------------------------------------*/
+#include "stdint.h"
+#include "stdbool.h"
+
+/* Macro defines --------------------------------------------------------------------------------*/
+#define TXCHAIN_SIZE            4       /* max buffers of one dma transmit chain */
+
+/* Data Type Define -----------------------------------------------------------------------------*/
+/* Transmit buffer descriptor */
+typedef struct
+{
+    uint8_t  *data;
+    uint16_t length;
+
+} TxChain_Desc_t;
+
+/* Uart and task notify hooks, context is the one given to TxChain_Init
+ * start:  start dma transmit of one buffer, true if started
+ * abort:  stop dma transmit after timeout
+ * wait:   task notify wait, same arguments and result as xTaskNotifyWait
+ * notify: set done bit of sender from tx complete interrupt */
+typedef struct
+{
+    bool (*start)(const uint8_t *data, uint16_t length, void *context);
+    void (*abort)(void *context);
+    bool (*wait)(uint32_t clear_entry, uint32_t clear_exit, uint32_t *value, uint32_t timeout, void *context);
+    void (*notify)(uint32_t bits, void *context);
+} TxChain_Hook_t;
+
+/* Transmit chain, one sender at a time */
+typedef struct
+{
+    TxChain_Desc_t          desc[TXCHAIN_SIZE];
+    volatile uint8_t        count;
+    volatile uint8_t        index;      /* buffer in dma */
+    volatile bool           waiting;    /* sender waits for done bit */
+    uint32_t                done_bit;
+    uint32_t                timeout;    /* wait hook timeout of whole chain */
+    const TxChain_Hook_t    *hook;
+    void                    *context;
+} TxChain_t;
+
+/* Function declaration -------------------------------------------------------------------------*/
+
+/*******************************************************************************
+* @Brief   Transmit Chain Initial
+* @Param   chain[in]: chain object
+*          hook[in]: uart and task notify hooks
+*          context[in]: user data for hooks
+*          done_bit[in]: notify bit of chain done
+*          timeout[in]: max wait of one chain, in unit of wait hook
+* @Note
+* @Return
+*******************************************************************************/
+void TxChain_Init(TxChain_t *chain, const TxChain_Hook_t *hook, void *context, uint32_t done_bit, uint32_t timeout);
+
+/*******************************************************************************
+* @Brief   Transmit Chain Send
+* @Param   desc[in]: buffer list, empty buffer is skipped
+*          count[in]: number of buffers, max TXCHAIN_SIZE
+*          total[out]: bytes sent, may be NULL
+* @Note    buffers are sent one by one without copy, next buffer is started
+*          by TxChain_Complete. Caller sleeps in wait hook until the last
+*          byte is out, other notify bits do not end the wait and are kept.
+*          Buffers must be kept until return
+* @Return  false on timeout, dma is aborted
+*******************************************************************************/
+bool TxChain_Send(TxChain_t *chain, const TxChain_Desc_t *desc, uint8_t count, uint32_t *total);
+
+/*******************************************************************************
+* @Brief   Transmit Chain Complete
+* @Param
+* @Note    call from uart tx complete interrupt, starts next buffer or sets
+*          done bit after the last one
+* @Return
+*******************************************************************************/
+void TxChain_Complete(TxChain_t *chain);
+
+
+#endif /* WIFI_TXCHAIN_H */
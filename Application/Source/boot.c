@@ -0,0 +1,187 @@
+/*
+***************************************************************************************************
+*                                  Boot Stage Orchestration
+*
+* File   : boot.c
+* Author : Douglas Xie
+* Date   : 2018.03.23
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*/
+
+/* Include Head Files ---------------------------------------------------------------------------*/
+#include "stm32f4xx_hal.h"
+#include "cmsis_os.h"
+#include "event_groups.h"
+
+#include "boot.h"
+#include "debug_task.h"
+
+/* Private variables ----------------------------------------------------------------------------*/
+/* Stage name for report */
+const char *boot_stage_name[BOOT_STAGE_NUM] =
+{
+    "config",
+    "periph",
+    "kernel",
+    "lcd",
+    "sensor",
+    "module",
+    "network",
+    "link",
+};
+
+/* ms since reset of each stage, 0 means not done */
+uint32_t boot_stage_tick[BOOT_STAGE_NUM];
+
+/* FreeRTOS event group handle, one readiness bit per stage */
+EventGroupHandle_t  boot_event_group = NULL;
+
+/* Boot debug message */
+DBG_MsgBuf_t boot_dbg;
+
+/* Public Function ------------------------------------------------------------------------------*/
+
+/*******************************************************************************
+* @Brief   Boot Initial
+* @Param
+* @Note    create readiness event group, call in default task before other tasks
+*          are created. Stages done before it are kept and set as ready
+* @Return
+*******************************************************************************/
+void Boot_Init(void)
+{
+    uint8_t i = 0;
+    EventBits_t ready = 0;
+
+    if(boot_event_group != NULL)
+    {
+        return;
+    }
+
+    boot_event_group = xEventGroupCreate();
+    for(i = 0; i < BOOT_STAGE_NUM; i++)
+    {
+        if(boot_stage_tick[i] != 0)
+        {
+            ready |= BOOT_READY(i);
+        }
+    }
+    xEventGroupSetBits(boot_event_group, ready);
+}
+
+/*******************************************************************************
+* @Brief   Boot Stage Done
+* @Param   stage[in]: finished stage
+* @Note    first call records ms since reset and sets readiness, later calls
+*          (recovery) are ignored. Can be called before scheduler starts
+* @Return
+*******************************************************************************/
+void Boot_StageDone(Boot_Stage_t stage)
+{
+    if((stage >= BOOT_STAGE_NUM) || (boot_stage_tick[stage] != 0))
+    {
+        return;
+    }
+
+    /* HAL tick runs from reset, same base before and after scheduler start */
+    boot_stage_tick[stage] = HAL_GetTick();
+    if(boot_stage_tick[stage] == 0)
+    {
+        boot_stage_tick[stage] = 1;
+    }
+
+    if(boot_event_group != NULL)
+    {
+        xEventGroupSetBits(boot_event_group, BOOT_READY(stage));
+    }
+
+    if(stage == BOOT_STAGE_LAST)
+    {
+        Boot_Report();
+    }
+}
+
+/*******************************************************************************
+* @Brief   Boot Wait Stage
+* @Param   stage[in]: stage to wait for
+*          timeout[in]: ticks
+* @Note
+* @Return  true if stage is done
+*******************************************************************************/
+bool Boot_WaitStage(Boot_Stage_t stage, uint32_t timeout)
+{
+    EventBits_t event_bits;
+
+    if(stage >= BOOT_STAGE_NUM)
+    {
+        return false;
+    }
+    if((boot_event_group == NULL) || (boot_stage_tick[stage] != 0))
+    {
+        return (boot_stage_tick[stage] != 0);
+    }
+
+    event_bits = xEventGroupWaitBits(boot_event_group,
+                                     BOOT_READY(stage),
+                                     pdFALSE,
+                                     pdTRUE,
+                                     (TickType_t) timeout );
+
+    return ((event_bits & BOOT_READY(stage)) != 0);
+}
+
+/*******************************************************************************
+* @Brief   Boot Stage Time
+* @Param   stage[in]: stage
+* @Note
+* @Return  ms since reset when stage is done, 0 if not done yet
+*******************************************************************************/
+uint32_t Boot_StageTime(Boot_Stage_t stage)
+{
+    if(stage >= BOOT_STAGE_NUM)
+    {
+        return 0;
+    }
+
+    return boot_stage_tick[stage];
+}
+
+/*******************************************************************************
+* @Brief   Boot Report
+* @Param
+* @Note    two stages per line to fit debug queue, time is ms since reset
+*          and '-' is not done yet. Link time is time to first connection
+* @Return
+*******************************************************************************/
+void Boot_Report(void)
+{
+#ifdef EN_DEBUG
+    uint8_t i = 0;
+    uint8_t length = 0;
+
+    for(i = 0; i < BOOT_STAGE_NUM; i++)
+    {
+        if((i % 2) == 0)
+        {
+            length = DBG_Sprintf((char*)boot_dbg.buf, "Boot:");
+        }
+
+        if(boot_stage_tick[i] != 0)
+        {
+            length += DBG_Sprintf((char*)&boot_dbg.buf[length], " %s %lu ms", boot_stage_name[i], (unsigned long)boot_stage_tick[i]);
+        }
+        else
+        {
+            length += DBG_Sprintf((char*)&boot_dbg.buf[length], " %s -", boot_stage_name[i]);
+        }
+
+        if(((i % 2) == 1) || (i == (BOOT_STAGE_NUM - 1)))
+        {
+            DBG_Sprintf((char*)&boot_dbg.buf[length], "\r\n");
+            DBG_SendMessage(DBG_MSG_TASK_STATE, boot_dbg.buf);
+        }
+    }
+#endif
+}
@@ -17,11 +17,14 @@
 
 #include "global_config.h"
 #include "main.h"
+#include "memory.h"
 #include "wifi_task.h"
 #include "client_task.h"
 #include "display_task.h"
 #include "camera_task.h"
 #include "debug_task.h"
+#include "boot.h"
+#include "metrics.h"
 
 #include "ov7670.h"
 #include "sccb.h"
@@ -44,6 +47,25 @@ bool tx_finish = false;
 /* Camera fifo buffer */
 Camera_Buffer_t     camera_info;
 
+/* Capture profile controller and profile of the fifo in capture */
+Adapt_t             camera_adapt;
+uint8_t             camera_profile = ADAPT_PROFILE_DEFAULT;
+
+/* Profile loaded to sensor at boot, first capture of it skips config */
+uint8_t             camera_preload = 0xFF;
+
+/* Live preview, sensor is configured once per preview format */
+Camera_Preview_t    camera_preview;
+bool                camera_preview_capture = false;
+uint8_t             camera_preview_format = 0xFF;
+TickType_t          camera_preview_tick = 0;
+
+/* Dma start of capture in progress, for capture time */
+TickType_t          camera_capture_tick = 0;
+
+/* Last photo, client fetches range of it by id */
+Camera_Frame_t      camera_frame;
+
 /* FreeRTOS event group handle */
 EventGroupHandle_t  camera_event_group;
 
@@ -52,6 +74,7 @@ DBG_MsgBuf_t camera_dbg;
 
 /* Function declaration -------------------------------------------------------------------------*/
 void Camera_DCMI_Init(void);
+void Camera_SensorPreload(void);
 
 /* Task Function implement ----------------------------------------------------------------------*/
 
@@ -67,12 +90,18 @@ void Camera_PhotoTask(void * argument)
     uint32_t pdma_buff;
     EventBits_t event_bits;
     Camera_State_t camera_state = CAMERA_IDLE;
+    bool camera_start = false;
     
     /* Create FreeRTOS event group */
     camera_event_group = xEventGroupCreate();        
     memset(&camera_info, 0, sizeof(Camera_Buffer_t));
+    Adapt_Init(&camera_adapt);
+    memset(&camera_preview, 0, sizeof(Camera_Preview_t));
+    memset(&camera_frame, 0, sizeof(Camera_Frame_t));
     
-    vTaskDelay(1000);
+    /* Sensor comes up while wifi module boots */
+    Camera_SensorPreload();
+    Boot_StageDone(BOOT_STAGE_SENSOR);
     DBG_SendMessage(DBG_MSG_TASK_STATE, "Camera Photo Task Start\r\n");
     
     /* Infinite loop */
@@ -85,11 +114,25 @@ void Camera_PhotoTask(void * argument)
             DBG_SendMessage( DBG_MSG_CAMERA, "Camera: Start Task\r\n" );
             
         case CAMERA_START:
-            /* Start when last fifo buffer has save */
-            if(camera_info.fifo_input == camera_info.fifo_output)
+            /* Start when last fifo buffer has save and range of last photo is
+             * not read from the new buffer */
+            taskENTER_CRITICAL();
+            if((camera_info.fifo_input == camera_info.fifo_output) &&
+               ((camera_frame.reading == false) || (camera_frame.fifo == camera_info.fifo_input)))
             {
-                /* Recieve data in new buffer */
+                /* Recieve data in new buffer, last photo in it is gone */
                 camera_info.fifo_input = ~camera_info.fifo_input;
+                if(camera_frame.fifo == camera_info.fifo_input)
+                {
+                    camera_frame.valid = false;
+                }
+                camera_start = true;
+            }
+            taskEXIT_CRITICAL();
+            
+            if(camera_start == true)
+            {
+                camera_start = false;
                 memset(&(camera_info.fifo_buffer[camera_info.fifo_input]), 0, sizeof(Camera_FiFo_t));
                 pdma_buff = (uint32_t)camera_info.fifo_buffer[camera_info.fifo_input].data;
                 
@@ -97,16 +140,42 @@ void Camera_PhotoTask(void * argument)
                 HAL_TIM_Base_Start_IT(&hcamera_delay_timer);
                 HAL_TIM_PWM_Start(&hcamera_clock_timer,TIM_CHANNEL_1);
             
-                /* OV7670 picture size and parameter config */
-                OV2640_JPEGConfig(JPEG_640x480);
-                DBG_SendMessage( DBG_MSG_CAMERA, "Camera: Config OK\r\n" );
+                camera_preview_capture = camera_preview.active;
+                if(camera_preview_capture == true)
+                {
+                    /* preview keeps sensor config between frames */
+                    if(camera_preview_format != camera_preview.format)
+                    {
+                        camera_preview_format = camera_preview.format;
+                        OV2640_JPEGConfig((ImageFormat_TypeDef)camera_preview_format);
+                    }
+                }
+                else
+                {
+                    /* OV7670 picture size and quality follow link quality */
+                    camera_preview_format = 0xFF;
+                    camera_profile = Adapt_Select(&camera_adapt, 
+                                                  (app_config.image_target != 0) ? app_config.image_target : ADAPT_TARGET_DEFAULT);
+                    if(camera_profile != camera_preload)
+                    {
+                        OV2640_JPEGConfig((ImageFormat_TypeDef)adapt_profile_table[camera_profile].format);
+                        OV2640_QualityConfig(adapt_profile_table[camera_profile].quality);
+                    }
+                    DBG_Sprintf(camera_dbg.buf, "Camera: Config OK, Profile %d\r\n", camera_profile);
+                    DBG_SendMessage( DBG_MSG_CAMERA, camera_dbg.buf );
+                }
+                camera_preload = 0xFF;
                 
                 /* Reset DCMI and start DMA receive */
                 Camera_DCMI_Init();
                 HAL_DCMI_Start_DMA(&hcamera_dcmi, DCMI_MODE_SNAPSHOT, pdma_buff, (CAMERA_BUFF_SIZE >> 2));
+                camera_capture_tick = xTaskGetTickCount();
                 
                 camera_state = CAMERA_RUNNING;
-                DBG_SendMessage( DBG_MSG_CAMERA, "Camera: Photo Start\r\n" );
+                if(camera_preview_capture == false)
+                {
+                    DBG_SendMessage( DBG_MSG_CAMERA, "Camera: Photo Start\r\n" );
+                }
             }
             break;
             
@@ -127,14 +196,24 @@ void Camera_PhotoTask(void * argument)
                 HAL_DCMI_DeInit(&hcamera_dcmi);
                 HAL_TIM_Base_Stop_IT(&hcamera_delay_timer);
                 HAL_TIM_PWM_Stop(&hcamera_clock_timer,TIM_CHANNEL_1);   
+                Metrics_Record(METRIC_HIST_CAPTURE, (xTaskGetTickCount() - camera_capture_tick) * portTICK_PERIOD_MS);
                 
                 if(camera_info.fifo_buffer[camera_info.fifo_input].length == 0)
                 {
+                    METRIC_INC(METRIC_CAMERA_ERRORS);
                     camera_state = CAMERA_IDLE;
                     DBG_SendMessage( DBG_MSG_CAMERA, "Camera: Photo Error\r\n" );
                 }
+                else if(camera_preview_capture == true)
+                {
+                    METRIC_INC(METRIC_CAMERA_PREVIEWS);
+                    camera_state = CAMERA_SAVE;
+                }
                 else
                 {
+                    METRIC_INC(METRIC_CAMERA_PHOTOS);
+                    METRIC_SET(METRIC_IMAGE_SIZE, camera_info.fifo_buffer[camera_info.fifo_input].length);
+                    Adapt_ImageSize(&camera_adapt, camera_profile, camera_info.fifo_buffer[camera_info.fifo_input].length);
                     camera_state = CAMERA_SAVE;
                     DBG_SendMessage( DBG_MSG_CAMERA, "Camera: Photo Done\r\n" );
                 }
@@ -146,10 +225,25 @@ void Camera_PhotoTask(void * argument)
             xEventGroupSetBits( camera_event_group, CAMERA_EVENT_SAVE_IMAGE);
             
             camera_state = CAMERA_IDLE;
-            DBG_SendMessage( DBG_MSG_CAMERA, "Camera: Save Photo Image\r\n" );
+            if(camera_preview_capture == false)
+            {
+                DBG_SendMessage( DBG_MSG_CAMERA, "Camera: Save Photo Image\r\n" );
+            }
             break;
             
         case CAMERA_IDLE:
+            if(camera_preview.active == true)
+            {
+                /* Live preview: capture at frame interval into the fifo not in streaming */
+                if(((xTaskGetTickCount() - camera_preview_tick) >= (camera_preview.interval / portTICK_PERIOD_MS)) &&
+                   ((camera_preview.sending == false) || (camera_preview.fifo == camera_info.fifo_input)))
+                {
+                    camera_preview_tick = xTaskGetTickCount();
+                    camera_state = CAMERA_START;
+                }
+                break;
+            }
+            
             vTaskDelay(1000);
             event_bits = xEventGroupWaitBits(camera_event_group,
                                              CAMERA_EVENT_PHOTO_START,
@@ -204,7 +298,18 @@ void Camera_SaveTask(void * argument)
             fifo_index = camera_info.fifo_input;
             
             /* Data buffer has valid data */
-            if((camera_info.fifo_buffer[fifo_index].data[0] == 0xFF) && (camera_info.fifo_buffer[fifo_index].data[1] == 0xD8))
+            if((camera_preview_capture == true) &&
+               (camera_info.fifo_buffer[fifo_index].data[0] == 0xFF) && (camera_info.fifo_buffer[fifo_index].data[1] == 0xD8))
+            {
+                /* Preview frame has no filename, post to udp stream */
+                camera_preview.fifo = fifo_index;
+                camera_preview.sending = true;
+                xEventGroupSetBits( camera_event_group, CAMERA_EVENT_PREVIEW);
+#ifndef USE_DEMO_VERSION
+                WiFi_Notify(WIFI_NOTIFY_PUSH);
+#endif
+            }
+            else if((camera_info.fifo_buffer[fifo_index].data[0] == 0xFF) && (camera_info.fifo_buffer[fifo_index].data[1] == 0xD8))
             {        
                 /* Fill filename to fifo */
                 HAL_RTC_GetTime(&hrtc, &sTime, RTC_FORMAT_BIN);
@@ -214,8 +319,17 @@ void Camera_SaveTask(void * argument)
                         sDate.Year+2000, sDate.Month, sDate.Date, sTime.Hours, sTime.Minutes, sTime.Seconds);
                 //sprintf(camera_info.fifo_buffer[fifo_index].filename, "%s.jpg", "20180214005632");
                 
+                /* Keep it addressable until this fifo is captured again */
+                camera_frame.id = (camera_frame.id == 0xFFFF) ? 1 : (camera_frame.id + 1);
+                camera_frame.fifo = fifo_index;
+                camera_frame.chunk = 0;
+                camera_frame.valid = true;
+                
                 /* Post wifi send event to wifi task */
                 xEventGroupSetBits( camera_event_group, CAMERA_EVENT_PUSH_IMAGE);
+#ifndef USE_DEMO_VERSION
+                WiFi_Notify(WIFI_NOTIFY_PUSH);
+#endif
                 
 #ifdef EN_DEBUG
                 DBG_Sprintf(camera_dbg.buf, "File:%s\r\nSize:%d\r\n", 
@@ -251,6 +365,39 @@ void Camera_SaveTask(void * argument)
 }
 
 
+/*******************************************************************************
+* @Brief   Camera Sensor Probe and Preload
+* @Param   
+* @Note    probe sensor id and load default profile, so first capture after
+*          boot skips sensor config. Clock is stopped again after loading
+* @Return  
+*******************************************************************************/
+void Camera_SensorPreload(void)
+{
+    uint16_t sensor_id = 0;
+    
+    HAL_TIM_Base_Start_IT(&hcamera_delay_timer);
+    HAL_TIM_PWM_Start(&hcamera_clock_timer,TIM_CHANNEL_1);
+    
+    sensor_id = OV2640_ReadID();
+    if((sensor_id >> 8) == OV2640_PIDH)
+    {
+        OV2640_JPEGConfig((ImageFormat_TypeDef)adapt_profile_table[ADAPT_PROFILE_DEFAULT].format);
+        OV2640_QualityConfig(adapt_profile_table[ADAPT_PROFILE_DEFAULT].quality);
+        camera_preload = ADAPT_PROFILE_DEFAULT;
+        DBG_SendMessage( DBG_MSG_CAMERA, "Camera: Sensor Preload OK\r\n" );
+    }
+    else
+    {
+        DBG_Sprintf(camera_dbg.buf, "Camera: Sensor ID Error %04X\r\n", sensor_id);
+        DBG_SendMessage( DBG_MSG_CAMERA, camera_dbg.buf );
+    }
+    
+    HAL_TIM_Base_Stop_IT(&hcamera_delay_timer);
+    HAL_TIM_PWM_Stop(&hcamera_clock_timer,TIM_CHANNEL_1);
+}
+
+
 /*******************************************************************************
 * @Brief   Camera DCMI Initial
 * @Param   
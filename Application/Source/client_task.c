@@ -25,6 +25,14 @@
 #include "display_task.h"
 #include "camera_task.h"
 #include "debug_task.h"
+#include "image_adapt.h"
+#include "msg_pool.h"
+#include "metrics.h"
+
+/* Macro Define ---------------------------------------------------------------------------------*/
+/* Entry of MSG_GET_LATENCY respond, command + flags + buckets */
+#define CMD_LATENCY_ENTRY_SIZE  (2 + METRICS_BUCKETS * 2)
+#define CMD_LATENCY_ENTRY_MAX   ((MSG_POOL_MEDIUM_SIZE - 1) / CMD_LATENCY_ENTRY_SIZE)
 
 /* Global Variable ------------------------------------------------------------------------------*/
 Client_Message_t message;           /* client message struct */
@@ -32,6 +40,7 @@ Client_Message_t feedback;
 
 QueueHandle_t request_queue;
 QueueHandle_t respond_queue;
+QueueHandle_t ota_queue;
 
 extern RTC_HandleTypeDef hrtc;
 extern RTC_TimeTypeDef sTime;
@@ -39,6 +48,8 @@ extern RTC_DateTypeDef sDate;
 
 /* Private Variable -----------------------------------------------------------------------------*/
 Client_Ota_t ota_info;
+Client_Batch_t client_batch;
+volatile uint8_t ota_pending = 0;   /* bin packets queued or in flash write */
 
 /* Function Declaration -------------------------------------------------------------------------*/
 void Client_GetMacAddress(void);
@@ -46,20 +57,70 @@ void Client_GetCameraImage(void);
 void Client_GetState(void);
 void Client_GetFirmwareVersion(void);
 void Client_GetID(void);
+void Client_GetRange(void);
+void Client_GetMetrics(void);
+void Client_GetLatency(void);
 void Client_SetWebAccount(void);
 void Client_SetWifi(void);
 void Client_SetMotor(void);
 void Client_SetTime(void);
 void Client_SetSchedule(void);
+void Client_SetChunkSize(void);
+void Client_SetImageTarget(void);
+void Client_SetPreview(void);
+void Client_SetProtocol(void);
 void Client_PushImage(void);
 void Client_PushWebAccount(void);
 void Client_PushAlarm(void);
 void Client_OtaUpdateRequest(void);
 void Client_OtaBinData(void);
 void Client_OtaVerify(void);
+bool Client_OtaWait(void);
 void Client_FactoryNew(void);
 void Client_FeedbackOK(void);
 void Client_FeedbackError(void);
+bool Client_FeedbackPayload(uint16_t length);
+void Client_RequestDispatch(void);
+const Client_Command_t *Client_FindCommand(uint8_t command);
+void Client_RespondOK(void);
+void Client_Batch(void);
+void Client_ConfigCommit(void);
+void Client_StationReset(void);
+
+/* Command Table --------------------------------------------------------------------------------*/
+/* Sorted by command, MSG_GET_LATENCY lists in this order */
+const Client_Command_t client_command_table[] =
+{
+    /* command          flags                               min     max                 handler */
+    { MSG_GET_MAC,      0,                                  0,      CMD_LENGTH_ANY,     Client_GetMacAddress },
+    { MSG_GET_IMAGE,    0,                                  0,      CMD_LENGTH_ANY,     Client_GetCameraImage },
+    { MSG_GET_STATE,    0,                                  0,      CMD_LENGTH_ANY,     Client_GetState },
+    { MSG_GET_VERSION,  0,                                  0,      CMD_LENGTH_ANY,     Client_GetFirmwareVersion },
+    { MSG_GET_ID,       0,                                  0,      CMD_LENGTH_ANY,     Client_GetID },
+    { MSG_GET_RANGE,    0,                                  11,     CMD_LENGTH_ANY,     Client_GetRange },
+    { MSG_GET_METRICS,  0,                                  0,      CMD_LENGTH_ANY,     Client_GetMetrics },
+    { MSG_GET_LATENCY,  0,                                  0,      1,                  Client_GetLatency },
+    { MSG_SET_ACCOUNT,  CMD_FLAG_FLASH | CMD_FLAG_BATCH,    4,      134,                Client_SetWebAccount },
+    { MSG_SET_WIFI,     CMD_FLAG_FLASH | CMD_FLAG_BATCH,    2,      CMD_LENGTH_ANY,     Client_SetWifi },
+    { MSG_SET_MOTOR,    CMD_FLAG_FLASH | CMD_FLAG_BATCH,    25,     CMD_LENGTH_ANY,     Client_SetMotor },
+    { MSG_SET_TIME,     CMD_FLAG_BATCH,                     7,      CMD_LENGTH_ANY,     Client_SetTime },
+    { MSG_SET_SCH,      CMD_FLAG_FLASH | CMD_FLAG_BATCH,    0,      7 * 12,             Client_SetSchedule },
+    { MSG_SET_CHUNK,    CMD_FLAG_BATCH,                     2,      CMD_LENGTH_ANY,     Client_SetChunkSize },
+    { MSG_SET_TARGET,   CMD_FLAG_FLASH | CMD_FLAG_BATCH,    2,      CMD_LENGTH_ANY,     Client_SetImageTarget },
+    { MSG_SET_PREVIEW,  CMD_FLAG_BATCH,                     0,      CMD_LENGTH_ANY,     Client_SetPreview },
+    { MSG_SET_PROTOCOL, CMD_FLAG_BATCH,                     1,      CMD_LENGTH_ANY,     Client_SetProtocol },
+    { MSG_OTA_REQUEST,  CMD_FLAG_FLASH,                     2,      2,                  Client_OtaUpdateRequest },
+    { MSG_OTA_BIN,      CMD_FLAG_FLASH,                     1,      CMD_LENGTH_ANY,     Client_OtaBinData },
+    { MSG_OTA_VERIFY,   CMD_FLAG_FLASH,                     0,      CMD_LENGTH_ANY,     Client_OtaVerify },
+    { MSG_BATCH,        CMD_FLAG_FLASH,                     1,      CMD_LENGTH_ANY,     Client_Batch },
+    { MSG_FACTORY_NEW,  CMD_FLAG_FLASH,                     0,      CMD_LENGTH_ANY,     Client_FactoryNew },
+    { MSG_FB_OK,        CMD_FLAG_NO_RESPOND,                0,      CMD_LENGTH_ANY,     Client_FeedbackOK },
+    { MSG_FB_ERROR,     CMD_FLAG_NO_RESPOND,                0,      CMD_LENGTH_ANY,     Client_FeedbackError },
+};
+#define CLIENT_COMMAND_NUM      (sizeof(client_command_table) / sizeof(Client_Command_t))
+
+/* Handler time of each command in table, ms histogram */
+uint16_t client_command_hist[CLIENT_COMMAND_NUM][METRICS_BUCKETS];
 
 /* Command Handler Implement -----------------------------------------------------------------*/
 
@@ -78,6 +139,9 @@ void Client_CommTask(void * argument)
     respond_queue = xQueueCreate(CLIENT_QUEUE_LENGTH, CLIENT_QUEUE_ITEM_SIZE);
     vQueueAddToRegistry( respond_queue, "Respond Queue" );
 
+    ota_queue = xQueueCreate(OTA_WRITE_QUEUE_LENGTH, sizeof(Client_OtaWrite_t));
+    vQueueAddToRegistry( ota_queue, "OTA Queue" );
+
     DBG_SendMessage(DBG_MSG_TASK_STATE, "Client Task Start\r\n");
 
     for (;;)
@@ -92,68 +156,36 @@ void Client_CommTask(void * argument)
 }
 
 /*******************************************************************************
-* @Brief   Receive Data Analyzer
-* @Param   data[in]: receive data from app
-* @Note    analyze data and fill message struct
-* @Return  true: analyze success
-*          false: analyze error
+* @Brief   Client OTA Write Task
+* @Param
+* @Note    ota queue is created by client task, which starts first
+* @Return
 *******************************************************************************/
-bool Client_DataAnalyzer(uint8_t *data, Client_Message_t *msg)
+void Client_OtaWriteTask(void * argument)
 {
-    bool ret = false;
-    uint16_t i = 0;
-    uint16_t temp = 0;
-    uint8_t checksum = 0;
+    Client_OtaWrite_t write;
 
-    memset(msg, 0, sizeof(Client_Message_t));
-
-    /* Find start code */
-    for (i = 0; i < MSG_BUFFER_SIZE; i++)
-    {
-        (data[i] == MSG_START_CODE) ? (temp++) : (temp = 0);
-
-        /* Find start code success */
-        if (temp >= MSG_RECOGNIZE_CODE_LEN)
-        {
-            i += 1;
-            break;
-        }
-    }
+    DBG_SendMessage(DBG_MSG_TASK_STATE, "OTA Write Task Start\r\n");
 
-    if (i < MSG_BUFFER_SIZE)
+    for (;;)
     {
-        /* Load data */
-        msg->command = data[i];
-        msg->index = data[i + 1] + (data[i + 2] << 8);
-        msg->length = data[i + 3] + (data[i + 4] << 8);
-        //msg->payload = &data[i+5];
-        msg->checksum = data[i + 5 + msg->length];
-
-        /* Validate checksum */
-        checksum = Mem_GetChecksum8(0, &data[i], msg->length + 5);
-        if (checksum == msg->checksum)
+        if ( (ota_queue != NULL) && xQueueReceive(ota_queue, &write, portMAX_DELAY) )
         {
-            if (msg->length == 0)
+            if (Mem_WriteApp(write.addr, write.data, write.length) == false)
             {
-                msg->payload = NULL;
-                ret = true;
+                ota_info.write_error = true;
             }
-            else if ((msg->length > 0) && (msg->length <= MSG_MAX_RX_PAYLOAD))
-            {
-                msg->payload = (uint8_t *)pvPortMalloc(msg->length);
-                memcpy(msg->payload, &data[i + 5], msg->length);
-                ret = true;
-            }
-        }
-    }
+            MsgPool_Free(write.block);
 
-    if (ret == false)
-    {
-        msg->command = MSG_FB_ERROR;
-        msg->payload = NULL;
+            taskENTER_CRITICAL();
+            ota_pending--;
+            taskEXIT_CRITICAL();
+        }
+        else
+        {
+            vTaskDelay(CLIENT_QUEUE_TIMEUOT);
+        }
     }
-
-    return ret;
 }
 
 /*******************************************************************************
@@ -166,81 +198,67 @@ void Client_RequestHandler(void)
 {
     DBG_SendMessage(DBG_MSG_CLIENT, "Client: Request Receive\r\n");
     memset(&feedback, 0, sizeof(Client_Message_t));
+    METRIC_INC(METRIC_CLIENT_REQUESTS);
 
-    switch (message.command)
-    {
-    case MSG_GET_MAC:       //------------------------- Get command
-        Client_GetMacAddress();
-        break;
-    case MSG_GET_IMAGE:
-        Client_GetCameraImage();
-        break;
-    case MSG_GET_STATE:
-        Client_GetState();
-        break;
-    case MSG_GET_VERSION:
-        Client_GetFirmwareVersion();
-        break;
-    case MSG_GET_ID:
-        Client_GetID();
-        break;
-
-    case MSG_SET_ACCOUNT:   //------------------------- Set command
-        Client_SetWebAccount();
-        break;
-    case MSG_SET_WIFI:
-        Client_SetWifi();
-        break;
-    case MSG_SET_MOTOR:
-        Client_SetMotor();
-        break;
-    case MSG_SET_TIME:
-        Client_SetTime();
-        break;
-    case MSG_SET_SCH:
-        Client_SetSchedule();
-        break;
-
-#if 0 /* Push command not receive, are push by device */
-    case MSG_PUSH_IMAGE:    //------------------------- Push command
-        Client_PushImage();
-        break;
-    case MSG_PUSH_ACCOUNT:
-        Client_PushWebAccount();
-        break;
-    case MSG_PUSH_ALARM:
-        Client_PushAlarm();
-        break;
-#endif
-    case MSG_OTA_REQUEST:   //------------------------- OTA command
-        Client_OtaUpdateRequest();
-        break;
-    case MSG_OTA_BIN:
-        Client_OtaBinData();
-        break;
-    case MSG_OTA_VERIFY:
-        Client_OtaVerify();
-        break;
-
-    case MSG_FACTORY_NEW:   //------------------------- Factory New command
-        Client_FactoryNew();
-        break;
-
-    case MSG_FB_OK:         //------------------------- Push Feedback command
-        Client_FeedbackOK();
-        break;
-
-    case MSG_FB_ERROR:
-        Client_FeedbackError();
-        break;
-
-    default:
+    Client_RequestDispatch();
+
+    /* Free payload memory */
+    MsgPool_Free(message.payload);
+}
+
+/*******************************************************************************
+* @Brief   Command Request Dispatch
+* @Param
+* @Note    run handler of message.command from command table, also for sub
+*          command of a batch. Payload length is checked here and handler
+*          time is recorded per command
+* @Return
+*******************************************************************************/
+void Client_RequestDispatch(void)
+{
+    const Client_Command_t *cmd = Client_FindCommand(message.command);
+    TickType_t start_tick = 0;
+
+    if (cmd == NULL)
+    {
         Client_RespondHandler( MSG_FB_ERROR );
-        break;
+        return;
+    }
+    if ((message.length < cmd->min_length) || (message.length > cmd->max_length))
+    {
+        DBG_SendMessage(DBG_MSG_CLIENT, "Client: Payload Length Error\r\n");
+        if ((cmd->flags & CMD_FLAG_NO_RESPOND) == 0)
+        {
+            Client_RespondHandler( MSG_FB_ERROR );
+        }
+        return;
     }
 
-    /* Free payload memory */
-    vPortFree(message.payload);
+    start_tick = xTaskGetTickCount();
+    cmd->handler();
+    Metrics_HistAdd(client_command_hist[cmd - client_command_table],
+                    (xTaskGetTickCount() - start_tick) * portTICK_PERIOD_MS);
+}
+
+/*******************************************************************************
+* @Brief   Find Command
+* @Param   command[in]: command code
+* @Note
+* @Return  descriptor in command table, NULL if command is not supported
+*******************************************************************************/
+const Client_Command_t *Client_FindCommand(uint8_t command)
+{
+    uint8_t i = 0;
+
+    for (i = 0; i < CLIENT_COMMAND_NUM; i++)
+    {
+        if (client_command_table[i].command == command)
+        {
+            return &client_command_table[i];
+        }
+    }
+
+    return NULL;
 }
 
 /*******************************************************************************
@@ -252,6 +270,16 @@ void Client_RequestHandler(void)
 void Client_RespondHandler(uint8_t state)
 {
     Disp_Request_t disp_req;
+
+    if (client_batch.active == true)
+    {
+        /* sub command: keep state for batch respond, payload is not sent */
+        client_batch.status[(client_batch.current << 1) + 1] = state;
+        MsgPool_Free(feedback.payload);
+        memset(&feedback, 0, sizeof(Client_Message_t));
+        return;
+    }
+
     DBG_SendMessage(DBG_MSG_CLIENT, "Client: Respond Post\r\n");
 
 #ifndef BACKID
@@ -268,7 +296,8 @@ void Client_RespondHandler(uint8_t state)
     }
     else  /* if(state == MSG_FB_ERROR) */
     {
-        vPortFree(feedback.payload);
+        METRIC_INC(METRIC_CLIENT_ERRORS);
+        MsgPool_Free(feedback.payload);
         feedback.index = 0;
         feedback.length = 0;
         feedback.payload = NULL;
@@ -278,13 +307,19 @@ void Client_RespondHandler(uint8_t state)
     /* Send respond message to client */
     feedback.client_id = message.client_id;
     feedback.command = state;
-    /* index, length, payload fill by handler */
-    feedback.checksum = Mem_GetChecksum8(0, (uint8_t *)&feedback.command, 5);
-    if (feedback.payload != NULL)
+    /* index, length, payload fill by handler, checksum or crc32 is built by
+     * wifi task with protocol version of the link */
+    feedback.tick = xTaskGetTickCount();
+    if (xQueueSend(respond_queue, &feedback, 0 ) == pdTRUE)
+    {
+        WiFi_Notify(WIFI_NOTIFY_RESPOND);
+    }
+    else
     {
-        feedback.checksum = Mem_GetChecksum8(feedback.checksum, feedback.payload, feedback.length);
+        /* respond is dropped, payload is not sent by wifi task */
+        MsgPool_Free(feedback.payload);
     }
-    xQueueSend(respond_queue, &feedback, 0 );
+    feedback.payload = NULL;
 
     /* Send message to lcd display task */
     disp_req.source = DISP_DBG_CLIENT;
@@ -294,36 +329,43 @@ void Client_RespondHandler(uint8_t state)
     xQueueSend(display_queue, &disp_req, 0 );
 }
 
+/*******************************************************************************
+* @Brief   Command Respond OK
+* @Param
+* @Note    respond state is command code itself in BACKID build
+* @Return
+*******************************************************************************/
+void Client_RespondOK(void)
+{
+#ifndef BACKID
+    Client_RespondHandler( MSG_FB_OK );
+#else
+    Client_RespondHandler( message.command );
+#endif
+}
+
 /*******************************************************************************/
 void Client_GetMacAddress(void)
 {
     uint8_t i;
     DBG_SendMessage(DBG_MSG_CLIENT, "Client: Get MAC\r\n");
 
-    vPortFree(feedback.payload);
-    feedback.index = 0;
-    feedback.length = 18;
-    feedback.payload = (uint8_t *)pvPortMalloc(18);
+    if (Client_FeedbackPayload(18) == false)
+    {
+        return;
+    }
     for (i = 0; i < 18; i++)
     {
         feedback.payload[i] = wifi_mac_string[i];
     }
-#ifndef BACKID
-    Client_RespondHandler( MSG_FB_OK );
-#else
-    Client_RespondHandler(MSG_GET_MAC);
-#endif
+    Client_RespondOK();
 }
 
 /*******************************************************************************/
 void Client_GetCameraImage(void)
 {
     DBG_SendMessage(DBG_MSG_CLIENT, "Client: Get Camera Image\r\n");
-#ifndef BACKID
-    Client_RespondHandler( MSG_FB_OK );
-#else
-    Client_RespondHandler( MSG_GET_IMAGE );
-#endif
+    Client_RespondOK();
     xEventGroupSetBits( camera_event_group, CAMERA_EVENT_PHOTO_START);
 }
 
@@ -331,51 +373,153 @@ void Client_GetCameraImage(void)
 void Client_GetState(void)
 {
     DBG_SendMessage(DBG_MSG_CLIENT, "Client: Get State\r\n");
-    feedback.index = 0;
-    feedback.length = 5;
-    feedback.payload = (uint8_t *)pvPortMalloc(5);
+    if (Client_FeedbackPayload(5) == false)
+    {
+        return;
+    }
     feedback.payload[0] = 0;
     feedback.payload[1] = 0;
     feedback.payload[2] = 1;
     feedback.payload[3] = 1;
     feedback.payload[4] = 0;
-#ifndef BACKID
-    Client_RespondHandler( MSG_FB_OK );
-#else
-    Client_RespondHandler( MSG_GET_STATE );
-#endif
+    Client_RespondOK();
 }
 
 /*******************************************************************************/
 void Client_GetFirmwareVersion(void)
 {
     DBG_SendMessage(DBG_MSG_CLIENT, "Client: Get Version\r\n");
-    feedback.index = 0;
-    feedback.length = 2;
-    feedback.payload = (uint8_t *)pvPortMalloc(2);
+    if (Client_FeedbackPayload(2) == false)
+    {
+        return;
+    }
     feedback.payload[0] = (uint8_t)(APP_VERSION & 0xFF);
     feedback.payload[1] = (uint8_t)((APP_VERSION >> 8) & 0xFF);
-#ifndef BACKID
-    Client_RespondHandler( MSG_FB_OK );
-#else
-    Client_RespondHandler( MSG_GET_VERSION );
-#endif
+    Client_RespondOK();
 }
 
 /*******************************************************************************/
 void Client_GetID(void)
 {
     DBG_SendMessage(DBG_MSG_CLIENT, "Client: Get ID\r\n");
-    feedback.index = 0;
-    feedback.length = strlen(app_config.account_id) + 1;
-    vPortFree(feedback.payload);
-    feedback.payload = (uint8_t *)pvPortMalloc(feedback.length);
+    if (Client_FeedbackPayload(strlen(app_config.account_id) + 1) == false)
+    {
+        return;
+    }
     memcpy(feedback.payload, app_config.account_id, feedback.length);
-#ifndef BACKID
-    Client_RespondHandler( MSG_FB_OK );
-#else
-    Client_RespondHandler( MSG_GET_ID );
-#endif
+    Client_RespondOK();
+}
+
+/*******************************************************************************
+* @Brief   Get Metrics
+* @Param
+* @Note    respond payload is metrics snapshot, see metrics.h for layout
+* @Return
+*******************************************************************************/
+void Client_GetMetrics(void)
+{
+    DBG_SendMessage(DBG_MSG_CLIENT, "Client: Get Metrics\r\n");
+    if (Client_FeedbackPayload(METRICS_SNAPSHOT_SIZE) == false)
+    {
+        return;
+    }
+    feedback.length = Metrics_Snapshot(feedback.payload, METRICS_SNAPSHOT_SIZE);
+    Client_RespondOK();
+}
+
+/*******************************************************************************
+* @Brief   Get Command Latency
+* @Param
+* @Note    payload: first command to list (1, optional). Respond payload:
+*          bucket count(1) + [command(1) + flags(1) + buckets(2 each)] of
+*          commands run so far, in command order, up to one medium block.
+*          App asks again from last command + 1 when the respond is full
+* @Return
+*******************************************************************************/
+void Client_GetLatency(void)
+{
+    uint8_t from = (message.length >= 1) ? message.payload[0] : 0;
+    uint8_t index[CLIENT_COMMAND_NUM];
+    uint8_t count = 0;
+    uint8_t *p = NULL;
+    uint8_t i = 0;
+    uint8_t j = 0;
+
+    DBG_SendMessage(DBG_MSG_CLIENT, "Client: Get Latency\r\n");
+    for (i = 0; (i < CLIENT_COMMAND_NUM) && (count < CMD_LATENCY_ENTRY_MAX); i++)
+    {
+        if (client_command_table[i].command < from)
+        {
+            continue;
+        }
+        for (j = 0; j < METRICS_BUCKETS; j++)
+        {
+            if (client_command_hist[i][j] != 0)
+            {
+                index[count++] = i;
+                break;
+            }
+        }
+    }
+
+    if (Client_FeedbackPayload(1 + count * CMD_LATENCY_ENTRY_SIZE) == false)
+    {
+        return;
+    }
+    p = feedback.payload;
+    *p++ = METRICS_BUCKETS;
+    for (i = 0; i < count; i++)
+    {
+        *p++ = client_command_table[index[i]].command;
+        *p++ = client_command_table[index[i]].flags;
+        for (j = 0; j < METRICS_BUCKETS; j++)
+        {
+            *p++ = client_command_hist[index[i]][j] & 0xFF;
+            *p++ = (client_command_hist[index[i]][j] >> 8) & 0xFF;
+        }
+    }
+    Client_RespondOK();
+}
+
+/*******************************************************************************
+* @Brief   Get Image Range
+* @Param
+* @Note    payload: frame id(2) + unit(1) + start(4) + count(4), respond
+*          payload: id(2) + size(4) + chunk(2) + filename, range data follows
+*          in MSG_PUSH_RANGE frames
+* @Return
+*******************************************************************************/
+void Client_GetRange(void)
+{
+    bool rtn_state = false;
+    uint8_t *p = message.payload;
+
+    DBG_SendMessage(DBG_MSG_CLIENT, "Client: Get Range\r\n");
+    if (message.length >= 11)
+    {
+        if (Client_FeedbackPayload(WIFI_RANGE_INFO_SIZE) == false)
+        {
+            return;
+        }
+        rtn_state = WiFi_SetRange(message.client_id,
+                                  p[0] + (p[1] << 8),
+                                  p[2],
+                                  p[3] + (p[4] << 8) + ((uint32_t)p[5] << 16) + ((uint32_t)p[6] << 24),
+                                  p[7] + (p[8] << 8) + ((uint32_t)p[9] << 16) + ((uint32_t)p[10] << 24),
+                                  feedback.payload);
+    }
+
+    if (rtn_state == true)
+    {
+        Client_RespondOK();
+        /* respond is queued first, range goes after it */
+        WiFi_StartRange();
+    }
+    else
+    {
+        DBG_SendMessage(DBG_MSG_CLIENT, "Client: Get Range Error\r\n");
+        Client_RespondHandler( MSG_FB_ERROR );
+    }
 }
 
 /*******************************************************************************/
@@ -419,19 +563,12 @@ void Client_SetWebAccount(void)
             /* switch to station if wifi and cloud all config ok */
             app_config.esp8266_mode = APP_ESP8266_STATION;
         }
-        Mem_WriteConfig();
+        Client_ConfigCommit();
         DBG_SendMessage(DBG_MSG_CLIENT, "Client: Set Account OK\r\n");
-#ifndef BACKID
-        Client_RespondHandler( MSG_FB_OK );
-#else
-        Client_RespondHandler( MSG_SET_ACCOUNT );
-#endif
+        Client_RespondOK();
         if (app_config.esp8266_mode == APP_ESP8266_STATION)
         {
-            vTaskDelay(10 / portTICK_PERIOD_MS);
-            DBG_SendMessage(DBG_MSG_CLIENT, "Reset and Switch to Station Mode\r\n");
-            vTaskDelay(1000 / portTICK_PERIOD_MS);
-            HAL_NVIC_SystemReset();
+            Client_StationReset();
         }
     }
     else
@@ -466,25 +603,21 @@ void Client_SetWifi(void)
             app_config.wifi_passwd[i] = message.payload[2 + ssid_len + i];
         }
 
+        /* new AP, fast join info of old one is invalid */
+        memset(&app_config.wifi_join, 0, sizeof(app_config.wifi_join));
+
         app_config.wifi_config_state = APP_CONFIG_OK;
         if (app_config.cloud_config_state == APP_CONFIG_OK)
         {
             /* switch to station if wifi and cloud all config ok */
             app_config.esp8266_mode = APP_ESP8266_STATION;
         }
-        Mem_WriteConfig();
+        Client_ConfigCommit();
         DBG_SendMessage(DBG_MSG_CLIENT, "Client: Set WiFi OK\r\n");
-#ifndef BACKID
-        Client_RespondHandler( MSG_FB_OK );
-#else
-        Client_RespondHandler( MSG_SET_WIFI );
-#endif
+        Client_RespondOK();
         if (app_config.esp8266_mode == APP_ESP8266_STATION)
         {
-            vTaskDelay(10 / portTICK_PERIOD_MS);
-            DBG_SendMessage(DBG_MSG_CLIENT, "Reset and Switch to Station Mode\r\n");
-            vTaskDelay(1000 / portTICK_PERIOD_MS);
-            HAL_NVIC_SystemReset();
+            Client_StationReset();
         }
     }
     else
@@ -507,13 +640,9 @@ void Client_SetMotor(void)
             app_config.motor_cfg.m_freq[i] = message.payload[5 + (i << 1)] + (message.payload[6 + (i << 1)] << 8);
             app_config.motor_cfg.m_step[i] = message.payload[15 + (i << 1)] + (message.payload[16 + (i << 1)] << 8);
         }
-        Mem_WriteConfig();
+        Client_ConfigCommit();
         DBG_SendMessage(DBG_MSG_CLIENT, "Client: Set Motor OK\r\n");
-#ifndef BACKID
-        Client_RespondHandler( MSG_FB_OK );
-#else
-        Client_RespondHandler( MSG_SET_MOTOR );
-#endif
+        Client_RespondOK();
     }
     else
     {
@@ -544,11 +673,7 @@ void Client_SetTime(void)
     {
         HAL_RTCEx_BKUPWrite(&hrtc, RTC_BKP_DR0, 0x32F2);
         DBG_SendMessage(DBG_MSG_CLIENT, "Client: Set RTC OK\r\n");
-#ifndef BACKID
-        Client_RespondHandler( MSG_FB_OK );
-#else
-        Client_RespondHandler( MSG_SET_TIME );
-#endif
+        Client_RespondOK();
     }
     else
     {
@@ -575,13 +700,9 @@ void Client_SetSchedule(void)
             app_config.schedule[i].feed_m4 = message.payload[i * 7 + 5];
             app_config.schedule[i].feed_m5 = message.payload[i * 7 + 6];
         }
-        Mem_WriteConfig();
+        Client_ConfigCommit();
         DBG_SendMessage(DBG_MSG_CLIENT, "Client:Set Feed Schedule OK\r\n");
-#ifndef BACKID
-        Client_RespondHandler( MSG_FB_OK );
-#else
-        Client_RespondHandler( MSG_SET_SCH );
-#endif
+        Client_RespondOK();
     }
     else
     {
@@ -590,47 +711,280 @@ void Client_SetSchedule(void)
     }
 }
 
+/*******************************************************************************/
+void Client_SetChunkSize(void)
+{
+    uint16_t size = 0;
+
+    if (message.length >= 2)
+    {
+        /* feedback accepted size, it may be limited */
+        size = WiFi_SetChunkSize(message.payload[0] + (message.payload[1] << 8));
+
+        if (Client_FeedbackPayload(2) == false)
+        {
+            return;
+        }
+        feedback.payload[0] = size & 0xFF;
+        feedback.payload[1] = (size >> 8) & 0xFF;
+
+        DBG_SendMessage(DBG_MSG_CLIENT, "Client: Set Chunk Size OK\r\n");
+        Client_RespondOK();
+    }
+    else
+    {
+        DBG_SendMessage(DBG_MSG_CLIENT, "Client: Set Chunk Size Error\r\n");
+        Client_RespondHandler( MSG_FB_ERROR );
+    }
+}
+
+/*******************************************************************************/
+void Client_SetImageTarget(void)
+{
+    uint16_t target = 0;
+
+    if (message.length >= 2)
+    {
+        /* 0 restores default, next capture picks profile for new target */
+        target = message.payload[0] + (message.payload[1] << 8);
+        if (target == 0)
+        {
+            target = ADAPT_TARGET_DEFAULT;
+        }
+        else if (target < ADAPT_TARGET_MIN)
+        {
+            target = ADAPT_TARGET_MIN;
+        }
+        else if (target > ADAPT_TARGET_MAX)
+        {
+            target = ADAPT_TARGET_MAX;
+        }
+        app_config.image_target = target;
+        Client_ConfigCommit();
+
+        if (Client_FeedbackPayload(2) == false)
+        {
+            return;
+        }
+        feedback.payload[0] = target & 0xFF;
+        feedback.payload[1] = (target >> 8) & 0xFF;
+
+        DBG_SendMessage(DBG_MSG_CLIENT, "Client: Set Image Target OK\r\n");
+        Client_RespondOK();
+    }
+    else
+    {
+        DBG_SendMessage(DBG_MSG_CLIENT, "Client: Set Image Target Error\r\n");
+        Client_RespondHandler( MSG_FB_ERROR );
+    }
+}
+
+/*******************************************************************************/
+void Client_SetPreview(void)
+{
+    bool rtn_state = false;
+
+    /* ip(4) + port(2) + fps(1) + size(1), port 0 or empty payload stops preview */
+    if (message.length >= 8)
+    {
+        rtn_state = WiFi_SetPreview(message.payload, 
+                                    message.payload[4] + (message.payload[5] << 8), 
+                                    message.payload[6], 
+                                    message.payload[7]);
+    }
+    else if (message.length == 0)
+    {
+        rtn_state = WiFi_SetPreview(NULL, 0, 0, 0);
+    }
+
+    if (rtn_state == true)
+    {
+        DBG_SendMessage(DBG_MSG_CLIENT, "Client: Set Preview OK\r\n");
+        Client_RespondOK();
+    }
+    else
+    {
+        DBG_SendMessage(DBG_MSG_CLIENT, "Client: Set Preview Error\r\n");
+        Client_RespondHandler( MSG_FB_ERROR );
+    }
+}
+
+/*******************************************************************************/
+void Client_SetProtocol(void)
+{
+    uint8_t version = 0;
+
+    /* client asks the highest version it has, device answers the one in use
+     * from next frame, this respond is still in old version */
+    if ((message.length >= 1) && (message.payload[0] >= MSG_PROTOCOL_V1))
+    {
+        if (Client_FeedbackPayload(1) == false)
+        {
+            return;
+        }
+        /* switch is done by wifi task after next respond of this link */
+        version = WiFi_SetProtocol(message.client_id, message.payload[0]);
+    }
+
+    if (version != 0)
+    {
+        feedback.payload[0] = version;
+
+        DBG_SendMessage(DBG_MSG_CLIENT, "Client: Set Protocol OK\r\n");
+        Client_RespondOK();
+    }
+    else
+    {
+        DBG_SendMessage(DBG_MSG_CLIENT, "Client: Set Protocol Error\r\n");
+        Client_RespondHandler( MSG_FB_ERROR );
+    }
+}
+
+/*******************************************************************************
+* @Brief   Batch Command
+* @Param
+* @Note    payload: count(1) + count * [command(1) + length(2) + payload]
+*          run set commands in order, config is written once and station
+*          reset is done after respond. Respond payload: count(1) +
+*          count * [command(1) + state(1)], sub command payload is not sent
+* @Return
+*******************************************************************************/
+void Client_Batch(void)
+{
+    Client_Message_t batch;
+    const Client_Command_t *cmd = NULL;
+    uint16_t offset = 1;
+    uint16_t length = 0;
+    uint8_t command = 0;
+    uint8_t count = 0;
+    uint8_t i = 0;
+
+    /* check layout of all sub commands before any is run */
+    if (message.length >= 1)
+    {
+        count = message.payload[0];
+    }
+    if ((count == 0) || (count > MSG_BATCH_MAX))
+    {
+        DBG_SendMessage(DBG_MSG_CLIENT, "Client: Batch Error\r\n");
+        Client_RespondHandler( MSG_FB_ERROR );
+        return;
+    }
+    for (i = 0; i < count; i++)
+    {
+        if ((offset + 3) > message.length)
+        {
+            break;
+        }
+        length = message.payload[offset + 1] + (message.payload[offset + 2] << 8);
+        /* sub payload must end inside batch, offset would wrap on a large length */
+        if (length > (message.length - offset - 3))
+        {
+            break;
+        }
+        offset += 3 + length;
+    }
+    if ((i != count) || (offset != message.length))
+    {
+        DBG_SendMessage(DBG_MSG_CLIENT, "Client: Batch Error\r\n");
+        Client_RespondHandler( MSG_FB_ERROR );
+        return;
+    }
+
+    memcpy(&batch, &message, sizeof(Client_Message_t));
+    memset(&client_batch, 0, sizeof(Client_Batch_t));
+    client_batch.active = true;
+
+    offset = 1;
+    for (i = 0; i < count; i++)
+    {
+        command = batch.payload[offset];
+        length = batch.payload[offset + 1] + (batch.payload[offset + 2] << 8);
+
+        client_batch.current = i;
+        client_batch.status[i << 1] = command;
+        client_batch.status[(i << 1) + 1] = MSG_FB_ERROR;
+
+        /* sub command payload is a view into batch payload */
+        message.command = command;
+        message.index = i;
+        message.length = length;
+        message.payload = (length > 0) ? &batch.payload[offset + 3] : NULL;
+        memset(&feedback, 0, sizeof(Client_Message_t));
+
+        /* only set command, get payload is not sent and ota/batch is not nested */
+        cmd = Client_FindCommand(command);
+        if ((cmd != NULL) && ((cmd->flags & CMD_FLAG_BATCH) != 0))
+        {
+            Client_RequestDispatch();
+        }
+        else
+        {
+            Client_RespondHandler( MSG_FB_ERROR );
+        }
+        offset += 3 + length;
+    }
+
+    memcpy(&message, &batch, sizeof(Client_Message_t));
+    client_batch.active = false;
+
+    /* one sector erase for all set commands */
+    if (client_batch.config_dirty == true)
+    {
+        Mem_WriteConfig();
+    }
+
+    DBG_SendMessage(DBG_MSG_CLIENT, "Client: Batch OK\r\n");
+    if (Client_FeedbackPayload(1 + (count << 1)) == true)
+    {
+        feedback.payload[0] = count;
+        memcpy(&feedback.payload[1], client_batch.status, count << 1);
+        Client_RespondOK();
+    }
+
+    if (client_batch.station_reset == true)
+    {
+        Client_StationReset();
+    }
+}
+
 /*******************************************************************************/
 void Client_PushImage(void)
 {
     DBG_SendMessage(DBG_MSG_CLIENT, "Client: Push Image\r\n");
-#ifndef BACKID
-    Client_RespondHandler( MSG_FB_OK );
-#else
-    Client_RespondHandler( MSG_PUSH_IMAGE );
-#endif
+    Client_RespondOK();
 }
 
 /*******************************************************************************/
 void Client_PushWebAccount(void)
 {
     DBG_SendMessage(DBG_MSG_CLIENT, "Client: Push Web Account\r\n");
-#ifndef BACKID
-    Client_RespondHandler( MSG_FB_OK );
-#else
-    Client_RespondHandler( MSG_PUSH_ACCOUNT );
-#endif
+    Client_RespondOK();
 }
 
 /*******************************************************************************/
 void Client_PushAlarm(void)
 {
     DBG_SendMessage(DBG_MSG_CLIENT, "Client: Push Alarm\r\n");
-#ifndef BACKID
-    Client_RespondHandler( MSG_FB_OK );
-#else
-    Client_RespondHandler( MSG_PUSH_ALARM );
-#endif
+    Client_RespondOK();
 }
 
 /*******************************************************************************/
 void Client_OtaUpdateRequest(void)
 {
     uint16_t fw_ver = 0;
-    memset(&ota_info, 0, sizeof(ota_info));
-    vPortFree(feedback.payload);
+    MsgPool_Free(feedback.payload);
     memset(&feedback, 0, sizeof(feedback));
 
+    /* packets of an aborted update must not land after the erase */
+    if (Client_OtaWait() == false)
+    {
+        Client_RespondHandler( MSG_FB_ERROR );
+        DBG_SendMessage(DBG_MSG_CLIENT, "Client: OTA Request Busy\r\n");
+        return;
+    }
+    memset(&ota_info, 0, sizeof(ota_info));
+
     if ((message.length == 2) && (message.payload != NULL))
     {
         fw_ver = message.payload[0] + (message.payload[1] << 8);
@@ -643,13 +997,16 @@ void Client_OtaUpdateRequest(void)
             Mem_WriteInfo();
 
             /* erase ota flash */
-            Mem_EraseApp(OTA_ADDR_START, OTA_ADDR_END);
-#ifndef BACKID
-            Client_RespondHandler( MSG_FB_OK );
-#else
-            Client_RespondHandler( MSG_OTA_REQUEST );
-#endif
-            DBG_SendMessage(DBG_MSG_CLIENT, "Client: OTA Request - OK\r\n");
+            if (Mem_EraseApp(OTA_ADDR_START, OTA_ADDR_END) == true)
+            {
+                Client_RespondOK();
+                DBG_SendMessage(DBG_MSG_CLIENT, "Client: OTA Request - OK\r\n");
+            }
+            else
+            {
+                Client_RespondHandler( MSG_FB_ERROR );
+                DBG_SendMessage(DBG_MSG_CLIENT, "Client: OTA Erase Error\r\n");
+            }
         }
         else
         {
@@ -668,33 +1025,82 @@ void Client_OtaUpdateRequest(void)
 void Client_OtaBinData(void)
 {
     DBG_MsgBuf_t dbg;
+    Client_OtaWrite_t write;
 
     DBG_Sprintf(dbg.buf, "Client: OTA Bin Packet %d\r\n", message.index);
     DBG_SendMessage(DBG_MSG_CLIENT, dbg.buf);
 
+    write.block = message.payload;
+
+    /* flash write of an earlier packet failed, stop the upload */
+    if (ota_info.write_error == true)
+    {
+        Client_RespondHandler( MSG_FB_ERROR );
+        return;
+    }
+
     /* packet 0 include firmware version, crc and size */
     if (message.index == 0)
     {
+        if (message.length < 8)
+        {
+            Client_RespondHandler( MSG_FB_ERROR );
+            return;
+        }
         /* extract firmware information */
         ota_info.fw_version = message.payload[0] + (message.payload[1] << 8);
         ota_info.fw_crc16 = message.payload[2] + (message.payload[3] << 8);
         ota_info.fw_size = message.payload[4] + (message.payload[5] << 8) + (message.payload[6] << 16) + (message.payload[7] << 24);
-        ota_info.write_length = message.length - 8;
-
-        /* write bin data */
-        Mem_WriteApp(OTA_ADDR_START, (uint8_t *)&message.payload[8], message.length - 8);
+        ota_info.write_length = 0;
 
+        write.data = &message.payload[8];
+        write.length = message.length - 8;
     }
     else
     {
-        Mem_WriteApp(OTA_ADDR_START + ota_info.write_length, (uint8_t *)message.payload, message.length);
-        ota_info.write_length += message.length;
+        write.data = message.payload;
+        write.length = message.length;
     }
-#ifndef BACKID
-    Client_RespondHandler( MSG_FB_OK );
-#else
-    Client_RespondHandler( MSG_OTA_BIN );
-#endif
+    write.addr = OTA_ADDR_START + ota_info.write_length;
+
+    /* hand pool block to writer task, wait here only when all buffers are used */
+    taskENTER_CRITICAL();
+    ota_pending++;
+    taskEXIT_CRITICAL();
+    if (xQueueSend(ota_queue, &write, OTA_WRITE_TIMEOUT) != pdTRUE)
+    {
+        taskENTER_CRITICAL();
+        ota_pending--;
+        taskEXIT_CRITICAL();
+        Client_RespondHandler( MSG_FB_ERROR );
+        DBG_SendMessage(DBG_MSG_CLIENT, "Client: OTA Write Timeout\r\n");
+        return;
+    }
+    message.payload = NULL;
+
+    ota_info.write_length += write.length;
+    Client_RespondOK();
+}
+
+/*******************************************************************************
+* @Brief   Client OTA Wait
+* @Param
+* @Note    wait until writer task has programmed all acked bin packets
+* @Return  false if flash write is not done in OTA_WRITE_TIMEOUT
+*******************************************************************************/
+bool Client_OtaWait(void)
+{
+    TickType_t start = xTaskGetTickCount();
+
+    while (ota_pending != 0)
+    {
+        if ((xTaskGetTickCount() - start) >= OTA_WRITE_TIMEOUT)
+        {
+            return false;
+        }
+        vTaskDelay(1);
+    }
+    return true;
 }
 
 /*******************************************************************************/
@@ -703,8 +1109,9 @@ void Client_OtaVerify(void)
     bool ota_success = false;
     uint16_t crc = 0;
 
-    /* check firmware size */
-    if (ota_info.write_length == ota_info.fw_size)
+    /* check firmware size, after last packets and held bytes are in flash */
+    if ((Client_OtaWait() == true) && (Mem_FlushApp() == true) &&
+        (ota_info.write_error == false) && (ota_info.write_length == ota_info.fw_size))
     {
         /* check crc */
         crc = CRC16_CCITT((uint8_t *)OTA_ADDR_START, ota_info.fw_size);
@@ -722,11 +1129,7 @@ void Client_OtaVerify(void)
         app_info.ota_length = ota_info.fw_size;
         app_info.ota_crc = ota_info.fw_crc16;
         Mem_WriteInfo();
-#ifndef BACKID
-        Client_RespondHandler( MSG_FB_OK );
-#else
-        Client_RespondHandler( MSG_OTA_VERIFY );
-#endif
+        Client_RespondOK();
         /* delay 1 second and reboot to excute new app */
         vTaskDelay(100 / portTICK_PERIOD_MS);
         DBG_SendMessage(DBG_MSG_CLIENT, "=== Device Reset After 3s ===\r\n");
@@ -755,11 +1158,7 @@ void Client_FactoryNew(void)
         app_config.motor_cfg.m_step[i] = MOTOR_DEFAULT_STEP;
     }
     Mem_WriteConfig();
-#ifndef BACKID
-    Client_RespondHandler( MSG_FB_OK );
-#else
-    Client_RespondHandler( MSG_FACTORY_NEW );
-#endif
+    Client_RespondOK();
     /* delay 1 second and reboot */
     vTaskDelay(1000 / portTICK_PERIOD_MS);
     HAL_NVIC_SystemReset();
@@ -775,6 +1174,64 @@ void Client_FeedbackError(void)
     DBG_SendMessage(DBG_MSG_CLIENT, "Client: Push Feedback Error\r\n");
 }
 
+/*******************************************************************************
+* @Brief   Config Commit
+* @Param
+* @Note    write config to flash, deferred to end of batch in batch mode
+* @Return
+*******************************************************************************/
+void Client_ConfigCommit(void)
+{
+    if (client_batch.active == true)
+    {
+        client_batch.config_dirty = true;
+        return;
+    }
+    Mem_WriteConfig();
+}
+
+/*******************************************************************************
+* @Brief   Station Reset
+* @Param
+* @Note    reboot to station mode after respond is sent, deferred to end of
+*          batch in batch mode
+* @Return
+*******************************************************************************/
+void Client_StationReset(void)
+{
+    if (client_batch.active == true)
+    {
+        client_batch.station_reset = true;
+        return;
+    }
+    vTaskDelay(10 / portTICK_PERIOD_MS);
+    DBG_SendMessage(DBG_MSG_CLIENT, "Reset and Switch to Station Mode\r\n");
+    vTaskDelay(1000 / portTICK_PERIOD_MS);
+    HAL_NVIC_SystemReset();
+}
+
+/*******************************************************************************
+* @Brief   Feedback Payload Allocate
+* @Param   length[in]: payload bytes
+* @Note    payload block from message pool, error is responded if pool is empty
+* @Return  true if feedback.payload is ready to fill
+*******************************************************************************/
+bool Client_FeedbackPayload(uint16_t length)
+{
+    MsgPool_Free(feedback.payload);
+    feedback.index = 0;
+    feedback.length = length;
+    feedback.payload = MsgPool_Alloc(length);
+    if (feedback.payload == NULL)
+    {
+        DBG_SendMessage(DBG_MSG_CLIENT, "Client: Payload Pool Empty\r\n");
+        Client_RespondHandler( MSG_FB_ERROR );
+        return false;
+    }
+
+    return true;
+}
+
 #endif /* USE_DEMO_VERSION */
 
 
@@ -20,6 +20,7 @@
 #include "lcd_driver.h"
 #include "display_task.h"
 #include "debug_task.h"
+#include "boot.h"
 
 /* Private variables ----------------------------------------------------------------------------*/
 QueueHandle_t display_queue;
@@ -54,7 +55,7 @@ void Disp_ShowTask(void * argument)
     LCD_DisplayString(APP_NAME_DISP);
     LCD_SetPosition(2, 0);
     LCD_DisplayString(APP_VER_DISP);
-    vTaskDelay(500 / portTICK_PERIOD_MS);
+    Boot_StageDone(BOOT_STAGE_LCD);
     
     /* Infinite loop */
     for(;;)
@@ -0,0 +1,230 @@
+/*
+***************************************************************************************************
+*                               Adaptive Image Profile Controller
+*
+* File   : image_adapt.c
+* Author : Douglas Xie
+* Date   : 2018.03.22
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*/
+
+/* Include Head Files ---------------------------------------------------------------------------*/
+#include "stdint.h"
+#include "stdbool.h"
+#include "string.h"
+
+#include "image_adapt.h"
+
+/* Macro defines --------------------------------------------------------------------------------*/
+/* Step up only when next profile is predicted within 3/4 of target */
+#define ADAPT_UP_MARGIN_NUM     3
+#define ADAPT_UP_MARGIN_DEN     4
+
+/* Rssi to highest allowed profile, weak link drops packets before goodput is measured */
+#define ADAPT_RSSI_GOOD         (-67)
+#define ADAPT_RSSI_FAIR         (-75)
+#define ADAPT_RSSI_WEAK         (-82)
+
+/* Private variables ----------------------------------------------------------------------------*/
+/* Smallest file first, format value is ImageFormat_TypeDef */
+const Adapt_Profile_t adapt_profile_table[ADAPT_PROFILE_NUM] =
+{
+    { 0x00, 0x30,  2500 },      /* JPEG_176x144, coarse */
+    { 0x01, 0x20,  6000 },      /* JPEG_320x240, coarse */
+    { 0x01, 0x0C, 10000 },      /* JPEG_320x240 */
+    { 0x03, 0x20, 18000 },      /* JPEG_640x480, coarse */
+    { 0x03, 0x0C, 30000 },      /* JPEG_640x480, sensor default quality */
+};
+
+/* Private function -----------------------------------------------------------------------------*/
+uint8_t Adapt_RssiCap(int8_t rssi);
+uint32_t Adapt_Predict(Adapt_t *adapt, uint8_t profile);
+
+/* Public Function ------------------------------------------------------------------------------*/
+
+/*******************************************************************************
+* @Brief   Adapt Initial
+* @Param   adapt[in]: controller object
+* @Note    link is unknown, default profile is used until first sample
+* @Return
+*******************************************************************************/
+void Adapt_Init(Adapt_t *adapt)
+{
+    uint8_t i = 0;
+
+    for(i = 0; i < ADAPT_PROFILE_NUM; i++)
+    {
+        adapt->size[i] = adapt_profile_table[i].size;
+    }
+    adapt->goodput = 0;
+    adapt->rssi = ADAPT_RSSI_UNKNOWN;
+    adapt->profile = ADAPT_PROFILE_DEFAULT;
+}
+
+/*******************************************************************************
+* @Brief   Adapt Link RSSI Sample
+* @Param   rssi[in]: dBm from AT+CWJAP?
+* @Note
+* @Return
+*******************************************************************************/
+void Adapt_LinkRssi(Adapt_t *adapt, int8_t rssi)
+{
+    adapt->rssi = rssi;
+}
+
+/*******************************************************************************
+* @Brief   Adapt Link Delivery Sample
+* @Param   length[in]: image bytes delivered
+*          elapsed_ms[in]: time from first chunk to last SEND OK
+* @Note    length is below camera buffer size, no overflow in ms scaling
+* @Return
+*******************************************************************************/
+void Adapt_LinkDelivery(Adapt_t *adapt, uint32_t length, uint32_t elapsed_ms)
+{
+    uint32_t sample = 0;
+
+    if(elapsed_ms == 0)
+    {
+        elapsed_ms = 1;
+    }
+    sample = (length * 1000) / elapsed_ms;
+    if(sample == 0)
+    {
+        sample = 1;
+    }
+
+    /* moving average, falls by 1/2 and rises by 1/4, so a fading link is 
+     * followed at once. First sample and a sample below half of average (busy
+     * channel, rssi still good) are taken as is */
+    if((adapt->goodput == 0) || (sample < adapt->goodput / 2))
+    {
+        adapt->goodput = sample;
+    }
+    else if(sample < adapt->goodput)
+    {
+        adapt->goodput = (adapt->goodput + sample) / 2;
+    }
+    else
+    {
+        adapt->goodput = (adapt->goodput * 3 + sample) / 4;
+    }
+}
+
+/*******************************************************************************
+* @Brief   Adapt Link Failure
+* @Param
+* @Note    image is not delivered, goodput estimate is halved
+* @Return
+*******************************************************************************/
+void Adapt_LinkFail(Adapt_t *adapt)
+{
+    if(adapt->goodput > 1)
+    {
+        adapt->goodput /= 2;
+    }
+    else
+    {
+        /* never measured, start from a small profile */
+        adapt->goodput = 1;
+    }
+}
+
+/*******************************************************************************
+* @Brief   Adapt Image Size Sample
+* @Param   profile[in]: profile of the capture
+*          length[in]: jpg size
+* @Note
+* @Return
+*******************************************************************************/
+void Adapt_ImageSize(Adapt_t *adapt, uint8_t profile, uint32_t length)
+{
+    if((profile >= ADAPT_PROFILE_NUM) || (length == 0))
+    {
+        return;
+    }
+
+    adapt->size[profile] = (adapt->size[profile] * 3 + length) / 4;
+}
+
+/*******************************************************************************
+* @Brief   Adapt Select Profile
+* @Param   target_ms[in]: target time to deliver one image
+* @Note    largest profile predicted within target is selected, step down is
+*          at once but step up is one profile per capture with margin, so a
+*          noisy link does not toggle between profiles
+* @Return  profile index of adapt_profile_table
+*******************************************************************************/
+uint8_t Adapt_Select(Adapt_t *adapt, uint32_t target_ms)
+{
+    uint8_t i = 0;
+    uint8_t cap = Adapt_RssiCap(adapt->rssi);
+    uint8_t best = 0;
+
+    if(adapt->goodput == 0)
+    {
+        /* no delivery measured yet, rssi only */
+        adapt->profile = (ADAPT_PROFILE_DEFAULT < cap) ? ADAPT_PROFILE_DEFAULT : cap;
+        return adapt->profile;
+    }
+
+    for(i = 0; i <= cap; i++)
+    {
+        if(Adapt_Predict(adapt, i) <= target_ms)
+        {
+            best = i;
+        }
+    }
+
+    if(best > adapt->profile)
+    {
+        if(Adapt_Predict(adapt, adapt->profile + 1) <= (target_ms * ADAPT_UP_MARGIN_NUM / ADAPT_UP_MARGIN_DEN))
+        {
+            adapt->profile++;
+        }
+    }
+    else
+    {
+        adapt->profile = best;
+    }
+
+    return adapt->profile;
+}
+
+/* Private Function -----------------------------------------------------------------------------*/
+
+/*******************************************************************************
+* @Brief   Adapt RSSI Cap
+* @Param   rssi[in]: dBm
+* @Note    unknown rssi (AP mode) does not limit profile
+* @Return  highest allowed profile
+*******************************************************************************/
+uint8_t Adapt_RssiCap(int8_t rssi)
+{
+    if((rssi == ADAPT_RSSI_UNKNOWN) || (rssi >= ADAPT_RSSI_GOOD))
+    {
+        return ADAPT_PROFILE_NUM - 1;
+    }
+    else if(rssi >= ADAPT_RSSI_FAIR)
+    {
+        return 3;
+    }
+    else if(rssi >= ADAPT_RSSI_WEAK)
+    {
+        return 2;
+    }
+
+    return 1;
+}
+
+/*******************************************************************************
+* @Brief   Adapt Predict Delivery Time
+* @Param   profile[in]: profile index
+* @Note
+* @Return  ms
+*******************************************************************************/
+uint32_t Adapt_Predict(Adapt_t *adapt, uint8_t profile)
+{
+    return (adapt->size[profile] * 1000) / adapt->goodput;
+}
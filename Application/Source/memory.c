@@ -27,7 +27,12 @@
 App_Info_t app_info;
 App_Config_t app_config;
 
+/* Private Variable -----------------------------------------------------------------------------*/
+Mem_Writer_t mem_app_writer;        /* ota bin stream, continues over packets */
+
 /* Private Function Declaration -----------------------------------------------------------------*/
+bool Mem_Program(uint32_t type_program, uint32_t address, uint32_t data);
+bool Mem_Erase(uint32_t first_sector, uint32_t number_of_sector);
 
 /* Public Function ------------------------------------------------------------------------------*/
 
@@ -68,40 +73,24 @@ void Mem_ReadInfo(void)
 * @Brief    Write App Info Sector
 * @Param   
 * @Note    
-* @Return  
+* @Return   false if erase, program or read back failed
 *******************************************************************************/
-void Mem_WriteInfo(void)
+bool Mem_WriteInfo(void)
 {
-    uint32_t i = 0;
-    uint32_t address, sector_error = 0;
-    FLASH_EraseInitTypeDef EraseInitStruct;
+    Mem_Writer_t writer;
 
     app_info.checksum = Mem_GetChecksum32(app_info.array32, (sizeof(app_info)/4) - 1);
     
     /* erase info sector */
-    HAL_FLASH_Unlock();
-    
-    EraseInitStruct.TypeErase     = FLASH_TYPEERASE_SECTORS;
-    EraseInitStruct.VoltageRange  = FLASH_VOLTAGE_RANGE_3;
-    EraseInitStruct.Sector        = Mem_GetSector(INFO_ADDR_START);
-    EraseInitStruct.NbSectors     = 1;
-    while(HAL_FLASHEx_Erase(&EraseInitStruct, &sector_error) != HAL_OK)
+    if(Mem_Erase(Mem_GetSector(INFO_ADDR_START), 1) == false)
     {
-        HAL_Delay(100);
+        return false;
     }
     
     /* write new info data */
-    address = INFO_ADDR_START;
-    for(i = 0; i < sizeof(app_info)/4; )
-    {
-        if(HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, address, app_info.array32[i]) == HAL_OK)
-        {
-            address = address + 4;
-            i++;
-        }
-    }
-    
-    HAL_FLASH_Lock();
+    Mem_WriterBegin(&writer, INFO_ADDR_START);
+    Mem_WriterPut(&writer, app_info.array, sizeof(app_info));
+    return Mem_WriterFlush(&writer);
 }
 
 /*******************************************************************************
@@ -146,8 +135,17 @@ void Mem_ReadConfig(void)
     /* validate checksum */
     if(app_config.checksum != Mem_GetChecksum32(app_config.array32, (sizeof(app_config)/4) - 1))
     {  
-        /* reset default value when checksum error */
-        Mem_ResetConfig();
+        if(app_config.array32[APP_CONFIG_LEGACY_WORDS] == Mem_GetChecksum32(app_config.array32, APP_CONFIG_LEGACY_WORDS))
+        {
+            /* config of old firmware, keep it and clear new fields */
+            memset(&app_config.array[APP_CONFIG_LEGACY_WORDS * 4], 0, sizeof(app_config) - (APP_CONFIG_LEGACY_WORDS * 4));
+            Mem_WriteConfig();
+        }
+        else
+        {
+            /* reset default value when checksum error */
+            Mem_ResetConfig();
+        }
     }
 }
 
@@ -155,57 +153,39 @@ void Mem_ReadConfig(void)
 * @Brief    Write Config Sector Data
 * @Param   
 * @Note    
-* @Return  
+* @Return   false if erase, program or read back failed
 *******************************************************************************/
-void Mem_WriteConfig(void)
+bool Mem_WriteConfig(void)
 {
-    uint32_t i = 0;
-    uint32_t address, sector_error = 0;
-    FLASH_EraseInitTypeDef EraseInitStruct;
+    Mem_Writer_t writer;
 
     /* update checksum */
     app_config.checksum = Mem_GetChecksum32(app_config.array32, (sizeof(app_config)/4) - 1);
     
-    /* erase info sector */
-    HAL_FLASH_Unlock();
-    
-    EraseInitStruct.TypeErase     = FLASH_TYPEERASE_SECTORS;
-    EraseInitStruct.VoltageRange  = FLASH_VOLTAGE_RANGE_3;
-    EraseInitStruct.Sector        = Mem_GetSector(CONFIG_ADDR_START);
-    EraseInitStruct.NbSectors     = 1;
-    while(HAL_FLASHEx_Erase(&EraseInitStruct, &sector_error) != HAL_OK)
-    {
-        HAL_Delay(100);
-    }
-    
-    /* write new info data */
-    address = CONFIG_ADDR_START;
-    for(i = 0; i < sizeof(app_config)/4; )
+    /* erase config sector */
+    if(Mem_Erase(Mem_GetSector(CONFIG_ADDR_START), 1) == false)
     {
-        if(HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, address, app_config.array32[i]) == HAL_OK)
-        {
-            address = address + 4;
-            i++;
-        }
+        return false;
     }
     
-    HAL_FLASH_Lock();
+    /* write new config data */
+    Mem_WriterBegin(&writer, CONFIG_ADDR_START);
+    Mem_WriterPut(&writer, app_config.array, sizeof(app_config));
+    return Mem_WriterFlush(&writer);
 }
 
 /*******************************************************************************
 * @Brief    Erase App Flash Sector
 * @Param   
-* @Note    
-* @Return  
+* @Note     bytes of app write not flushed yet are dropped
+* @Return   false if erase failed
 *******************************************************************************/
-void Mem_EraseApp(uint32_t start_addr, uint32_t end_addr)
+bool Mem_EraseApp(uint32_t start_addr, uint32_t end_addr)
 {
-    uint32_t sector_error = 0;
     uint32_t first_sector = 0;
     uint32_t number_of_sector = 0;
-    FLASH_EraseInitTypeDef EraseInitStruct;
 
-    HAL_FLASH_Unlock();
+    Mem_WriterBegin(&mem_app_writer, 0);
     
     /* Get the 1st sector to erase */
     first_sector = Mem_GetSector(start_addr);
@@ -213,45 +193,170 @@ void Mem_EraseApp(uint32_t start_addr, uint32_t end_addr)
     /* Get the number of sector to erase from 1st sector*/
     number_of_sector = Mem_GetSector(end_addr) - first_sector + 1;
     
-    /* Fill EraseInit structure*/
-    EraseInitStruct.TypeErase = FLASH_TYPEERASE_SECTORS;
-    EraseInitStruct.VoltageRange = FLASH_VOLTAGE_RANGE_3;
-    EraseInitStruct.Sector = first_sector;
-    EraseInitStruct.NbSectors = number_of_sector;
-    
-    while(HAL_FLASHEx_Erase(&EraseInitStruct, &sector_error) != HAL_OK)
+    return Mem_Erase(first_sector, number_of_sector);
+}
+
+/*******************************************************************************
+* @Brief    Write App Bin Data
+* @Param   
+* @Note     should erase app flash before write data. Write from where last
+*           write ended continues the stream, up to 3 bytes wait for next
+*           write or Mem_FlushApp
+* @Return   false if program or read back failed, also for later writes
+*******************************************************************************/
+bool Mem_WriteApp(uint32_t start_addr, uint8_t *data_buf, uint32_t data_len)
+{
+    /* not where last write ended: new stream */
+    if((mem_app_writer.address + mem_app_writer.count) != start_addr)
     {
-        HAL_Delay(100);
+        Mem_WriterFlush(&mem_app_writer);
+        Mem_WriterBegin(&mem_app_writer, start_addr);
     }
     
-    HAL_FLASH_Lock();
+    return Mem_WriterPut(&mem_app_writer, data_buf, data_len);
 }
 
 /*******************************************************************************
-* @Brief    Write App Bin Data
+* @Brief    Flush App Bin Data
 * @Param   
-* @Note     should erase app flash before write data
+* @Note     write bytes held by Mem_WriteApp, call before verify
+* @Return   false if any write of the stream failed
+*******************************************************************************/
+bool Mem_FlushApp(void)
+{
+    return Mem_WriterFlush(&mem_app_writer);
+}
+
+/*******************************************************************************
+* @Brief    Flash Writer Begin
+* @Param    writer[out]: writer
+*           address[in]: flash address of first byte, erased before
+* @Note     
 * @Return  
 *******************************************************************************/
-void Mem_WriteApp(uint32_t start_addr, uint8_t *data_buf, uint32_t data_len)
+void Mem_WriterBegin(Mem_Writer_t *writer, uint32_t address)
 {
-    uint32_t i = 0;
-    uint32_t write_addr = 0;
+    memset(writer, 0, sizeof(Mem_Writer_t));
+    writer->address = address;
+}
+
+/*******************************************************************************
+* @Brief    Flash Writer Put
+* @Param    writer[in]: writer
+*           data[in]: data, any alignment
+*           length[in]: data length
+* @Note     bytes before first word boundary are programmed one by one, then
+*           words; words are read back once per put. Tail of less than a word
+*           waits in writer
+* @Return   false if program or read back failed
+*******************************************************************************/
+bool Mem_WriterPut(Mem_Writer_t *writer, const uint8_t *data, uint32_t length)
+{
+    const uint8_t *source = NULL;
+    uint32_t start = 0;
+    uint32_t word = 0;
+
+    if(writer->error == true)
+    {
+        return false;
+    }
+    
+    HAL_FLASH_Unlock();
+    
+    /* start address not word aligned */
+    while((writer->error == false) && (length > 0) && (writer->count == 0) && ((writer->address & 0x03) != 0))
+    {
+        if((Mem_Program(FLASH_TYPEPROGRAM_BYTE, writer->address, *data) == false) ||
+           (*(volatile uint8_t *)writer->address != *data))
+        {
+            writer->error = true;
+        }
+        writer->address++;
+        data++;
+        length--;
+    }
+    
+    /* complete word left by last put */
+    while((writer->error == false) && (length > 0) && (writer->count > 0))
+    {
+        writer->pending[writer->count++] = *data;
+        data++;
+        length--;
+        if(writer->count == 4)
+        {
+            memcpy(&word, writer->pending, 4);
+            if((Mem_Program(FLASH_TYPEPROGRAM_WORD, writer->address, word) == false) ||
+               (*(volatile uint32_t *)writer->address != word))
+            {
+                writer->error = true;
+            }
+            writer->address += 4;
+            writer->count = 0;
+        }
+    }
+    
+    /* aligned words */
+    start = writer->address;
+    source = data;
+    while((writer->error == false) && (length >= 4))
+    {
+        memcpy(&word, data, 4);
+        if(Mem_Program(FLASH_TYPEPROGRAM_WORD, writer->address, word) == false)
+        {
+            writer->error = true;
+        }
+        writer->address += 4;
+        data += 4;
+        length -= 4;
+    }
+    if((writer->error == false) && (memcmp((const void *)start, source, writer->address - start) != 0))
+    {
+        writer->error = true;
+    }
+    
+    /* tail waits for next put or flush */
+    if((writer->error == false) && (length > 0))
+    {
+        memcpy(writer->pending, data, length);
+        writer->count = length;
+    }
+    
+    HAL_FLASH_Lock();
+    
+    return (writer->error == false);
+}
+
+/*******************************************************************************
+* @Brief    Flash Writer Flush
+* @Param    writer[in]: writer
+* @Note     bytes of a word not complete are programmed one by one
+* @Return   false if this or an earlier put failed
+*******************************************************************************/
+bool Mem_WriterFlush(Mem_Writer_t *writer)
+{
+    uint8_t i = 0;
 
+    if(writer->error == true)
+    {
+        return false;
+    }
+    
     HAL_FLASH_Unlock();
     
-    /* write firmware bin data */
-    write_addr = start_addr;
-    while(i < data_len)
+    for(i = 0; (i < writer->count) && (writer->error == false); i++)
     {
-        if(HAL_FLASH_Program(FLASH_TYPEPROGRAM_BYTE, write_addr, data_buf[i]) == HAL_OK)
+        if((Mem_Program(FLASH_TYPEPROGRAM_BYTE, writer->address, writer->pending[i]) == false) ||
+           (*(volatile uint8_t *)writer->address != writer->pending[i]))
         {
-            i++;
-            write_addr++;
+            writer->error = true;
         }
+        writer->address++;
     }
+    writer->count = 0;
     
     HAL_FLASH_Lock();
+    
+    return (writer->error == false);
 }
 
 /*******************************************************************************
@@ -427,3 +532,66 @@ uint32_t Mem_GetSector(uint32_t address)
     return sector;
 }
 
+/* Private Function -----------------------------------------------------------------------------*/
+
+/*******************************************************************************
+* @Brief    Program Flash
+* @Param    type_program[in]: FLASH_TYPEPROGRAM_BYTE or FLASH_TYPEPROGRAM_WORD
+*           address[in]: flash address
+*           data[in]: byte or word
+* @Note     flash is unlocked by caller
+* @Return   false if all MEM_PROGRAM_RETRY tries failed
+*******************************************************************************/
+bool Mem_Program(uint32_t type_program, uint32_t address, uint32_t data)
+{
+    uint8_t retry = 0;
+
+    for(retry = 0; retry < MEM_PROGRAM_RETRY; retry++)
+    {
+        if(HAL_FLASH_Program(type_program, address, data) == HAL_OK)
+        {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+/*******************************************************************************
+* @Brief    Erase Flash Sectors
+* @Param    first_sector[in]: FLASH_SECTOR_x
+*           number_of_sector[in]: sectors from first
+* @Note     
+* @Return   false if all MEM_ERASE_RETRY tries failed
+*******************************************************************************/
+bool Mem_Erase(uint32_t first_sector, uint32_t number_of_sector)
+{
+    uint32_t sector_error = 0;
+    uint8_t retry = 0;
+    bool result = false;
+    FLASH_EraseInitTypeDef EraseInitStruct;
+
+    EraseInitStruct.TypeErase     = FLASH_TYPEERASE_SECTORS;
+    EraseInitStruct.VoltageRange  = FLASH_VOLTAGE_RANGE_3;
+    EraseInitStruct.Sector        = first_sector;
+    EraseInitStruct.NbSectors     = number_of_sector;
+    
+    HAL_FLASH_Unlock();
+    
+    for(retry = 0; (retry < MEM_ERASE_RETRY) && (result == false); retry++)
+    {
+        if(HAL_FLASHEx_Erase(&EraseInitStruct, &sector_error) == HAL_OK)
+        {
+            result = true;
+        }
+        else
+        {
+            HAL_Delay(100);
+        }
+    }
+    
+    HAL_FLASH_Lock();
+    
+    return result;
+}
+
@@ -0,0 +1,164 @@
+/*
+***************************************************************************************************
+*                               Runtime Metrics Registry
+*
+* File   : metrics.c
+* Author : Douglas Xie
+* Date   : 2018.03.27
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*/
+
+/* Include Head Files ---------------------------------------------------------------------------*/
+#include "stm32f4xx_hal.h"
+#include "cmsis_os.h"
+#include "string.h"
+
+#include "metrics.h"
+#include "boot.h"
+#include "msg_pool.h"
+#include "camera_task.h"
+
+/* Public variables -----------------------------------------------------------------------------*/
+uint32_t metrics_counter[METRIC_COUNTER_NUM];
+uint32_t metrics_gauge[METRIC_GAUGE_NUM];
+uint16_t metrics_hist[METRIC_HIST_NUM][METRICS_BUCKETS];
+
+/* Private function -----------------------------------------------------------------------------*/
+void Metrics_Sample(void);
+uint8_t *Metrics_Put32(uint8_t *p, uint32_t value);
+
+/* Public Function ------------------------------------------------------------------------------*/
+
+/*******************************************************************************
+* @Brief   Metrics Record Latency
+* @Param   hist[in]: histogram
+*          value_ms[in]: latency in ms
+* @Note    
+* @Return
+*******************************************************************************/
+void Metrics_Record(Metric_Hist_t hist, uint32_t value_ms)
+{
+    Metrics_HistAdd(metrics_hist[hist], value_ms);
+}
+
+/*******************************************************************************
+* @Brief   Metrics Histogram Add
+* @Param   hist[in]: METRICS_BUCKETS buckets, may be owned by other module
+*          value_ms[in]: latency in ms
+* @Note    one count leading zeros for the bucket, bucket saturates at 0xFFFF
+* @Return
+*******************************************************************************/
+void Metrics_HistAdd(uint16_t *hist, uint32_t value_ms)
+{
+    uint32_t bucket = 0;
+    
+    /* log2 bucket, 0~1ms, 2~3ms, 4~7ms ... */
+    if(value_ms > 1)
+    {
+        bucket = 31 - __CLZ(value_ms);
+        if(bucket > (METRICS_BUCKETS - 1))
+        {
+            bucket = METRICS_BUCKETS - 1;
+        }
+    }
+    
+    if(hist[bucket] < 0xFFFF)
+    {
+        hist[bucket]++;
+    }
+}
+
+/*******************************************************************************
+* @Brief   Metrics Snapshot
+* @Param   buffer[out]: snapshot, little endian
+*          size[in]: buffer size, METRICS_SNAPSHOT_SIZE
+* @Note    sampled gauges are refreshed first
+* @Return  bytes of snapshot, 0 if buffer is too small
+*******************************************************************************/
+uint16_t Metrics_Snapshot(uint8_t *buffer, uint16_t size)
+{
+    uint8_t *p = buffer;
+    uint8_t i = 0;
+    uint8_t j = 0;
+    
+    if(size < METRICS_SNAPSHOT_SIZE)
+    {
+        return 0;
+    }
+    
+    Metrics_Sample();
+    
+    *p++ = METRICS_VERSION;
+    p = Metrics_Put32(p, (xTaskGetTickCount() * portTICK_PERIOD_MS) / 1000);
+    
+    *p++ = METRIC_COUNTER_NUM;
+    for(i = 0; i < METRIC_COUNTER_NUM; i++)
+    {
+        p = Metrics_Put32(p, metrics_counter[i]);
+    }
+    
+    *p++ = METRIC_GAUGE_NUM;
+    for(i = 0; i < METRIC_GAUGE_NUM; i++)
+    {
+        p = Metrics_Put32(p, metrics_gauge[i]);
+    }
+    
+    *p++ = METRIC_HIST_NUM;
+    *p++ = METRICS_BUCKETS;
+    for(i = 0; i < METRIC_HIST_NUM; i++)
+    {
+        for(j = 0; j < METRICS_BUCKETS; j++)
+        {
+            *p++ = metrics_hist[i][j] & 0xFF;
+            *p++ = (metrics_hist[i][j] >> 8) & 0xFF;
+        }
+    }
+    
+    *p++ = BOOT_STAGE_NUM;
+    for(i = 0; i < BOOT_STAGE_NUM; i++)
+    {
+        p = Metrics_Put32(p, Boot_StageTime((Boot_Stage_t)i));
+    }
+    
+    return (uint16_t)(p - buffer);
+}
+
+/* Private Function -----------------------------------------------------------------------------*/
+
+/*******************************************************************************
+* @Brief   Metrics Sample Gauges
+* @Param
+* @Note    state kept by other modules is read here, not on their hot path
+* @Return
+*******************************************************************************/
+void Metrics_Sample(void)
+{
+    METRIC_SET(METRIC_HEAP_FREE, xPortGetFreeHeapSize());
+    METRIC_SET(METRIC_HEAP_MIN, xPortGetMinimumEverFreeHeapSize());
+    METRIC_SET(METRIC_POOL_SMALL_HIGH, msg_pool_small.high_water);
+    METRIC_SET(METRIC_POOL_MEDIUM_HIGH, msg_pool_medium.high_water);
+    METRIC_SET(METRIC_POOL_LARGE_HIGH, msg_pool_large.high_water);
+    METRIC_SET(METRIC_POOL_FAIL, msg_pool_small.fail + msg_pool_medium.fail + msg_pool_large.fail);
+    METRIC_SET(METRIC_LINK_RSSI, (int32_t)camera_adapt.rssi);
+    METRIC_SET(METRIC_LINK_GOODPUT, camera_adapt.goodput);
+    METRIC_SET(METRIC_IMAGE_PROFILE, camera_adapt.profile);
+}
+
+/*******************************************************************************
+* @Brief   Metrics Put Word
+* @Param   p[in]: write position
+*          value[in]: 32bit value
+* @Note    little endian
+* @Return  next write position
+*******************************************************************************/
+uint8_t *Metrics_Put32(uint8_t *p, uint32_t value)
+{
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+    p[2] = (value >> 16) & 0xFF;
+    p[3] = (value >> 24) & 0xFF;
+    
+    return p + 4;
+}
@@ -23,6 +23,7 @@
 #include "motor_task.h"
 #include "debug_task.h"
 #include "memory.h"
+#include "metrics.h"
 
 /* Macro Define ---------------------------------------------------------------------------------*/
 
@@ -98,6 +99,7 @@ void Motor_ControlTask(void * argument)
                 motor_group.motor5.step += app_config.schedule[schedule_index].feed_m5 * (app_config.motor_cfg.m_step[4] << 1);
 
                 schedule_index++;
+                METRIC_INC(METRIC_MOTOR_FEEDS);
             }
         }
 
@@ -0,0 +1,188 @@
+/*
+***************************************************************************************************
+*                               Message Payload Block Pool
+*
+* File   : msg_pool.c
+* Author : Douglas Xie
+* Date   : 2018.03.25
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*/
+
+/* Include Head Files ---------------------------------------------------------------------------*/
+#include "stdint.h"
+#include "stdbool.h"
+#include "string.h"
+
+#include "msg_pool.h"
+
+/* Public variables -----------------------------------------------------------------------------*/
+Pool_t msg_pool_small;
+Pool_t msg_pool_medium;
+Pool_t msg_pool_large;
+
+/* Private variables ----------------------------------------------------------------------------*/
+/* Message payload storage, out of kernel heap so heap only holds stacks and queues */
+uint32_t msg_pool_small_storage[(MSG_POOL_SMALL_SIZE * MSG_POOL_SMALL_NUM) / 4];
+uint32_t msg_pool_medium_storage[(MSG_POOL_MEDIUM_SIZE * MSG_POOL_MEDIUM_NUM) / 4];
+uint32_t msg_pool_large_storage[(MSG_POOL_LARGE_SIZE * MSG_POOL_LARGE_NUM) / 4];
+
+/* Public Function ------------------------------------------------------------------------------*/
+
+/*******************************************************************************
+* @Brief   Pool Initial
+* @Param   pool[in]: pool object
+*          storage[in]: block_size * block_num bytes, 4 bytes aligned
+*          block_size[in]: bytes of one block, multiple of 4
+*          block_num[in]: number of blocks
+* @Note
+* @Return
+*******************************************************************************/
+void Pool_Init(Pool_t *pool, void *storage, uint16_t block_size, uint16_t block_num)
+{
+    uint16_t i = 0;
+    uint8_t *block = (uint8_t *)storage;
+
+    pool->storage = (uint8_t *)storage;
+    pool->block_size = block_size;
+    pool->block_num = block_num;
+    pool->used = 0;
+    pool->high_water = 0;
+    pool->fail = 0;
+
+    /* chain all blocks, first block is head */
+    pool->free_list = NULL;
+    for(i = block_num; i > 0; i--)
+    {
+        block = &pool->storage[(uint32_t)(i - 1) * block_size];
+        *(void **)block = pool->free_list;
+        pool->free_list = block;
+    }
+}
+
+/*******************************************************************************
+* @Brief   Pool Allocate
+* @Param
+* @Note    O(1), callable from task and ISR
+* @Return  block, NULL if pool is empty
+*******************************************************************************/
+void *Pool_Alloc(Pool_t *pool)
+{
+    void *block = NULL;
+    uint32_t state = POOL_LOCK();
+
+    block = pool->free_list;
+    if(block != NULL)
+    {
+        pool->free_list = *(void **)block;
+        pool->used++;
+        if(pool->used > pool->high_water)
+        {
+            pool->high_water = pool->used;
+        }
+    }
+    else
+    {
+        pool->fail++;
+    }
+
+    POOL_UNLOCK(state);
+    return block;
+}
+
+/*******************************************************************************
+* @Brief   Pool Free
+* @Param   block[in]: block from Pool_Alloc of this pool
+* @Note    O(1), callable from task and ISR
+* @Return  false if block is not of this pool
+*******************************************************************************/
+bool Pool_Free(Pool_t *pool, void *block)
+{
+    uint32_t offset = 0;
+    uint32_t state = 0;
+
+    if(((uint8_t *)block < pool->storage) ||
+       ((uint8_t *)block >= (pool->storage + (uint32_t)pool->block_size * pool->block_num)))
+    {
+        return false;
+    }
+    offset = (uint32_t)((uint8_t *)block - pool->storage);
+    if((offset % pool->block_size) != 0)
+    {
+        return false;
+    }
+
+    state = POOL_LOCK();
+    *(void **)block = pool->free_list;
+    pool->free_list = block;
+    if(pool->used > 0)
+    {
+        pool->used--;
+    }
+    POOL_UNLOCK(state);
+
+    return true;
+}
+
+/*******************************************************************************
+* @Brief   Message Pool Initial
+* @Param
+* @Note    call once before tasks are created
+* @Return
+*******************************************************************************/
+void MsgPool_Init(void)
+{
+    Pool_Init(&msg_pool_small, msg_pool_small_storage, MSG_POOL_SMALL_SIZE, MSG_POOL_SMALL_NUM);
+    Pool_Init(&msg_pool_medium, msg_pool_medium_storage, MSG_POOL_MEDIUM_SIZE, MSG_POOL_MEDIUM_NUM);
+    Pool_Init(&msg_pool_large, msg_pool_large_storage, MSG_POOL_LARGE_SIZE, MSG_POOL_LARGE_NUM);
+}
+
+/*******************************************************************************
+* @Brief   Message Pool Allocate
+* @Param   length[in]: payload bytes
+* @Note    smallest block that fits, a respond does not fall back to large
+*          block so ota packet always finds one
+* @Return  block, NULL if length is 0, too large or pool is empty
+*******************************************************************************/
+uint8_t *MsgPool_Alloc(uint16_t length)
+{
+    if(length == 0)
+    {
+        return NULL;
+    }
+    if(length <= MSG_POOL_SMALL_SIZE)
+    {
+        return (uint8_t *)Pool_Alloc(&msg_pool_small);
+    }
+    if(length <= MSG_POOL_MEDIUM_SIZE)
+    {
+        return (uint8_t *)Pool_Alloc(&msg_pool_medium);
+    }
+    if(length <= MSG_POOL_LARGE_SIZE)
+    {
+        return (uint8_t *)Pool_Alloc(&msg_pool_large);
+    }
+
+    msg_pool_large.fail++;
+    return NULL;
+}
+
+/*******************************************************************************
+* @Brief   Message Pool Free
+* @Param   payload[in]: block from MsgPool_Alloc or NULL
+* @Note    replace vPortFree of message payload
+* @Return
+*******************************************************************************/
+void MsgPool_Free(void *payload)
+{
+    if(payload == NULL)
+    {
+        return;
+    }
+    if((Pool_Free(&msg_pool_small, payload) == false) &&
+       (Pool_Free(&msg_pool_medium, payload) == false))
+    {
+        Pool_Free(&msg_pool_large, payload);
+    }
+}
@@ -1008,6 +1008,34 @@ void OV2640_Reset(void)
 
 }
 
+/**
+* @brief  Reads the OV2640 product ID.
+* @param  None
+* @retval PIDH << 8 | PIDL, PIDH is OV2640_PIDH when sensor answers
+*/
+uint16_t OV2640_ReadID(void)
+{
+    uint16_t id;
+    
+    SCCB_WR_Reg(OV2640_DSP_RA_DLMT, 0x01);
+    id = SCCB_RD_Reg(OV2640_SENSOR_PIDH) << 8;
+    id |= SCCB_RD_Reg(OV2640_SENSOR_PIDL);
+    
+    return id;
+}
+
+
+/**
+* @brief  Configures the OV2640 JPEG quantization scale.
+* @param  Quality: Qs value, 0x0C is sensor default, larger is smaller file
+*         with lower quality. Call after OV2640_JPEGConfig.
+* @retval None
+*/
+void OV2640_QualityConfig(uint8_t Quality)
+{
+    SCCB_WR_Reg(OV2640_DSP_RA_DLMT, 0x00);
+    SCCB_WR_Reg(OV2640_DSP_Qs, Quality);
+}
 
 /**
 * @brief  Configures the OV2640 camera brightness.
@@ -0,0 +1,237 @@
+/*
+***************************************************************************************************
+*                               Byte Ring Buffer
+*
+* File   : ring_buffer.c
+* Author : Douglas Xie
+* Date   : 2018.03.05
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*/
+
+/* Include Head Files ---------------------------------------------------------------------------*/
+#include "stdint.h"
+#include "stdbool.h"
+#include "string.h"
+
+#include "ring_buffer.h"
+
+/* Public Function ------------------------------------------------------------------------------*/
+
+/*******************************************************************************
+* @Brief   Ring Buffer Initial
+* @Param   ring[in]: ring object
+*          buffer[in]: storage memory
+*          size[in]: storage size in bytes
+* @Note
+* @Return
+*******************************************************************************/
+void Ring_Init(Ring_Buffer_t *ring, uint8_t *buffer, uint16_t size)
+{
+    ring->buffer = buffer;
+    ring->size = size;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->dma_events = 0;
+}
+
+/*******************************************************************************
+* @Brief   Ring Buffer Reset
+* @Param
+* @Note    drop all data and move head and tail to start of storage
+* @Return
+*******************************************************************************/
+void Ring_Reset(Ring_Buffer_t *ring)
+{
+    ring->head = 0;
+    ring->tail = 0;
+    ring->dma_events = 0;
+}
+
+/*******************************************************************************
+* @Brief   Ring Buffer Write
+* @Param   data[in]: input data
+*          length[in]: input data length
+* @Note    software producer, data is truncated when ring is full
+* @Return  number of bytes written
+*******************************************************************************/
+uint16_t Ring_Write(Ring_Buffer_t *ring, const uint8_t *data, uint16_t length)
+{
+    uint16_t space = ring->size - 1 - Ring_Count(ring);
+    uint16_t head = ring->head;
+    uint16_t part = 0;
+
+    if(length > space)
+    {
+        length = space;
+    }
+
+    /* copy until end of storage, then wrap to start */
+    part = ring->size - head;
+    if(part > length)
+    {
+        part = length;
+    }
+    memcpy(&ring->buffer[head], data, part);
+    memcpy(&ring->buffer[0], &data[part], length - part);
+
+    head += length;
+    if(head >= ring->size)
+    {
+        head -= ring->size;
+    }
+    ring->head = head;
+
+    return length;
+}
+
+/*******************************************************************************
+* @Brief   Ring Buffer Set Head
+* @Param   head[in]: new write index
+* @Note    hardware producer, used when dma writes the storage directly
+* @Return
+*******************************************************************************/
+void Ring_SetHead(Ring_Buffer_t *ring, uint16_t head)
+{
+    if(head >= ring->size)
+    {
+        head = 0;
+    }
+    ring->head = head;
+}
+
+/*******************************************************************************
+* @Brief   Ring Buffer Set Dma Head
+* @Param   head[in]: dma write index
+*          events[in]: half and full transfer events since Ring_Reset
+* @Note    circular dma producer. A move of head crosses a known number of
+*          half ring boundaries, two more events mean dma went round the
+*          whole ring. An event counted before its head move is carried to
+*          next call
+* @Return  true when dma lapped the ring or passed tail, unread data is lost
+*******************************************************************************/
+bool Ring_SetHeadDma(Ring_Buffer_t *ring, uint16_t head, uint32_t events)
+{
+    uint16_t half = ring->size / 2;
+    uint16_t last = ring->head;
+    uint16_t count = Ring_Count(ring);
+    uint16_t move = 0;
+    uint16_t cross = 0;
+    int32_t pending = 0;
+    bool lapped = false;
+
+    if(head >= ring->size)
+    {
+        head = 0;
+    }
+
+    /* boundaries at half and end of storage passed from last head to head */
+    move = (head >= last) ? (head - last) : (ring->size - last + head);
+    cross = (uint16_t)((last + move) / half - last / half);
+
+    /* events not matched yet, negative while an interrupt is still pending */
+    pending = (int32_t)(events - ring->dma_events);
+    if((pending >= (int32_t)cross + 2) || ((uint32_t)count + move >= ring->size))
+    {
+        lapped = true;
+    }
+
+    /* each lap is two events, an odd one is for a move not seen yet */
+    if(pending >= (int32_t)cross + 2)
+    {
+        cross += (uint16_t)((pending - cross) & ~1);
+    }
+    ring->dma_events += cross;
+
+    ring->head = head;
+    return lapped;
+}
+
+/*******************************************************************************
+* @Brief   Ring Buffer Data Count
+* @Param
+* @Note
+* @Return  number of bytes can be read
+*******************************************************************************/
+uint16_t Ring_Count(const Ring_Buffer_t *ring)
+{
+    uint16_t head = ring->head;
+    uint16_t tail = ring->tail;
+
+    return (head >= tail) ? (head - tail) : (ring->size - tail + head);
+}
+
+/*******************************************************************************
+* @Brief   Ring Buffer Peek
+* @Param   data[out]: point to first unread byte
+* @Note    return the contiguous part only, call again after Ring_Skip()
+*          to get the wrapped part
+* @Return  number of contiguous bytes at *data
+*******************************************************************************/
+uint16_t Ring_Peek(const Ring_Buffer_t *ring, uint8_t **data)
+{
+    uint16_t head = ring->head;
+    uint16_t tail = ring->tail;
+
+    *data = &ring->buffer[tail];
+
+    return (head >= tail) ? (head - tail) : (ring->size - tail);
+}
+
+/*******************************************************************************
+* @Brief   Ring Buffer Skip
+* @Param   length[in]: bytes to drop
+* @Note
+* @Return
+*******************************************************************************/
+void Ring_Skip(Ring_Buffer_t *ring, uint16_t length)
+{
+    uint16_t tail = ring->tail;
+    uint16_t count = Ring_Count(ring);
+
+    if(length > count)
+    {
+        length = count;
+    }
+
+    tail += length;
+    if(tail >= ring->size)
+    {
+        tail -= ring->size;
+    }
+    ring->tail = tail;
+}
+
+/*******************************************************************************
+* @Brief   Ring Buffer Read
+* @Param   data[out]: output buffer
+*          length[in]: output buffer size
+* @Note
+* @Return  number of bytes read
+*******************************************************************************/
+uint16_t Ring_Read(Ring_Buffer_t *ring, uint8_t *data, uint16_t length)
+{
+    uint16_t total = 0;
+    uint16_t part = 0;
+    uint8_t *pdata;
+
+    /* at most two contiguous parts */
+    while(total < length)
+    {
+        part = Ring_Peek(ring, &pdata);
+        if(part == 0)
+        {
+            break;
+        }
+        if(part > (length - total))
+        {
+            part = length - total;
+        }
+        memcpy(&data[total], pdata, part);
+        Ring_Skip(ring, part);
+        total += part;
+    }
+
+    return total;
+}
@@ -0,0 +1,334 @@
+/*
+***************************************************************************************************
+*                               ESP8266 AT Response Tokenizer
+*
+* File   : wifi_parser.c
+* Author : Douglas Xie
+* Date   : 2018.03.12
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*/
+
+/* Include Head Files ---------------------------------------------------------------------------*/
+#include "stdint.h"
+#include "stdbool.h"
+#include "string.h"
+
+#include "wifi_parser.h"
+
+/* Macro defines --------------------------------------------------------------------------------*/
+/* Parser state */
+#define PARSER_STATE_LINE       0       /* collect response line */
+#define PARSER_STATE_DISCARD    1       /* line overflow, drop until new line */
+#define PARSER_STATE_IPD        2       /* +IPD payload */
+
+/* Keyword match flags */
+#define PARSER_KEY_EXACT        0x00    /* whole line is keyword */
+#define PARSER_KEY_PREFIX       0x01    /* line start with keyword */
+#define PARSER_KEY_LINK         0x02    /* "n," before keyword, n is link id */
+
+#define PARSER_KEY(str, flags, type)    { str, sizeof(str) - 1, flags, type }
+
+/* Data Type Define -----------------------------------------------------------------------------*/
+typedef struct
+{
+    const char          *keyword;
+    uint8_t             length;
+    uint8_t             flags;
+    Parser_EventType_t  type;
+} Parser_Keyword_t;
+
+/* Private variables ----------------------------------------------------------------------------*/
+/* Response keyword table, the most frequent first */
+const Parser_Keyword_t parser_keyword_table[] =
+{
+    PARSER_KEY("OK",                PARSER_KEY_EXACT,   PARSER_EVT_OK),
+    PARSER_KEY("SEND OK",           PARSER_KEY_EXACT,   PARSER_EVT_SEND_OK),
+    PARSER_KEY("Recv ",             PARSER_KEY_PREFIX,  PARSER_EVT_RECV),
+    PARSER_KEY("CONNECT",           PARSER_KEY_LINK,    PARSER_EVT_LINK_CONNECT),
+    PARSER_KEY("CLOSED",            PARSER_KEY_LINK,    PARSER_EVT_LINK_CLOSED),
+    PARSER_KEY("ERROR",             PARSER_KEY_EXACT,   PARSER_EVT_ERROR),
+    PARSER_KEY("SEND FAIL",         PARSER_KEY_EXACT,   PARSER_EVT_SEND_FAIL),
+    PARSER_KEY("FAIL",              PARSER_KEY_EXACT,   PARSER_EVT_FAIL),
+    PARSER_KEY("busy ",             PARSER_KEY_PREFIX,  PARSER_EVT_BUSY),
+    PARSER_KEY("CLOSED",            PARSER_KEY_EXACT,   PARSER_EVT_CLOSED),
+    PARSER_KEY("WIFI CONNECTED",    PARSER_KEY_EXACT,   PARSER_EVT_WIFI_CONNECTED),
+    PARSER_KEY("WIFI GOT IP",       PARSER_KEY_EXACT,   PARSER_EVT_WIFI_GOT_IP),
+    PARSER_KEY("WIFI DISCONNECT",   PARSER_KEY_EXACT,   PARSER_EVT_WIFI_DISCONNECT),
+    PARSER_KEY("ready",             PARSER_KEY_EXACT,   PARSER_EVT_READY),
+};
+
+#define PARSER_KEYWORD_NUM      (sizeof(parser_keyword_table) / sizeof(parser_keyword_table[0]))
+
+/* Private function -----------------------------------------------------------------------------*/
+void Parser_Emit(Parser_t *parser, Parser_EventType_t type, uint8_t link_id, const uint8_t *data, uint16_t length);
+void Parser_ClassifyLine(Parser_t *parser);
+bool Parser_IpdHead(Parser_t *parser);
+
+/* Public Function ------------------------------------------------------------------------------*/
+
+/*******************************************************************************
+* @Brief   Parser Initial
+* @Param   parser[in]: parser object
+*          callback[in]: event callback
+*          context[in]: user data for callback
+* @Note
+* @Return
+*******************************************************************************/
+void Parser_Init(Parser_t *parser, Parser_Callback_t callback, void *context)
+{
+    parser->callback = callback;
+    parser->context = context;
+    Parser_Reset(parser);
+}
+
+/*******************************************************************************
+* @Brief   Parser Reset
+* @Param
+* @Note    drop partial line and +IPD payload
+* @Return
+*******************************************************************************/
+void Parser_Reset(Parser_t *parser)
+{
+    parser->line_length = 0;
+    parser->ipd_remain = 0;
+    parser->ipd_link = PARSER_LINK_NONE;
+    parser->state = PARSER_STATE_LINE;
+}
+
+/*******************************************************************************
+* @Brief   Parser Input
+* @Param   data[in]: bytes from wifi module
+*          length[in]: data length
+* @Note    events are emitted by callback before return, +IPD payload is
+*          emitted as spans of input buffer without copy
+* @Return
+*******************************************************************************/
+void Parser_Input(Parser_t *parser, const uint8_t *data, uint16_t length)
+{
+    uint16_t i = 0;
+    uint16_t span = 0;
+    uint8_t  byte = 0;
+
+    while(i < length)
+    {
+        /* +IPD payload, pass through in one span */
+        if(parser->state == PARSER_STATE_IPD)
+        {
+            span = length - i;
+            if(span > parser->ipd_remain)
+            {
+                span = parser->ipd_remain;
+            }
+            Parser_Emit(parser, PARSER_EVT_IPD_DATA, parser->ipd_link, &data[i], span);
+            parser->ipd_remain -= span;
+            i += span;
+
+            if(parser->ipd_remain == 0)
+            {
+                Parser_Emit(parser, PARSER_EVT_IPD_DONE, parser->ipd_link, 0, 0);
+                parser->state = PARSER_STATE_LINE;
+            }
+            continue;
+        }
+
+        byte = data[i];
+        i++;
+
+        if(byte == '\n')
+        {
+            if(parser->state == PARSER_STATE_LINE)
+            {
+                Parser_ClassifyLine(parser);
+            }
+            parser->line_length = 0;
+            parser->state = PARSER_STATE_LINE;
+            continue;
+        }
+
+        if(parser->state == PARSER_STATE_DISCARD)
+        {
+            continue;
+        }
+
+        if(parser->line_length == 0)
+        {
+            /* send prompt "> " has no new line */
+            if(byte == '>')
+            {
+                Parser_Emit(parser, PARSER_EVT_SEND_READY, PARSER_LINK_NONE, 0, 0);
+                continue;
+            }
+            if((byte == ' ') || (byte == '\r'))
+            {
+                continue;
+            }
+        }
+
+        if(parser->line_length >= PARSER_LINE_SIZE)
+        {
+            Parser_Emit(parser, PARSER_EVT_OVERFLOW, PARSER_LINK_NONE, 0, 0);
+            parser->state = PARSER_STATE_DISCARD;
+            continue;
+        }
+        parser->line[parser->line_length] = byte;
+        parser->line_length++;
+
+        /* "+IPD,n,m:" header end, payload follows without new line */
+        if((byte == ':') && (Parser_IpdHead(parser) == true))
+        {
+            parser->line_length = 0;
+        }
+    }
+}
+
+/* Private Function -----------------------------------------------------------------------------*/
+
+/*******************************************************************************
+* @Brief   Parser Emit Event
+* @Param
+* @Note
+* @Return
+*******************************************************************************/
+void Parser_Emit(Parser_t *parser, Parser_EventType_t type, uint8_t link_id, const uint8_t *data, uint16_t length)
+{
+    Parser_Event_t event;
+
+    if(parser->callback != 0)
+    {
+        event.type = type;
+        event.link_id = link_id;
+        event.data = data;
+        event.length = length;
+        parser->callback(&event, parser->context);
+    }
+}
+
+/*******************************************************************************
+* @Brief   Parser Classify Line
+* @Param
+* @Note    match line with keyword table, unknown line is emitted as text
+* @Return
+*******************************************************************************/
+void Parser_ClassifyLine(Parser_t *parser)
+{
+    uint16_t i = 0;
+    uint16_t length = parser->line_length;
+    const uint8_t *text = parser->line;
+    const uint8_t *body = 0;
+    uint16_t body_length = 0;
+    uint8_t link_id = PARSER_LINK_NONE;
+    const Parser_Keyword_t *key;
+
+    /* strip \r at line end */
+    while((length > 0) && (text[length - 1] == '\r'))
+    {
+        length--;
+    }
+    if(length == 0)
+    {
+        return;
+    }
+
+    for(i = 0; i < PARSER_KEYWORD_NUM; i++)
+    {
+        key = &parser_keyword_table[i];
+        body = text;
+        body_length = length;
+        link_id = PARSER_LINK_NONE;
+
+        if(key->flags & PARSER_KEY_LINK)
+        {
+            if((length < 2) || (text[0] < '0') || (text[0] > '9') || (text[1] != ','))
+            {
+                continue;
+            }
+            link_id = text[0] - '0';
+            body = &text[2];
+            body_length = length - 2;
+        }
+
+        if(key->flags & PARSER_KEY_PREFIX)
+        {
+            if(body_length < key->length)
+            {
+                continue;
+            }
+        }
+        else if(body_length != key->length)
+        {
+            continue;
+        }
+
+        if(memcmp(body, key->keyword, key->length) == 0)
+        {
+            Parser_Emit(parser, key->type, link_id, text, length);
+            return;
+        }
+    }
+
+    Parser_Emit(parser, PARSER_EVT_LINE, PARSER_LINK_NONE, text, length);
+}
+
+/*******************************************************************************
+* @Brief   Parser +IPD Header
+* @Param
+* @Note    "+IPD,m:" in single link mode or "+IPD,n,m:" in multi link mode
+* @Return  true if line is +IPD header
+*******************************************************************************/
+bool Parser_IpdHead(Parser_t *parser)
+{
+    uint16_t i = 0;
+    uint16_t field = 0;
+    uint32_t value[2] = {0, 0};
+
+    if((parser->line_length < 7) || (memcmp(parser->line, "+IPD,", 5) != 0))
+    {
+        return false;
+    }
+
+    /* parse 1 or 2 number fields between "+IPD," and ':' */
+    for(i = 5; i < (parser->line_length - 1); i++)
+    {
+        if(parser->line[i] == ',')
+        {
+            field++;
+            if(field > 1)
+            {
+                break;
+            }
+        }
+        else if((parser->line[i] >= '0') && (parser->line[i] <= '9'))
+        {
+            value[field] = value[field] * 10 + (parser->line[i] - '0');
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    if(field == 0)
+    {
+        parser->ipd_link = PARSER_LINK_NONE;
+        parser->ipd_remain = (uint16_t)value[0];
+    }
+    else
+    {
+        parser->ipd_link = (uint8_t)value[0];
+        parser->ipd_remain = (uint16_t)value[1];
+    }
+
+    Parser_Emit(parser, PARSER_EVT_IPD_HEAD, parser->ipd_link, 0, parser->ipd_remain);
+    if(parser->ipd_remain > 0)
+    {
+        parser->state = PARSER_STATE_IPD;
+    }
+    else
+    {
+        Parser_Emit(parser, PARSER_EVT_IPD_DONE, parser->ipd_link, 0, 0);
+    }
+
+    return true;
+}
@@ -0,0 +1,297 @@
+/*
+***************************************************************************************************
+*                               Client Message Frame Reassembly
+*
+* File   : wifi_reasm.c
+* Author : Douglas Xie
+* Date   : 2018.03.20
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*/
+
+/* Include Head Files ---------------------------------------------------------------------------*/
+#include "stdint.h"
+#include "stdbool.h"
+#include "string.h"
+
+#include "wifi_reasm.h"
+#include "crc32.h"
+
+/* Private function -----------------------------------------------------------------------------*/
+void Reasm_Byte(Reasm_t *reasm, uint8_t byte);
+void Reasm_Check(Reasm_t *reasm, uint8_t byte);
+void Reasm_Broken(Reasm_t *reasm, uint8_t byte);
+
+/* Public Function ------------------------------------------------------------------------------*/
+
+/*******************************************************************************
+* @Brief   Reassembly Initial
+* @Param   reasm[in]: reassembly object
+*          buffer[in]: payload storage, frame with larger payload is dropped
+*          size[in]: storage size in bytes
+*          callback[in]: complete frame callback
+*          context[in]: user data for callback
+* @Note
+* @Return
+*******************************************************************************/
+void Reasm_Init(Reasm_t *reasm, uint8_t *buffer, uint16_t size, Reasm_Callback_t callback, void *context)
+{
+    reasm->buffer = buffer;
+    reasm->size = size;
+    reasm->dropped = 0;
+    reasm->callback = callback;
+    reasm->context = context;
+    reasm->version = REASM_VERSION_1;
+    Reasm_Reset(reasm);
+}
+
+/*******************************************************************************
+* @Brief   Reassembly Reset
+* @Param
+* @Note    drop partial frame, call when link is connected or closed
+* @Return
+*******************************************************************************/
+void Reasm_Reset(Reasm_t *reasm)
+{
+    reasm->state = REASM_STATE_START;
+    reasm->count = 0;
+    reasm->held = 0;
+    reasm->taken = 0;
+}
+
+/*******************************************************************************
+* @Brief   Reassembly Set Version
+* @Param   version[in]: REASM_VERSION_x
+* @Note    next frame is checked by checksum8 or crc32, partial frame is dropped
+* @Return
+*******************************************************************************/
+void Reasm_SetVersion(Reasm_t *reasm, uint8_t version)
+{
+    reasm->version = (version == REASM_VERSION_2) ? REASM_VERSION_2 : REASM_VERSION_1;
+    Reasm_Reset(reasm);
+}
+
+/*******************************************************************************
+* @Brief   Reassembly Input
+* @Param   data[in]: one segment of link data, any size
+*          length[in]: data length
+* @Note    zero or more validated frames are emitted by callback before
+*          return. Payload of a frame complete in this segment is not copied,
+*          only a frame that spans segments is kept in buffer
+* @Return  false if any byte is dropped
+*******************************************************************************/
+bool Reasm_Input(Reasm_t *reasm, const uint8_t *data, uint16_t length)
+{
+    uint32_t dropped = reasm->dropped;
+    uint16_t i = 0;
+    uint16_t j = 0;
+    uint16_t part = 0;
+    uint16_t tail = (reasm->version == REASM_VERSION_2) ? REASM_CRC_LEN : 1;
+
+    while(i < length)
+    {
+        if(reasm->state != REASM_STATE_PAYLOAD)
+        {
+            Reasm_Byte(reasm, data[i]);
+            i++;
+            continue;
+        }
+
+        /* payload is taken in one step */
+        part = reasm->frame.length - reasm->held;
+        if(part > (length - i))
+        {
+            part = length - i;
+        }
+
+        if((reasm->held == 0) && ((length - i) >= (reasm->frame.length + tail + REASM_CODE_LEN)))
+        {
+            /* rest of frame is in this segment, point to it */
+            reasm->frame.payload = &data[i];
+        }
+        else
+        {
+            memcpy(&reasm->buffer[reasm->held], &data[i], part);
+            reasm->frame.payload = reasm->buffer;
+        }
+
+        if(reasm->version == REASM_VERSION_1)
+        {
+            for(j = 0; j < part; j++)
+            {
+                reasm->sum += data[i + j];
+            }
+        }
+        reasm->held += part;
+        reasm->taken += part;
+        i += part;
+
+        if(reasm->held >= reasm->frame.length)
+        {
+            reasm->count = 0;
+            reasm->frame.checksum = 0;
+            reasm->state = REASM_STATE_CHECKSUM;
+        }
+    }
+
+    return (reasm->dropped == dropped);
+}
+
+/* Private Function -----------------------------------------------------------------------------*/
+
+/*******************************************************************************
+* @Brief   Reassembly Input Byte
+* @Param   byte[in]: next byte out of payload
+* @Note    length is checked against buffer before payload, so a broken
+*          length never reads or writes out of bounds
+* @Return
+*******************************************************************************/
+void Reasm_Byte(Reasm_t *reasm, uint8_t byte)
+{
+    switch(reasm->state)
+    {
+    case REASM_STATE_START:
+        if(byte == REASM_START_CODE)
+        {
+            if(reasm->count < REASM_CODE_LEN)
+            {
+                reasm->count++;
+            }
+            else
+            {
+                /* longer run, the first one is garbage */
+                reasm->dropped++;
+            }
+        }
+        else if(reasm->count >= REASM_CODE_LEN)
+        {
+            reasm->head[0] = byte;
+            reasm->sum = byte;
+            reasm->count = 1;
+            reasm->taken = REASM_CODE_LEN + 1;
+            reasm->state = REASM_STATE_HEAD;
+        }
+        else
+        {
+            reasm->dropped += reasm->count + 1;
+            reasm->count = 0;
+        }
+        break;
+
+    case REASM_STATE_HEAD:
+        reasm->head[reasm->count++] = byte;
+        reasm->sum += byte;
+        reasm->taken++;
+        if(reasm->count < REASM_HEAD_LEN)
+        {
+            break;
+        }
+
+        reasm->frame.command = reasm->head[0];
+        reasm->frame.index = reasm->head[1] + (reasm->head[2] << 8);
+        reasm->frame.length = reasm->head[3] + (reasm->head[4] << 8);
+        reasm->frame.payload = NULL;
+        reasm->frame.checksum = 0;
+        reasm->held = 0;
+        if(reasm->frame.length > reasm->size)
+        {
+            /* broken length, never fits */
+            Reasm_Broken(reasm, byte);
+        }
+        else
+        {
+            reasm->count = 0;
+            reasm->state = (reasm->frame.length == 0) ? REASM_STATE_CHECKSUM : REASM_STATE_PAYLOAD;
+        }
+        break;
+
+    case REASM_STATE_CHECKSUM:
+        Reasm_Check(reasm, byte);
+        break;
+
+    case REASM_STATE_END:
+        if(byte != REASM_END_CODE)
+        {
+            /* start code was in data or frame is cut */
+            reasm->taken++;
+            Reasm_Broken(reasm, byte);
+            break;
+        }
+
+        reasm->taken++;
+        reasm->count++;
+        if(reasm->count >= REASM_CODE_LEN)
+        {
+            if(reasm->callback != 0)
+            {
+                reasm->callback(&reasm->frame, reasm->context);
+            }
+            Reasm_Reset(reasm);
+        }
+        break;
+
+    default:
+        Reasm_Reset(reasm);
+        break;
+    }
+}
+
+/*******************************************************************************
+* @Brief   Reassembly Check Byte
+* @Param   byte[in]: checksum8, or one byte of crc32 in little endian
+* @Note    crc32 is done over head and payload once all 4 bytes are in, the
+*          payload is still valid since zero copy needs the whole frame in
+*          one segment
+* @Return
+*******************************************************************************/
+void Reasm_Check(Reasm_t *reasm, uint8_t byte)
+{
+    uint32_t crc = 0;
+
+    reasm->taken++;
+    if(reasm->version == REASM_VERSION_1)
+    {
+        reasm->frame.checksum = byte;
+        if(byte != reasm->sum)
+        {
+            Reasm_Broken(reasm, byte);
+            return;
+        }
+    }
+    else
+    {
+        reasm->frame.checksum |= (uint32_t)byte << (reasm->count << 3);
+        reasm->count++;
+        if(reasm->count < REASM_CRC_LEN)
+        {
+            return;
+        }
+
+        crc = CRC32_Calculate(CRC32_INIT, reasm->head, REASM_HEAD_LEN);
+        crc = CRC32_Calculate(crc, reasm->frame.payload, reasm->frame.length);
+        if(crc != reasm->frame.checksum)
+        {
+            Reasm_Broken(reasm, byte);
+            return;
+        }
+    }
+
+    reasm->count = 0;
+    reasm->state = REASM_STATE_END;
+}
+
+/*******************************************************************************
+* @Brief   Reassembly Broken Frame
+* @Param   byte[in]: byte that breaks the frame
+* @Note    bytes before it are dropped, it is hunted again as start code since
+*          next frame may start right after a cut one. Bytes already passed
+*          are not scanned again, client resends on timeout
+* @Return
+*******************************************************************************/
+void Reasm_Broken(Reasm_t *reasm, uint8_t byte)
+{
+    reasm->dropped += reasm->taken - 1;
+    Reasm_Reset(reasm);
+    Reasm_Byte(reasm, byte);
+}
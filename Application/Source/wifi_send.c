@@ -0,0 +1,497 @@
+/*
+***************************************************************************************************
+*                               ESP8266 AT Send Window
+*
+* File   : wifi_send.c
+* Author : Douglas Xie
+* Date   : 2018.03.05
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*/
+
+/* Include Head Files ---------------------------------------------------------------------------*/
+#include "stdint.h"
+#include "stdbool.h"
+#include "string.h"
+
+#include "wifi_send.h"
+
+/* Private Function -----------------------------------------------------------------------------*/
+
+/*******************************************************************************
+* @Brief   Drain Send Window
+* @Param   outstanding[in/out]: chunks waiting for SEND OK
+* @Note
+* @Return  false if a chunk got no SEND OK
+*******************************************************************************/
+static bool Send_Drain(Send_t *send, uint8_t *outstanding)
+{
+    while(*outstanding > 0)
+    {
+        if(Send_WaitEvent(send, WIFI_RX_SEND_OK, outstanding) != WIFI_RX_SEND_OK)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*******************************************************************************
+* @Brief   Fan-out Next Link
+* @Param   next[in/out]: round robin start link
+*          outstanding[in]: chunks of all links waiting for SEND OK
+*          window[in]: max outstanding chunks
+* @Note    closed link is dropped from this frame, link with least send time
+*          goes first, round robin among equal ones
+* @Return  link can send next chunk, WIFI_LINK_NUM if none
+*******************************************************************************/
+static uint8_t Send_FanoutNext(Send_t *send, uint8_t *next, uint8_t outstanding, uint8_t window)
+{
+    uint8_t i = 0;
+    uint8_t link = 0;
+    uint8_t best = WIFI_LINK_NUM;
+    WiFi_FanoutLink_t *plink;
+
+    if(outstanding >= window)
+    {
+        return WIFI_LINK_NUM;
+    }
+
+    for(i = 0; i < WIFI_LINK_NUM; i++)
+    {
+        link = (*next + i) % WIFI_LINK_NUM;
+        plink = &send->link[link];
+
+        if((plink->state == WIFI_LINK_SENDING) && (send->hook->connected(link, send->context) == false))
+        {
+            plink->state = WIFI_LINK_FAIL;
+        }
+
+        if((plink->state == WIFI_LINK_SENDING) && (plink->inflight < WIFI_LINK_WINDOW) &&
+           ((best == WIFI_LINK_NUM) || (plink->busy_tick < send->link[best].busy_tick)))
+        {
+            best = link;
+        }
+    }
+
+    if(best < WIFI_LINK_NUM)
+    {
+        *next = (best + 1) % WIFI_LINK_NUM;
+    }
+    return best;
+}
+
+/*******************************************************************************
+* @Brief   Fan-out Credit SEND OK
+* @Param   count[in]: number of SEND OK received
+* @Note    module reports SEND OK in send order without link id
+* @Return
+*******************************************************************************/
+static void Send_FanoutCredit(Send_t *send, uint8_t count)
+{
+    WiFi_FanoutLink_t *plink;
+
+    while((count > 0) && (send->fifo_count > 0))
+    {
+        plink = &send->link[send->fifo[send->fifo_head]];
+        plink->inflight--;
+        plink->done_tick = send->hook->tick(send->context);
+        plink->busy_tick += plink->done_tick - send->fifo_tick[send->fifo_head];
+
+        send->fifo_head = (send->fifo_head + 1) % WIFI_SEND_WINDOW;
+        send->fifo_count--;
+        count--;
+    }
+}
+
+/*******************************************************************************
+* @Brief   Fan-out Drop Oldest Link
+* @Param   outstanding[in/out]: chunks waiting for SEND OK
+*          event[in]: SEND FAIL, error or WIFI_RX_NONE of timeout
+* @Note    called when the oldest chunk get SEND FAIL, error or timeout. On
+*          first timeout the chunk keeps its place, module still owes its
+*          result and a late one must not be credited to the next link
+* @Return
+*******************************************************************************/
+static void Send_FanoutFailHead(Send_t *send, uint8_t *outstanding, WiFi_RxState_t event)
+{
+    WiFi_FanoutLink_t *plink;
+
+    if(send->fifo_count > 0)
+    {
+        plink = &send->link[send->fifo[send->fifo_head]];
+        if((event == WIFI_RX_NONE) && (plink->state != WIFI_LINK_FAIL))
+        {
+            plink->state = WIFI_LINK_FAIL;
+            return;
+        }
+        plink->state = WIFI_LINK_FAIL;
+        Send_FanoutCredit(send, 1);
+        if(*outstanding > 0)
+        {
+            (*outstanding)--;
+        }
+    }
+}
+
+/*******************************************************************************
+* @Brief   Fan-out Wait Event
+* @Param   target[in]: expect event
+*          outstanding[in/out]: chunks waiting for SEND OK
+* @Note    SEND OK taken in the wait is credited to links in send order
+* @Return  same as Send_WaitEvent
+*******************************************************************************/
+static WiFi_RxState_t Send_FanoutWait(Send_t *send, WiFi_RxState_t target, uint8_t *outstanding)
+{
+    WiFi_RxState_t event = WIFI_RX_NONE;
+    uint8_t before = *outstanding;
+
+    event = Send_WaitEvent(send, target, outstanding);
+    Send_FanoutCredit(send, before - *outstanding);
+    return event;
+}
+
+/*******************************************************************************
+* @Brief   Fan-out Drain Window
+* @Param   outstanding[in/out]: chunks waiting for SEND OK
+* @Note    wait SEND OK of all chunks in flight, drop link on error
+* @Return
+*******************************************************************************/
+static void Send_FanoutDrain(Send_t *send, uint8_t *outstanding)
+{
+    WiFi_RxState_t event = WIFI_RX_NONE;
+
+    while(*outstanding > 0)
+    {
+        event = Send_FanoutWait(send, WIFI_RX_SEND_OK, outstanding);
+        if(event != WIFI_RX_SEND_OK)
+        {
+            Send_FanoutFailHead(send, outstanding, event);
+        }
+    }
+}
+
+/* Public Function ------------------------------------------------------------------------------*/
+
+/*******************************************************************************
+* @Brief   Send Window Initial
+* @Param   send[in]: send object
+*          hook[in]: module and task hooks
+*          context[in]: user data for hooks
+* @Note
+* @Return
+*******************************************************************************/
+void Send_Init(Send_t *send, const Send_Hook_t *hook, void *context)
+{
+    memset(send, 0, sizeof(Send_t));
+    send->hook = hook;
+    send->context = context;
+}
+
+/*******************************************************************************
+* @Brief   Wait Send Event
+* @Param   target[in]: expect event
+*          outstanding[in/out]: chunks waiting for SEND OK
+* @Note    SEND OK of pipelined chunks is counted on the way, OK and other
+*          data are skipped. Waiting for '>' goes on after SEND OK of an
+*          earlier chunk, it normally comes first
+* @Return  target, SEND_OK when waiting for RECV, or the error event,
+*          WIFI_RX_NONE when timeout
+*******************************************************************************/
+WiFi_RxState_t Send_WaitEvent(Send_t *send, WiFi_RxState_t target, uint8_t *outstanding)
+{
+    WiFi_RxState_t state = WIFI_RX_NONE;
+
+    while(send->hook->receive(&state, send->context) == true)
+    {
+        if(state == target)
+        {
+            if((target == WIFI_RX_SEND_OK) && (*outstanding > 0))
+            {
+                (*outstanding)--;
+            }
+            return target;
+        }
+
+        switch(state)
+        {
+        case WIFI_RX_SEND_OK:
+            if(*outstanding > 0)
+            {
+                (*outstanding)--;
+            }
+            /* module without "Recv n bytes" print, own chunk is done */
+            if((target == WIFI_RX_RECV) && (*outstanding == 0))
+            {
+                return WIFI_RX_SEND_OK;
+            }
+            break;
+
+        case WIFI_RX_SEND_FAIL:
+        case WIFI_RX_BUSY:
+        case WIFI_RX_ERROR:
+        case WIFI_RX_ATFB_ERROR:
+        case WIFI_RX_ATFB_FAIL:
+        case WIFI_RX_ATFB_CLOSED:
+        case WIFI_RX_CLOSED:
+            return state;
+
+        default:
+            break;
+        }
+    }
+
+    return WIFI_RX_NONE;
+}
+
+/*******************************************************************************
+* @Brief   Send Image to One Link
+* @Param   link[in]: link of AT+CIPSEND
+*          length[in]: image bytes
+*          chunk_size[in]: jpg bytes of one packet
+*          window[in]: max chunks in flight, WIFI_SEND_WINDOW
+* @Note    Sliding window upload: next AT+CIPSEND is sent once module prints
+*          "Recv n bytes" for the previous chunk, up to window chunks wait for
+*          SEND OK at the same time. When module is busy the window falls
+*          back to 1 (stop and wait) for the rest of image. Packets start
+*          from 1, waiting respond is sent between chunks
+* @Return  true when every chunk got SEND OK
+*******************************************************************************/
+bool Send_Image(Send_t *send, uint8_t link, uint32_t length, uint16_t chunk_size, uint8_t window)
+{
+    bool rtn_state = true;
+    const Send_Hook_t *hook = send->hook;
+    WiFi_RxState_t event = WIFI_RX_NONE;
+    uint32_t offset = 0;
+    uint32_t chunk_tick = 0;
+    uint16_t chunk = 0;
+    uint16_t packet = 1;
+    uint8_t outstanding = 0;
+
+    send->fallback = 0;
+    while((offset < length) && (rtn_state == true))
+    {
+        chunk = ((length - offset) >= chunk_size) ? chunk_size : (length - offset);
+        chunk_tick = hook->tick(send->context);
+
+        /* control respond has priority, drain window and insert it between chunks */
+        if(hook->pending(send->context) == true)
+        {
+            rtn_state = Send_Drain(send, &outstanding);
+            if(rtn_state == false)
+            {
+                break;
+            }
+            hook->preempt(send->context);
+            chunk_tick = hook->tick(send->context);
+        }
+
+        /* window is full, wait for the oldest SEND OK */
+        while((outstanding >= window) && (rtn_state == true))
+        {
+            rtn_state = (Send_WaitEvent(send, WIFI_RX_SEND_OK, &outstanding) == WIFI_RX_SEND_OK);
+        }
+        if(rtn_state == false)
+        {
+            break;
+        }
+
+        /* rx buffer can be flushed only when nothing is in flight */
+        hook->command(link, packet, chunk, (outstanding == 0), send->context);
+
+        event = Send_WaitEvent(send, WIFI_RX_SEND_READY, &outstanding);
+        if(event != WIFI_RX_SEND_READY)
+        {
+            if((window > 1) && ((event == WIFI_RX_BUSY) || (event == WIFI_RX_ATFB_ERROR) || (event == WIFI_RX_NONE)))
+            {
+                /* module can not overlap commands, drain and retry this chunk */
+                send->fallback++;
+                window = 1;
+                rtn_state = Send_Drain(send, &outstanding);
+                continue;
+            }
+            rtn_state = false;
+            break;
+        }
+
+        if(hook->data(link, packet, offset, chunk, send->context) == false)
+        {
+            rtn_state = false;
+            break;
+        }
+        outstanding++;
+
+        /* wait until module take all bytes of this chunk */
+        event = Send_WaitEvent(send, (window > 1) ? WIFI_RX_RECV : WIFI_RX_SEND_OK, &outstanding);
+        if((event != WIFI_RX_RECV) && (event != WIFI_RX_SEND_OK))
+        {
+            rtn_state = false;
+            break;
+        }
+        hook->accepted(chunk_tick, send->context);
+
+        packet++;
+        offset += chunk;
+    }
+
+    /* wait SEND OK of the last chunks */
+    if(rtn_state == true)
+    {
+        rtn_state = Send_Drain(send, &outstanding);
+    }
+
+    return rtn_state;
+}
+
+/*******************************************************************************
+* @Brief   Fan-out Image to Links
+* @Param   links[in]: bit n set subscribes link n
+*          length[in]: image bytes
+*          chunk_size[in]: jpg bytes of one packet
+* @Note    Chunks of one frame are interleaved across links, packet 0 of each
+*          link is file info. Each link has its own progress and at most
+*          WIFI_LINK_WINDOW chunks in flight, the link with least send time
+*          goes first so a slow link does not stall others, a link with error
+*          or timeout is dropped. Result of each link is in send->link
+* @Return  true if at least one link got the whole frame
+*******************************************************************************/
+bool Send_Fanout(Send_t *send, uint8_t links, uint32_t length, uint16_t chunk_size)
+{
+    bool rtn_state = false;
+    const Send_Hook_t *hook = send->hook;
+    WiFi_RxState_t event = WIFI_RX_NONE;
+    WiFi_FanoutLink_t *plink;
+    uint32_t chunk_tick = 0;
+    uint16_t chunk = 0;
+    uint8_t window = WIFI_SEND_WINDOW;
+    uint8_t busy_retry = 0;
+    uint8_t outstanding = 0;
+    uint8_t next = 0;
+    uint8_t link = 0;
+
+    /* subscribe links to this frame */
+    send->fallback = 0;
+    send->fifo_head = 0;
+    send->fifo_count = 0;
+    for(link = 0; link < WIFI_LINK_NUM; link++)
+    {
+        memset(&send->link[link], 0, sizeof(WiFi_FanoutLink_t));
+        if((links & (1 << link)) != 0)
+        {
+            send->link[link].state = WIFI_LINK_SENDING;
+            send->link[link].start_tick = hook->tick(send->context);
+        }
+    }
+
+    for(;;)
+    {
+        /* control respond has priority, drain window and insert it between chunks */
+        if(hook->pending(send->context) == true)
+        {
+            Send_FanoutDrain(send, &outstanding);
+            hook->preempt(send->context);
+        }
+
+        link = Send_FanoutNext(send, &next, outstanding, window);
+
+        /* no link can send now, wait for the oldest SEND OK */
+        if(link >= WIFI_LINK_NUM)
+        {
+            if(outstanding == 0)
+            {
+                break;
+            }
+            event = Send_FanoutWait(send, WIFI_RX_SEND_OK, &outstanding);
+            if(event != WIFI_RX_SEND_OK)
+            {
+                /* the oldest link is slow or closed, drop it so others go on */
+                Send_FanoutFailHead(send, &outstanding, event);
+            }
+            continue;
+        }
+        plink = &send->link[link];
+
+        /* packet 0 is file info, then jpg data */
+        chunk = 0;
+        if(plink->packet_id != 0)
+        {
+            chunk = ((length - plink->offset) >= chunk_size) ? chunk_size : (length - plink->offset);
+        }
+        chunk_tick = hook->tick(send->context);
+        hook->command(link, plink->packet_id, chunk, (outstanding == 0), send->context);
+
+        /* SEND OK of an earlier chunk is counted in the wait and credited to its link,
+         * SEND FAIL fails the oldest link, not this one, and the wait for '>' goes on */
+        do
+        {
+            event = Send_FanoutWait(send, WIFI_RX_SEND_READY, &outstanding);
+            if(event == WIFI_RX_SEND_FAIL)
+            {
+                Send_FanoutFailHead(send, &outstanding, event);
+            }
+        } while(event == WIFI_RX_SEND_FAIL);
+        if(event != WIFI_RX_SEND_READY)
+        {
+            if((outstanding > 0) && (window > 1) && ((event == WIFI_RX_BUSY) || (event == WIFI_RX_ATFB_ERROR) || (event == WIFI_RX_NONE)))
+            {
+                /* module can not overlap commands, drain and retry this chunk */
+                send->fallback++;
+                window = 1;
+                Send_FanoutDrain(send, &outstanding);
+            }
+            else if((event == WIFI_RX_BUSY) && (outstanding == 0) && (busy_retry < WIFI_LINK_BUSY_REPEAT))
+            {
+                /* module still sends a chunk given up by timeout, wait its result and retry */
+                busy_retry++;
+                Send_WaitEvent(send, WIFI_RX_SEND_OK, &outstanding);
+            }
+            else
+            {
+                /* link is not valid */
+                plink->state = WIFI_LINK_FAIL;
+            }
+            continue;
+        }
+        busy_retry = 0;
+
+        if(hook->data(link, plink->packet_id, plink->offset, chunk, send->context) == false)
+        {
+            plink->state = WIFI_LINK_FAIL;
+            continue;
+        }
+        plink->offset += chunk;
+
+        /* chunk is in flight, SEND OK is credited to links in send order */
+        send->fifo[(send->fifo_head + send->fifo_count) % WIFI_SEND_WINDOW] = link;
+        send->fifo_tick[(send->fifo_head + send->fifo_count) % WIFI_SEND_WINDOW] = hook->tick(send->context);
+        send->fifo_count++;
+        outstanding++;
+        plink->inflight++;
+        plink->packet_id++;
+        if(plink->offset >= length)
+        {
+            plink->state = WIFI_LINK_SENT;
+        }
+
+        /* wait until module take all bytes of this chunk */
+        event = Send_FanoutWait(send, (window > 1) ? WIFI_RX_RECV : WIFI_RX_SEND_OK, &outstanding);
+        if((event != WIFI_RX_RECV) && (event != WIFI_RX_SEND_OK))
+        {
+            Send_FanoutFailHead(send, &outstanding, event);
+        }
+        else
+        {
+            hook->accepted(chunk_tick, send->context);
+        }
+    }
+
+    for(link = 0; link < WIFI_LINK_NUM; link++)
+    {
+        if(send->link[link].state == WIFI_LINK_SENT)
+        {
+            rtn_state = true;
+        }
+    }
+    return rtn_state;
+}
@@ -25,6 +25,15 @@
 #include "display_task.h"
 #include "camera_task.h"
 #include "debug_task.h"
+#include "ring_buffer.h"
+#include "wifi_parser.h"
+#include "wifi_reasm.h"
+#include "wifi_txchain.h"
+#include "ov7670.h"
+#include "boot.h"
+#include "msg_pool.h"
+#include "crc32.h"
+#include "metrics.h"
 
 /* Private variables ----------------------------------------------------------------------------*/
 extern UART_HandleTypeDef huart1;
@@ -33,33 +42,51 @@ extern QueueHandle_t respond_queue;
 
 /* WiFi output buffer */
 uint8_t tx_buffer[WIFI_TX_BUF_SIZE];
-bool wifi_uart_tx_done = false;
 
-/* WiFi input buffer */
-uint8_t  rx_buffer[WIFI_RX_BUF_SIZE];
-uint16_t rx_index = 0;
-uint16_t line_start = 0;
+/* Transmit chain, next buffer is started from tx complete interrupt */
+TxChain_t wifi_tx_chain;
+TaskHandle_t tx_chain_task = NULL;
 
-/* Client input data buffer */
-uint8_t  client_data[WIFI_DATA_BUF_SIZE];
-uint16_t client_data_index = 0;
-uint16_t client_data_size = 0;
+/* AT send window of image upload and AP mode fan-out, events come from receive queue */
+Send_t wifi_send;
+
+/* Control task handle, target of WiFi_Notify() */
+TaskHandle_t wifi_ctrl_task = NULL;
+
+/* WiFi response tokenizer, run in receive task */
+Parser_t wifi_parser;
+
+/* WiFi uart circular dma buffer */
+uint8_t  rx_ring_buffer[WIFI_RX_RING_SIZE];
+Ring_Buffer_t wifi_rx_ring;
+TaskHandle_t  wifi_rx_task = NULL;
+SemaphoreHandle_t wifi_rx_mutex = NULL;
+volatile bool wifi_rx_error = false;
+volatile uint32_t wifi_rx_dma_events = 0;   /* half/full transfer interrupts since dma start */
+
+/* Client input data, frames are decoded from +IPD segments as they come,
+ * link buffer only keeps payload of a frame that spans segments */
+uint8_t  client_data[WIFI_LINK_NUM][MSG_MAX_RX_PAYLOAD];
+Reasm_t  client_reasm[WIFI_LINK_NUM];
 uint8_t  client_id_active = 0xFF;
-bool push_event = false;
+
+/* Protocol version of each link, switch is applied after its respond is sent */
+uint8_t  client_version[WIFI_LINK_NUM];
+uint8_t  client_version_next[WIFI_LINK_NUM];
 
 /* WiFi mac and ip address */
 uint8_t wifi_mac_string[18];    /* string format: AA:BB:CC:DD:EE:FF\0 */
 uint8_t wifi_ip_string[16];     /* string format: 192.168.100.123\0 */
 
 /* Client management */
-uint8_t client_list[5] = {0,0,0,0,0};
+uint8_t client_list[WIFI_LINK_NUM] = {0,0,0,0,0};
 
 /* WiFi state variable */
-WiFi_RxState_t wifi_rx_state     = WIFI_RX_NONE;
 WiFi_CtrlState_t wifi_ctrl_state = WIFI_CTRL_ECHO;
 
-/* WiFi queue */
+/* WiFi queue, command reply and unsolicited event are queued separately */
 QueueHandle_t receive_queue;
+QueueHandle_t wifi_event_queue;
 QueueHandle_t wifi_tx_queue;
 
 /* WiFi debug message */
@@ -67,17 +94,48 @@ DBG_MsgBuf_t wifi_message;
 
 int8_t start_code[5] = {123,123,123,123,123};   /* 0x7B */
 int8_t end_code[5] = {-88,-88,-88,-88,-88};     /* 0xA8*/
-uint8_t packet_buf[WIFI_PACKET_SIZE+13];
 uint8_t packet_id = 0;
+uint16_t wifi_chunk_size = WIFI_CHUNK_DEFAULT;  /* image payload of one packet */
 bool tcp_client_connected = false;
 
+/* WiFi uart baudrate candidates, ascending order */
+const uint32_t wifi_baudrate_list[WIFI_BAUDRATE_NUM] = {WIFI_BAUDRATE_RUNNING, 1500000UL, 2000000UL, WIFI_BAUDRATE_MAX};
+#ifdef WIFI_FLOW_CONTROL
+bool wifi_flow_ctrl = true;
+#else
+bool wifi_flow_ctrl = false;
+#endif
+bool wifi_passthrough = false;      /* station mode transparent transmission */
+
+/* Station fast join info of current connection, saved to config when changed */
+JoinCfg_t wifi_join;
+int8_t wifi_rssi = ADAPT_RSSI_UNKNOWN;     /* dBm of connected AP from AT+CWJAP? */
+
+/* AP mode live preview. Client task writes preview_next and control task copies
+ * it to preview_viewer, both in critical section. Link state is control task only */
+WiFi_Preview_t preview_viewer;                  /* viewer in use */
+WiFi_Preview_t preview_next;                    /* last request of client task */
+volatile bool  preview_request = false;         /* viewer changed, link to be opened or closed */
+bool     preview_link = false;          /* UDP link is open */
+uint16_t preview_frame_id = 0;
+
+/* Range of last photo asked by client */
+WiFi_Range_t wifi_range;
+uint8_t  preview_head[WIFI_PREVIEW_HEAD_SIZE];
+
+/* Link recovery, tier tried last and time of each tier from fault to idle */
+WiFi_Recover_t wifi_recover_tier = WIFI_RECOVER_NONE;
+TickType_t wifi_recover_tick = 0;
+bool wifi_recover_reset = false;        /* module was reset in this recovery */
+uint32_t wifi_recover_ms[WIFI_RECOVER_TIER_NUM];
+
 /* Function declaration -------------------------------------------------------------------------*/
 /* Control task branch handler */
 bool WiFi_Ctrl_Echo(void);
 bool WiFi_Ctrl_SetupUART(void);
 bool WiFi_Ctrl_GetMac(void);
 
-bool WiFi_Ctrl_SetupAP(void);
+bool WiFi_Ctrl_SetupAP(bool reset);
 bool WiFi_Ctrl_StartTcpServer(void);
 
 bool WiFi_Ctrl_SetupStation(void);
@@ -85,19 +143,89 @@ bool WiFi_Ctrl_ConnectAP(void);
 bool WiFi_Ctrl_GetIP(void);
 bool WiFi_Ctrl_StartTcpClient(void);
 bool WiFi_Ctrl_CloseTcpClient(void);
+bool WiFi_Ctrl_SaveJoinInfo(void);
+bool WiFi_Ctrl_SampleRssi(void);
+WiFi_CtrlState_t WiFi_Ctrl_Recover(WiFi_Recover_t tier);
+void WiFi_RecoverDone(void);
+bool WiFi_Ctrl_EnterPassthrough(void);
+bool WiFi_Ctrl_ExitPassthrough(void);
 
 bool WiFi_Ctrl_ClientManage(void);
-bool WiFi_Ctrl_ReceRequest(void);
 bool WiFi_Ctrl_SendImageFileInfo(void);
 bool WiFi_Ctrl_SendImage(void);
 bool WiFi_Ctrl_SendRespond(void);
+bool WiFi_Ctrl_PreviewLink(void);
+bool WiFi_Ctrl_SendPreview(void);
+bool WiFi_Ctrl_SendRange(void);
+WiFi_RxState_t WiFi_WaitSendEvent(WiFi_RxState_t target, uint8_t *outstanding);
+bool WiFi_SendImagePacket(uint8_t link, uint8_t *data, uint16_t length);
+uint16_t WiFi_PackImageFileInfo(uint8_t link, uint32_t data_length, uint8_t *pfilename);
+uint16_t WiFi_FrameSize(uint8_t link, uint16_t length);
+uint8_t WiFi_PackFrameTail(uint8_t link, const uint8_t *head, uint8_t head_length, const uint8_t *data, uint16_t length, uint8_t *tail);
+void WiFi_LinkProtocolReset(uint8_t link);
+bool WiFi_Ctrl_FanoutImage(void);
+bool WiFi_PreemptRespond(void);
+void WiFi_TxLatencyRecord(WiFi_TxClass_t tx_class, TickType_t start_tick);
+void WiFi_TxLatencyReport(void);
+bool WiFi_SendHookReceive(WiFi_RxState_t *state, void *context);
+void WiFi_SendHookCommand(uint8_t link, uint16_t packet, uint16_t length, bool flush, void *context);
+bool WiFi_SendHookData(uint8_t link, uint16_t packet, uint32_t offset, uint16_t length, void *context);
+bool WiFi_SendHookPending(void *context);
+void WiFi_SendHookPreempt(void *context);
+uint32_t WiFi_SendHookTick(void *context);
+void WiFi_SendHookAccepted(uint32_t tick, void *context);
+bool WiFi_SendHookConnected(uint8_t link, void *context);
+void WiFi_ChunkReport(uint32_t image_length, uint16_t chunk_size);
+#ifdef EN_DEBUG
+void WiFi_FrameCheckBench(void);
+#endif
 WiFi_CtrlState_t WiFi_Ctrl_Idle(void);
 
 /* UART function */
-void WiFi_SetUartBaudrate(uint32_t baudrate);
+void WiFi_SetUartBaudrate(uint32_t baudrate, bool flow_ctrl);
+bool WiFi_ProbeBaudrate(uint32_t baudrate);
+bool WiFi_SetModuleBaudrate(uint32_t baudrate, bool save);
 bool WiFi_SendCommand(uint8_t *cmd);
 bool WiFi_SendData(uint8_t *data, uint16_t length);
+bool WiFi_SendChain(WiFi_TxDesc_t *chain, uint8_t count);
+bool WiFi_TxChainStart(const uint8_t *data, uint16_t length, void *context);
+void WiFi_TxChainAbort(void *context);
+bool WiFi_TxChainWait(uint32_t clear_entry, uint32_t clear_exit, uint32_t *value, uint32_t timeout, void *context);
+void WiFi_TxChainNotify(uint32_t bits, void *context);
 void WiFi_ResetRxBuffer(void);
+void WiFi_FlushReply(void);
+void WiFi_StartReceive(void);
+void WiFi_ReceiveTask(void * argument);
+void WiFi_RxParserEvent(const Parser_Event_t *event, void *context);
+void WiFi_RxPostEvent(WiFi_Receive_t *receive);
+void WiFi_RxRequest(uint8_t client_id, const Reasm_Frame_t *frame);
+void WiFi_RxFrame(const Reasm_Frame_t *frame, void *context);
+void WiFi_RxLinkData(uint8_t link, const uint8_t *data, uint16_t length);
+bool WiFi_ParseIp(const uint8_t *text, uint16_t length, uint8_t *ip);
+bool WiFi_ParseJoin(const uint8_t *text, uint16_t length);
+bool WiFi_WaitReady(TickType_t timeout);
+
+/* Uart dma and task notify of the transmit chain */
+const TxChain_Hook_t wifi_tx_hook =
+{
+    WiFi_TxChainStart,
+    WiFi_TxChainAbort,
+    WiFi_TxChainWait,
+    WiFi_TxChainNotify,
+};
+
+/* Receive queue, AT+CIPSEND and image frames of the send window */
+const Send_Hook_t wifi_send_hook =
+{
+    WiFi_SendHookReceive,
+    WiFi_SendHookCommand,
+    WiFi_SendHookData,
+    WiFi_SendHookPending,
+    WiFi_SendHookPreempt,
+    WiFi_SendHookTick,
+    WiFi_SendHookAccepted,
+    WiFi_SendHookConnected,
+};
 
 /* Task Function implement ----------------------------------------------------------------------*/
 
@@ -110,7 +238,9 @@ void WiFi_ResetRxBuffer(void);
 void WiFi_ControlTask(void * argument)
 {
     uint8_t error_counter = 0;
-    uint16_t idle_counter = 0;
+    uint8_t join_counter = 0;
+    
+    wifi_ctrl_task = xTaskGetCurrentTaskHandle();
     
     for(int i = 0; i < MSG_RECOGNIZE_CODE_LEN; i++)
     {
@@ -118,19 +248,56 @@ void WiFi_ControlTask(void * argument)
         tx_buffer[WIFI_TX_BUF_SIZE-1-i] = MSG_END_CODE;
     }
     
-    /* Power on delay for WiFi module initial */
-    vTaskDelay(WIFI_RESET_DELAY);
-    
     /* Create wifi queue and register queue for debug */
     if( receive_queue == NULL )
     {
         receive_queue = xQueueCreate(WIFI_QUEUE_LENGTH, WIFI_QUEUE_ITEM_SIZE);
         vQueueAddToRegistry( receive_queue, "WiFi Queue" );
     }
+    if( wifi_event_queue == NULL )
+    {
+        wifi_event_queue = xQueueCreate(WIFI_EVENT_QUEUE_LENGTH, WIFI_QUEUE_ITEM_SIZE);
+        vQueueAddToRegistry( wifi_event_queue, "WiFi Event Queue" );
+    }
     
-    WiFi_ResetRxBuffer();
+    /* Start uart circular dma receive and the parser task */
+    wifi_rx_mutex = xSemaphoreCreateMutex();
+    Ring_Init(&wifi_rx_ring, rx_ring_buffer, WIFI_RX_RING_SIZE);
+    Parser_Init(&wifi_parser, WiFi_RxParserEvent, (void *) 0);
+    TxChain_Init(&wifi_tx_chain, &wifi_tx_hook, (void *) 0, WIFI_NOTIFY_TX_DONE, WIFI_TX_TIMEOUT);
+    Send_Init(&wifi_send, &wifi_send_hook, (void *) 0);
+    for(int i = 0; i < WIFI_LINK_NUM; i++)
+    {
+        Reasm_Init(&client_reasm[i], client_data[i], MSG_MAX_RX_PAYLOAD, WiFi_RxFrame, &client_reasm[i]);
+        client_version[i] = MSG_PROTOCOL_V1;
+        client_version_next[i] = 0;
+    }
+    WiFi_StartReceive();
+    xTaskCreate( WiFi_ReceiveTask,
+                "WiFi Rx", 
+                CFG_STACK_WIFI_RX,
+                (void *) 0,
+                CFG_PRIORITY_WIFI_RX,
+                &wifi_rx_task);
+    
+    /* Start with negotiated rate of last boot */
+    if(app_config.wifi_baudrate != 0)
+    {
+        WiFi_SetUartBaudrate(app_config.wifi_baudrate, wifi_flow_ctrl);
+    }
+    else
+    {
+        WiFi_SetUartBaudrate(WIFI_BAUDRATE_RUNNING, wifi_flow_ctrl);
+    }
+    
+    /* Power on: module prints ready when boot finish, lcd and sensor come up
+     * meanwhile. No ready line after mcu only reset, wait the old fixed delay */
+    WiFi_WaitReady(WIFI_RESET_DELAY);
     
     DBG_SendMessage(DBG_MSG_TASK_STATE, "WiFi Task Start\r\n");
+#ifdef EN_DEBUG
+    WiFi_FrameCheckBench();
+#endif
     
     /* Infinite loop */
     for(;;)
@@ -142,6 +309,7 @@ void WiFi_ControlTask(void * argument)
             DBG_SendMessage(DBG_MSG_WIFI_CTRL, "WiFi: Test Echo\r\n");
             if(WiFi_Ctrl_Echo() == true)
             {
+                Boot_StageDone(BOOT_STAGE_MODULE);
                 wifi_ctrl_state = WIFI_CTRL_GET_MAC;
             }
             else
@@ -180,13 +348,16 @@ void WiFi_ControlTask(void * argument)
         case WIFI_CTRL_SETUP_AP:
             /* Setup wifi AP mode */
             DBG_SendMessage(DBG_MSG_WIFI_CTRL, "WiFi: Setup WiFi AP Mode\r\n");
-            if(WiFi_Ctrl_SetupAP() == true)
+            /* rejoin tier keeps module running, only boot and reset tier need AT+RST */
+            if(WiFi_Ctrl_SetupAP(wifi_recover_tier != WIFI_RECOVER_JOIN) == true)
             {
+                Boot_StageDone(BOOT_STAGE_NETWORK);
                 wifi_ctrl_state = WIFI_CTRL_START_SERVER;
             }
             else
             {
-                wifi_ctrl_state = WIFI_CTRL_SETUP_UART;
+                /* repeated failure escalates to module reset */
+                wifi_ctrl_state = WiFi_Ctrl_Recover(WIFI_RECOVER_JOIN);
             }
             break;
             
@@ -195,11 +366,13 @@ void WiFi_ControlTask(void * argument)
             DBG_SendMessage(DBG_MSG_WIFI_CTRL, "WiFi: Start TCP Server\r\n");
             if(WiFi_Ctrl_StartTcpServer() == true)
             {
+                Boot_StageDone(BOOT_STAGE_LINK);
+                WiFi_RecoverDone();
                 wifi_ctrl_state = WIFI_CTRL_IDLE;
             }
             else
             {
-                wifi_ctrl_state = WIFI_CTRL_SETUP_AP;
+                wifi_ctrl_state = WiFi_Ctrl_Recover(WIFI_RECOVER_LINK);
             }
             break;
 
@@ -208,11 +381,12 @@ void WiFi_ControlTask(void * argument)
             DBG_SendMessage(DBG_MSG_WIFI_CTRL, "WiFi: Start WiFi Station Mode\r\n");
             if(WiFi_Ctrl_SetupStation() == true)
             {
+                join_counter = 0;
                 wifi_ctrl_state = WIFI_CTRL_CONNECT_AP;
             }
             else
             {
-                wifi_ctrl_state = WIFI_CTRL_SETUP_UART;
+                wifi_ctrl_state = WiFi_Ctrl_Recover(WIFI_RECOVER_JOIN);
             }
             break;
             
@@ -223,6 +397,12 @@ void WiFi_ControlTask(void * argument)
             {
                 wifi_ctrl_state = WIFI_CTRL_GET_IP;
             }
+            else if((wifi_recover_tier == WIFI_RECOVER_JOIN) || (++join_counter >= WIFI_JOIN_REPEAT))
+            {
+                /* rejoin tier gets one try, reset tier joins again anyway */
+                join_counter = 0;
+                wifi_ctrl_state = WiFi_Ctrl_Recover(WIFI_RECOVER_JOIN);
+            }
             break;
             
         case WIFI_CTRL_GET_IP:
@@ -230,8 +410,16 @@ void WiFi_ControlTask(void * argument)
             DBG_SendMessage(DBG_MSG_WIFI_CTRL, "WiFi: Get IP\r\n");
             if(WiFi_Ctrl_GetIP() == true)
             {
+                WiFi_Ctrl_SaveJoinInfo();
+                Boot_StageDone(BOOT_STAGE_NETWORK);
+                join_counter = 0;
                 wifi_ctrl_state = WIFI_CTRL_START_CLIENT;
             }
+            else if((wifi_recover_tier == WIFI_RECOVER_JOIN) || (++join_counter >= WIFI_JOIN_REPEAT))
+            {
+                join_counter = 0;
+                wifi_ctrl_state = WiFi_Ctrl_Recover(WIFI_RECOVER_JOIN);
+            }
             else
             {
                 wifi_ctrl_state = WIFI_CTRL_CONNECT_AP;
@@ -243,8 +431,14 @@ void WiFi_ControlTask(void * argument)
             DBG_SendMessage(DBG_MSG_WIFI_CTRL, "WiFi: Start TCP Client\r\n");
             if(WiFi_Ctrl_StartTcpClient() == true)
             {
+                Boot_StageDone(BOOT_STAGE_LINK);
+                WiFi_RecoverDone();
                 wifi_ctrl_state = WIFI_CTRL_IDLE;
             }
+            else
+            {
+                wifi_ctrl_state = WiFi_Ctrl_Recover(WIFI_RECOVER_LINK);
+            }
             break;
             
         case WIFI_CTRL_CLIENT_MANAGE:
@@ -256,9 +450,9 @@ void WiFi_ControlTask(void * argument)
             }
             break;
             
-        case WIFI_CTRL_RECE_REQUEST:
-            /* Receive request from client */
-            if(WiFi_Ctrl_ReceRequest() == true)
+        case WIFI_CTRL_SEND_RESPOND:
+            /* Send respond to client */
+            if(WiFi_Ctrl_SendRespond() == true)
             {
                 wifi_ctrl_state = WIFI_CTRL_IDLE;
                 error_counter = 0;
@@ -273,65 +467,78 @@ void WiFi_ControlTask(void * argument)
             }
             break;
             
-        case WIFI_CTRL_SEND_RESPOND:
-            /* Send respond to client */
-            if(WiFi_Ctrl_SendRespond() == true)
+        case WIFI_CTRL_SEND_IMAGE:
+#ifdef WIFI_PASSTHROUGH
+            /* Station mode has single link, stream image without AT wrapper */
+            if((app_config.esp8266_mode == APP_ESP8266_STATION) && (wifi_passthrough == false))
             {
-                wifi_ctrl_state = WIFI_CTRL_IDLE;
-                error_counter = 0;
+                WiFi_Ctrl_EnterPassthrough();
+            }
+#endif
+            /* Send data to client, AP mode pushes to every connected link */
+            if(app_config.esp8266_mode == APP_ESP8266_STATION)
+            {
+                WiFi_Ctrl_SendImageFileInfo();
+                WiFi_Ctrl_SendImage();
             }
             else
             {
-                error_counter++;
-                if(error_counter >= WIFI_ERROR_REPEAT)
-                {
-                    wifi_ctrl_state = WIFI_CTRL_IDLE;
-                }
+                WiFi_Ctrl_FanoutImage();
             }
+            wifi_ctrl_state = WIFI_CTRL_IDLE;
             break;
             
-        case WIFI_CTRL_SEND_IMAGE:
-            /* Send data to client */
-            WiFi_Ctrl_SendImageFileInfo();
-            WiFi_Ctrl_SendImage();
+        case WIFI_CTRL_PREVIEW_LINK:
+            /* Open or close UDP link of live preview */
+            DBG_SendMessage(DBG_MSG_WIFI_CTRL, "WiFi: Preview Link\r\n");
+            WiFi_Ctrl_PreviewLink();
+            wifi_ctrl_state = WIFI_CTRL_IDLE;
+            break;
+            
+        case WIFI_CTRL_SEND_PREVIEW:
+            /* Stream one preview frame, lost datagram is not resent */
+            WiFi_Ctrl_SendPreview();
+            wifi_ctrl_state = WIFI_CTRL_IDLE;
+            break;
+            
+        case WIFI_CTRL_SEND_RANGE:
+            /* Resend part of last photo to the client that asked */
+            WiFi_Ctrl_SendRange();
             wifi_ctrl_state = WIFI_CTRL_IDLE;
             break;
             
         case WIFI_CTRL_IDLE:
-            /* Idle and waiting for event */
+            /* Idle and waiting for event, alive test if no event in period */
             wifi_ctrl_state = WiFi_Ctrl_Idle();
-            if(wifi_ctrl_state == WIFI_CTRL_IDLE)
-            {
-                idle_counter++;
-                if(idle_counter >= 500)
-                {
-                    idle_counter = 0;
-                    wifi_ctrl_state = WIFI_CTRL_ALIVE_TEST;
-                }
-            }
-            else
-            {
-                idle_counter = 0;
-            }
             break;
             
         case WIFI_CTRL_ALIVE_TEST:
+            /* AT command is not accepted in transparent transmission */
+            if(wifi_passthrough == true)
+            {
+                WiFi_Ctrl_ExitPassthrough();
+            }
+            
             if(WiFi_Ctrl_Echo() == true)
             {
+                /* station link quality for next capture profile */
+                if(app_config.esp8266_mode == APP_ESP8266_STATION)
+                {
+                    WiFi_Ctrl_SampleRssi();
+                }
                 wifi_ctrl_state = WIFI_CTRL_IDLE;
             }
             else
             {                      
+                /* module does not answer AT, only reset helps */
                 DBG_SendMessage(DBG_MSG_WIFI_CTRL, "WiFi: Alive Test\r\n");
-                wifi_ctrl_state = WIFI_CTRL_SETUP_AP;
+                wifi_ctrl_state = WiFi_Ctrl_Recover(WIFI_RECOVER_RESET);
             }
             break;
             
         default:
             break;
         }
-        
-        vTaskDelay(WIFI_TASK_PERIOD);
     }
 }
 
@@ -365,14 +572,148 @@ bool WiFi_Ctrl_Echo(void)
 bool WiFi_Ctrl_SetupUART(void)
 {
     bool rtn_state = false;
-    WiFi_Receive_t receive = {.client_id = 0xFF, .rx_state = WIFI_RX_NONE};
+    uint8_t i = 0;
+    uint32_t baudrate = 0;
+    uint32_t probe_list[WIFI_BAUDRATE_NUM + 2];
+    uint32_t max_rate = (wifi_flow_ctrl == true) ? WIFI_BAUDRATE_MAX : WIFI_BAUDRATE_NOFLOW;
+    
+    /*--------------- Find WiFi UART Baudrate -----------------*/
+    /* saved rate first, then module default and all candidates */
+    probe_list[0] = (app_config.wifi_baudrate != 0) ? app_config.wifi_baudrate : WIFI_BAUDRATE_RUNNING;
+    probe_list[1] = WIFI_BAUDRATE_DEFAULT;
+    for(i = 0; i < WIFI_BAUDRATE_NUM; i++)
+    {
+        probe_list[i + 2] = wifi_baudrate_list[i];
+    }
+    
+    for(i = 0; i < (WIFI_BAUDRATE_NUM + 2); i++)
+    {
+        if((i > 0) && (probe_list[i] == probe_list[0]))
+        {
+            continue;
+        }
+        if(WiFi_ProbeBaudrate(probe_list[i]) == true)
+        {
+            baudrate = probe_list[i];
+            rtn_state = true;
+            break;
+        }
+    }
+    
+    if(rtn_state == false)
+    {
+        DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Setup Baudrate Failed\r\n");
+        return rtn_state;
+    }
+    
+    /*--------------- Step Down WiFi UART Baudrate -----------------*/
+    /* rate saved with flow control, echo passes but a full chunk may overrun */
+    if((baudrate > max_rate) && (WiFi_SetModuleBaudrate(max_rate, false) == true))
+    {
+        vTaskDelay(WIFI_BAUDRATE_SWITCH);
+        if(WiFi_ProbeBaudrate(max_rate) == true)
+        {
+            baudrate = max_rate;
+        }
+        else
+        {
+            /* link is broken, move module back to last good rate */
+            WiFi_SetModuleBaudrate(baudrate, false);
+            vTaskDelay(WIFI_BAUDRATE_SWITCH);
+            rtn_state = WiFi_ProbeBaudrate(baudrate);
+        }
+    }
+    
+    /*--------------- Step Up WiFi UART Baudrate -----------------*/
+    for(i = 0; (i < WIFI_BAUDRATE_NUM) && (rtn_state == true); i++)
+    {
+        if((wifi_baudrate_list[i] <= baudrate) || (wifi_baudrate_list[i] > max_rate))
+        {
+            continue;
+        }
+        
+        /* temporary rate, lost after module reset */
+        if(WiFi_SetModuleBaudrate(wifi_baudrate_list[i], false) == false)
+        {
+            break;
+        }
+        vTaskDelay(WIFI_BAUDRATE_SWITCH);
+        
+        if(WiFi_ProbeBaudrate(wifi_baudrate_list[i]) == true)
+        {
+            baudrate = wifi_baudrate_list[i];
+        }
+        else
+        {
+            /* link is broken, move module back to last good rate */
+            WiFi_SetModuleBaudrate(baudrate, false);
+            vTaskDelay(WIFI_BAUDRATE_SWITCH);
+            rtn_state = WiFi_ProbeBaudrate(baudrate);
+            break;
+        }
+    }
+    
+    /*--------------- Save WiFi UART Baudrate -----------------*/
+    if((rtn_state == true) && 
+       ((app_config.wifi_baudrate != baudrate) || (app_config.wifi_flow_ctrl != wifi_flow_ctrl)))
+    {
+        /* module keep this rate after AT+RST */
+        rtn_state = WiFi_SetModuleBaudrate(baudrate, true);
+        if(rtn_state == true)
+        {
+            app_config.wifi_baudrate = baudrate;
+            app_config.wifi_flow_ctrl = wifi_flow_ctrl;
+            Mem_WriteConfig();
+        }
+    }
+    
+    if(rtn_state == true)
+    {
+        DBG_Sprintf((char *)wifi_message.buf, "\tWiFi Rx: Baudrate %d\r\n", baudrate);
+        DBG_SendMessage(DBG_MSG_WIFI_RX, wifi_message.buf);
+    }
+    else
+    {        
+        DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Setup Baudrate Failed\r\n");
+    }
+    
+    return rtn_state;
+}
+
+/*******************************************************************************
+* @Brief   Probe WiFi UART Baudrate
+* @Param   baudrate[in]: mcu uart baudrate to try
+* @Note    first command after rate change may be broken, so try twice
+* @Return  
+*******************************************************************************/
+bool WiFi_ProbeBaudrate(uint32_t baudrate)
+{
+    WiFi_SetUartBaudrate(baudrate, wifi_flow_ctrl);
+    
+    if(WiFi_Ctrl_Echo() == true)
+    {
+        return true;
+    }
     
-    /*--------------- Set WiFi UART Baudrate -----------------*/
-    /* Set mcu wifi uart to default baudrate */
-    WiFi_SetUartBaudrate(WIFI_BAUDRATE_DEFAULT);
+    return WiFi_Ctrl_Echo();
+}
+
+/*******************************************************************************
+* @Brief   Set WiFi Module Baudrate
+* @Param   baudrate[in]: new module baudrate
+*          save[in]: true - AT+UART_DEF, kept in module flash
+*                    false - AT+UART_CUR, lost after reset
+* @Note    module answers OK at old rate then change to new rate
+* @Return  
+*******************************************************************************/
+bool WiFi_SetModuleBaudrate(uint32_t baudrate, bool save)
+{
+    bool rtn_state = false;
+    WiFi_Receive_t receive = {.client_id = 0xFF, .rx_state = WIFI_RX_NONE};
     
-    /* Set wifi module uart baudrate to high speed mode */
-    sprintf((char*)tx_buffer, "AT+CIOBAUD=%d\r\n", WIFI_BAUDRATE_RUNNING);
+    //example: AT+UART_CUR=921600,8,1,0,0
+    sprintf((char*)tx_buffer, "AT+UART_%s=%d,8,1,0,%d\r\n", (save == true) ? "DEF" : "CUR", 
+            baudrate, (wifi_flow_ctrl == true) ? 3 : 0);
     WiFi_SendCommand(tx_buffer);
     
     /* Receive rx_state until get result state or timeout */
@@ -380,19 +721,10 @@ bool WiFi_Ctrl_SetupUART(void)
     {
         if(receive.rx_state == WIFI_RX_ATFB_OK)
         {
-            DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Setup Baudrate OK\r\n");
             rtn_state = true;
         }
-        else
-        {        
-            DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Setup Baudrate Failed\r\n");
-            rtn_state = false;
-        }
     }
     
-    /* Set mcu wifi uart to running baudrate */
-    WiFi_SetUartBaudrate(WIFI_BAUDRATE_RUNNING);
-    
     return rtn_state;
 }
 
@@ -440,13 +772,15 @@ bool WiFi_Ctrl_GetMac(void)
                                 wifi_mac_string[9], wifi_mac_string[10],
                                 wifi_mac_string[12], wifi_mac_string[13],
                                 wifi_mac_string[15], wifi_mac_string[16]);
+    /* display queue is created by display task, first show waits for lcd */
+    Boot_WaitStage(BOOT_STAGE_LCD, portMAX_DELAY);
     xQueueSend(display_queue, &disp_req, 0 );
 
-    WiFi_ResetRxBuffer();
+    WiFi_FlushReply();
     return rtn_state;
 }
 
-bool WiFi_Ctrl_SetupAP(void)
+bool WiFi_Ctrl_SetupAP(bool reset)
 {
     bool rtn_state = false;
     WiFi_Receive_t receive = {.client_id = 0xFF, .rx_state = WIFI_RX_NONE};
@@ -497,8 +831,10 @@ bool WiFi_Ctrl_SetupAP(void)
     }
     
     /*-------------- Reset WiFi Module -----------------*/
-    if(rtn_state == true)
+    if((rtn_state == true) && (reset == true))
     {    
+        /* drop ready of last boot before reset */
+        xTaskNotifyWait(WIFI_NOTIFY_READY, 0, NULL, 0);
         sprintf((char*)tx_buffer, "AT+RST\r\n");
         WiFi_SendCommand(tx_buffer);
         
@@ -507,7 +843,7 @@ bool WiFi_Ctrl_SetupAP(void)
         {
             if(receive.rx_state == WIFI_RX_ATFB_OK)
             {
-                vTaskDelay(WIFI_RESET_DELAY);
+                WiFi_WaitReady(WIFI_RESET_DELAY);
                 DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Reset WiFi OK\r\n");
                 rtn_state = true;
             }
@@ -519,7 +855,7 @@ bool WiFi_Ctrl_SetupAP(void)
         }
     }
     
-    WiFi_ResetRxBuffer();
+    WiFi_FlushReply();
     return rtn_state;
 }
 
@@ -547,6 +883,23 @@ bool WiFi_Ctrl_StartTcpServer(void)
         }
     }
     
+    /*-------------- Reserve Preview Link -----------------*/
+    if(rtn_state == true)
+    {
+        /* Server takes link 0~3, last link is left for UDP preview */
+        sprintf((char*)tx_buffer, "AT+CIPSERVERMAXCONN=%d\r\n", WIFI_SERVER_MAX_CONN);
+        WiFi_SendCommand(tx_buffer);
+        
+        /* Old firmware without this command still works, only preview is affected */
+        if( xQueueReceive(receive_queue, &receive, (TickType_t) WIFI_RX_FB_TIMEOUT))
+        {
+            if(receive.rx_state != WIFI_RX_ATFB_OK)
+            {        
+                DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Set Max Conn Failed\r\n");
+            }
+        }
+    }
+    
     /*-------------- Start TCP Server -----------------*/
     if(rtn_state == true)
     {
@@ -595,8 +948,16 @@ bool WiFi_Ctrl_StartTcpServer(void)
     
     /* Set IP Address */
     sprintf(wifi_ip_string, "192.168.4.1");
+    
+    /* UDP link is lost with server, reopen it for the viewer */
+    preview_link = false;
+    camera_preview.active = false;
+    if(preview_viewer.port != 0)
+    {
+        preview_request = true;
+    }
 
-    WiFi_ResetRxBuffer();
+    WiFi_FlushReply();
     return rtn_state;
 }
 
@@ -636,7 +997,6 @@ bool WiFi_Ctrl_SetupStation(void)
         {
             if(receive.rx_state == WIFI_RX_ATFB_OK)
             {
-                vTaskDelay(WIFI_RESET_DELAY);
                 DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Disable Auto Connect AP OK\r\n");
                 rtn_state = true;
             }
@@ -651,6 +1011,8 @@ bool WiFi_Ctrl_SetupStation(void)
     /*-------------- Reset WiFi Module -----------------*/
     if(rtn_state == true)
     {
+        /* drop ready of last boot before reset */
+        xTaskNotifyWait(WIFI_NOTIFY_READY, 0, NULL, 0);
         sprintf((char*)tx_buffer, "AT+RST\r\n");
         WiFi_SendCommand(tx_buffer);
 
@@ -659,7 +1021,7 @@ bool WiFi_Ctrl_SetupStation(void)
         {
             if(receive.rx_state == WIFI_RX_ATFB_OK)
             {
-                vTaskDelay(WIFI_RESET_DELAY);
+                WiFi_WaitReady(WIFI_RESET_DELAY);
                 DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Reset WiFi OK\r\n");
                 rtn_state = true;
             }
@@ -671,40 +1033,89 @@ bool WiFi_Ctrl_SetupStation(void)
         }
     }
 
-    WiFi_ResetRxBuffer();
+    WiFi_FlushReply();
     return rtn_state;
 }
 
 bool WiFi_Ctrl_ConnectAP(void)
 {
     bool rtn_state = false;
+    bool fast_join = false;
+    bool static_ip = false;
+    JoinCfg_t *join = &app_config.wifi_join;
     WiFi_Receive_t receive = {.client_id = 0xFF, .rx_state = WIFI_RX_NONE};
 
-    /*-------------- Enable DHCP Client -----------------*/
-    sprintf((char*)tx_buffer, "AT+CWDHCP=1,1\r\n");
-    WiFi_SendCommand(tx_buffer);
-    
-    /* Receive rx_state until get result state or timeout */
-    if( xQueueReceive(receive_queue, &receive, (TickType_t) WIFI_RX_FB_TIMEOUT))
+#ifdef WIFI_FAST_JOIN
+    fast_join = (join->channel != 0);
+#endif
+#ifdef WIFI_STATIC_IP
+    static_ip = (fast_join == true) && (join->ip[0] != 0);
+#endif
+
+    if(static_ip == true)
     {
-        if(receive.rx_state == WIFI_RX_ATFB_OK)
+        /*-------------- Set Static IP -----------------*/
+        /* AT+CIPSTA disables DHCP client, lease of last join is reused */
+        sprintf((char*)tx_buffer, "AT+CIPSTA=\"%d.%d.%d.%d\",\"%d.%d.%d.%d\",\"%d.%d.%d.%d\"\r\n", 
+                join->ip[0], join->ip[1], join->ip[2], join->ip[3],
+                join->gateway[0], join->gateway[1], join->gateway[2], join->gateway[3],
+                join->netmask[0], join->netmask[1], join->netmask[2], join->netmask[3]);
+        WiFi_SendCommand(tx_buffer);
+        
+        /* Receive rx_state until get result state or timeout */
+        if( xQueueReceive(receive_queue, &receive, (TickType_t) WIFI_RX_FB_TIMEOUT))
         {
-            vTaskDelay(WIFI_RESET_DELAY);
-            DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Enable DHCP Client OK\r\n");
-            rtn_state = true;
+            if(receive.rx_state == WIFI_RX_ATFB_OK)
+            {
+                DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Set Static IP OK\r\n");
+                rtn_state = true;
+            }
+            else
+            {
+                DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Set Static IP Failed\r\n");
+                rtn_state = false;
+            }
         }
-        else
+    }
+    else
+    {
+        /*-------------- Enable DHCP Client -----------------*/
+        sprintf((char*)tx_buffer, "AT+CWDHCP=1,1\r\n");
+        WiFi_SendCommand(tx_buffer);
+        
+        /* Receive rx_state until get result state or timeout */
+        if( xQueueReceive(receive_queue, &receive, (TickType_t) WIFI_RX_FB_TIMEOUT))
         {
-            DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Enable DHCP Client Failed\r\n");
-            rtn_state = false;
+            if(receive.rx_state == WIFI_RX_ATFB_OK)
+            {
+                DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Enable DHCP Client OK\r\n");
+                rtn_state = true;
+            }
+            else
+            {
+                DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Enable DHCP Client Failed\r\n");
+                rtn_state = false;
+            }
         }
     }
     
     /*-------------- Connect WiFi AP -----------------*/
     if(rtn_state == true)
     {
-        sprintf((char*)tx_buffer, "AT+CWJAP=\"%s\",\"%s\"\r\n", app_config.wifi_ssid, app_config.wifi_passwd);
+        if(fast_join == true)
+        {
+            /* Join cached BSSID, module does not scan for the strongest AP */
+            sprintf((char*)tx_buffer, "AT+CWJAP=\"%s\",\"%s\",\"%02x:%02x:%02x:%02x:%02x:%02x\"\r\n", 
+                    app_config.wifi_ssid, app_config.wifi_passwd,
+                    join->bssid[0], join->bssid[1], join->bssid[2], 
+                    join->bssid[3], join->bssid[4], join->bssid[5]);
+        }
+        else
+        {
+            sprintf((char*)tx_buffer, "AT+CWJAP=\"%s\",\"%s\"\r\n", app_config.wifi_ssid, app_config.wifi_passwd);
+        }
         WiFi_SendCommand(tx_buffer);
+        rtn_state = false;
         
         /* Receive rx_state until get result state or timeout */
         /* 1. WIFI CONNECTED */
@@ -723,9 +1134,15 @@ bool WiFi_Ctrl_ConnectAP(void)
                 rtn_state = false;
             }
         }
+        
+        /* AP is gone or moved, scan on next join, cache is rewritten after join */
+        if((rtn_state == false) && (fast_join == true))
+        {
+            join->channel = 0;
+        }
     }
 
-    WiFi_ResetRxBuffer();
+    WiFi_FlushReply();
     return rtn_state;
 }
 
@@ -772,7 +1189,7 @@ bool WiFi_Ctrl_GetIP(void)
         }
     }
 
-    WiFi_ResetRxBuffer();
+    WiFi_FlushReply();
     return rtn_state;
 }
 
@@ -825,7 +1242,7 @@ bool WiFi_Ctrl_StartTcpClient(void)
         }
     }
 
-    WiFi_ResetRxBuffer();
+    WiFi_FlushReply();
     return rtn_state;
 }
 
@@ -838,9 +1255,14 @@ bool WiFi_Ctrl_CloseTcpClient(void)
     sprintf((char*)tx_buffer, "AT+CIPCLOSE\r\n");
     WiFi_SendCommand(tx_buffer);
 
-    /* Receive rx_state until get result state or timeout */
+    /* Receive rx_state until get result state or timeout, CLOSED comes before OK */
     if( xQueueReceive(receive_queue, &receive, (TickType_t) WIFI_RX_FB_TIMEOUT))
     {
+        if(receive.rx_state == WIFI_RX_CLOSED)
+        {
+            xQueueReceive(receive_queue, &receive, (TickType_t) WIFI_RX_FB_TIMEOUT);
+        }
+        
         if(receive.rx_state == WIFI_RX_ATFB_OK)
         {
             tcp_client_connected = false;
@@ -854,92 +1276,354 @@ bool WiFi_Ctrl_CloseTcpClient(void)
         }
     }
 
-    WiFi_ResetRxBuffer();
+    WiFi_FlushReply();
     return rtn_state;
 }
 
-bool WiFi_Ctrl_ClientManage(void)
+/*******************************************************************************
+* @Brief   Save Fast Join Info
+* @Param   
+* @Note    Query BSSID and channel of current AP, lease is taken from AT+CIPSTA? 
+*          of get ip state. Config is written only when info is changed.
+* @Return  
+*******************************************************************************/
+bool WiFi_Ctrl_SaveJoinInfo(void)
 {
     bool rtn_state = false;
     WiFi_Receive_t receive = {.client_id = 0xFF, .rx_state = WIFI_RX_NONE};
-    Disp_Request_t disp_req;
-    
+
+    /*-------------- Query Connected AP -----------------*/
+    wifi_join.channel = 0;
+    wifi_rssi = ADAPT_RSSI_UNKNOWN;
+    sprintf((char*)tx_buffer, "AT+CWJAP?\r\n");
+    WiFi_SendCommand(tx_buffer);
+
     /* Receive rx_state until get result state or timeout */
     if( xQueueReceive(receive_queue, &receive, (TickType_t) WIFI_RX_FB_TIMEOUT))
     {
-        if(receive.rx_state == WIFI_RX_ID_CONNECT)
+        if((receive.rx_state == WIFI_RX_ATFB_OK) && (wifi_join.channel != 0))
         {
-            DBG_Sprintf(wifi_message.buf, "\tWiFi Rx: Client %d Connect\r\n", receive.client_id);
-            DBG_SendMessage(DBG_MSG_WIFI_RX, wifi_message.buf);
-            
-            sprintf(disp_req.message2, "Client%d-Connect", receive.client_id);
-        }
-        else
-        {        
-            DBG_Sprintf(wifi_message.buf, "\tWiFi Rx: Client %d Closed\r\n", receive.client_id);
-            DBG_SendMessage(DBG_MSG_WIFI_RX, wifi_message.buf);
-            
-            sprintf(disp_req.message2, "Client%d-Closed", receive.client_id);
+            rtn_state = true;
+            Adapt_LinkRssi(&camera_adapt, wifi_rssi);
         }
-
-        disp_req.source = DISP_DBG_WIFI;
-        disp_req.show_line1 = true;
-        disp_req.show_line2 = true;      
-        sprintf(disp_req.message1, "DBG: WiFi");
-        xQueueSend(display_queue, &disp_req, 0 ); 
-        rtn_state = true;
     }
     
-    WiFi_ResetRxBuffer();
+    if((rtn_state == true) && (memcmp(&wifi_join, &app_config.wifi_join, sizeof(JoinCfg_t)) != 0))
+    {
+        memcpy(&app_config.wifi_join, &wifi_join, sizeof(JoinCfg_t));
+        Mem_WriteConfig();
+        
+        DBG_Sprintf((char *)wifi_message.buf, "\tWiFi Rx: Join Info Saved, CH%d\r\n", wifi_join.channel);
+        DBG_SendMessage(DBG_MSG_WIFI_RX, wifi_message.buf);
+    }
+
+    WiFi_FlushReply();
     return rtn_state;
 }
 
-bool WiFi_Ctrl_ReceRequest(void)
-{
-    bool rtn_state = false;
+/*******************************************************************************
+* @Brief   Sample Link RSSI
+* @Param   
+* @Note    AT+CWJAP? of idle alive test, rssi is fed to capture profile 
+*          controller. Cached join info is not touched.
+* @Return  
+*******************************************************************************/
+bool WiFi_Ctrl_SampleRssi(void)
+{
+    bool rtn_state = false;
     WiFi_Receive_t receive = {.client_id = 0xFF, .rx_state = WIFI_RX_NONE};
-    Client_Message_t msg;
+    JoinCfg_t join;
     
+    memcpy(&join, &wifi_join, sizeof(JoinCfg_t));
+    wifi_rssi = ADAPT_RSSI_UNKNOWN;
+    sprintf((char*)tx_buffer, "AT+CWJAP?\r\n");
+    WiFi_SendCommand(tx_buffer);
+
     /* Receive rx_state until get result state or timeout */
-    if( xQueueReceive(receive_queue, &receive, (TickType_t) 0))
+    if( xQueueReceive(receive_queue, &receive, (TickType_t) WIFI_RX_FB_TIMEOUT))
     {
-        if(receive.rx_state == WIFI_RX_IPD_OK)
-        {            
-            DBG_SendMessage(DBG_MSG_WIFI_RX, "WiFi: Receive Request OK\r\n");
+        if((receive.rx_state == WIFI_RX_ATFB_OK) && (wifi_rssi != ADAPT_RSSI_UNKNOWN))
+        {
+            Adapt_LinkRssi(&camera_adapt, wifi_rssi);
             rtn_state = true;
+        }
+    }
+    memcpy(&wifi_join, &join, sizeof(JoinCfg_t));
+    
+    WiFi_FlushReply();
+    return rtn_state;
+}
+
+/*******************************************************************************
+* @Brief   Link Recovery
+* @Param   tier[in]: lowest tier can fix the fault
+* @Note    Cheap tier first: reopen TCP link, then rejoin AP (or setup soft AP
+*          again without reset), then reset module. A repeated fault moves to
+*          next tier, after reset tier it starts from given tier again since 
+*          the fault is out of module.
+*          Station that still has its IP when link reopen fails skips rejoin,
+*          AP is fine: reset once for a stuck module, after that only reopen
+*          link since the fault is at server side.
+* @Return  next control state
+*******************************************************************************/
+WiFi_CtrlState_t WiFi_Ctrl_Recover(WiFi_Recover_t tier)
+{
+    WiFi_CtrlState_t next_state = WIFI_CTRL_SETUP_UART;
+    WiFi_Recover_t lowest = tier;
+    
+    /* AT command is not accepted in transparent transmission */
+    if(wifi_passthrough == true)
+    {
+        WiFi_Ctrl_ExitPassthrough();
+    }
+    
+    if(wifi_recover_tier == WIFI_RECOVER_NONE)
+    {
+        wifi_recover_tick = xTaskGetTickCount();
+    }
+    else if(tier <= wifi_recover_tier)
+    {
+        tier = (WiFi_Recover_t)(wifi_recover_tier + 1);
+    }
+    if(tier >= WIFI_RECOVER_TIER_NUM)
+    {
+        tier = lowest;
+    }
+    else if((tier == WIFI_RECOVER_JOIN) && (lowest == WIFI_RECOVER_LINK) &&
+            (app_config.esp8266_mode == APP_ESP8266_STATION) &&
+            (WiFi_Ctrl_GetIP() == true) && (strcmp((char *)wifi_ip_string, "0.0.0.0") != 0))
+    {
+        tier = (wifi_recover_reset == true) ? WIFI_RECOVER_LINK : WIFI_RECOVER_RESET;
+    }
+    if(tier == WIFI_RECOVER_RESET)
+    {
+        wifi_recover_reset = true;
+    }
+    wifi_recover_tier = tier;
+    
+    DBG_Sprintf((char *)wifi_message.buf, "WiFi: Recover Tier %d\r\n", tier);
+    DBG_SendMessage(DBG_MSG_WIFI_CTRL, wifi_message.buf);
+    
+    switch(tier)
+    {
+    case WIFI_RECOVER_LINK:
+        if(app_config.esp8266_mode == APP_ESP8266_STATION)
+        {
+            if(tcp_client_connected == true)
+            {
+                WiFi_Ctrl_CloseTcpClient();
+            }
+            tcp_client_connected = false;
+            next_state = WIFI_CTRL_START_CLIENT;
+        }
+        else
+        {
+            next_state = WIFI_CTRL_START_SERVER;
+        }
+        break;
+        
+    case WIFI_RECOVER_JOIN:
+        if(app_config.esp8266_mode == APP_ESP8266_STATION)
+        {
+            next_state = WIFI_CTRL_CONNECT_AP;
+        }
+        else
+        {
+            next_state = WIFI_CTRL_SETUP_AP;
+        }
+        break;
+        
+    default:
+        next_state = WIFI_CTRL_SETUP_UART;
+        break;
+    }
+    
+    return next_state;
+}
+
+/*******************************************************************************
+* @Brief   Link Recovery Done
+* @Param   
+* @Note    Called when TCP server or client is started, log recovery time
+* @Return  
+*******************************************************************************/
+void WiFi_RecoverDone(void)
+{
+    uint32_t elapsed_ms = 0;
+    
+    if(wifi_recover_tier != WIFI_RECOVER_NONE)
+    {
+        elapsed_ms = (xTaskGetTickCount() - wifi_recover_tick) * portTICK_PERIOD_MS;
+        wifi_recover_ms[wifi_recover_tier] = elapsed_ms;
+        METRIC_INC(METRIC_WIFI_RECOVER);
+        
+        DBG_Sprintf((char *)wifi_message.buf, "WiFi: Recovered Tier %d %dms\r\n", wifi_recover_tier, elapsed_ms);
+        DBG_SendMessage(DBG_MSG_WIFI_CTRL, wifi_message.buf);
+        wifi_recover_tier = WIFI_RECOVER_NONE;
+        wifi_recover_reset = false;
+    }
+    
+    /* Station link events raised by rejoin and reconnect are stale now */
+    if(app_config.esp8266_mode == APP_ESP8266_STATION)
+    {
+        xQueueReset(wifi_event_queue);
+    }
+}
+
+/*******************************************************************************
+* @Brief   Enter Transparent Transmission
+* @Param   
+* @Note    Station mode only: AT+CIPMODE=1 then AT+CIPSEND once, after '>'
+*          all uart data is forwarded to TCP server without AT wrapper
+* @Return  
+*******************************************************************************/
+bool WiFi_Ctrl_EnterPassthrough(void)
+{
+    bool rtn_state = false;
+    WiFi_Receive_t receive = {.client_id = 0xFF, .rx_state = WIFI_RX_NONE};
+    uint8_t outstanding = 0;
+
+    /*-------------- Set Transparent Transmission Mode -----------------*/
+    sprintf((char*)tx_buffer, "AT+CIPMODE=1\r\n");
+    WiFi_SendCommand(tx_buffer);
+
+    /* Receive rx_state until get result state or timeout */
+    if( xQueueReceive(receive_queue, &receive, (TickType_t) WIFI_RX_FB_TIMEOUT))
+    {
+        if(receive.rx_state == WIFI_RX_ATFB_OK)
+        {
+            rtn_state = true;
+        }
+    }
+
+    /*-------------- Start Sending -----------------*/
+    if(rtn_state == true)
+    {
+        sprintf((char*)tx_buffer, "AT+CIPSEND\r\n");
+        WiFi_SendCommand(tx_buffer);
+        
+        if(WiFi_WaitSendEvent(WIFI_RX_SEND_READY, &outstanding) == WIFI_RX_SEND_READY)
+        {
+            /* parser switch to raw message frame */
+            xSemaphoreTake(wifi_rx_mutex, portMAX_DELAY);
+            wifi_passthrough = true;
+            Reasm_Reset(&client_reasm[0]);
+            xSemaphoreGive(wifi_rx_mutex);
             
-            /* Analyze client request and post to client queue */
-            Client_DataAnalyzer(client_data, &msg);
-            msg.client_id = receive.client_id;
-            xQueueSend(request_queue, &msg, 0 ); 
-            
-            WiFi_ResetRxBuffer();
+            DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Enter Passthrough OK\r\n");
         }
         else
-        {        
+        {
             rtn_state = false;
         }
     }
-    else
-    {        
-        rtn_state = false;
+    
+    if(rtn_state == false)
+    {
+        /* back to normal mode */
+        sprintf((char*)tx_buffer, "AT+CIPMODE=0\r\n");
+        WiFi_SendCommand(tx_buffer);
+        xQueueReceive(receive_queue, &receive, (TickType_t) WIFI_RX_FB_TIMEOUT);
+        
+        DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Enter Passthrough Failed\r\n");
+    }
+
+    WiFi_FlushReply();
+    return rtn_state;
+}
+
+/*******************************************************************************
+* @Brief   Exit Transparent Transmission
+* @Param   
+* @Note    "+++" is recognized only as a separate uart packet, keep the line
+*          silent before it and wait 1s before next AT command
+* @Return  
+*******************************************************************************/
+bool WiFi_Ctrl_ExitPassthrough(void)
+{
+    bool rtn_state = false;
+    WiFi_Receive_t receive = {.client_id = 0xFF, .rx_state = WIFI_RX_NONE};
+
+    vTaskDelay(WIFI_ESCAPE_GUARD);
+    WiFi_SendData((uint8_t *)"+++", 3);
+    vTaskDelay(WIFI_ESCAPE_DELAY);
+    
+    xSemaphoreTake(wifi_rx_mutex, portMAX_DELAY);
+    wifi_passthrough = false;
+    xSemaphoreGive(wifi_rx_mutex);
+
+    /*-------------- Set Normal Transmission Mode -----------------*/
+    sprintf((char*)tx_buffer, "AT+CIPMODE=0\r\n");
+    WiFi_SendCommand(tx_buffer);
+
+    /* Receive rx_state until get result state or timeout */
+    if( xQueueReceive(receive_queue, &receive, (TickType_t) WIFI_RX_FB_TIMEOUT))
+    {
+        if(receive.rx_state == WIFI_RX_ATFB_OK)
+        {
+            DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Exit Passthrough OK\r\n");
+            rtn_state = true;
+        }
+        else
+        {
+            DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Exit Passthrough Failed\r\n");
+            rtn_state = false;
+        }
+    }
+
+    WiFi_FlushReply();
+    return rtn_state;
+}
+
+bool WiFi_Ctrl_ClientManage(void)
+{
+    bool rtn_state = false;
+    WiFi_Receive_t receive = {.client_id = 0xFF, .rx_state = WIFI_RX_NONE};
+    Disp_Request_t disp_req;
+    
+    /* Link event is peeked by idle state, take it from event queue */
+    if( xQueueReceive(wifi_event_queue, &receive, (TickType_t) 0))
+    {
+        if(receive.rx_state == WIFI_RX_ID_CONNECT)
+        {
+            DBG_Sprintf(wifi_message.buf, "\tWiFi Rx: Client %d Connect\r\n", receive.client_id);
+            DBG_SendMessage(DBG_MSG_WIFI_RX, wifi_message.buf);
+            
+            sprintf(disp_req.message2, "Client%d-Connect", receive.client_id);
+        }
+        else
+        {        
+            DBG_Sprintf(wifi_message.buf, "\tWiFi Rx: Client %d Closed\r\n", receive.client_id);
+            DBG_SendMessage(DBG_MSG_WIFI_RX, wifi_message.buf);
+            
+            sprintf(disp_req.message2, "Client%d-Closed", receive.client_id);
+        }
+
+        disp_req.source = DISP_DBG_WIFI;
+        disp_req.show_line1 = true;
+        disp_req.show_line2 = true;      
+        sprintf(disp_req.message1, "DBG: WiFi");
+        xQueueSend(display_queue, &disp_req, 0 ); 
+        rtn_state = true;
     }
     
+    WiFi_FlushReply();
     return rtn_state;
 }
 
 bool WiFi_Ctrl_SendRespond(void)
 {
     bool rtn_state = false;
-    WiFi_Receive_t receive = {.client_id = 0xFF, .rx_state = WIFI_RX_NONE};
     Client_Message_t respond;
     uint16_t length = 0;   
+    uint8_t outstanding = 0;
+    WiFi_TxDesc_t chain[3];
     
     DBG_SendMessage(DBG_MSG_WIFI_RX, "WiFi: Sending Respond\r\n");
     
     if(xQueueReceive(respond_queue, &respond, (TickType_t) 10))
     {
-        length = respond.length + MSG_CMD_SIZE;
+        length = WiFi_FrameSize(respond.client_id, respond.length);
         if(app_config.esp8266_mode == APP_ESP8266_STATION)
         {
             //example: AT+CIPSEND=14
@@ -950,20 +1634,16 @@ bool WiFi_Ctrl_SendRespond(void)
             //example: AT+CIPSEND=0,14
             sprintf((char*)tx_buffer, "AT+CIPSEND=%d,%d\r\n", respond.client_id, length);
         }
-        WiFi_SendCommand(tx_buffer);
         
-        if( xQueueReceive(receive_queue, &receive, (TickType_t) WIFI_RX_FB_TIMEOUT))
+        if(wifi_passthrough == true)
         {
-            if(receive.rx_state == WIFI_RX_ATFB_OK)
-            {
-                if( xQueueReceive(receive_queue, &receive, (TickType_t) WIFI_RX_FB_TIMEOUT))
-                {
-                    if(receive.rx_state == WIFI_RX_SEND_READY)
-                    {
-                        rtn_state = true;
-                    }
-                }
-            }
+            /* transparent transmission, send packet directly */
+            rtn_state = true;
+        }
+        else
+        {
+            WiFi_SendCommand(tx_buffer);
+            rtn_state = (WiFi_WaitSendEvent(WIFI_RX_SEND_READY, &outstanding) == WIFI_RX_SEND_READY);
         }
         
         if(rtn_state == true)
@@ -974,34 +1654,43 @@ bool WiFi_Ctrl_SendRespond(void)
             tx_buffer[MSG_RECOGNIZE_CODE_LEN+2] = (respond.index >> 8) & 0xFF;
             tx_buffer[MSG_RECOGNIZE_CODE_LEN+3] = respond.length & 0xFF;
             tx_buffer[MSG_RECOGNIZE_CODE_LEN+4] = (respond.length >> 8) & 0xFF;
-            tx_buffer[MSG_RECOGNIZE_CODE_LEN+5] = respond.checksum;
-            memset(&tx_buffer[MSG_RECOGNIZE_CODE_LEN+6], MSG_END_CODE, MSG_RECOGNIZE_CODE_LEN);
             
-            WiFi_SendData(tx_buffer, MSG_RECOGNIZE_CODE_LEN+5);
-            if(respond.length != 0)
-            {
-                WiFi_SendData(respond.payload, respond.length);
-            }
-            WiFi_SendData(&tx_buffer[MSG_RECOGNIZE_CODE_LEN+5], MSG_RECOGNIZE_CODE_LEN+1);
+            chain[0].data = tx_buffer;
+            chain[0].length = MSG_RECOGNIZE_CODE_LEN+5;
+            chain[1].data = respond.payload;
+            chain[1].length = respond.length;
+            chain[2].data = &tx_buffer[MSG_RECOGNIZE_CODE_LEN+5];
+            chain[2].length = WiFi_PackFrameTail(respond.client_id, &tx_buffer[MSG_RECOGNIZE_CODE_LEN], 5, 
+                                                 respond.payload, respond.length, chain[2].data);
+            rtn_state = WiFi_SendChain(chain, 3);
             
-            if( xQueueReceive(receive_queue, &receive, (TickType_t) WIFI_RX_FB_TIMEOUT))
+            if((rtn_state == true) && (wifi_passthrough == false))
             {
-                if(receive.rx_state == WIFI_RX_SEND_OK)
-                {
-                    rtn_state = true;
-                }
-                else
-                {        
-                    rtn_state = false;
-                }
+                outstanding = 1;
+                rtn_state = (WiFi_WaitSendEvent(WIFI_RX_SEND_OK, &outstanding) == WIFI_RX_SEND_OK);
             }
         }
         
-        /* free payload memory to avoid stack overflow */
-        vPortFree(respond.payload);
+        /* return payload block to message pool */
+        MsgPool_Free(respond.payload);
+        
+        /* protocol switch asked by this respond, client sends new frame only
+         * after it got the respond */
+        if((respond.client_id < WIFI_LINK_NUM) && (client_version_next[respond.client_id] != 0))
+        {
+            if(rtn_state == true)
+            {
+                xSemaphoreTake(wifi_rx_mutex, portMAX_DELAY);
+                client_version[respond.client_id] = client_version_next[respond.client_id];
+                Reasm_SetVersion(&client_reasm[respond.client_id], client_version[respond.client_id]);
+                xSemaphoreGive(wifi_rx_mutex);
+            }
+            client_version_next[respond.client_id] = 0;
+        }
         
         if(rtn_state == true)
         {
+            WiFi_TxLatencyRecord(WIFI_TX_CONTROL, respond.tick);
             DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Send Respond OK\r\n");
         }
         else
@@ -1020,10 +1709,10 @@ bool WiFi_Ctrl_SendRespond(void)
 bool WiFi_Ctrl_SendImageFileInfo(void)
 {
     bool rtn_state = false;
-    WiFi_Receive_t receive = {.client_id = 0xFF, .rx_state = WIFI_RX_NONE};
     uint32_t data_length = 0;
+    uint16_t length = 0;
     uint8_t *pfilename;
-    uint8_t checksum = 0;
+    uint8_t outstanding = 0;
     
     DBG_SendMessage(DBG_MSG_WIFI_RX, "WiFi: Send Image Size & Filename\r\n");   
     
@@ -1033,672 +1722,1850 @@ bool WiFi_Ctrl_SendImageFileInfo(void)
     if(app_config.esp8266_mode == APP_ESP8266_STATION)
     {
         //example: AT+CIPSEND=14
-        sprintf((char*)tx_buffer, "AT+CIPSEND=%d\r\n", 4 + CAMERA_FILENAME_SIZE + MSG_CMD_SIZE);
+        sprintf((char*)tx_buffer, "AT+CIPSEND=%d\r\n", WiFi_FrameSize(client_id_active, WIFI_FILE_INFO_LEN));
     }
     else
     {       
         //example: AT+CIPSEND=0,14
-        sprintf((char*)tx_buffer, "AT+CIPSEND=%d,%d\r\n", client_id_active, 4 + CAMERA_FILENAME_SIZE + MSG_CMD_SIZE);
+        sprintf((char*)tx_buffer, "AT+CIPSEND=%d,%d\r\n", client_id_active, WiFi_FrameSize(client_id_active, WIFI_FILE_INFO_LEN));
     }
-    WiFi_SendCommand(tx_buffer);
     
-    if( xQueueReceive(receive_queue, &receive, (TickType_t) WIFI_RX_FB_TIMEOUT))
+    if(wifi_passthrough == true)
     {
-        if(receive.rx_state == WIFI_RX_ATFB_OK)
-        {
-            if( xQueueReceive(receive_queue, &receive, (TickType_t) WIFI_RX_FB_TIMEOUT))
-            {
-                if(receive.rx_state == WIFI_RX_SEND_READY)
-                {
-                    rtn_state = true;
-                }
-            }
-        }
+        /* transparent transmission, send packet directly */
+        rtn_state = true;
+    }
+    else
+    {
+        WiFi_SendCommand(tx_buffer);
+        rtn_state = (WiFi_WaitSendEvent(WIFI_RX_SEND_READY, &outstanding) == WIFI_RX_SEND_READY);
     }
         
     if(rtn_state == true)
     {
-        memset(tx_buffer, MSG_START_CODE, MSG_RECOGNIZE_CODE_LEN);
-        tx_buffer[MSG_RECOGNIZE_CODE_LEN] = MSG_PUSH_IMAGE;
-        tx_buffer[MSG_RECOGNIZE_CODE_LEN+1] = packet_id & 0xFF;
-        tx_buffer[MSG_RECOGNIZE_CODE_LEN+2] = (packet_id >> 8) & 0xFF;
-        tx_buffer[MSG_RECOGNIZE_CODE_LEN+3] = (4 + CAMERA_FILENAME_SIZE) & 0xFF;
-        tx_buffer[MSG_RECOGNIZE_CODE_LEN+4] = ((4 + CAMERA_FILENAME_SIZE) >> 8) & 0xFF;
-        tx_buffer[MSG_RECOGNIZE_CODE_LEN+5] = data_length & 0xFF;
-        tx_buffer[MSG_RECOGNIZE_CODE_LEN+6] = (data_length >> 8) & 0xFF;
-        tx_buffer[MSG_RECOGNIZE_CODE_LEN+7] = (data_length >> 16) & 0xFF;
-        tx_buffer[MSG_RECOGNIZE_CODE_LEN+8] = (data_length >> 24) & 0xFF;
-        memcpy(&tx_buffer[MSG_RECOGNIZE_CODE_LEN+9], pfilename, CAMERA_FILENAME_SIZE);
-        tx_buffer[MSG_RECOGNIZE_CODE_LEN+CAMERA_FILENAME_SIZE+9] = Mem_GetChecksum8(0, (uint8_t *)&tx_buffer[MSG_RECOGNIZE_CODE_LEN], 9+CAMERA_FILENAME_SIZE);
-        memset(&tx_buffer[MSG_RECOGNIZE_CODE_LEN+CAMERA_FILENAME_SIZE+10], MSG_END_CODE, MSG_RECOGNIZE_CODE_LEN);
-        
-        WiFi_SendData(tx_buffer, 4 + CAMERA_FILENAME_SIZE + MSG_CMD_SIZE);
-        if( xQueueReceive(receive_queue, &receive, (TickType_t) WIFI_RX_FB_TIMEOUT))
+        length = WiFi_PackImageFileInfo(client_id_active, data_length, pfilename);
+        WiFi_SendData(tx_buffer, length);
+        if(wifi_passthrough == false)
         {
-            if(receive.rx_state == WIFI_RX_SEND_OK)
-            {     
-                DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Send Image Size & Filename OK\r\n");
-                rtn_state = true;
-            }
-            else
-            {        
-                DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Send Image Size & Filename Failed\r\n");
-                rtn_state = false;
-            }
+            outstanding = 1;
+            rtn_state = (WiFi_WaitSendEvent(WIFI_RX_SEND_OK, &outstanding) == WIFI_RX_SEND_OK);
+        }
+        
+        if(rtn_state == true)
+        {     
+            DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Send Image Size & Filename OK\r\n");
+        }
+        else
+        {        
+            DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Send Image Size & Filename Failed\r\n");
         }
     }
     
     return rtn_state;
 }
 
-bool WiFi_Ctrl_SendImage(void)
+/*******************************************************************************
+* @Brief   Fan-out Image to All Links
+* @Param   
+* @Note    AP mode, Send_Fanout interleaves chunks of one frame across 
+*          connected links from the camera buffer without copy. Each link 
+*          has its own progress and at most WIFI_LINK_WINDOW chunks in 
+*          flight, the link with least send time goes first so a slow link
+*          does not stall others, a link with error or timeout is dropped
+* @Return  true if at least one link got the whole frame
+*******************************************************************************/
+bool WiFi_Ctrl_FanoutImage(void)
 {
     bool rtn_state = false;
-    WiFi_Receive_t receive = {.client_id = 0xFF, .rx_state = WIFI_RX_NONE};
-    uint32_t data_length = 0;
-    uint32_t i = 0;
-    uint8_t checksum = 0;
+    WiFi_FanoutLink_t *plink;
+    uint32_t image_length = camera_info.fifo_buffer[camera_info.fifo_input].length;
+    uint16_t chunk_size = wifi_chunk_size;
+    uint8_t links = 0;
+    uint8_t link = 0;
+    uint32_t elapsed_ms = 0;
+    uint32_t slowest_ms = 0;
     
-    DBG_SendMessage(DBG_MSG_WIFI_RX, "WiFi: Send Image Data\r\n");   
+    DBG_SendMessage(DBG_MSG_WIFI_RX, "WiFi: Fan-out Image\r\n");   
     
-    packet_id = 1;
-    data_length = camera_info.fifo_buffer[camera_info.fifo_input].length;
-    for(i = 0; i < camera_info.fifo_buffer[camera_info.fifo_input].length; i += WIFI_PACKET_SIZE)
+    METRIC_SET(METRIC_CHUNK_SIZE, chunk_size);
+    
+    /* chunk index of range request is based on this size */
+    if(camera_frame.fifo == camera_info.fifo_input)
     {
-        DBG_SendMessage(DBG_MSG_WIFI_RX, ">");
-
-        if(app_config.esp8266_mode == APP_ESP8266_STATION)
+        camera_frame.chunk = chunk_size;
+    }
+    
+    /* every connected link subscribes this frame */
+    for(link = 0; link < WIFI_LINK_NUM; link++)
+    {
+        if(client_list[link] == 1)
         {
-            //example: AT+CIPSEND=14
-            if(data_length >= WIFI_PACKET_SIZE)
-            {
-                sprintf((char*)tx_buffer, "AT+CIPSEND=%d\r\n", WIFI_PACKET_SIZE + MSG_CMD_SIZE);
-            }
-            else
-            {
-                sprintf((char*)tx_buffer, "AT+CIPSEND=%d\r\n", data_length + MSG_CMD_SIZE);
-            }
+            links |= (1 << link);
         }
-        else
-        {       
-            //example: AT+CIPSEND=0,14
-            if(data_length >= WIFI_PACKET_SIZE)
+    }
+    
+    Send_Fanout(&wifi_send, links, image_length, chunk_size);
+    if(wifi_send.fallback > 0)
+    {
+        /* module can not overlap commands */
+        DBG_SendMessage(DBG_MSG_WIFI_RX, "\r\n\tWiFi Rx: Send Window Fallback\r\n");
+        METRIC_ADD(METRIC_WIFI_RETRY, wifi_send.fallback);
+    }
+    
+    /* per link throughput, the slowest link drives next capture profile */
+    rtn_state = false;
+    for(link = 0; link < WIFI_LINK_NUM; link++)
+    {
+        plink = &wifi_send.link[link];
+        if(plink->state == WIFI_LINK_SENT)
+        {
+            elapsed_ms = (plink->done_tick - plink->start_tick) * portTICK_PERIOD_MS;
+            if(elapsed_ms == 0)
             {
-                sprintf((char*)tx_buffer, "AT+CIPSEND=%d,%d\r\n", client_id_active, WIFI_PACKET_SIZE + MSG_CMD_SIZE);
+                elapsed_ms = 1;
             }
-            else
+            DBG_Sprintf((char *)wifi_message.buf, "\tWiFi Rx: Link %d %d ms %d KB/s\r\n", 
+                        link, elapsed_ms, image_length / elapsed_ms);
+            DBG_SendMessage(DBG_MSG_WIFI_RX, wifi_message.buf);
+            METRIC_INC(METRIC_WIFI_IMAGES);
+            Metrics_Record(METRIC_HIST_DELIVERY, elapsed_ms);
+            if(elapsed_ms > slowest_ms)
             {
-                sprintf((char*)tx_buffer, "AT+CIPSEND=%d,%d\r\n", client_id_active, data_length + MSG_CMD_SIZE);
+                slowest_ms = elapsed_ms;
             }
+            rtn_state = true;
         }
-        WiFi_SendCommand(tx_buffer);
-        
-        if( xQueueReceive(receive_queue, &receive, (TickType_t) WIFI_RX_FB_TIMEOUT))
-        {
-            if(receive.rx_state == WIFI_RX_ATFB_OK)
-            {
-                if( xQueueReceive(receive_queue, &receive, (TickType_t) WIFI_RX_FB_TIMEOUT))
-                {
-                    if(receive.rx_state == WIFI_RX_SEND_READY)
-                    {
-                        rtn_state = true;
-                    }
-                }
-            }
-        }
-        
-        if(rtn_state == true)
-        {
-            wifi_uart_tx_done = false;
-            if(data_length >= WIFI_PACKET_SIZE)
-            {
-                memset(tx_buffer, MSG_START_CODE, MSG_RECOGNIZE_CODE_LEN);
-                tx_buffer[MSG_RECOGNIZE_CODE_LEN] = MSG_PUSH_IMAGE;
-                tx_buffer[MSG_RECOGNIZE_CODE_LEN+1] = packet_id & 0xFF;
-                tx_buffer[MSG_RECOGNIZE_CODE_LEN+2] = (packet_id >> 8) & 0xFF;
-                tx_buffer[MSG_RECOGNIZE_CODE_LEN+3] = WIFI_PACKET_SIZE & 0xFF;
-                tx_buffer[MSG_RECOGNIZE_CODE_LEN+4] = (WIFI_PACKET_SIZE >> 8) & 0xFF;
-                checksum = Mem_GetChecksum8(0, (uint8_t *)&tx_buffer[MSG_RECOGNIZE_CODE_LEN], 5);
-                checksum = Mem_GetChecksum8(checksum, (uint8_t *)&(camera_info.fifo_buffer[camera_info.fifo_input].data[i]), WIFI_PACKET_SIZE);
-                tx_buffer[MSG_RECOGNIZE_CODE_LEN+5] = checksum;
-                memset(&tx_buffer[MSG_RECOGNIZE_CODE_LEN+6], MSG_END_CODE, MSG_RECOGNIZE_CODE_LEN);
-                
-                WiFi_SendData(tx_buffer, MSG_RECOGNIZE_CODE_LEN+5);
-                WiFi_SendData((uint8_t *)&(camera_info.fifo_buffer[camera_info.fifo_input].data[i]), WIFI_PACKET_SIZE);
-                WiFi_SendData(&tx_buffer[MSG_RECOGNIZE_CODE_LEN+5], MSG_RECOGNIZE_CODE_LEN+1);
-                
-                packet_id++;
-                data_length -= WIFI_PACKET_SIZE;
-            }
-            else
-            {
-                memset(tx_buffer, MSG_START_CODE, MSG_RECOGNIZE_CODE_LEN);
-                tx_buffer[MSG_RECOGNIZE_CODE_LEN] = MSG_PUSH_IMAGE;
-                tx_buffer[MSG_RECOGNIZE_CODE_LEN+1] = packet_id & 0xFF;
-                tx_buffer[MSG_RECOGNIZE_CODE_LEN+2] = (packet_id >> 8) & 0xFF;
-                tx_buffer[MSG_RECOGNIZE_CODE_LEN+3] = data_length & 0xFF;
-                tx_buffer[MSG_RECOGNIZE_CODE_LEN+4] = (data_length >> 8) & 0xFF;
-                checksum = Mem_GetChecksum8(0, (uint8_t *)&tx_buffer[MSG_RECOGNIZE_CODE_LEN], 5);
-                checksum = Mem_GetChecksum8(checksum, (uint8_t *)&(camera_info.fifo_buffer[camera_info.fifo_input].data[i]), data_length);
-                tx_buffer[MSG_RECOGNIZE_CODE_LEN+5] = checksum;
-                memset(&tx_buffer[MSG_RECOGNIZE_CODE_LEN+6], MSG_END_CODE, MSG_RECOGNIZE_CODE_LEN);
-                
-                WiFi_SendData(tx_buffer, MSG_RECOGNIZE_CODE_LEN+5);
-                WiFi_SendData((uint8_t *)&(camera_info.fifo_buffer[camera_info.fifo_input].data[i]), data_length);
-                WiFi_SendData(&tx_buffer[MSG_RECOGNIZE_CODE_LEN+5], MSG_RECOGNIZE_CODE_LEN+1);
-                
-                packet_id++;
-                data_length = 0;
-            }
-
-            while(wifi_uart_tx_done == false)
-            {
-                vTaskDelay(5);
-            }
-            
-            if( xQueueReceive(receive_queue, &receive, (TickType_t) WIFI_RX_FB_TIMEOUT))
-            {
-                if(receive.rx_state == WIFI_RX_SEND_OK)
-                {
-                    rtn_state = true;
-                }
-                else
-                {        
-                    rtn_state = false;
-                }
-            }
-        }
-        
-        if(rtn_state == true)
+        else if(plink->state == WIFI_LINK_FAIL)
         {
-            //vTaskDelay(1);
-        }
-        else
-        {
-            break;
+            DBG_Sprintf((char *)wifi_message.buf, "\tWiFi Rx: Link %d Failed\r\n", link);
+            DBG_SendMessage(DBG_MSG_WIFI_RX, wifi_message.buf);
+            METRIC_INC(METRIC_WIFI_IMAGE_FAIL);
         }
     }
-    
-    DBG_SendMessage(DBG_MSG_WIFI_RX, "\r\n");
     if(rtn_state == true)
     {
-        DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Send Image Data OK\r\n");
+        Adapt_LinkDelivery(&camera_adapt, image_length, slowest_ms);
     }
     else
     {
-        DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Send Image Data Failed\r\n");
+        Adapt_LinkFail(&camera_adapt);
     }
+    WiFi_ChunkReport(image_length, chunk_size);
+    WiFi_TxLatencyReport();
     
     return rtn_state;
 }
 
-WiFi_CtrlState_t WiFi_Ctrl_Idle(void)
+/*******************************************************************************
+* @Brief   Preempt Image With Respond
+* @Param   
+* @Note    called between image chunks when no chunk is in flight, send all
+*          queued responds so control latency is bounded by one chunk
+* @Return  true if any respond is sent
+*******************************************************************************/
+bool WiFi_PreemptRespond(void)
 {
-    EventBits_t event_bits; 
-    WiFi_CtrlState_t next_state = WIFI_CTRL_IDLE;
-    WiFi_Receive_t receive = {.client_id = 0xFF, .rx_state = WIFI_RX_NONE};
-    Client_Message_t respond;
+    bool rtn_state = false;
     
-    /* Peek a queue item and check it's type (get item but not remove from queue) */
-    if(xQueuePeek(receive_queue, &receive, (TickType_t) 0))
-    {
-        switch(receive.rx_state)
-        {
-        case WIFI_RX_ID_CONNECT:
-        case WIFI_RX_ID_CLOSED:
-            next_state = WIFI_CTRL_CLIENT_MANAGE;
-            break;
-            
-        case WIFI_RX_IPD_RECEVING:
-        case WIFI_RX_IPD_OK:
-            next_state = WIFI_CTRL_RECE_REQUEST;
-            break;
-            
-        case WIFI_RX_OVERFLOW:
-        case WIFI_RX_IPD_ERROR:
-        default:
-            DBG_SendMessage(DBG_MSG_WIFI_RX, "WiFi: Error Data\r\n");
-            WiFi_ResetRxBuffer();
-            next_state = WIFI_CTRL_IDLE;
-            break;
-            
-        }
-    }
-    else if(xQueuePeek(respond_queue, &respond, (TickType_t) 0))
-    {
-        next_state = WIFI_CTRL_SEND_RESPOND;
-    }
-    else
+    while(uxQueueMessagesWaiting(respond_queue) > 0)
     {
-        if(client_id_active != 0xFF)
-        {
-            /* Get camera push image event */
-            event_bits = xEventGroupWaitBits(camera_event_group,
-                                             CAMERA_EVENT_PUSH_IMAGE,
-                                             pdTRUE,
-                                             pdTRUE,
-                                             0 );
-            
-            if(( event_bits & CAMERA_EVENT_PUSH_IMAGE ) == CAMERA_EVENT_PUSH_IMAGE )
-            {
-                xEventGroupClearBits(camera_event_group, CAMERA_EVENT_PUSH_IMAGE);
-                
-                next_state = WIFI_CTRL_SEND_IMAGE;
-            }
-        }
+        WiFi_Ctrl_SendRespond();
+        rtn_state = true;
     }
     
-    return next_state;
+    return rtn_state;
 }
 
-
-/* UART Function implement ----------------------------------------------------------------------*/
+/*******************************************************************************
+* @Brief   Record Transmit Latency
+* @Param   tx_class[in]: priority class
+*          start_tick[in]: tick when data is ready to send
+* @Note    
+* @Return  
+*******************************************************************************/
+void WiFi_TxLatencyRecord(WiFi_TxClass_t tx_class, TickType_t start_tick)
+{
+    Metrics_Record((Metric_Hist_t)(METRIC_HIST_TX_CONTROL + tx_class), 
+                   (xTaskGetTickCount() - start_tick) * portTICK_PERIOD_MS);
+}
 
 /*******************************************************************************
-* @Brief   Set UART Baudrate 
+* @Brief   Report Transmit Latency
 * @Param   
-* @Note    Set uart baudrate that connect to wifi module
+* @Note    print histogram of each class to debug port, 4 buckets per line,
+*          line starts with ms of its first bucket
 * @Return  
 *******************************************************************************/
-void WiFi_SetUartBaudrate(uint32_t baudrate)
+void WiFi_TxLatencyReport(void)
 {
-    HAL_UART_DeInit(&hwifi_uart);
+    uint8_t i = 0;
+    uint8_t j = 0;
+    uint16_t *hist;
     
-    hwifi_uart.Instance = WIFI_USART;
-    hwifi_uart.Init.BaudRate = baudrate;
-    hwifi_uart.Init.WordLength = UART_WORDLENGTH_8B;
-    hwifi_uart.Init.StopBits = UART_STOPBITS_1;
-    hwifi_uart.Init.Parity = UART_PARITY_NONE;
-    hwifi_uart.Init.Mode = UART_MODE_TX_RX;
-    hwifi_uart.Init.HwFlowCtl = UART_HWCONTROL_NONE;
-    hwifi_uart.Init.OverSampling = UART_OVERSAMPLING_16;
-    if (HAL_UART_Init(&hwifi_uart) != HAL_OK)
+    for(i = 0; i < WIFI_TX_CLASS_NUM; i++)
     {
-        Error_Handler();
+        hist = metrics_hist[METRIC_HIST_TX_CONTROL + i];
+        for(j = 0; j < METRICS_BUCKETS; j += 4)
+        {
+            DBG_Sprintf((char *)wifi_message.buf, "\tTx%d >=%dms: %d %d %d %d\r\n", 
+                        i, (j == 0) ? 0 : (1 << j), hist[j], hist[j+1], hist[j+2], hist[j+3]);
+            DBG_SendMessage(DBG_MSG_WIFI_RX, wifi_message.buf);
+        }
     }
+}
+
+/*******************************************************************************
+* @Brief   Report Chunk Efficiency
+* @Param   image_length[in]: jpg size
+*          chunk_size[in]: payload bytes of one packet
+* @Note    frame overhead of every packet by protocol version, file info included
+* @Return  
+*******************************************************************************/
+void WiFi_ChunkReport(uint32_t image_length, uint16_t chunk_size)
+{
+    uint32_t chunks = (image_length + chunk_size - 1) / chunk_size;
+    uint32_t overhead = (chunks + 1) * WiFi_FrameSize(client_id_active, 0);
+    uint32_t permille = (overhead * 1000) / (image_length + overhead);
     
-    WiFi_ResetRxBuffer();
+    DBG_Sprintf((char *)wifi_message.buf, "\tChunk %d x %d, overhead %d.%d%%\r\n", 
+                chunk_size, chunks, permille / 10, permille % 10);
+    DBG_SendMessage(DBG_MSG_WIFI_RX, wifi_message.buf);
 }
 
+#ifdef EN_DEBUG
 /*******************************************************************************
-* @Brief   Send Command to WiFi Module
+* @Brief   Frame Check Benchmark
 * @Param   
-* @Note    Send AT commandto wifi module
+* @Note    cpu cycles by DWT->CYCCNT of CRC32_Calculate (crc unit), table crc
+*          (used when unit is busy) and Mem_GetChecksum8 over one chunk of
+*          camera buffer in sram, interrupts masked while counting
 * @Return  
 *******************************************************************************/
-bool WiFi_SendCommand(uint8_t *cmd)
+void WiFi_FrameCheckBench(void)
 {
-    WiFi_ResetRxBuffer();
+    uint8_t *data = camera_info.fifo_buffer[0].data;
+    uint32_t cycles[3];
+    uint32_t start = 0;
+    volatile uint32_t result = 0;
+    
+    /* enable cycle counter, debugger may have done it already */
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    
+    taskENTER_CRITICAL();
+    start = DWT->CYCCNT;
+    result = CRC32_Calculate(CRC32_INIT, data, WIFI_CHUNK_DEFAULT);
+    cycles[0] = DWT->CYCCNT - start;
     
-    if( HAL_UART_Transmit_DMA(&hwifi_uart, cmd, strlen((const char*)cmd)) == HAL_OK )
+    start = DWT->CYCCNT;
+    result = CRC32_Software(CRC32_INIT, data, WIFI_CHUNK_DEFAULT);
+    cycles[1] = DWT->CYCCNT - start;
+    
+    start = DWT->CYCCNT;
+    result = Mem_GetChecksum8(0, data, WIFI_CHUNK_DEFAULT);
+    cycles[2] = DWT->CYCCNT - start;
+    taskEXIT_CRITICAL();
+    (void)result;
+    
+    DBG_Sprintf((char *)wifi_message.buf, "\tCRC %dB: unit %d table %d cyc\r\n", 
+                WIFI_CHUNK_DEFAULT, cycles[0], cycles[1]);
+    DBG_SendMessage(DBG_MSG_WIFI_RX, wifi_message.buf);
+    DBG_Sprintf((char *)wifi_message.buf, "\tSum8 %dB: %d cyc\r\n", 
+                WIFI_CHUNK_DEFAULT, cycles[2]);
+    DBG_SendMessage(DBG_MSG_WIFI_RX, wifi_message.buf);
+}
+#endif /* EN_DEBUG */
+
+/*******************************************************************************
+* @Brief   Pack Image File Info
+* @Param   link[in]: link the frame is for
+*          data_length[in]: jpg file size
+*          pfilename[in]: jpg filename
+* @Note    frame of packet_id 0 is built in tx_buffer
+* @Return  frame length
+*******************************************************************************/
+uint16_t WiFi_PackImageFileInfo(uint8_t link, uint32_t data_length, uint8_t *pfilename)
+{
+    uint8_t tail = 0;
+    
+    memset(tx_buffer, MSG_START_CODE, MSG_RECOGNIZE_CODE_LEN);
+    tx_buffer[MSG_RECOGNIZE_CODE_LEN] = MSG_PUSH_IMAGE;
+    tx_buffer[MSG_RECOGNIZE_CODE_LEN+1] = 0;
+    tx_buffer[MSG_RECOGNIZE_CODE_LEN+2] = 0;
+    tx_buffer[MSG_RECOGNIZE_CODE_LEN+3] = WIFI_FILE_INFO_LEN & 0xFF;
+    tx_buffer[MSG_RECOGNIZE_CODE_LEN+4] = (WIFI_FILE_INFO_LEN >> 8) & 0xFF;
+    tx_buffer[MSG_RECOGNIZE_CODE_LEN+5] = data_length & 0xFF;
+    tx_buffer[MSG_RECOGNIZE_CODE_LEN+6] = (data_length >> 8) & 0xFF;
+    tx_buffer[MSG_RECOGNIZE_CODE_LEN+7] = (data_length >> 16) & 0xFF;
+    tx_buffer[MSG_RECOGNIZE_CODE_LEN+8] = (data_length >> 24) & 0xFF;
+    memcpy(&tx_buffer[MSG_RECOGNIZE_CODE_LEN+9], pfilename, CAMERA_FILENAME_SIZE);
+    tail = WiFi_PackFrameTail(link, &tx_buffer[MSG_RECOGNIZE_CODE_LEN], 5, &tx_buffer[MSG_RECOGNIZE_CODE_LEN+5], 
+                              WIFI_FILE_INFO_LEN, &tx_buffer[MSG_RECOGNIZE_CODE_LEN+5+WIFI_FILE_INFO_LEN]);
+    
+    return MSG_RECOGNIZE_CODE_LEN + 5 + WIFI_FILE_INFO_LEN + tail;
+}
+
+/*******************************************************************************
+* @Brief   Frame Size
+* @Param   link[in]: link the frame is for
+*          length[in]: payload length
+* @Note    
+* @Return  bytes of frame in protocol version of link
+*******************************************************************************/
+uint16_t WiFi_FrameSize(uint8_t link, uint16_t length)
+{
+    if((link < WIFI_LINK_NUM) && (client_version[link] == MSG_PROTOCOL_V2))
     {
-        while(__HAL_UART_GET_FLAG(&hwifi_uart, UART_FLAG_TC) == false);
-        __HAL_UART_CLEAR_FLAG(&hwifi_uart, UART_FLAG_TC);
-        return true;
+        return length + MSG_CMD_SIZE_V2;
     }
-    else
+    return length + MSG_CMD_SIZE;
+}
+
+/*******************************************************************************
+* @Brief   Pack Frame Tail
+* @Param   link[in]: link the frame is for
+*          head[in]: command, index and length, may be followed by payload head
+*          head_length[in]: 5 + bytes of payload head
+*          data[in]: rest of payload
+*          length[in]: data length
+*          tail[out]: checksum or crc32 and end code
+* @Note    v1: checksum8, v2: crc32 little endian, CRC unit does the payload
+* @Return  bytes of tail
+*******************************************************************************/
+uint8_t WiFi_PackFrameTail(uint8_t link, const uint8_t *head, uint8_t head_length, const uint8_t *data, uint16_t length, uint8_t *tail)
+{
+    uint32_t crc = 0;
+    
+    if((link < WIFI_LINK_NUM) && (client_version[link] == MSG_PROTOCOL_V2))
     {
-        return false;
+        crc = CRC32_Calculate(CRC32_INIT, head, head_length);
+        crc = CRC32_Calculate(crc, data, length);
+        tail[0] = crc & 0xFF;
+        tail[1] = (crc >> 8) & 0xFF;
+        tail[2] = (crc >> 16) & 0xFF;
+        tail[3] = (crc >> 24) & 0xFF;
+        memset(&tail[4], MSG_END_CODE, MSG_RECOGNIZE_CODE_LEN);
+        return 4 + MSG_RECOGNIZE_CODE_LEN;
     }
+    
+    tail[0] = Mem_GetChecksum8(0, (uint8_t *)head, head_length);
+    tail[0] = Mem_GetChecksum8(tail[0], (uint8_t *)data, length);
+    memset(&tail[1], MSG_END_CODE, MSG_RECOGNIZE_CODE_LEN);
+    return 1 + MSG_RECOGNIZE_CODE_LEN;
 }
 
 /*******************************************************************************
-* @Brief   Send Data to WiFi Module
+* @Brief   Preview Link
 * @Param   
-* @Note    Send image data in raw byte format
+* @Note    Close link of last viewer, then open UDP link to new viewer. 
+*          Camera starts preview capture after link is open.
 * @Return  
 *******************************************************************************/
-bool WiFi_SendData(uint8_t *data, uint16_t length)
+bool WiFi_Ctrl_PreviewLink(void)
 {
-    if( HAL_UART_Transmit_DMA(&hwifi_uart, data, length) == HAL_OK )
+    bool rtn_state = false;
+    WiFi_Receive_t receive = {.client_id = 0xFF, .rx_state = WIFI_RX_NONE};
+    
+    /* take last request, a newer one sets preview_request again */
+    taskENTER_CRITICAL();
+    preview_viewer = preview_next;
+    preview_request = false;
+    camera_preview.active = false;
+    taskEXIT_CRITICAL();
+    
+    /*-------------- Close Last Viewer -----------------*/
+    if(preview_link == true)
     {
-        while(__HAL_UART_GET_FLAG(&hwifi_uart, UART_FLAG_TC) == false);
-        __HAL_UART_CLEAR_FLAG(&hwifi_uart, UART_FLAG_TC);
+        sprintf((char*)tx_buffer, "AT+CIPCLOSE=%d\r\n", WIFI_PREVIEW_LINK);
+        WiFi_SendCommand(tx_buffer);
+        xQueueReceive(receive_queue, &receive, (TickType_t) WIFI_RX_FB_TIMEOUT);
+        preview_link = false;
+        WiFi_FlushReply();
+    }
+    
+    if(preview_viewer.port == 0)
+    {
+        DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Preview Stop\r\n");
         return true;
     }
-    else
+    
+    /*-------------- Open UDP Link -----------------*/
+    //example: AT+CIPSTART=4,"UDP","192.168.4.2",5000
+    sprintf((char*)tx_buffer, "AT+CIPSTART=%d,\"UDP\",\"%d.%d.%d.%d\",%d\r\n", WIFI_PREVIEW_LINK, 
+            preview_viewer.ip[0], preview_viewer.ip[1], preview_viewer.ip[2], preview_viewer.ip[3], 
+            preview_viewer.port);
+    WiFi_SendCommand(tx_buffer);
+    
+    /* Receive rx_state until get result state or timeout */
+    if( xQueueReceive(receive_queue, &receive, (TickType_t) WIFI_RX_FB_TIMEOUT))
     {
-        return false;
+        if(receive.rx_state == WIFI_RX_ATFB_OK)
+        {
+            DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Preview Start\r\n");
+            preview_link = true;
+            preview_frame_id = 0;
+            camera_preview.format = preview_viewer.format;
+            camera_preview.interval = preview_viewer.interval;
+            camera_preview.active = true;
+            rtn_state = true;
+        }
+        else
+        {
+            DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Preview Link Failed\r\n");
+        }
     }
+    
+    WiFi_FlushReply();
+    return rtn_state;
 }
 
 /*******************************************************************************
-* @Brief   Reset Rx Buffer
+* @Brief   Send Preview Frame
 * @Param   
-* @Note    Reset all rx buffer
+* @Note    Frame is split to datagrams with frame id and fragment header, 
+*          viewer drops a frame with lost fragment instead of waiting for it.
+*          Control respond is sent between datagrams.
 * @Return  
 *******************************************************************************/
-void WiFi_ResetRxBuffer(void)
+bool WiFi_Ctrl_SendPreview(void)
 {
-    HAL_UART_AbortReceive(&hwifi_uart);
+    bool rtn_state = preview_link;
+    uint8_t *image = camera_info.fifo_buffer[camera_preview.fifo].data;
+    uint32_t image_length = camera_info.fifo_buffer[camera_preview.fifo].length;
+    uint32_t offset = 0;
+    uint16_t chunk = 0;
+    uint8_t frag = 0;
+    uint8_t frag_count = (image_length + WIFI_PREVIEW_PAYLOAD - 1) / WIFI_PREVIEW_PAYLOAD;
+    uint8_t outstanding = 0;
+    WiFi_TxDesc_t chain[2];
+    
+    for(frag = 0; (frag < frag_count) && (rtn_state == true); frag++)
+    {
+        WiFi_PreemptRespond();
+        
+        chunk = ((image_length - offset) >= WIFI_PREVIEW_PAYLOAD) ? WIFI_PREVIEW_PAYLOAD : (image_length - offset);
+        
+        //example: AT+CIPSEND=4,1472
+        sprintf((char*)tx_buffer, "AT+CIPSEND=%d,%d\r\n", WIFI_PREVIEW_LINK, chunk + WIFI_PREVIEW_HEAD_SIZE);
+        WiFi_SendCommand(tx_buffer);
+        if(WiFi_WaitSendEvent(WIFI_RX_SEND_READY, &outstanding) != WIFI_RX_SEND_READY)
+        {
+            rtn_state = false;
+            break;
+        }
+        
+        preview_head[0] = WIFI_PREVIEW_MAGIC;
+        preview_head[1] = camera_preview.format;
+        preview_head[2] = preview_frame_id & 0xFF;
+        preview_head[3] = (preview_frame_id >> 8) & 0xFF;
+        preview_head[4] = frag;
+        preview_head[5] = frag_count;
+        preview_head[6] = chunk & 0xFF;
+        preview_head[7] = (chunk >> 8) & 0xFF;
+        
+        chain[0].data = preview_head;
+        chain[0].length = WIFI_PREVIEW_HEAD_SIZE;
+        chain[1].data = &image[offset];
+        chain[1].length = chunk;
+        if(WiFi_SendChain(chain, 2) == false)
+        {
+            rtn_state = false;
+            break;
+        }
+        
+        outstanding = 1;
+        if(WiFi_WaitSendEvent(WIFI_RX_SEND_OK, &outstanding) != WIFI_RX_SEND_OK)
+        {
+            rtn_state = false;
+            break;
+        }
+        offset += chunk;
+    }
     
-    memset(rx_buffer, 0, WIFI_RX_BUF_SIZE);
-    memset(client_data, 0, WIFI_DATA_BUF_SIZE);
+    if(rtn_state == false)
+    {
+        DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Preview Frame Dropped\r\n");
+    }
     
-    rx_index = 0;
-    line_start = 0;
-    //client_id_active = 0xFF;    
-    client_data_size = 0;
-    client_data_index = 0;
+    /* camera may capture to this fifo again */
+    preview_frame_id++;
+    camera_preview.sending = false;
     
-    xQueueReset(receive_queue);
-    wifi_rx_state = WIFI_RX_NONE;
-    HAL_UART_Receive_DMA(&hwifi_uart, rx_buffer, 1);
+    return rtn_state;
 }
 
 /*******************************************************************************
-* @Brief   UART Receive Complete Callback
+* @Brief   Send Image Range
 * @Param   
-* @Note    Update receive index
+* @Note    stop and wait, one MSG_PUSH_RANGE frame per chunk, payload is 
+*          offset + jpg data read in place from the kept fifo
 * @Return  
 *******************************************************************************/
-void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+bool WiFi_Ctrl_SendRange(void)
 {
-    uint16_t i = 0;
-    BaseType_t xHigherPriorityTaskWoken;
-    WiFi_Receive_t receive = {.client_id = 0xFF, .rx_state = WIFI_RX_NONE};
+    bool rtn_state = true;
+    uint8_t link = wifi_range.link;
+    uint8_t *image = camera_info.fifo_buffer[camera_frame.fifo].data;
+    uint32_t offset = wifi_range.offset;
+    uint32_t end = wifi_range.offset + wifi_range.length;
+    uint16_t chunk = 0;
+    uint8_t outstanding = 0;
+    uint8_t *head = &tx_buffer[MSG_RECOGNIZE_CODE_LEN];
+    TickType_t chunk_tick = 0;
+    WiFi_TxDesc_t chain[3];
     
-    /* We have not woken a task at the start of the ISR. */
-	xHigherPriorityTaskWoken = pdFALSE;
-    push_event = false;
+    DBG_SendMessage(DBG_MSG_WIFI_RX, "WiFi: Send Image Range\r\n");   
     
-    if(huart == &hwifi_uart)
+    while((offset < end) && (rtn_state == true))
     {
-        /* one byte received, update the index */
-        rx_index++;
-        if(rx_index >= WIFI_RX_BUF_SIZE)
-        {
-            rx_index = 0;
-            line_start = 0;
-            wifi_rx_state = WIFI_RX_OVERFLOW;
-            receive.rx_state = WIFI_RX_OVERFLOW;
-            push_event = true;
-        }
+        WiFi_PreemptRespond();
+        
+        chunk = ((end - offset) >= wifi_range.chunk) ? wifi_range.chunk : (end - offset);
+        chunk_tick = xTaskGetTickCount();
         
-        /* Check packet header type ------------------------------------------*/
-        if(rx_index == 1)
+        if(wifi_passthrough == false)
         {
-            if(rx_buffer[0] == 'A')
-            {
-                /* A */
-                wifi_rx_state = WIFI_RX_ATFB;
-            }
-            else if((rx_buffer[0] == '+'))
-            {
-                /* + */
-                wifi_rx_state = WIFI_RX_IPD;
-                client_data_index = 0;
-                client_data_size = 0;
-            }
-            else if((rx_buffer[0] >= '0') && (rx_buffer[0] <= '4'))
-            {
-                /* n */
-                wifi_rx_state = WIFI_RX_ID;
-            }
-            else if(rx_buffer[0] == 'R')
-            {
-                /* R */
-                wifi_rx_state = WIFI_RX_RECV;
-            }
-            else if(rx_buffer[0] == 'E')
+            if(app_config.esp8266_mode == APP_ESP8266_STATION)
             {
-                /* E */
-                wifi_rx_state = WIFI_RX_ERROR;
-            }
-            else if(rx_buffer[0] == '>')
-            {
-                /* > */
-                wifi_rx_state = WIFI_RX_SEND_READY;
-                receive.rx_state = WIFI_RX_SEND_READY;
-                push_event = true;
-            }
-            else if(rx_buffer[0] == 'C')
-            {
-                /* C */
-                wifi_rx_state = WIFI_RX_CLOSED;
+                //example: AT+CIPSEND=14
+                sprintf((char*)tx_buffer, "AT+CIPSEND=%d\r\n", WiFi_FrameSize(link, chunk + WIFI_RANGE_HEAD_SIZE));
             }
             else
+            {       
+                //example: AT+CIPSEND=0,14
+                sprintf((char*)tx_buffer, "AT+CIPSEND=%d,%d\r\n", link, WiFi_FrameSize(link, chunk + WIFI_RANGE_HEAD_SIZE));
+            }
+            WiFi_SendCommand(tx_buffer);
+            if(WiFi_WaitSendEvent(WIFI_RX_SEND_READY, &outstanding) != WIFI_RX_SEND_READY)
             {
-                wifi_rx_state = WIFI_RX_NONE;
-                rx_buffer[0] = 0;
-                rx_index = 0;
-                line_start = 0;         
+                rtn_state = false;
+                break;
             }
         }
-        /* Recevive all packet according to header type ----------------------*/
-        else
+        
+        memset(tx_buffer, MSG_START_CODE, MSG_RECOGNIZE_CODE_LEN);
+        head[0] = MSG_PUSH_RANGE;
+        head[1] = wifi_range.frame_id & 0xFF;
+        head[2] = (wifi_range.frame_id >> 8) & 0xFF;
+        head[3] = (chunk + WIFI_RANGE_HEAD_SIZE) & 0xFF;
+        head[4] = ((chunk + WIFI_RANGE_HEAD_SIZE) >> 8) & 0xFF;
+        head[5] = offset & 0xFF;
+        head[6] = (offset >> 8) & 0xFF;
+        head[7] = (offset >> 16) & 0xFF;
+        head[8] = (offset >> 24) & 0xFF;
+        
+        chain[0].data = tx_buffer;
+        chain[0].length = MSG_RECOGNIZE_CODE_LEN + 5 + WIFI_RANGE_HEAD_SIZE;
+        chain[1].data = &image[offset];
+        chain[1].length = chunk;
+        chain[2].data = &tx_buffer[chain[0].length];
+        chain[2].length = WiFi_PackFrameTail(link, head, 5 + WIFI_RANGE_HEAD_SIZE, &image[offset], chunk, chain[2].data);
+        if(WiFi_SendChain(chain, 3) == false)
+        {
+            rtn_state = false;
+            break;
+        }
+        
+        if(wifi_passthrough == false)
         {
-            switch(wifi_rx_state)
+            outstanding = 1;
+            if(WiFi_WaitSendEvent(WIFI_RX_SEND_OK, &outstanding) != WIFI_RX_SEND_OK)
             {
-            case WIFI_RX_ATFB:
-                if(rx_buffer[rx_index - 1] == '\n')
-                {
-                    /* OK\r\n(4bytes)  --  ERROR\r\n(7bytes) or FAIL\r\n(6bytes) or CLOSED\r\n(8bytes) */
-                    if(((rx_index - line_start) >= 4) && ((rx_index - line_start) <= 8))
-                    {
-                        if(memcmp(&(rx_buffer[rx_index - 4]), "OK", 2) == 0)
-                        {
-                            if(memcmp(&(rx_buffer[0]), "AT+CIPSTAMAC?", 13) == 0)
-                            {
-                                memcpy(&wifi_mac_string[0], &rx_buffer[28], 17);
-                                wifi_mac_string[17] = '\0';
-                            }
-                            else if(memcmp(&(rx_buffer[0]), "AT+CIPSTA?", 10) == 0)
-                            {
-                                memcpy(&wifi_ip_string[0], &rx_buffer[24], 15);
-                                wifi_ip_string[15] = '\0';
-                            }
-
-                            wifi_rx_state = WIFI_RX_ATFB_OK;
-                            receive.rx_state = WIFI_RX_ATFB_OK;
-                            push_event = true;
-                        }
-                        else if(memcmp(&(rx_buffer[rx_index - 7]), "ERROR", 5) == 0)
-                        {
-                            wifi_rx_state = WIFI_RX_ATFB_ERROR;
-                            receive.rx_state = WIFI_RX_ATFB_ERROR;
-                            push_event = true;
-                        }
-                        else if(memcmp(&(rx_buffer[rx_index - 6]), "FAIL", 4) == 0)
-                        {               
-                            wifi_rx_state = WIFI_RX_ATFB_FAIL;
-                            receive.rx_state = WIFI_RX_ATFB_FAIL;
-                            push_event = true;
-                        }
-                        else if(memcmp(&(rx_buffer[rx_index - 8]), "CLOSED", 6) == 0)
-                        {               
-                            wifi_rx_state = WIFI_RX_ATFB_CLOSED;
-                            receive.rx_state = WIFI_RX_ATFB_CLOSED;
-                            push_event = true;
-                        }
-                    }
-                    
-                    line_start = rx_index;
-                }
-                break;
-                
-            case WIFI_RX_IPD:
-                if (rx_buffer[rx_index - 1] == ':')
-                {
-                    if (app_config.esp8266_mode == APP_ESP8266_STATION)
-                    {
-                        /* Station mode: TCP single client, IPD has no client id */
-                        if (rx_index > 6)
-                        {
-                            client_id_active = 0;
-                            client_data_size = 0;
-                            for (i = 5; i < (rx_index - 1); i++)
-                            {
-                                client_data_size *= 10;
-                                client_data_size += (rx_buffer[i] - '0');
-                            }
-
-                            wifi_rx_state = WIFI_RX_IPD_RECEVING;
-                            client_data_index = 0;
-                            receive.client_id = client_id_active;
-                            receive.rx_state = WIFI_RX_IPD_RECEVING;
-                        }
-                        else
-                        {
-                            wifi_rx_state = WIFI_RX_IPD_ERROR;
-                            receive.rx_state = WIFI_RX_IPD_ERROR;
-                        }
-                    }
-                    else
-                    {
-                        /* AP mode: TCP Multi-Client, IPD include client id */
-                        if (rx_index > 8)
-                        {
-                            client_id_active = rx_buffer[5] - '0';
-                            client_data_size = 0;
-                            for (i = 7; i < (rx_index - 1); i++)
-                            {
-                                client_data_size *= 10;
-                                client_data_size += (rx_buffer[i] - '0');
-                            }
-
-                            wifi_rx_state = WIFI_RX_IPD_RECEVING;
-                            client_data_index = 0;
-                            receive.client_id = client_id_active;
-                            receive.rx_state = WIFI_RX_IPD_RECEVING;
-                        }
-                        else
-                        {
-                            wifi_rx_state = WIFI_RX_IPD_ERROR;
-                            receive.rx_state = WIFI_RX_IPD_ERROR;
-                        }
-                    }
-                    push_event = true;
-                }
-                break;
-                
-            case WIFI_RX_IPD_RECEVING:
-                client_data_index++;  
-                rx_index--;
-                if(client_data_index >= client_data_size)
-                {
-                    wifi_rx_state = WIFI_RX_IPD_OK;
-                    receive.client_id = client_id_active;
-                    receive.rx_state = WIFI_RX_IPD_OK;
-                    push_event = true;
-                }
-                break;
-                
-            case WIFI_RX_ID:
-                if(rx_buffer[rx_index - 1] == '\n')
-                {
-                    if(memcmp(&(rx_buffer[2]), "CLOSED", 6) == 0)
-                        //if((rx_buffer[2] == 'C') && (rx_buffer[3] == 'L') && (rx_buffer[4] == 'O') && (rx_buffer[5] == 'S'))
-                    {
-                        client_list[(rx_buffer[0] - '0')] = 0;
-                        wifi_rx_state = WIFI_RX_ID_CLOSED;
-                        receive.client_id = rx_buffer[0] - '0';
-                        receive.rx_state = WIFI_RX_ID_CLOSED;
-                        push_event = true;
-                    }
-                    else if(memcmp(&(rx_buffer[2]), "CONNECT", 7) == 0)
-                        //else if((rx_buffer[2] == 'C') && (rx_buffer[3] == 'O') && (rx_buffer[4] == 'N') && (rx_buffer[5] == 'N'))
-                    {
-                        client_list[(rx_buffer[0] - '0')] = 1;
-                        wifi_rx_state = WIFI_RX_ID_CONNECT;
-                        receive.client_id = rx_buffer[0] - '0';
-                        client_id_active = receive.client_id;
-                        receive.rx_state = WIFI_RX_ID_CONNECT;
-                        push_event = true;
-                    }               
-                    else
-                    {
-                        wifi_rx_state = WIFI_RX_ERROR;
-                        receive.rx_state = WIFI_RX_ERROR;
-                        push_event = true;
-                    }
-                }
-                break;
-                
-            case WIFI_RX_RECV:
-                if(rx_buffer[rx_index - 1] == '\n')
-                {
-                    if(memcmp(&(rx_buffer[line_start]), "SEND OK", 7) == 0)
-                        //if((rx_buffer[rx_index - 3] == 'O') && (rx_buffer[rx_index - 2] == 'K'))
-                    {
-                        wifi_rx_state = WIFI_RX_SEND_OK;
-                        receive.rx_state = WIFI_RX_SEND_OK;
-                        push_event = true;
-                    }
-                    else if(memcmp(&(rx_buffer[line_start]), "SEND FAIL", 9) == 0)
-                        //else if((rx_buffer[rx_index - 5] == 'F') && (rx_buffer[rx_index - 4] == 'A') && (rx_buffer[rx_index - 3] == 'I') && (rx_buffer[rx_index - 2] == 'L'))
-                    {               
-                        wifi_rx_state = WIFI_RX_SEND_FAIL;
-                        receive.rx_state = WIFI_RX_SEND_FAIL;
-                        push_event = true;
-                    }
-                    
-                    line_start = rx_index;
-                }
-                break;
-                
-            case WIFI_RX_ERROR:
-                /* Wait for full packet */
-                if(rx_buffer[rx_index - 1] == '\n')
-                {
-                    receive.rx_state = WIFI_RX_ERROR;
-                    push_event = true;
-                }
+                rtn_state = false;
                 break;
+            }
+        }
+        WiFi_TxLatencyRecord(WIFI_TX_IMAGE, chunk_tick);
+        offset += chunk;
+    }
+    
+    if(rtn_state == false)
+    {
+        DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Image Range Dropped\r\n");
+    }
+    
+    /* camera may capture to this fifo again */
+    camera_frame.reading = false;
+    wifi_range.request = false;
+    
+    return rtn_state;
+}
+
+/*******************************************************************************
+* @Brief   Wait Image Send Event
+* @Param   target[in]: expect event
+*          outstanding[in/out]: chunks waiting for SEND OK
+* @Note    SEND OK of pipelined chunks is counted on the way, OK and other
+*          data are skipped. Waiting for '>' goes on after SEND OK of an
+*          earlier chunk, it normally comes first
+* @Return  target, SEND_OK when waiting for RECV, or the error event,
+*          WIFI_RX_NONE when timeout
+*******************************************************************************/
+WiFi_RxState_t WiFi_WaitSendEvent(WiFi_RxState_t target, uint8_t *outstanding)
+{
+    return Send_WaitEvent(&wifi_send, target, outstanding);
+}
+
+/*******************************************************************************
+* @Brief   Send Window Hooks
+* @Param   
+* @Note    receive queue, AT+CIPSEND and frames of camera buffer for wifi_send,
+*          image is the one of WiFi_Ctrl_SendImage or WiFi_Ctrl_FanoutImage
+* @Return  
+*******************************************************************************/
+bool WiFi_SendHookReceive(WiFi_RxState_t *state, void *context)
+{
+    WiFi_Receive_t receive = {.client_id = 0xFF, .rx_state = WIFI_RX_NONE};
+    
+    if(xQueueReceive(receive_queue, &receive, (TickType_t) WIFI_RX_FB_TIMEOUT) != pdTRUE)
+    {
+        return false;
+    }
+    *state = receive.rx_state;
+    return true;
+}
+
+void WiFi_SendHookCommand(uint8_t link, uint16_t packet, uint16_t length, bool flush, void *context)
+{
+    length = WiFi_FrameSize(link, (packet == 0) ? WIFI_FILE_INFO_LEN : length);
+    
+    DBG_SendMessage(DBG_MSG_WIFI_RX, ">");
+    if(app_config.esp8266_mode == APP_ESP8266_STATION)
+    {
+        //example: AT+CIPSEND=14
+        sprintf((char*)tx_buffer, "AT+CIPSEND=%d\r\n", length);
+    }
+    else
+    {       
+        //example: AT+CIPSEND=0,14
+        sprintf((char*)tx_buffer, "AT+CIPSEND=%d,%d\r\n", link, length);
+    }
+    
+    if(flush == true)
+    {
+        WiFi_SendCommand(tx_buffer);
+    }
+    else
+    {
+        WiFi_SendData(tx_buffer, strlen((const char*)tx_buffer));
+    }
+}
+
+bool WiFi_SendHookData(uint8_t link, uint16_t packet, uint32_t offset, uint16_t length, void *context)
+{
+    uint8_t *image = camera_info.fifo_buffer[camera_info.fifo_input].data;
+    
+    if(packet == 0)
+    {
+        length = WiFi_PackImageFileInfo(link, camera_info.fifo_buffer[camera_info.fifo_input].length, 
+                                        camera_info.fifo_buffer[camera_info.fifo_input].filename);
+        return WiFi_SendData(tx_buffer, length);
+    }
+    packet_id = packet;
+    return WiFi_SendImagePacket(link, &image[offset], length);
+}
+
+bool WiFi_SendHookPending(void *context)
+{
+    return uxQueueMessagesWaiting(respond_queue) > 0;
+}
+
+void WiFi_SendHookPreempt(void *context)
+{
+    WiFi_PreemptRespond();
+}
+
+uint32_t WiFi_SendHookTick(void *context)
+{
+    return xTaskGetTickCount();
+}
+
+void WiFi_SendHookAccepted(uint32_t tick, void *context)
+{
+    WiFi_TxLatencyRecord(WIFI_TX_IMAGE, tick);
+}
+
+bool WiFi_SendHookConnected(uint8_t link, void *context)
+{
+    return client_list[link] == 1;
+}
+
+/*******************************************************************************
+* @Brief   Send Image Packet
+* @Param   link[in]: link the frame is for
+*          data[in]: jpg data of this packet
+*          length[in]: data length
+* @Note    frame = start code + cmd + id + length + data + checksum + end code,
+*          jpg data is sent from camera buffer without copy
+* @Return  
+*******************************************************************************/
+bool WiFi_SendImagePacket(uint8_t link, uint8_t *data, uint16_t length)
+{
+    WiFi_TxDesc_t chain[3];
+    
+    memset(tx_buffer, MSG_START_CODE, MSG_RECOGNIZE_CODE_LEN);
+    tx_buffer[MSG_RECOGNIZE_CODE_LEN] = MSG_PUSH_IMAGE;
+    tx_buffer[MSG_RECOGNIZE_CODE_LEN+1] = packet_id & 0xFF;
+    tx_buffer[MSG_RECOGNIZE_CODE_LEN+2] = (packet_id >> 8) & 0xFF;
+    tx_buffer[MSG_RECOGNIZE_CODE_LEN+3] = length & 0xFF;
+    tx_buffer[MSG_RECOGNIZE_CODE_LEN+4] = (length >> 8) & 0xFF;
+    
+    chain[0].data = tx_buffer;
+    chain[0].length = MSG_RECOGNIZE_CODE_LEN+5;
+    chain[1].data = data;
+    chain[1].length = length;
+    chain[2].data = &tx_buffer[MSG_RECOGNIZE_CODE_LEN+5];
+    chain[2].length = WiFi_PackFrameTail(link, &tx_buffer[MSG_RECOGNIZE_CODE_LEN], 5, data, length, chain[2].data);
+    
+    return WiFi_SendChain(chain, 3);
+}
+
+/*******************************************************************************
+* @Brief   Send Image Data
+* @Param   
+* @Note    Sliding window upload of Send_Image: next AT+CIPSEND is sent once
+*          module prints "Recv n bytes" for the previous chunk, up to 
+*          WIFI_SEND_WINDOW chunks wait for SEND OK at the same time. When 
+*          module is busy the window falls back to 1 (stop and wait) for the
+*          rest of image. Passthrough sends packets back to back.
+* @Return  
+*******************************************************************************/
+bool WiFi_Ctrl_SendImage(void)
+{
+    bool rtn_state = true;
+    uint8_t *image = camera_info.fifo_buffer[camera_info.fifo_input].data;
+    uint32_t image_length = camera_info.fifo_buffer[camera_info.fifo_input].length;
+    uint32_t offset = 0;
+    uint16_t chunk_size = wifi_chunk_size;
+    uint16_t chunk = 0;
+    TickType_t start_tick = xTaskGetTickCount();
+    TickType_t chunk_tick = 0;
+    uint32_t elapsed_ms = 0;
+    
+    DBG_SendMessage(DBG_MSG_WIFI_RX, "WiFi: Send Image Data\r\n");   
+    
+    METRIC_SET(METRIC_CHUNK_SIZE, chunk_size);
+    
+    /* chunk index of range request is based on this size */
+    if(camera_frame.fifo == camera_info.fifo_input)
+    {
+        camera_frame.chunk = chunk_size;
+    }
+    
+    if(wifi_passthrough == true)
+    {
+        /* transparent transmission, no AT exchange per packet */
+        packet_id = 1;
+        while((offset < image_length) && (rtn_state == true))
+        {
+            DBG_SendMessage(DBG_MSG_WIFI_RX, ">");
+            
+            chunk = ((image_length - offset) >= chunk_size) ? chunk_size : (image_length - offset);
+            chunk_tick = xTaskGetTickCount();
+            
+            WiFi_PreemptRespond();
+            rtn_state = WiFi_SendImagePacket(client_id_active, &image[offset], chunk);
+            WiFi_TxLatencyRecord(WIFI_TX_IMAGE, chunk_tick);
+            packet_id++;
+            offset += chunk;
+        }
+    }
+    else
+    {
+        rtn_state = Send_Image(&wifi_send, client_id_active, image_length, chunk_size, WIFI_SEND_WINDOW);
+        if(wifi_send.fallback > 0)
+        {
+            /* module can not overlap commands */
+            DBG_SendMessage(DBG_MSG_WIFI_RX, "\r\n\tWiFi Rx: Send Window Fallback\r\n");
+            METRIC_ADD(METRIC_WIFI_RETRY, wifi_send.fallback);
+        }
+    }
+    
+    DBG_SendMessage(DBG_MSG_WIFI_RX, "\r\n");
+    if(rtn_state == true)
+    {
+        elapsed_ms = (xTaskGetTickCount() - start_tick) * portTICK_PERIOD_MS;
+        if(elapsed_ms == 0)
+        {
+            elapsed_ms = 1;
+        }
+        DBG_Sprintf((char *)wifi_message.buf, "\tWiFi Rx: Image %d B %d ms %d KB/s\r\n", 
+                    image_length, elapsed_ms, image_length / elapsed_ms);
+        DBG_SendMessage(DBG_MSG_WIFI_RX, wifi_message.buf);
+        DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Send Image Data OK\r\n");
+        METRIC_INC(METRIC_WIFI_IMAGES);
+        Metrics_Record(METRIC_HIST_DELIVERY, elapsed_ms);
+        Adapt_LinkDelivery(&camera_adapt, image_length, elapsed_ms);
+        WiFi_ChunkReport(image_length, chunk_size);
+        WiFi_TxLatencyReport();
+    }
+    else
+    {
+        METRIC_INC(METRIC_WIFI_IMAGE_FAIL);
+        Adapt_LinkFail(&camera_adapt);
+        DBG_SendMessage(DBG_MSG_WIFI_RX, "\tWiFi Rx: Send Image Data Failed\r\n");
+    }
+    
+    return rtn_state;
+}
+
+/*******************************************************************************
+* @Brief   WiFi Control Idle
+* @Param   
+* @Note    Check pending events, block on task notify if nothing to do
+* @Return  next control state
+*******************************************************************************/
+WiFi_CtrlState_t WiFi_Ctrl_Idle(void)
+{
+    EventBits_t event_bits; 
+    WiFi_CtrlState_t next_state = WIFI_CTRL_IDLE;
+    WiFi_Receive_t receive = {.client_id = 0xFF, .rx_state = WIFI_RX_NONE};
+    Client_Message_t respond;
+    
+    /* Peek an event item and check it's type (get item but not remove from queue).
+     * Request is decoded by receive task, only link and error event is here */
+    if(xQueuePeek(wifi_event_queue, &receive, (TickType_t) 0))
+    {
+        switch(receive.rx_state)
+        {
+        case WIFI_RX_ID_CONNECT:
+        case WIFI_RX_ID_CLOSED:
+            next_state = WIFI_CTRL_CLIENT_MANAGE;
+            break;
+            
+        case WIFI_RX_CLOSED:
+            /* Station mode: server closed the link, reopen it first */
+            xQueueReceive(wifi_event_queue, &receive, (TickType_t) 0);
+            DBG_SendMessage(DBG_MSG_WIFI_RX, "WiFi: TCP Link Lost\r\n");
+            tcp_client_connected = false;
+            next_state = WiFi_Ctrl_Recover(WIFI_RECOVER_LINK);
+            break;
+            
+        case WIFI_RX_AP_DISCONNECT:
+            /* Station mode: AP lost, TCP link is gone too */
+            xQueueReceive(wifi_event_queue, &receive, (TickType_t) 0);
+            DBG_SendMessage(DBG_MSG_WIFI_RX, "WiFi: AP Link Lost\r\n");
+            tcp_client_connected = false;
+            next_state = WiFi_Ctrl_Recover(WIFI_RECOVER_JOIN);
+            break;
+            
+        case WIFI_RX_OVERFLOW:
+        case WIFI_RX_IPD_ERROR:
+        default:
+            DBG_SendMessage(DBG_MSG_WIFI_RX, "WiFi: Error Data\r\n");
+            xQueueReceive(wifi_event_queue, &receive, (TickType_t) 0);
+            next_state = WIFI_CTRL_IDLE;
+            break;
+            
+        }
+    }
+    else if(xQueuePeek(respond_queue, &respond, (TickType_t) 0))
+    {
+        next_state = WIFI_CTRL_SEND_RESPOND;
+    }
+    else if(wifi_range.request == true)
+    {
+        next_state = WIFI_CTRL_SEND_RANGE;
+    }
+    else if(preview_request == true)
+    {
+        next_state = WIFI_CTRL_PREVIEW_LINK;
+    }
+    else if(xEventGroupWaitBits(camera_event_group, CAMERA_EVENT_PREVIEW, pdTRUE, pdTRUE, 0) & CAMERA_EVENT_PREVIEW)
+    {
+        next_state = WIFI_CTRL_SEND_PREVIEW;
+    }
+    else
+    {
+        if(client_id_active != 0xFF)
+        {
+            /* Get camera push image event */
+            event_bits = xEventGroupWaitBits(camera_event_group,
+                                             CAMERA_EVENT_PUSH_IMAGE,
+                                             pdTRUE,
+                                             pdTRUE,
+                                             0 );
+            
+            if(( event_bits & CAMERA_EVENT_PUSH_IMAGE ) == CAMERA_EVENT_PUSH_IMAGE )
+            {
+                xEventGroupClearBits(camera_event_group, CAMERA_EVENT_PUSH_IMAGE);
                 
-            case WIFI_RX_CLOSED:
-                /* Wait for full packet */
-                if(rx_buffer[rx_index - 1] == '\n')
-                {
-                    receive.rx_state = WIFI_RX_CLOSED;
-                    push_event = true;
-                }
-                break;
-            default:
-                break;
+                next_state = WIFI_CTRL_SEND_IMAGE;
+            }
+        }
+    }
+    
+    /* Nothing to do, sleep until rx, respond or push event is notified.
+     * Queues are checked above, so event posted before wait is not lost */
+    if(next_state == WIFI_CTRL_IDLE)
+    {
+        if(xTaskNotifyWait(0, WIFI_NOTIFY_EVENT, NULL, WIFI_ALIVE_PERIOD) == pdFALSE)
+        {
+            next_state = WIFI_CTRL_ALIVE_TEST;
+        }
+    }
+    
+    return next_state;
+}
+
+
+/* UART Function implement ----------------------------------------------------------------------*/
+
+/*******************************************************************************
+* @Brief   Set UART Baudrate 
+* @Param   baudrate[in]: uart baudrate
+*          flow_ctrl[in]: enable RTS/CTS
+* @Note    Set uart baudrate that connect to wifi module
+* @Return  
+*******************************************************************************/
+void WiFi_SetUartBaudrate(uint32_t baudrate, bool flow_ctrl)
+{
+    HAL_UART_DeInit(&hwifi_uart);
+    
+    hwifi_uart.Instance = WIFI_USART;
+    hwifi_uart.Init.BaudRate = baudrate;
+    hwifi_uart.Init.WordLength = UART_WORDLENGTH_8B;
+    hwifi_uart.Init.StopBits = UART_STOPBITS_1;
+    hwifi_uart.Init.Parity = UART_PARITY_NONE;
+    hwifi_uart.Init.Mode = UART_MODE_TX_RX;
+    hwifi_uart.Init.HwFlowCtl = (flow_ctrl == true) ? UART_HWCONTROL_RTS_CTS : UART_HWCONTROL_NONE;
+    hwifi_uart.Init.OverSampling = UART_OVERSAMPLING_16;
+    if (HAL_UART_Init(&hwifi_uart) != HAL_OK)
+    {
+        Error_Handler();
+    }
+    
+    /* Dma is stopped by deinit, restart circular receive */
+    xSemaphoreTake(wifi_rx_mutex, portMAX_DELAY);
+    WiFi_StartReceive();
+    xSemaphoreGive(wifi_rx_mutex);
+    
+    WiFi_ResetRxBuffer();
+}
+
+/*******************************************************************************
+* @Brief   Send Command to WiFi Module
+* @Param   
+* @Note    Send AT commandto wifi module, replies of previous command are 
+*          dropped but receive keeps running
+* @Return  
+*******************************************************************************/
+bool WiFi_SendCommand(uint8_t *cmd)
+{
+    WiFi_FlushReply();
+    
+    return WiFi_SendData(cmd, strlen((const char*)cmd));
+}
+
+/*******************************************************************************
+* @Brief   Send Data to WiFi Module
+* @Param   
+* @Note    Send image data in raw byte format
+* @Return  
+*******************************************************************************/
+bool WiFi_SendData(uint8_t *data, uint16_t length)
+{
+    WiFi_TxDesc_t desc = {.data = data, .length = length};
+    
+    return WiFi_SendChain(&desc, 1);
+}
+
+/*******************************************************************************
+* @Brief   Send Buffer Chain to WiFi Module
+* @Param   chain[in]: buffer list, empty buffer is skipped
+*          count[in]: number of buffers, max TXCHAIN_SIZE
+* @Note    Buffers are sent by dma one by one without copy, next buffer is
+*          started in tx complete interrupt. Caller sleeps on task notify until
+*          the last byte is out, buffers must be kept until return.
+* @Return  
+*******************************************************************************/
+bool WiFi_SendChain(WiFi_TxDesc_t *chain, uint8_t count)
+{
+    bool rtn_state = false;
+    uint32_t total = 0;
+    
+    tx_chain_task = xTaskGetCurrentTaskHandle();
+    rtn_state = TxChain_Send(&wifi_tx_chain, chain, count, &total);
+    tx_chain_task = NULL;
+    
+    METRIC_ADD(METRIC_WIFI_TX_BYTES, total);
+    return rtn_state;
+}
+
+/*******************************************************************************
+* @Brief   Transmit Chain Hooks
+* @Param   
+* @Note    uart dma and task notify of the sender for wifi_txchain
+* @Return  
+*******************************************************************************/
+bool WiFi_TxChainStart(const uint8_t *data, uint16_t length, void *context)
+{
+    return HAL_UART_Transmit_DMA(&hwifi_uart, (uint8_t *)data, length) == HAL_OK;
+}
+
+void WiFi_TxChainAbort(void *context)
+{
+    HAL_UART_AbortTransmit(&hwifi_uart);
+}
+
+bool WiFi_TxChainWait(uint32_t clear_entry, uint32_t clear_exit, uint32_t *value, uint32_t timeout, void *context)
+{
+    return xTaskNotifyWait(clear_entry, clear_exit, value, (TickType_t) timeout) == pdTRUE;
+}
+
+void WiFi_TxChainNotify(uint32_t bits, void *context)
+{
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    
+    if(tx_chain_task != NULL)
+    {
+        xTaskNotifyFromISR(tx_chain_task, bits, eSetBits, &xHigherPriorityTaskWoken);
+        portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+    }
+}
+
+/*******************************************************************************
+* @Brief   Reset Rx Buffer
+* @Param   
+* @Note    Drop unread ring data and reset parser, dma keeps running
+* @Return  
+*******************************************************************************/
+void WiFi_ResetRxBuffer(void)
+{
+    uint16_t head = 0;
+    
+    xSemaphoreTake(wifi_rx_mutex, portMAX_DELAY);
+    
+    head = WIFI_RX_RING_SIZE - __HAL_DMA_GET_COUNTER(hwifi_uart.hdmarx);
+    Ring_SetHeadDma(&wifi_rx_ring, head, wifi_rx_dma_events);
+    Ring_Skip(&wifi_rx_ring, Ring_Count(&wifi_rx_ring));
+    
+    Parser_Reset(&wifi_parser);
+    //client_id_active = 0xFF;    
+    for(int i = 0; i < WIFI_LINK_NUM; i++)
+    {
+        WiFi_LinkProtocolReset(i);
+    }
+    
+    xQueueReset(receive_queue);
+    xQueueReset(wifi_event_queue);
+    
+    xSemaphoreGive(wifi_rx_mutex);
+}
+
+/*******************************************************************************
+* @Brief   Flush Command Reply
+* @Param   
+* @Note    Drop late replies of previous command only, unsolicited event and
+*          data in ring or parser are kept
+* @Return  
+*******************************************************************************/
+void WiFi_FlushReply(void)
+{
+    xQueueReset(receive_queue);
+}
+
+/*******************************************************************************
+* @Brief   Start Rx Circular DMA
+* @Param   
+* @Note    dma writes ring storage forever, caller should hold wifi_rx_mutex
+* @Return  
+*******************************************************************************/
+void WiFi_StartReceive(void)
+{
+    Ring_Reset(&wifi_rx_ring);
+    wifi_rx_dma_events = 0;
+    HAL_UART_Receive_DMA(&hwifi_uart, rx_ring_buffer, WIFI_RX_RING_SIZE);
+    __HAL_UART_CLEAR_IDLEFLAG(&hwifi_uart);
+    __HAL_UART_ENABLE_IT(&hwifi_uart, UART_IT_IDLE);
+}
+
+/*******************************************************************************
+* @Brief   WiFi Receive Task
+* @Param   
+* @Note    Wake by idle line, dma half/full or poll timeout, then drain ring
+*          and run parser in task context
+* @Return  
+*******************************************************************************/
+void WiFi_ReceiveTask(void * argument)
+{
+    uint16_t length = 0;
+    uint16_t head = 0;
+    uint8_t *pdata;
+    
+    DBG_SendMessage(DBG_MSG_TASK_STATE, "WiFi Rx Task Start\r\n");
+    
+    for(;;)
+    {
+        ulTaskNotifyTake(pdTRUE, WIFI_RX_POLL_PERIOD);
+        
+        xSemaphoreTake(wifi_rx_mutex, portMAX_DELAY);
+        
+        /* Dma is aborted by uart error, restart and resync parser */
+        if(wifi_rx_error == true)
+        {
+            wifi_rx_error = false;
+            WiFi_StartReceive();
+            Parser_Reset(&wifi_parser);
+        }
+        
+        /* Dma position is the ring head. Dma went round the ring before
+         * drain, so data is lost at an unknown place: drop ring and resync */
+        head = WIFI_RX_RING_SIZE - __HAL_DMA_GET_COUNTER(hwifi_uart.hdmarx);
+        if(Ring_SetHeadDma(&wifi_rx_ring, head, wifi_rx_dma_events) == true)
+        {
+            Ring_Skip(&wifi_rx_ring, Ring_Count(&wifi_rx_ring));
+            Parser_Reset(&wifi_parser);
+            for(int i = 0; i < WIFI_LINK_NUM; i++)
+            {
+                Reasm_Reset(&client_reasm[i]);
+            }
+            METRIC_INC(METRIC_WIFI_RX_LAP);
+        }
+        
+        /* Drain in bulk, at most two contiguous parts */
+        while((length = Ring_Peek(&wifi_rx_ring, &pdata)) > 0)
+        {
+            if(wifi_passthrough == true)
+            {
+                /* Transparent transmission, data from server is raw message frame of link 0 */
+                client_id_active = 0;
+                WiFi_RxLinkData(0, pdata, length);
+            }
+            else
+            {
+                Parser_Input(&wifi_parser, pdata, length);
+            }
+            Ring_Skip(&wifi_rx_ring, length);
+        }
+        
+        xSemaphoreGive(wifi_rx_mutex);
+    }
+}
+
+/*******************************************************************************
+* @Brief   WiFi Receive Parser Event
+* @Param   event[in]: typed response from tokenizer
+* @Note    Update client data and post to queue, run in receive task
+* @Return  
+*******************************************************************************/
+void WiFi_RxParserEvent(const Parser_Event_t *event, void *context)
+{
+    uint16_t i = 0;
+    bool unsolicited = false;
+    WiFi_Receive_t receive = {.client_id = 0xFF, .rx_state = WIFI_RX_NONE};
+    
+    switch(event->type)
+    {
+    case PARSER_EVT_OK:
+        receive.rx_state = WIFI_RX_ATFB_OK;
+        break;
+        
+    case PARSER_EVT_ERROR:
+        receive.rx_state = WIFI_RX_ATFB_ERROR;
+        break;
+        
+    case PARSER_EVT_FAIL:
+        receive.rx_state = WIFI_RX_ATFB_FAIL;
+        break;
+        
+    case PARSER_EVT_CLOSED:
+        receive.rx_state = WIFI_RX_CLOSED;
+        /* Station mode: single link closed, also wake idle to recover it */
+        if(app_config.esp8266_mode == APP_ESP8266_STATION)
+        {
+            WiFi_LinkProtocolReset(0);
+            WiFi_RxPostEvent(&receive);
+        }
+        break;
+        
+    case PARSER_EVT_WIFI_DISCONNECT:
+        if(app_config.esp8266_mode == APP_ESP8266_STATION)
+        {
+            receive.rx_state = WIFI_RX_AP_DISCONNECT;
+            unsolicited = true;
+        }
+        break;
+        
+    case PARSER_EVT_BUSY:
+        receive.rx_state = WIFI_RX_BUSY;
+        break;
+        
+    case PARSER_EVT_SEND_READY:
+        receive.rx_state = WIFI_RX_SEND_READY;
+        break;
+        
+    case PARSER_EVT_RECV:
+        /* all data is taken by module, next CIPSEND is allowed */
+        receive.rx_state = WIFI_RX_RECV;
+        break;
+        
+    case PARSER_EVT_SEND_OK:
+        receive.rx_state = WIFI_RX_SEND_OK;
+        break;
+        
+    case PARSER_EVT_SEND_FAIL:
+        receive.rx_state = WIFI_RX_SEND_FAIL;
+        break;
+        
+    case PARSER_EVT_OVERFLOW:
+        receive.rx_state = WIFI_RX_OVERFLOW;
+        unsolicited = true;
+        break;
+        
+    case PARSER_EVT_LINK_CONNECT:
+        if((event->link_id == WIFI_PREVIEW_LINK) && (app_config.esp8266_mode != APP_ESP8266_STATION))
+        {
+            /* UDP preview link, opened by control task */
+        }
+        else if(event->link_id < WIFI_LINK_NUM)
+        {
+            client_list[event->link_id] = 1;
+            client_id_active = event->link_id;
+            WiFi_LinkProtocolReset(event->link_id);
+            receive.client_id = event->link_id;
+            receive.rx_state = WIFI_RX_ID_CONNECT;
+            unsolicited = true;
+        }
+        break;
+        
+    case PARSER_EVT_LINK_CLOSED:
+        if((event->link_id == WIFI_PREVIEW_LINK) && (app_config.esp8266_mode != APP_ESP8266_STATION))
+        {
+            preview_link = false;
+            camera_preview.active = false;
+        }
+        else if(event->link_id < WIFI_LINK_NUM)
+        {
+            client_list[event->link_id] = 0;
+            WiFi_LinkProtocolReset(event->link_id);
+            receive.client_id = event->link_id;
+            receive.rx_state = WIFI_RX_ID_CLOSED;
+            unsolicited = true;
+        }
+        break;
+        
+    case PARSER_EVT_IPD_HEAD:
+        /* Station mode: TCP single client, IPD has no client id */
+        client_id_active = (event->link_id == PARSER_LINK_NONE) ? 0 : event->link_id;
+        break;
+        
+    case PARSER_EVT_IPD_DATA:
+        /* payload span point to ring buffer, frame may span several +IPD */
+        WiFi_RxLinkData((event->link_id == PARSER_LINK_NONE) ? 0 : event->link_id, event->data, event->length);
+        break;
+        
+    case PARSER_EVT_LINE:
+        /* +CIPSTAMAC:"aa:bb:cc:dd:ee:ff", +CIPSTA:ip:"192.168.1.100", 
+         * +CWJAP:"ssid","aa:bb:cc:dd:ee:ff",6,-50 */
+        if((event->length > 12) && (memcmp(event->data, "+CIPSTAMAC:\"", 12) == 0))
+        {
+            for(i = 0; (i < 17) && ((12 + i) < event->length) && (event->data[12 + i] != '"'); i++)
+            {
+                wifi_mac_string[i] = event->data[12 + i];
+            }
+            wifi_mac_string[i] = '\0';
+        }
+        else if((event->length > 12) && (memcmp(event->data, "+CIPSTA:ip:\"", 12) == 0))
+        {
+            for(i = 0; (i < 15) && ((12 + i) < event->length) && (event->data[12 + i] != '"'); i++)
+            {
+                wifi_ip_string[i] = event->data[12 + i];
+            }
+            wifi_ip_string[i] = '\0';
+            WiFi_ParseIp(&event->data[12], event->length - 12, wifi_join.ip);
+        }
+        else if((event->length > 17) && (memcmp(event->data, "+CIPSTA:gateway:\"", 17) == 0))
+        {
+            WiFi_ParseIp(&event->data[17], event->length - 17, wifi_join.gateway);
+        }
+        else if((event->length > 17) && (memcmp(event->data, "+CIPSTA:netmask:\"", 17) == 0))
+        {
+            WiFi_ParseIp(&event->data[17], event->length - 17, wifi_join.netmask);
+        }
+        else if((event->length > 8) && (memcmp(event->data, "+CWJAP:\"", 8) == 0))
+        {
+            WiFi_ParseJoin(event->data, event->length);
+        }
+        break;
+        
+    case PARSER_EVT_READY:
+        /* module boot finish, after power on or AT+RST */
+        WiFi_Notify(WIFI_NOTIFY_READY);
+        break;
+        
+    default:
+        /* echo, WIFI CONNECTED ... no action */
+        break;
+    }
+    
+    /* post to queue when state update */       
+    if(unsolicited == true)
+    {
+        WiFi_RxPostEvent(&receive);
+    }
+    else if(receive.rx_state != WIFI_RX_NONE)
+    {   
+        xQueueSend( receive_queue, &receive, 0 );
+    }
+}
+
+/*******************************************************************************
+* @Brief   Parse IP Address
+* @Param   text[in]: "192.168.1.100" without leading quote, end at quote or length
+*          ip[out]: 4 bytes address, unchanged if text is invalid
+* @Note    
+* @Return  true if address is valid
+*******************************************************************************/
+bool WiFi_ParseIp(const uint8_t *text, uint16_t length, uint8_t *ip)
+{
+    uint16_t i = 0;
+    uint8_t field = 0;
+    uint16_t value = 0;
+    uint8_t result[4];
+    
+    for(i = 0; (i < length) && (text[i] != '"'); i++)
+    {
+        if((text[i] >= '0') && (text[i] <= '9'))
+        {
+            value = value * 10 + (text[i] - '0');
+            if(value > 255)
+            {
+                return false;
+            }
+        }
+        else if((text[i] == '.') && (field < 3))
+        {
+            result[field] = (uint8_t)value;
+            field++;
+            value = 0;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    
+    if(field != 3)
+    {
+        return false;
+    }
+    result[3] = (uint8_t)value;
+    memcpy(ip, result, 4);
+    
+    return true;
+}
+
+/*******************************************************************************
+* @Brief   Parse Join Info
+* @Param   text[in]: +CWJAP:"ssid","aa:bb:cc:dd:ee:ff",6,-50
+* @Note    ssid may contain any char, bssid is located from the last '",'.
+*          rssi after channel is parsed to wifi_rssi.
+* @Return  true if bssid and channel are parsed to wifi_join
+*******************************************************************************/
+bool WiFi_ParseJoin(const uint8_t *text, uint16_t length)
+{
+    uint16_t i = 0;
+    uint16_t end = 0;
+    uint8_t digit = 0;
+    uint8_t bssid[6];
+    uint8_t channel = 0;
+    int16_t rssi = 0;
+    
+    /* find quote that ends bssid */
+    for(i = length - 1; i > 25; i--)
+    {
+        if((text[i - 1] == '"') && (text[i] == ','))
+        {
+            end = i - 1;
+            break;
+        }
+    }
+    if(end == 0)
+    {
+        return false;
+    }
+    
+    /* 17 chars bssid, aa:bb:cc:dd:ee:ff */
+    for(i = 0; i < 17; i++)
+    {
+        digit = text[end - 17 + i];
+        if((i % 3) == 2)
+        {
+            if(digit != ':')
+            {
+                return false;
             }
+            continue;
         }
         
-        if(wifi_rx_state == WIFI_RX_IPD_RECEVING)
+        if((digit >= '0') && (digit <= '9'))
+        {
+            digit = digit - '0';
+        }
+        else if((digit >= 'a') && (digit <= 'f'))
         {
-            /* receiving data payload */
-            HAL_UART_Receive_DMA(huart, (client_data + client_data_index), 1);
+            digit = digit - 'a' + 10;
         }
-        else if(push_event == true)
+        else if((digit >= 'A') && (digit <= 'F'))
         {
-            /* start a new packet */
-            HAL_UART_Receive_DMA(huart, rx_buffer, 1);
-            rx_index = 0;
+            digit = digit - 'A' + 10;
         }
         else
         {
-            /* ready for receive next byte */
-            HAL_UART_Receive_DMA(huart, (rx_buffer + rx_index), 1);
+            return false;
         }
-        
-        /* post to queue when state update */       
-        if(push_event == true)
-        {   
-            /* send new state to queue */
-            xQueueSendFromISR( receive_queue, &receive, &xHigherPriorityTaskWoken );
-            
-            /* switch context if necessary.*/
-            portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+        bssid[i / 3] = ((i % 3) == 0) ? (digit << 4) : (bssid[i / 3] | digit);
+    }
+    
+    /* channel follows bssid */
+    for(i = end + 2; (i < length) && (text[i] >= '0') && (text[i] <= '9'); i++)
+    {
+        channel = channel * 10 + (text[i] - '0');
+    }
+    if(channel == 0)
+    {
+        return false;
+    }
+    
+    /* ",-50" follows channel */
+    if(((i + 2) < length) && (text[i] == ',') && (text[i + 1] == '-'))
+    {
+        for(i = i + 2; (i < length) && (text[i] >= '0') && (text[i] <= '9') && (rssi < 128); i++)
+        {
+            rssi = rssi * 10 + (text[i] - '0');
+        }
+        if((rssi > 0) && (rssi <= 128))
+        {
+            wifi_rssi = (int8_t)(-rssi);
+        }
+    }
+    
+    memcpy(wifi_join.bssid, bssid, 6);
+    wifi_join.channel = channel;
+    
+    return true;
+}
+
+/*******************************************************************************
+* @Brief   WiFi Wait Module Ready
+* @Param   timeout[in]: ticks, longest boot time of module
+* @Note    replace fixed delay after power on and AT+RST, return as soon as
+*          parser gets ready line. Other notify bits are kept for idle state
+* @Return  true if ready line is received
+*******************************************************************************/
+bool WiFi_WaitReady(TickType_t timeout)
+{
+    uint32_t notify = 0;
+    TickType_t start = xTaskGetTickCount();
+    TickType_t elapsed = 0;
+    
+    while(elapsed < timeout)
+    {
+        if((xTaskNotifyWait(0, WIFI_NOTIFY_READY, &notify, timeout - elapsed) == pdTRUE) &&
+           ((notify & WIFI_NOTIFY_READY) != 0))
+        {
+            return true;
+        }
+        elapsed = xTaskGetTickCount() - start;
+    }
+    
+    return false;
+}
+
+/*******************************************************************************
+* @Brief   WiFi Receive Post Event
+* @Param   receive[in]: unsolicited event
+* @Note    Post to event queue and wake control task
+* @Return  
+*******************************************************************************/
+void WiFi_RxPostEvent(WiFi_Receive_t *receive)
+{
+    xQueueSend( wifi_event_queue, receive, 0 );
+    WiFi_Notify(WIFI_NOTIFY_RX);
+}
+
+/*******************************************************************************
+* @Brief   WiFi Receive Link Data
+* @Param   link[in]: link of +IPD, 0 for station mode
+*          data[in]: payload span in ring buffer
+*          length[in]: span length
+* @Note    Feed link decoder, validated frame is posted from WiFi_RxFrame
+* @Return  
+*******************************************************************************/
+void WiFi_RxLinkData(uint8_t link, const uint8_t *data, uint16_t length)
+{
+    WiFi_Receive_t receive = {.client_id = link, .rx_state = WIFI_RX_IPD_ERROR};
+    
+    if(link >= WIFI_LINK_NUM)
+    {
+        return;
+    }
+    
+    if(Reasm_Input(&client_reasm[link], data, length) == false)
+    {
+        /* garbage or broken frame is dropped */
+        METRIC_INC(METRIC_WIFI_RX_DROP);
+        WiFi_RxPostEvent(&receive);
+    }
+}
+
+/*******************************************************************************
+* @Brief   WiFi Receive Frame
+* @Param   frame[in]: validated message frame
+*          context[in]: reassembly object of the link
+* @Note    Reassembly callback
+* @Return  
+*******************************************************************************/
+void WiFi_RxFrame(const Reasm_Frame_t *frame, void *context)
+{
+    METRIC_INC(METRIC_WIFI_RX_FRAMES);
+    WiFi_RxRequest((Reasm_t *)context - client_reasm, frame);
+}
+
+/*******************************************************************************
+* @Brief   WiFi Receive Request
+* @Param   client_id[in]: link of request
+*          frame[in]: validated message frame, payload is in ring or link
+*          buffer and valid only in this call
+* @Note    Payload is copied for client task as soon as frame is complete, 
+*          so ring and link buffer are free for next +IPD
+* @Return  
+*******************************************************************************/
+void WiFi_RxRequest(uint8_t client_id, const Reasm_Frame_t *frame)
+{
+    Client_Message_t msg;
+    WiFi_Receive_t receive = {.client_id = client_id, .rx_state = WIFI_RX_OVERFLOW};
+    
+    memset(&msg, 0, sizeof(Client_Message_t));
+    msg.client_id = client_id;
+    msg.command = frame->command;
+    msg.index = frame->index;
+    msg.length = frame->length;
+    msg.checksum = frame->checksum;
+    if(frame->length > 0)
+    {
+        msg.payload = MsgPool_Alloc(frame->length);
+        if(msg.payload == NULL)
+        {
+            WiFi_RxPostEvent(&receive);
+            return;
+        }
+        memcpy(msg.payload, frame->payload, frame->length);
+    }
+    
+    /* Post to client queue */
+    if(xQueueSend(request_queue, &msg, 0 ) != pdTRUE)
+    {
+        /* client task is busy, drop request and free its payload */
+        MsgPool_Free(msg.payload);
+        WiFi_RxPostEvent(&receive);
+    }
+}
+
+/*******************************************************************************
+* @Brief   WiFi Control Task Notify
+* @Param   event[in]: WIFI_NOTIFY_xxx bits
+* @Note    wake control task from idle after posting respond or push event
+* @Return  
+*******************************************************************************/
+void WiFi_Notify(uint32_t event)
+{
+    if(wifi_ctrl_task != NULL)
+    {
+        xTaskNotify(wifi_ctrl_task, event, eSetBits);
+    }
+}
+
+/*******************************************************************************
+* @Brief   Set Image Chunk Size
+* @Param   size[in]: payload bytes of one image packet, 0 to fit one TCP segment
+* @Note    limited to WIFI_CHUNK_MIN ~ WIFI_CHUNK_MAX, frame in progress keeps
+*          the old size
+* @Return  accepted chunk size
+*******************************************************************************/
+uint16_t WiFi_SetChunkSize(uint16_t size)
+{
+    if(size == 0)
+    {
+        size = WIFI_CHUNK_MSS;
+    }
+    else if(size < WIFI_CHUNK_MIN)
+    {
+        size = WIFI_CHUNK_MIN;
+    }
+    else if(size > WIFI_CHUNK_MAX)
+    {
+        size = WIFI_CHUNK_MAX;
+    }
+    wifi_chunk_size = size;
+    
+    DBG_Sprintf((char *)wifi_message.buf, "WiFi: Chunk Size %d\r\n", size);
+    DBG_SendMessage(DBG_MSG_WIFI_CTRL, wifi_message.buf);
+    
+    return size;
+}
+
+/*******************************************************************************
+* @Brief   Set Live Preview
+* @Param   ip[in]: viewer address, 4 bytes
+*          port[in]: viewer UDP port, 0 to stop preview
+*          fps[in]: frame rate, 1 ~ WIFI_PREVIEW_FPS_MAX
+*          format[in]: JPEG_176x144 or JPEG_320x240
+* @Note    AP mode only, station link is single TCP link. Called from client 
+*          task, request is copied to preview_next, link is opened by control
+*          task and camera starts after it with format and rate of request.
+* @Return  false if request is not accepted
+*******************************************************************************/
+bool WiFi_SetPreview(const uint8_t *ip, uint16_t port, uint8_t fps, uint8_t format)
+{
+    WiFi_Preview_t request;
+    
+    if(app_config.esp8266_mode == APP_ESP8266_STATION)
+    {
+        return false;
+    }
+    
+    memset(&request, 0, sizeof(WiFi_Preview_t));
+    if(port != 0)
+    {
+        if((fps == 0) || (fps > WIFI_PREVIEW_FPS_MAX) || (format > JPEG_320x240))
+        {
+            return false;
+        }
+        memcpy(request.ip, ip, 4);
+        request.port = port;
+        request.format = format;
+        request.interval = 1000 / fps;
+    }
+    
+    /* stop old stream now, control task takes the request by value */
+    taskENTER_CRITICAL();
+    preview_next = request;
+    camera_preview.active = false;
+    preview_request = true;
+    taskEXIT_CRITICAL();
+    WiFi_Notify(WIFI_NOTIFY_PREVIEW);
+    
+    return true;
+}
+
+/*******************************************************************************
+* @Brief   Set Link Protocol
+* @Param   client_id[in]: link of request
+*          version[in]: highest version client has
+* @Note    Called from client task. Link switches after next respond to it is
+*          sent, a frame before that is still in old version
+* @Return  version in use from next frame, 0 if link is not valid
+*******************************************************************************/
+uint8_t WiFi_SetProtocol(uint8_t client_id, uint8_t version)
+{
+    if((client_id >= WIFI_LINK_NUM) || (version < MSG_PROTOCOL_V1))
+    {
+        return 0;
+    }
+    if(version > MSG_PROTOCOL_V2)
+    {
+        version = MSG_PROTOCOL_V2;
+    }
+    
+    client_version_next[client_id] = version;
+    return version;
+}
+
+/*******************************************************************************
+* @Brief   Set Image Range
+* @Param   client_id[in]: link of request
+*          frame_id[in]: id of last photo, 0 for any
+*          unit[in]: WIFI_RANGE_CHUNK or WIFI_RANGE_BYTE
+*          start[in]: first chunk index or byte offset
+*          count[in]: chunks or bytes, 0 to the end of image
+*          info[out]: id(2) + size(4) + chunk(2) + filename, WIFI_RANGE_INFO_SIZE
+* @Note    Called from client task. Photo fifo is locked from here until
+*          range is sent, range past the end of image is cut. Chunk index is
+*          in chunk of push image, data per frame is WIFI_RANGE_DATA_MAX at most
+* @Return  false if photo is gone or range is out of image
+*******************************************************************************/
+bool WiFi_SetRange(uint8_t client_id, uint16_t frame_id, uint8_t unit, uint32_t start, uint32_t count, uint8_t *info)
+{
+    bool rtn_state = false;
+    uint32_t image_length = 0;
+    uint16_t chunk = 0;
+    
+    if((client_id >= WIFI_LINK_NUM) || (wifi_range.request == true))
+    {
+        return false;
+    }
+    /* station link is single TCP link, not in client list */
+    if((app_config.esp8266_mode != APP_ESP8266_STATION) && (client_list[client_id] != 1))
+    {
+        return false;
+    }
+    
+    /* lock fifo of last photo, camera checks it before capture */
+    taskENTER_CRITICAL();
+    if((camera_frame.valid == true) && ((frame_id == 0) || (frame_id == camera_frame.id)))
+    {
+        camera_frame.reading = true;
+        rtn_state = true;
+    }
+    taskEXIT_CRITICAL();
+    if(rtn_state == false)
+    {
+        return false;
+    }
+    
+    image_length = camera_info.fifo_buffer[camera_frame.fifo].length;
+    chunk = (camera_frame.chunk != 0) ? camera_frame.chunk : wifi_chunk_size;
+    
+    /* chunk index to byte, 1 is first packet of push image */
+    if(unit == WIFI_RANGE_CHUNK)
+    {
+        if((start == 0) || ((start - 1) >= (image_length + chunk - 1) / chunk))
+        {
+            rtn_state = false;
+        }
+        else
+        {
+            start = (start - 1) * chunk;
+            count = (count > (image_length / chunk + 1)) ? 0 : (count * chunk);
         }
     }
+    else if(unit != WIFI_RANGE_BYTE)
+    {
+        rtn_state = false;
+    }
+    
+    if((rtn_state == false) || (start >= image_length))
+    {
+        camera_frame.reading = false;
+        return false;
+    }
+    if((count == 0) || (count > (image_length - start)))
+    {
+        count = image_length - start;
+    }
+    
+    wifi_range.link = client_id;
+    wifi_range.frame_id = camera_frame.id;
+    /* offset head must fit in AT+CIPSEND with a full chunk of data */
+    wifi_range.chunk = (chunk > WIFI_RANGE_DATA_MAX) ? WIFI_RANGE_DATA_MAX : chunk;
+    wifi_range.offset = start;
+    wifi_range.length = count;
+    
+    info[0] = camera_frame.id & 0xFF;
+    info[1] = (camera_frame.id >> 8) & 0xFF;
+    info[2] = image_length & 0xFF;
+    info[3] = (image_length >> 8) & 0xFF;
+    info[4] = (image_length >> 16) & 0xFF;
+    info[5] = (image_length >> 24) & 0xFF;
+    info[6] = chunk & 0xFF;
+    info[7] = (chunk >> 8) & 0xFF;
+    memcpy(&info[8], camera_info.fifo_buffer[camera_frame.fifo].filename, CAMERA_FILENAME_SIZE);
+    
+    return true;
+}
+
+/*******************************************************************************
+* @Brief   Start Image Range
+* @Param   
+* @Note    range set by WiFi_SetRange is sent after respond
+* @Return  
+*******************************************************************************/
+void WiFi_StartRange(void)
+{
+    wifi_range.request = true;
+    WiFi_Notify(WIFI_NOTIFY_RANGE);
+}
+
+/*******************************************************************************
+* @Brief   Link Protocol Reset
+* @Param   link[in]: link connected or closed
+* @Note    new client starts in v1, partial frame is dropped
+* @Return  
+*******************************************************************************/
+void WiFi_LinkProtocolReset(uint8_t link)
+{
+    client_version[link] = MSG_PROTOCOL_V1;
+    client_version_next[link] = 0;
+    Reasm_SetVersion(&client_reasm[link], REASM_VERSION_1);
+}
+
+/*******************************************************************************
+* @Brief   UART Idle Line Callback
+* @Param   
+* @Note    A burst from wifi module is finished, wake receive task
+* @Return  
+*******************************************************************************/
+void WiFi_UartIdleCallback(void)
+{
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    
+    if(wifi_rx_task != NULL)
+    {
+        vTaskNotifyGiveFromISR(wifi_rx_task, &xHigherPriorityTaskWoken);
+        portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+    }
+}
+
+/*******************************************************************************
+* @Brief   UART Receive Half Complete Callback
+* @Param   
+* @Note    Circular dma passed middle of ring, count it for lap check and
+*          wake receive task
+* @Return  
+*******************************************************************************/
+void HAL_UART_RxHalfCpltCallback(UART_HandleTypeDef *huart)
+{
+    if(huart == &hwifi_uart)
+    {
+        wifi_rx_dma_events++;
+        WiFi_UartIdleCallback();
+    }
+}
+
+/*******************************************************************************
+* @Brief   UART Receive Complete Callback
+* @Param   
+* @Note    Circular dma wrap to start of ring, count it for lap check and
+*          wake receive task
+* @Return  
+*******************************************************************************/
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+{
+    if(huart == &hwifi_uart)
+    {
+        wifi_rx_dma_events++;
+        WiFi_UartIdleCallback();
+    }
+}
+
+/*******************************************************************************
+* @Brief   UART Error Callback
+* @Param   
+* @Note    HAL aborts rx dma on error, let receive task restart it
+* @Return  
+*******************************************************************************/
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
+{
+    if(huart == &hwifi_uart)
+    {
+        wifi_rx_error = true;
+        WiFi_UartIdleCallback();
+    }
 }
 
 /*******************************************************************************
 * @Brief   UART Transmit Complete Callback
 * @Param   
-* @Note    Update transmit finish flag
+* @Note    Start next buffer of tx chain, notify sender after the last one
 * @Return  
 *******************************************************************************/
 void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
 {
     if(huart == &hwifi_uart)
     {
-        wifi_uart_tx_done = true;
+        TxChain_Complete(&wifi_tx_chain);
     }
 }
 
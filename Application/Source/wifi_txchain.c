@@ -0,0 +1,130 @@
+/*
+***************************************************************************************************
+*                               UART DMA Transmit Chain
+*
+* File   : wifi_txchain.c
+* Author : Douglas Xie
+* Date   : 2018.03.05
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*/
+
+/* Include Head Files ---------------------------------------------------------------------------*/
+#include "stdint.h"
+#include "stdbool.h"
+#include "string.h"
+
+#include "wifi_txchain.h"
+
+/* Public Function ------------------------------------------------------------------------------*/
+
+/*******************************************************************************
+* @Brief   Transmit Chain Initial
+* @Param   chain[in]: chain object
+*          hook[in]: uart and task notify hooks
+*          context[in]: user data for hooks
+*          done_bit[in]: notify bit of chain done
+*          timeout[in]: max wait of one chain, in unit of wait hook
+* @Note
+* @Return
+*******************************************************************************/
+void TxChain_Init(TxChain_t *chain, const TxChain_Hook_t *hook, void *context, uint32_t done_bit, uint32_t timeout)
+{
+    memset(chain, 0, sizeof(TxChain_t));
+    chain->hook = hook;
+    chain->context = context;
+    chain->done_bit = done_bit;
+    chain->timeout = timeout;
+}
+
+/*******************************************************************************
+* @Brief   Transmit Chain Send
+* @Param   desc[in]: buffer list, empty buffer is skipped
+*          count[in]: number of buffers, max TXCHAIN_SIZE
+*          total[out]: bytes sent, may be NULL
+* @Note    buffers are sent one by one without copy, next buffer is started
+*          by TxChain_Complete. Caller sleeps in wait hook until the last
+*          byte is out, other notify bits do not end the wait and are kept.
+*          Buffers must be kept until return
+* @Return  false on timeout, dma is aborted
+*******************************************************************************/
+bool TxChain_Send(TxChain_t *chain, const TxChain_Desc_t *desc, uint8_t count, uint32_t *total)
+{
+    bool rtn_state = false;
+    uint8_t i = 0;
+    uint32_t notify = 0;
+    uint32_t bytes = 0;
+
+    if(total != NULL)
+    {
+        *total = 0;
+    }
+
+    /* load descriptors, skip empty buffer */
+    chain->count = 0;
+    for(i = 0; (i < count) && (chain->count < TXCHAIN_SIZE); i++)
+    {
+        if(desc[i].length != 0)
+        {
+            chain->desc[chain->count] = desc[i];
+            chain->count++;
+            bytes += desc[i].length;
+        }
+    }
+    if(chain->count == 0)
+    {
+        return true;
+    }
+
+    /* clear done bit left by timeout transfer, entry clear is skipped when a
+     * notify is pending so clear it on exit too */
+    chain->waiting = true;
+    chain->hook->wait(chain->done_bit, chain->done_bit, NULL, 0, chain->context);
+
+    chain->index = 0;
+    if(chain->hook->start(chain->desc[0].data, chain->desc[0].length, chain->context) == true)
+    {
+        /* other notify bits may wake task, wait for tx done bit */
+        while(chain->hook->wait(0, chain->done_bit, &notify, chain->timeout, chain->context) == true)
+        {
+            if((notify & chain->done_bit) != 0)
+            {
+                rtn_state = true;
+                break;
+            }
+        }
+
+        if(rtn_state == false)
+        {
+            chain->hook->abort(chain->context);
+        }
+    }
+
+    chain->waiting = false;
+    if((rtn_state == true) && (total != NULL))
+    {
+        *total = bytes;
+    }
+    return rtn_state;
+}
+
+/*******************************************************************************
+* @Brief   Transmit Chain Complete
+* @Param
+* @Note    call from uart tx complete interrupt, starts next buffer or sets
+*          done bit after the last one
+* @Return
+*******************************************************************************/
+void TxChain_Complete(TxChain_t *chain)
+{
+    chain->index++;
+    if(chain->index < chain->count)
+    {
+        chain->hook->start(chain->desc[chain->index].data, chain->desc[chain->index].length, chain->context);
+    }
+    else if(chain->waiting == true)
+    {
+        chain->hook->notify(chain->done_bit, chain->context);
+    }
+}
@@ -58,12 +58,16 @@
 #include "display_task.h"
 #include "camera_task.h"
 #include "debug_task.h"
+#include "boot.h"
+#include "msg_pool.h"
 #include "global_config.h"
 #include "util.h"
 
 /* USER CODE END Includes */
 
 /* Private variables ---------------------------------------------------------*/
+CRC_HandleTypeDef hcrc;
+
 DCMI_HandleTypeDef hdcmi;
 DMA_HandleTypeDef hdma_dcmi;
 
@@ -104,6 +108,7 @@ static void MX_USART1_UART_Init(void);
 static void MX_USART2_UART_Init(void);
 static void MX_TIM6_Init(void);
 static void MX_RTC_Init(void);
+static void MX_CRC_Init(void);
 void StartDefaultTask(void const * argument);
 
 void HAL_TIM_MspPostInit(TIM_HandleTypeDef *htim);
@@ -134,6 +139,7 @@ int main(void)
     /* USER CODE BEGIN Init */
     Mem_ReadInfo();
     Mem_ReadConfig();
+    Boot_StageDone(BOOT_STAGE_CONFIG);
     /* USER CODE END Init */
     
     /* Configure the system clock */
@@ -155,6 +161,7 @@ int main(void)
     MX_USART2_UART_Init();
     MX_TIM6_Init();
     MX_RTC_Init();
+    MX_CRC_Init();
     
     /* USER CODE BEGIN 2 */
 #else
@@ -169,7 +176,9 @@ int main(void)
     MX_USART2_UART_Init();
     MX_TIM6_Init();
     MX_RTC_Init();
+    MX_CRC_Init();
 #endif  
+    Boot_StageDone(BOOT_STAGE_PERIPH);
     /* USER CODE END 2 */
     
     /* USER CODE BEGIN RTOS_MUTEX */
@@ -288,6 +297,18 @@ void SystemClock_Config(void)
     HAL_NVIC_SetPriority(SysTick_IRQn, 15, 0);
 }
 
+/* CRC init function */
+static void MX_CRC_Init(void)
+{
+    
+    hcrc.Instance = CRC;
+    if (HAL_CRC_Init(&hcrc) != HAL_OK)
+    {
+        _Error_Handler(__FILE__, __LINE__);
+    }
+    
+}
+
 /* DCMI init function */
 static void MX_DCMI_Init(void)
 {
@@ -697,6 +718,11 @@ void StartDefaultTask(void const * argument)
     DBG_SendMessage(DBG_MSG_TASK_STATE, APP_VER_DBG);
     //DBG_SendMessage(DBG_MSG_TASK_STATE, "Default Task Start\r\n");
     
+    /* Tasks bring up lcd, sensor and wifi module in parallel, dependent
+     * stage waits for readiness of boot event group */
+    Boot_Init();
+    MsgPool_Init();
+    
     /* Create WiFi Control Task */
     xTaskCreate( WiFi_ControlTask,
                 "WiFi", 
@@ -713,6 +739,16 @@ void StartDefaultTask(void const * argument)
                 CFG_PRIORITY_CLIENT,
                 NULL);
     
+#ifndef USE_DEMO_VERSION
+    /* Create OTA Flash Write Task, after client task which creates its queue */
+    xTaskCreate( Client_OtaWriteTask,
+                "OTA", 
+                CFG_STACK_OTA,
+                (void *) 0,
+                CFG_PRIORITY_OTA,
+                NULL);
+#endif
+    
     /* Create Motor Control Task */
     xTaskCreate( Motor_ControlTask,
                 "Motor", 
@@ -754,6 +790,7 @@ void StartDefaultTask(void const * argument)
                 CFG_PRIORITY_DEBUG, 
                 NULL); 
 #endif
+    Boot_StageDone(BOOT_STAGE_KERNEL);
     
     /* Infinite loop */
     for(;;)
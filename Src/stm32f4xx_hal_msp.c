@@ -91,6 +91,40 @@ void HAL_MspInit(void)
     /* USER CODE END MspInit 1 */
 }
 
+void HAL_CRC_MspInit(CRC_HandleTypeDef* hcrc)
+{
+    
+    if(hcrc->Instance==CRC)
+    {
+        /* USER CODE BEGIN CRC_MspInit 0 */
+        
+        /* USER CODE END CRC_MspInit 0 */
+        /* Peripheral clock enable */
+        __HAL_RCC_CRC_CLK_ENABLE();
+        /* USER CODE BEGIN CRC_MspInit 1 */
+        
+        /* USER CODE END CRC_MspInit 1 */
+    }
+    
+}
+
+void HAL_CRC_MspDeInit(CRC_HandleTypeDef* hcrc)
+{
+    
+    if(hcrc->Instance==CRC)
+    {
+        /* USER CODE BEGIN CRC_MspDeInit 0 */
+        
+        /* USER CODE END CRC_MspDeInit 0 */
+        /* Peripheral clock disable */
+        __HAL_RCC_CRC_CLK_DISABLE();
+        /* USER CODE BEGIN CRC_MspDeInit 1 */
+        
+        /* USER CODE END CRC_MspDeInit 1 */
+    }
+    
+}
+
 void HAL_DCMI_MspInit(DCMI_HandleTypeDef* hdcmi)
 {
     
@@ -567,7 +601,7 @@ void HAL_UART_MspInit(UART_HandleTypeDef* huart)
         hdma_usart1_rx.Init.MemInc = DMA_MINC_ENABLE;
         hdma_usart1_rx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
         hdma_usart1_rx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
-        hdma_usart1_rx.Init.Mode = DMA_NORMAL;
+        hdma_usart1_rx.Init.Mode = DMA_CIRCULAR;
         hdma_usart1_rx.Init.Priority = DMA_PRIORITY_LOW;
         hdma_usart1_rx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
         if (HAL_DMA_Init(&hdma_usart1_rx) != HAL_OK)
@@ -599,7 +633,18 @@ void HAL_UART_MspInit(UART_HandleTypeDef* huart)
         HAL_NVIC_SetPriority(USART1_IRQn, 5, 0);
         HAL_NVIC_EnableIRQ(USART1_IRQn);
         /* USER CODE BEGIN USART1_MspInit 1 */
-        
+#ifdef WIFI_FLOW_CONTROL
+        /**USART1 GPIO Configuration    
+        PA11     ------> USART1_CTS
+        PA12     ------> USART1_RTS 
+        */
+        GPIO_InitStruct.Pin = GPIO_PIN_11|GPIO_PIN_12;
+        GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+        GPIO_InitStruct.Pull = GPIO_PULLUP;
+        GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+        GPIO_InitStruct.Alternate = GPIO_AF7_USART1;
+        HAL_GPIO_Init(GPIOA, &GPIO_InitStruct);
+#endif
         /* USER CODE END USART1_MspInit 1 */
     }
     else if(huart->Instance==USART2)
@@ -38,6 +38,7 @@
 
 /* USER CODE BEGIN 0 */
 #include "delay.h"
+#include "wifi_task.h"
 /* USER CODE END 0 */
 
 /* External variables --------------------------------------------------------*/
@@ -187,7 +188,14 @@ void TIM1_UP_TIM10_IRQHandler(void)
 void USART1_IRQHandler(void)
 {
   /* USER CODE BEGIN USART1_IRQn 0 */
-
+#ifndef USE_DEMO_VERSION
+  /* Idle line: a burst from wifi module is finished */
+  if((__HAL_UART_GET_FLAG(&huart1, UART_FLAG_IDLE) != RESET) && (__HAL_UART_GET_IT_SOURCE(&huart1, UART_IT_IDLE) != RESET))
+  {
+    __HAL_UART_CLEAR_IDLEFLAG(&huart1);
+    WiFi_UartIdleCallback();
+  }
+#endif
   /* USER CODE END USART1_IRQn 0 */
   HAL_UART_IRQHandler(&huart1);
   /* USER CODE BEGIN USART1_IRQn 1 */
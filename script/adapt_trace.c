@@ -0,0 +1,298 @@
+/*
+***************************************************************************************************
+*                           Adaptive Image Profile Link Traces (host)
+*
+* File   : adapt_trace.c
+* Author : Douglas Xie
+* Date   : 2018.03.30
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*
+* Drive image_adapt with synthetic station link traces, one capture per step like
+* Camera_PhotoTask and WiFi_Ctrl_SendImage: rssi sample, Adapt_Select, jpg size of the profile,
+* delivery time on the link of this step, then Adapt_ImageSize and Adapt_LinkDelivery or
+* Adapt_LinkFail. Real jpg size differs from the table estimate by scene, goodput and size have
+* noise. Each trace is also run with the fixed 640x480 capture of the old photo task. In target
+* counts only captures where the smallest profile can meet the target on that link.
+* Traces:
+*   good:   60 KB/s, -55 dBm
+*   weak:   4 KB/s, -80 dBm, jpg over 16 KB is lost by SEND FAIL at every second try
+*   fade:   good link fades to 3 KB/s at -84 dBm for 40 captures, then comes back
+*   busy:   good link drops to 6 KB/s for 40 captures by a busy channel, rssi stays good
+*   noisy:  12 KB/s with +-50% goodput noise
+*   outage: 20 KB/s, SEND FAIL for 6 captures in the middle
+*
+*   gcc -O2 -I../Application/Include adapt_trace.c ../Application/Source/image_adapt.c
+*       -o adapt_trace
+*   ./adapt_trace [target_ms]
+* Pass or fail is checked with default target, other targets only print the table.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "image_adapt.h"
+
+#define TRACE_STEPS         120
+#define TRACE_WARMUP        3           /* captures before first delivery is measured */
+#define TRACE_SCENE         1.3         /* real jpg of a detailed scene over table estimate */
+#define TRACE_FIXED_MS      150.0       /* file info, window fill and last SEND OK */
+#define TRACE_FAIL_MS       20000.0     /* SEND FAIL or window timeout, image is lost */
+#define TRACE_SETTLE        3           /* captures to meet target again after a fade */
+#define TRACE_WEAK_RSSI     (-75)       /* below it a large jpg is often lost by SEND FAIL */
+#define TRACE_WEAK_SIZE     16000
+
+typedef enum
+{
+    TRACE_GOOD = 0,
+    TRACE_WEAK,
+    TRACE_FADE,
+    TRACE_BUSY,
+    TRACE_NOISY,
+    TRACE_OUTAGE,
+    TRACE_NUM
+} Trace_Type_t;
+
+typedef struct
+{
+    double      goodput;                /* bytes per second */
+    int8_t      rssi;
+    bool        fail;
+} Trace_Link_t;
+
+typedef struct
+{
+    uint32_t    delivered;
+    uint32_t    feasible;               /* smallest profile can meet target on this link */
+    uint32_t    in_target;
+    uint32_t    failed;
+    uint32_t    switches;
+    uint32_t    settle;                 /* captures from fade to first in target */
+    double      total_ms;
+    double      bytes;
+    uint8_t     profile;                /* profile of last capture */
+    uint8_t     low;                    /* lowest profile after warmup */
+} Trace_Result_t;
+
+/* Percent of in target, - if no capture can meet target */
+static const char *Trace_Percent(uint32_t in_target, uint32_t feasible)
+{
+    static char text[2][16];
+    static uint8_t n = 0;
+
+    n = (n + 1) % 2;
+    if(feasible == 0)
+    {
+        return "-";
+    }
+    sprintf(text[n], "%.1f%%", 100.0 * in_target / feasible);
+    return text[n];
+}
+
+static double Trace_Random(void)
+{
+    return rand() / (RAND_MAX + 1.0);
+}
+
+static Trace_Link_t Trace_Link(Trace_Type_t type, uint32_t step)
+{
+    Trace_Link_t link = { 60000.0, -55, false };
+
+    switch(type)
+    {
+    case TRACE_WEAK:
+        link.goodput = 4000.0;
+        link.rssi = -80;
+        break;
+
+    case TRACE_FADE:
+        if((step >= 40) && (step < 80))
+        {
+            link.goodput = 3000.0;
+            link.rssi = -84;
+        }
+        break;
+
+    case TRACE_BUSY:
+        if((step >= 40) && (step < 80))
+        {
+            link.goodput = 6000.0;
+        }
+        break;
+
+    case TRACE_NOISY:
+        link.goodput = 12000.0 * (0.5 + Trace_Random());
+        link.rssi = -70;
+        break;
+
+    case TRACE_OUTAGE:
+        link.goodput = 20000.0;
+        link.rssi = -72;
+        link.fail = (step >= 60) && (step < 66);
+        break;
+
+    case TRACE_GOOD:
+    default:
+        break;
+    }
+    return link;
+}
+
+/*******************************************************************************
+* @Brief   Run One Trace
+* @Param   type[in]: link trace
+*          target_ms[in]: target time to deliver one image
+*          fixed[in]: old photo task, always profile 640x480 default quality
+* @Note    delivery samples are taken after warmup like the first uploads
+* @Return
+*******************************************************************************/
+static void Trace_Run(Trace_Type_t type, uint32_t target_ms, bool fixed, Trace_Result_t *result)
+{
+    Adapt_t adapt;
+    Trace_Link_t link;
+    uint32_t step = 0;
+    uint32_t length = 0;
+    uint8_t profile = 0;
+    uint8_t last = 0xFF;
+    double elapsed = 0;
+    bool settled = false;
+    bool feasible = false;
+
+    memset(result, 0, sizeof(Trace_Result_t));
+    result->low = ADAPT_PROFILE_NUM;
+    Adapt_Init(&adapt);
+    srand(type + 1);
+
+    for(step = 0; step < TRACE_STEPS; step++)
+    {
+        link = Trace_Link(type, step);
+
+        /* alive test samples rssi between captures */
+        Adapt_LinkRssi(&adapt, link.rssi);
+        profile = (fixed == true) ? ADAPT_PROFILE_DEFAULT : Adapt_Select(&adapt, target_ms);
+        if((last != 0xFF) && (profile != last))
+        {
+            result->switches++;
+        }
+        last = profile;
+        if((step >= TRACE_WARMUP) && (profile < result->low))
+        {
+            result->low = profile;
+        }
+
+        length = (uint32_t)(adapt_profile_table[profile].size * TRACE_SCENE * (0.9 + 0.2 * Trace_Random()));
+        Adapt_ImageSize(&adapt, profile, length);
+
+        elapsed = length / (link.goodput * (0.9 + 0.2 * Trace_Random())) * 1000.0 + TRACE_FIXED_MS;
+        if((link.rssi < TRACE_WEAK_RSSI) && (length > TRACE_WEAK_SIZE) && (Trace_Random() < 0.5))
+        {
+            link.fail = true;
+        }
+        if((link.fail == true) || (elapsed > TRACE_FAIL_MS))
+        {
+            Adapt_LinkFail(&adapt);
+            result->failed++;
+            continue;
+        }
+        Adapt_LinkDelivery(&adapt, length, (uint32_t)elapsed);
+
+        if(step < TRACE_WARMUP)
+        {
+            continue;
+        }
+        result->delivered++;
+        result->total_ms += elapsed;
+        result->bytes += length;
+        feasible = (adapt_profile_table[0].size * TRACE_SCENE * 1.1 / (link.goodput * 0.9) * 1000.0 + TRACE_FIXED_MS <= target_ms);
+        if(feasible == true)
+        {
+            result->feasible++;
+            result->in_target += (elapsed <= target_ms) ? 1 : 0;
+        }
+
+        /* captures the controller needs to follow the fade */
+        if(((type == TRACE_FADE) || (type == TRACE_BUSY)) && (step >= 40) && (feasible == true) && (settled == false))
+        {
+            result->settle++;
+            settled = (elapsed <= target_ms);
+        }
+    }
+    result->profile = profile;
+}
+
+int main(int argc, char **argv)
+{
+    static const char *trace_name[] = { "good", "weak", "fade", "busy", "noisy", "outage" };
+    Trace_Result_t result;
+    Trace_Result_t fixed;
+    uint32_t target_ms = ADAPT_TARGET_DEFAULT;
+    uint32_t failed = 0;
+    uint32_t t = 0;
+    double percent = 0;
+    bool ok = true;
+
+    if(argc > 1)
+    {
+        target_ms = (uint32_t)atoi(argv[1]);
+    }
+    printf("target %u ms, %u captures per trace\n", target_ms, TRACE_STEPS);
+    printf("%-8s %10s %10s %9s %7s %8s %7s %8s | %10s %9s %7s\n", "trace", "in target", "mean ms", "KB/image",
+           "failed", "switches", "settle", "profile", "fixed in", "fixed ms", "failed");
+
+    for(t = 0; t < TRACE_NUM; t++)
+    {
+        Trace_Run((Trace_Type_t)t, target_ms, false, &result);
+        Trace_Run((Trace_Type_t)t, target_ms, true, &fixed);
+
+        percent = (result.feasible > 0) ? (100.0 * result.in_target / result.feasible) : 100.0;
+        printf("%-8s %10s %10.0f %9.1f %7u %8u %7u %8u | %10s %9.0f %7u", trace_name[t],
+               Trace_Percent(result.in_target, result.feasible),
+               (result.delivered > 0) ? (result.total_ms / result.delivered) : 0,
+               (result.delivered > 0) ? (result.bytes / result.delivered / 1024.0) : 0,
+               result.failed, result.switches, result.settle, result.profile,
+               Trace_Percent(fixed.in_target, fixed.feasible),
+               (fixed.delivered > 0) ? (fixed.total_ms / fixed.delivered) : 0, fixed.failed);
+
+        /* controller meets target where the link allows, does not toggle on noise.
+         * Profile the trace ends with is known for the default target only */
+        if(target_ms != ADAPT_TARGET_DEFAULT)
+        {
+            printf("\n");
+            continue;
+        }
+        switch((Trace_Type_t)t)
+        {
+        case TRACE_GOOD:
+            ok = (result.profile == ADAPT_PROFILE_NUM - 1) && (percent >= 95.0);
+            break;
+
+        case TRACE_FADE:
+        case TRACE_BUSY:
+            ok = (result.settle <= TRACE_SETTLE) && (result.profile == ADAPT_PROFILE_NUM - 1) && (percent >= 85.0);
+            break;
+
+        case TRACE_NOISY:
+            ok = (result.switches <= TRACE_STEPS / 15) && (percent >= 80.0);
+            break;
+
+        case TRACE_OUTAGE:
+            /* steps down on SEND FAIL and comes back */
+            ok = (percent >= 90.0) && (result.failed == 6) && (result.low < result.profile);
+            break;
+
+        case TRACE_WEAK:
+        default:
+            ok = (percent >= 90.0) && (result.failed == 0);
+            break;
+        }
+        printf("%s\n", (ok == true) ? "" : "  FAILED");
+        failed += (ok == true) ? 0 : 1;
+    }
+
+    printf("%u failed\n", failed);
+    return (failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,291 @@
+/*
+***************************************************************************************************
+*                           ESP8266 AT Send Window Emulator (host)
+*
+* File   : at_emulator.c
+* Author : Douglas Xie
+* Date   : 2018.03.30
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*
+* Image upload of WiFi_Ctrl_SendImage against an emulated ESP8266: AT+CIPSEND is answered by
+* OK and '>', data is taken at uart rate and answered by "Recv n bytes", SEND OK comes when
+* the peer acks the chunk. Module variants:
+*   busy:    old firmware, "busy s..." to a CIPSEND while a chunk is in flight, sender must
+*            fall back to stop and wait
+*   serial:  OK at once, but '>' only after SEND OK of the chunk in flight, so SEND OK comes
+*            while the sender waits for '>' (usual AT firmware)
+*   buffer:  '>' at once, chunks queue in module TCP buffer
+* Sender loop and event wait are Send_Image and Send_WaitEvent of wifi_send.c, the emulated
+* module is behind its hooks and events are taken in time order. Every image must be
+* delivered in full with every SEND OK taken, no more than window chunks may wait for SEND
+* OK, and busy module makes the sender fall back once. With serial module a SEND OK that ends
+* the send window while the sender waits for '>' must not end that wait.
+*
+*   gcc -O2 -I../Application/Include at_emulator.c ../Application/Source/wifi_send.c -o at_emulator
+*   ./at_emulator [image_kb] [chunk]
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "wifi_send.h"
+
+#define EMU_UART_BPS        92160.0     /* 921600 baud, 10 bits per byte */
+#define EMU_WIFI_BPS        400000.0    /* module TCP goodput to peer */
+#define EMU_CMD_MS          0.3         /* module answers a command */
+#define EMU_TIMEOUT_MS      1000.0      /* WIFI_RX_FB_TIMEOUT */
+#define EMU_FRAME_OVERHEAD  16          /* MSG_CMD_SIZE */
+#define EMU_EVENT_MAX       64
+
+typedef struct
+{
+    double          time;
+    WiFi_RxState_t  state;
+} Emu_Event_t;
+
+typedef enum
+{
+    EMU_MODULE_BUSY = 0,
+    EMU_MODULE_SERIAL,
+    EMU_MODULE_BUFFER,
+    EMU_MODULE_NUM
+} Emu_Module_t;
+
+typedef struct
+{
+    /* module */
+    Emu_Module_t    module;
+    double          rtt_ms;
+    double          link_free;          /* wifi side done with earlier chunks */
+    uint32_t        in_flight;          /* chunks not acked by peer */
+    double          ack_time[EMU_EVENT_MAX];
+    uint32_t        ack_count;
+    Emu_Event_t     events[EMU_EVENT_MAX];
+    uint32_t        event_count;
+    uint16_t        expect;             /* CIPSEND length, 0 when no '>' given */
+    uint32_t        delivered;          /* jpg bytes taken */
+    /* sender */
+    double          now;
+    uint32_t        early_send_ok;      /* SEND OK taken while waiting for '>' */
+    uint32_t        sent;               /* frames written */
+    uint32_t        acked;              /* SEND OK taken */
+    uint32_t        max_window;         /* most frames waiting for SEND OK */
+} Emu_t;
+
+static void Emu_Post(Emu_t *emu, double time, WiFi_RxState_t state)
+{
+    uint32_t i = emu->event_count;
+
+    /* keep time order, same time keeps post order */
+    while((i > 0) && (emu->events[i - 1].time > time))
+    {
+        emu->events[i] = emu->events[i - 1];
+        i--;
+    }
+    emu->events[i].time = time;
+    emu->events[i].state = state;
+    emu->event_count++;
+}
+
+/* Peer acks of earlier chunks due now free the module */
+static void Emu_Acked(Emu_t *emu)
+{
+    uint32_t i = 0;
+
+    while((i < emu->ack_count) && (emu->ack_time[i] <= emu->now))
+    {
+        i++;
+    }
+    memmove(emu->ack_time, &emu->ack_time[i], (emu->ack_count - i) * sizeof(double));
+    emu->ack_count -= i;
+    emu->in_flight = emu->ack_count;
+}
+
+/* Sender writes AT+CIPSEND, length is jpg bytes of the packet */
+static void Emu_Command(uint8_t link, uint16_t packet, uint16_t length, bool flush, void *context)
+{
+    Emu_t *emu = (Emu_t *)context;
+    double ready = 0;
+
+    (void)link;
+    (void)packet;
+    (void)flush;
+
+    emu->now += 20 / EMU_UART_BPS * 1000.0;
+    Emu_Acked(emu);
+    if((emu->module == EMU_MODULE_BUSY) && (emu->in_flight > 0))
+    {
+        Emu_Post(emu, emu->now + EMU_CMD_MS, WIFI_RX_BUSY);
+        return;
+    }
+    emu->expect = length + EMU_FRAME_OVERHEAD;
+    ready = emu->now + EMU_CMD_MS;
+    Emu_Post(emu, ready, WIFI_RX_ATFB_OK);
+    /* SEND OK of chunk in flight is printed first, it is posted earlier */
+    if((emu->module == EMU_MODULE_SERIAL) && (emu->ack_count > 0) && (emu->ack_time[emu->ack_count - 1] > ready))
+    {
+        ready = emu->ack_time[emu->ack_count - 1];
+    }
+    Emu_Post(emu, ready, WIFI_RX_SEND_READY);
+}
+
+/* Sender writes the frame, returns at uart tx complete */
+static bool Emu_Data(uint8_t link, uint16_t packet, uint32_t offset, uint16_t length, void *context)
+{
+    Emu_t *emu = (Emu_t *)context;
+    double start = 0;
+    double ack = 0;
+
+    (void)link;
+    (void)packet;
+    if((emu->expect != length + EMU_FRAME_OVERHEAD) || (offset != emu->delivered))
+    {
+        return false;
+    }
+    emu->expect = 0;
+    emu->delivered += length;
+    emu->sent++;
+    if(emu->sent - emu->acked > emu->max_window)
+    {
+        emu->max_window = emu->sent - emu->acked;
+    }
+    length += EMU_FRAME_OVERHEAD;
+    emu->now += length / EMU_UART_BPS * 1000.0;
+    Emu_Post(emu, emu->now + EMU_CMD_MS, WIFI_RX_RECV);
+
+    start = (emu->link_free > emu->now) ? emu->link_free : emu->now;
+    emu->link_free = start + length / EMU_WIFI_BPS * 1000.0;
+    ack = emu->link_free + emu->rtt_ms;
+    emu->ack_time[emu->ack_count++] = ack;
+    emu->in_flight = emu->ack_count;
+    Emu_Post(emu, ack, WIFI_RX_SEND_OK);
+    return true;
+}
+
+static bool Emu_Receive(WiFi_RxState_t *state, void *context)
+{
+    Emu_t *emu = (Emu_t *)context;
+
+    if((emu->event_count == 0) || (emu->events[0].time > emu->now + EMU_TIMEOUT_MS))
+    {
+        emu->now += EMU_TIMEOUT_MS;
+        return false;
+    }
+    if(emu->events[0].time > emu->now)
+    {
+        emu->now = emu->events[0].time;
+    }
+    *state = emu->events[0].state;
+    emu->event_count--;
+    memmove(emu->events, &emu->events[1], emu->event_count * sizeof(Emu_Event_t));
+    if(*state == WIFI_RX_SEND_OK)
+    {
+        emu->acked++;
+        /* '>' of the CIPSEND is not taken yet */
+        if(emu->expect != 0)
+        {
+            emu->early_send_ok++;
+        }
+    }
+    return true;
+}
+
+/* No control respond and no task tick in the emulator */
+static bool Emu_Pending(void *context)
+{
+    (void)context;
+    return false;
+}
+
+static void Emu_Preempt(void *context)
+{
+    (void)context;
+}
+
+static uint32_t Emu_Tick(void *context)
+{
+    return (uint32_t)((Emu_t *)context)->now;
+}
+
+static void Emu_Accepted(uint32_t tick, void *context)
+{
+    (void)tick;
+    (void)context;
+}
+
+static bool Emu_Connected(uint8_t link, void *context)
+{
+    (void)link;
+    (void)context;
+    return true;
+}
+
+static const Send_Hook_t emu_hook =
+{
+    Emu_Receive,
+    Emu_Command,
+    Emu_Data,
+    Emu_Pending,
+    Emu_Preempt,
+    Emu_Tick,
+    Emu_Accepted,
+    Emu_Connected,
+};
+
+int main(int argc, char **argv)
+{
+    static const double rtts[] = { 2.0, 10.0, 30.0, 80.0 };
+    static const char *name[] = { "busy", "serial", "buffer" };
+    uint32_t image = 40 * 1024;
+    uint16_t chunk = 1000;
+    uint8_t window = 0;
+    uint32_t n = 0;
+    uint32_t failed = 0;
+    bool done = false;
+    bool ok = false;
+    Emu_t emu;
+    Send_t send;
+
+    if(argc > 1)
+    {
+        image = (uint32_t)atoi(argv[1]) * 1024;
+    }
+    if(argc > 2)
+    {
+        chunk = (uint16_t)atoi(argv[2]);
+    }
+    printf("image %u bytes, chunk %u, uart %.0f B/s, wifi %.0f B/s\n", image, chunk, EMU_UART_BPS, EMU_WIFI_BPS);
+    printf("%-8s %7s %7s %10s %10s %9s %12s\n", "module", "rtt ms", "window", "ms", "KB/s", "fallback", "early sendok");
+
+    for(n = 0; n < EMU_MODULE_NUM; n++)
+    {
+        for(uint32_t r = 0; r < sizeof(rtts) / sizeof(rtts[0]); r++)
+        {
+            for(window = 1; window <= WIFI_SEND_WINDOW; window++)
+            {
+                memset(&emu, 0, sizeof(emu));
+                emu.module = (Emu_Module_t)n;
+                emu.rtt_ms = rtts[r];
+                Send_Init(&send, &emu_hook, &emu);
+                done = Send_Image(&send, 0, image, chunk, window);
+                ok = (done == true) && (emu.delivered == image) && (emu.acked == emu.sent) &&
+                     (emu.max_window <= window) && (send.fallback <= 1);
+                if(ok == false)
+                {
+                    failed++;
+                }
+                printf("%-8s %7.0f %7u %10.1f %10.1f %9u %12u%s\n", name[n], rtts[r], window,
+                       emu.now, image / emu.now * 1000.0 / 1024, send.fallback, emu.early_send_ok,
+                       (ok == true) ? "" : "  FAILED");
+            }
+        }
+    }
+
+    printf("%u failed\n", failed);
+    return (failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,366 @@
+/*
+***************************************************************************************************
+*                           Image Chunk Size Throughput Sweep (host)
+*
+* File   : chunk_sweep.c
+* Author : Douglas Xie
+* Date   : 2018.03.30
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*
+* Upload loop of WiFi_Ctrl_SendImage (station, AT+CIPSEND per chunk, send window) over a model
+* of uart and of ESP8266 lwip, throughput of one image by chunk size and link.
+*   uart:  AT+CIPSEND and frame at 921600 baud, '>' after module has room for the frame
+*   lwip:  each frame is written as its own segments of TCP_MSS, send buffer of 2 MSS and
+*          8 segments, SEND OK when all segments of the frame are acked
+*   peer:  ack every second segment or after delayed ack timer
+* Frame overhead and chunks per frame are the ones of WiFi_ChunkReport, chunk limits and the
+* MSS chunk are the ones of WiFi_SetChunkSize.
+*
+*   gcc -O2 chunk_sweep.c -o chunk_sweep
+*   ./chunk_sweep [image_bytes]
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SIM_UART_BPS        92160.0     /* 921600 baud, 10 bits per byte */
+#define SIM_CMD_SIZE        16          /* MSG_CMD_SIZE */
+#define SIM_CMD_SIZE_V2     19          /* MSG_CMD_SIZE_V2 */
+#define SIM_CIPSEND_MAX     2048        /* WIFI_CIPSEND_MAX */
+#define SIM_TCP_MSS         1460        /* WIFI_TCP_MSS */
+#define SIM_CHUNK_DEFAULT   1000        /* WIFI_CHUNK_DEFAULT */
+#define SIM_CHUNK_MSS       (SIM_TCP_MSS - SIM_CMD_SIZE_V2)      /* WIFI_CHUNK_MSS */
+#define SIM_CHUNK_MIN       256         /* WIFI_CHUNK_MIN */
+#define SIM_CHUNK_MAX       (SIM_CIPSEND_MAX - SIM_CMD_SIZE_V2)  /* WIFI_CHUNK_MAX */
+#define SIM_SEND_WINDOW     3           /* WIFI_SEND_WINDOW */
+
+#define SIM_SND_BUF         (2 * SIM_TCP_MSS)   /* esp8266 lwip TCP_SND_BUF */
+#define SIM_SND_QUEUELEN    8                   /* esp8266 lwip TCP_SND_QUEUELEN */
+#define SIM_SEG_OVERHEAD    90          /* TCP/IP header, 802.11 header and preamble time */
+#define SIM_PROMPT_MS       1.0         /* module answers AT+CIPSEND with '>' */
+#define SIM_RECV_MS         0.5         /* module copies frame, Recv n bytes */
+#define SIM_DELACK_MS       40.0        /* peer delayed ack */
+#define SIM_SEG_MAX         4096
+#define SIM_SWEEP_NUM       16
+
+typedef struct
+{
+    const char  *name;
+    double      air_bps;                /* bytes per second on air */
+    double      rtt_ms;
+} Sim_Link_t;
+
+typedef struct
+{
+    uint16_t    length;
+    double      sent;                   /* last bit on air */
+    double      ack;                    /* ack back to module, 0 while delayed ack pending */
+} Sim_Seg_t;
+
+typedef struct
+{
+    Sim_Seg_t   seg[SIM_SEG_MAX];
+    uint32_t    seg_count;
+    uint32_t    seg_acked;              /* oldest segment not acked at current time */
+    double      air_free;
+    uint32_t    pending;                /* segments peer has not acked yet */
+    double      pending_ack;            /* ack back to module if delayed ack timer fires */
+    double      pending_deadline;
+    uint32_t    pending_first;
+} Sim_Tcp_t;
+
+static Sim_Tcp_t tcp;
+
+static double Sim_Uart(uint32_t length)
+{
+    return length / SIM_UART_BPS * 1000.0;
+}
+
+/* Same as WiFi_FrameSize of wifi_task.c */
+static uint16_t Sim_FrameSize(uint8_t version, uint16_t length)
+{
+    return length + ((version == 2) ? SIM_CMD_SIZE_V2 : SIM_CMD_SIZE);
+}
+
+/* Same as WiFi_SetChunkSize of wifi_task.c */
+static uint16_t Sim_SetChunkSize(uint16_t size)
+{
+    if(size == 0)
+    {
+        size = SIM_CHUNK_MSS;
+    }
+    else if(size < SIM_CHUNK_MIN)
+    {
+        size = SIM_CHUNK_MIN;
+    }
+    else if(size > SIM_CHUNK_MAX)
+    {
+        size = SIM_CHUNK_MAX;
+    }
+    return size;
+}
+
+/* Peer acks every second segment or when delayed ack timer fires */
+static void Sim_PeerAck(uint32_t last, double time, const Sim_Link_t *link)
+{
+    uint32_t i = 0;
+
+    for(i = tcp.pending_first; i <= last; i++)
+    {
+        tcp.seg[i].ack = time + link->rtt_ms / 2;
+    }
+    tcp.pending = 0;
+    tcp.pending_first = last + 1;
+}
+
+static void Sim_PeerReceive(uint32_t index, const Sim_Link_t *link)
+{
+    double arrive = tcp.seg[index].sent + link->rtt_ms / 2;
+
+    if((tcp.pending > 0) && (tcp.pending_deadline <= arrive))
+    {
+        Sim_PeerAck(index - 1, tcp.pending_deadline, link);
+    }
+    tcp.pending++;
+    if(tcp.pending >= 2)
+    {
+        Sim_PeerAck(index, arrive, link);
+    }
+    else
+    {
+        tcp.pending_deadline = arrive + SIM_DELACK_MS;
+        tcp.pending_ack = tcp.pending_deadline + link->rtt_ms / 2;
+    }
+}
+
+/* Ack time of a segment, delayed ack fires if nothing else comes first */
+static double Sim_AckTime(uint32_t index)
+{
+    if(tcp.seg[index].ack > 0)
+    {
+        return tcp.seg[index].ack;
+    }
+    return tcp.pending_ack;
+}
+
+/*******************************************************************************
+* @Brief   Send Buffer Room
+* @Param   length[in]: frame bytes
+*          now[in]: time AT+CIPSEND is received
+* @Note    frame is written as its own segments, lwip needs room for all of them
+* @Return  time module has room and prints '>'
+*******************************************************************************/
+static double Sim_Room(uint16_t length, double now)
+{
+    uint32_t segs = (length + SIM_TCP_MSS - 1) / SIM_TCP_MSS;
+    uint32_t bytes = 0;
+    uint32_t count = 0;
+    uint32_t i = 0;
+    double time = now;
+
+    while(tcp.seg_acked < tcp.seg_count)
+    {
+        if(Sim_AckTime(tcp.seg_acked) > now)
+        {
+            break;
+        }
+        tcp.seg_acked++;
+    }
+    for(i = tcp.seg_acked; i < tcp.seg_count; i++)
+    {
+        bytes += tcp.seg[i].length;
+        count++;
+    }
+    /* oldest segments are acked first */
+    for(i = tcp.seg_acked; (i < tcp.seg_count) &&
+        ((bytes + length > SIM_SND_BUF) || (count + segs > SIM_SND_QUEUELEN)); i++)
+    {
+        time = (Sim_AckTime(i) > now) ? Sim_AckTime(i) : now;
+        bytes -= tcp.seg[i].length;
+        count--;
+    }
+    return time;
+}
+
+/* Frame written to lwip, segments go on air in order */
+static uint32_t Sim_Write(uint16_t length, double now, const Sim_Link_t *link)
+{
+    uint16_t part = 0;
+    uint32_t index = 0;
+
+    while(length > 0)
+    {
+        part = (length > SIM_TCP_MSS) ? SIM_TCP_MSS : length;
+        index = tcp.seg_count++;
+        tcp.seg[index].length = part;
+        tcp.seg[index].ack = 0;
+        tcp.air_free = ((tcp.air_free > now) ? tcp.air_free : now) + (part + SIM_SEG_OVERHEAD) / link->air_bps * 1000.0;
+        tcp.seg[index].sent = tcp.air_free;
+        Sim_PeerReceive(index, link);
+        length -= part;
+    }
+    return index;
+}
+
+/*******************************************************************************
+* @Brief   Image Upload Timeline
+* @Param   image_length[in]: jpg size
+*          chunk_size[in]: payload bytes of one packet
+* @Note    same window and order as WiFi_Ctrl_SendImage of wifi_task.c, station
+*          mode AT+CIPSEND=<length>
+* @Return  ms from first AT+CIPSEND to last SEND OK
+*******************************************************************************/
+static double Sim_SendImage(uint32_t image_length, uint16_t chunk_size, uint8_t version, const Sim_Link_t *link)
+{
+    static uint32_t last_seg[SIM_SEG_MAX];  /* SEND OK when it is acked */
+    uint32_t offset = 0;
+    uint32_t packet = 0;
+    uint16_t chunk = 0;
+    uint16_t length = 0;
+    char cmd[32];
+    double now = 0;
+    double end = 0;
+
+    memset(&tcp, 0, sizeof(tcp));
+    while(offset < image_length)
+    {
+        chunk = ((image_length - offset) >= chunk_size) ? chunk_size : (image_length - offset);
+        length = Sim_FrameSize(version, chunk);
+
+        /* window is full, wait for the oldest SEND OK */
+        if((packet >= SIM_SEND_WINDOW) && (Sim_AckTime(last_seg[packet - SIM_SEND_WINDOW]) > now))
+        {
+            now = Sim_AckTime(last_seg[packet - SIM_SEND_WINDOW]);
+        }
+
+        sprintf(cmd, "AT+CIPSEND=%d\r\n", length);
+        now += Sim_Uart((uint32_t)strlen(cmd));
+        now = Sim_Room(length, now) + SIM_PROMPT_MS;
+        now += Sim_Uart(length) + SIM_RECV_MS;
+        last_seg[packet] = Sim_Write(length, now, link);
+
+        packet++;
+        offset += chunk;
+    }
+
+    /* wait SEND OK of the last chunks, delayed ack of the last segment fires */
+    end = Sim_AckTime(last_seg[packet - 1]);
+    return (end > now) ? end : now;
+}
+
+/* Same as WiFi_ChunkReport of wifi_task.c, permille */
+static uint32_t Sim_ChunkReport(uint32_t image_length, uint16_t chunk_size, uint8_t version, uint32_t *chunks)
+{
+    uint32_t overhead = 0;
+
+    *chunks = (image_length + chunk_size - 1) / chunk_size;
+    overhead = (*chunks + 1) * Sim_FrameSize(version, 0);
+    return (overhead * 1000) / (image_length + overhead);
+}
+
+int main(int argc, char **argv)
+{
+    static const Sim_Link_t link_list[] = {
+        { "near", 600000.0, 5.0 },
+        { "room", 300000.0, 20.0 },
+        { "far",  120000.0, 60.0 },
+        { "cloud", 300000.0, 150.0 },
+    };
+    const uint32_t link_num = sizeof(link_list) / sizeof(link_list[0]);
+    uint16_t sweep[SIM_SWEEP_NUM];
+    double kbps[SIM_SWEEP_NUM][4];
+    uint32_t image_length = 40 * 1024;
+    uint32_t sweep_num = 0;
+    uint32_t failed = 0;
+    uint32_t chunks = 0;
+    uint32_t permille = 0;
+    uint32_t mss = 0;
+    uint32_t def = 0;
+    uint32_t max = 0;
+    uint32_t i = 0;
+    uint32_t n = 0;
+    uint8_t version = 0;
+
+    if(argc > 1)
+    {
+        image_length = (uint32_t)atoi(argv[1]);
+    }
+
+    /* client requests go through the same limits as MSG_SET_CHUNK */
+    sweep[sweep_num++] = Sim_SetChunkSize(1);
+    for(i = 512; i < SIM_CHUNK_MAX; i += 256)
+    {
+        sweep[sweep_num++] = Sim_SetChunkSize((uint16_t)i);
+        if((i < SIM_CHUNK_DEFAULT) && (i + 256 > SIM_CHUNK_DEFAULT))
+        {
+            def = sweep_num;
+            sweep[sweep_num++] = Sim_SetChunkSize(SIM_CHUNK_DEFAULT);
+        }
+        if((i < SIM_CHUNK_MSS) && (i + 256 > SIM_CHUNK_MSS))
+        {
+            mss = sweep_num;
+            sweep[sweep_num++] = Sim_SetChunkSize(0);
+        }
+    }
+    max = sweep_num;
+    sweep[sweep_num++] = Sim_SetChunkSize(0xFFFF);
+
+    /* chunk limits must keep every frame in one AT+CIPSEND, MSS chunk in one segment */
+    for(version = 1; version <= 2; version++)
+    {
+        if((Sim_FrameSize(version, sweep[max]) > SIM_CIPSEND_MAX) || (Sim_FrameSize(version, sweep[mss]) > SIM_TCP_MSS))
+        {
+            printf("v%d: chunk %d or %d does not fit\n", version, sweep[max], sweep[mss]);
+            failed++;
+        }
+    }
+
+    for(version = 1; version <= 2; version++)
+    {
+        printf("\nprotocol v%d, image %u bytes, KB/s\n", version, image_length);
+        printf("%6s %6s %5s %7s %9s", "chunk", "frame", "segs", "chunks", "overhead");
+        for(n = 0; n < link_num; n++)
+        {
+            printf(" %5s/%-3.0f", link_list[n].name, link_list[n].rtt_ms);
+        }
+        printf("\n");
+
+        for(i = 0; i < sweep_num; i++)
+        {
+            permille = Sim_ChunkReport(image_length, sweep[i], version, &chunks);
+            printf("%6d %6d %5d %7u %7u.%u%%", sweep[i], Sim_FrameSize(version, sweep[i]),
+                   (Sim_FrameSize(version, sweep[i]) + SIM_TCP_MSS - 1) / SIM_TCP_MSS, chunks, permille / 10, permille % 10);
+            for(n = 0; n < link_num; n++)
+            {
+                kbps[i][n] = image_length / Sim_SendImage(image_length, sweep[i], version, &link_list[n]) * 1000.0 / 1024.0;
+                printf(" %9.1f", kbps[i][n]);
+            }
+            printf("%s\n", (i == mss) ? "  mss" : ((i == def) ? "  default" : ""));
+        }
+
+        /* MSS chunk is never worse than the old fixed 1000 bytes, and wins where rtt limits */
+        for(n = 0; n < link_num; n++)
+        {
+            if(kbps[mss][n] < kbps[def][n] * 0.99)
+            {
+                printf("v%d %s: mss chunk %.1f KB/s below default %.1f KB/s\n", version, link_list[n].name,
+                       kbps[mss][n], kbps[def][n]);
+                failed++;
+            }
+            if((link_list[n].rtt_ms >= 60.0) && (kbps[mss][n] < kbps[max][n]))
+            {
+                printf("v%d %s: mss chunk %.1f KB/s below max chunk %.1f KB/s\n", version, link_list[n].name,
+                       kbps[mss][n], kbps[max][n]);
+                failed++;
+            }
+        }
+    }
+
+    printf("%u failed\n", failed);
+    return (failed == 0) ? 0 : 1;
+}
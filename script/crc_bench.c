@@ -0,0 +1,92 @@
+/*
+***************************************************************************************************
+*                           Frame Check Cost Benchmark (host)
+*
+* File   : crc_bench.c
+* Author : Douglas Xie
+* Date   : 2018.03.26
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*
+* Cost per KB of protocol v1 checksum8 (same loop as Mem_GetChecksum8) and of protocol v2
+* crc32 by table (CRC32_Software, the fallback when CRC unit is busy). On target the CRC unit
+* takes one word per AHB write, 256 writes per KB.
+* Also prints CRC-32/MPEG-2 check value of "123456789", must be 0x0376E6E7.
+*
+*   gcc -O2 -DCRC32_HOST -I../Application/Include crc_bench.c ../Application/Source/crc32.c -o crc_bench
+*   ./crc_bench
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "crc32.h"
+
+#define BENCH_BLOCK_SIZE    1000        /* one image chunk */
+#define BENCH_ROUNDS        200000
+
+/* Same as Mem_GetChecksum8 of memory.c */
+static uint8_t Bench_Checksum8(uint8_t init_value, const uint8_t *pdata, uint32_t length)
+{
+    uint8_t checksum = init_value;
+    uint32_t i = 0;
+
+    for(i = 0; i < length; i++)
+    {
+        checksum += *pdata;
+        pdata++;
+    }
+
+    return checksum;
+}
+
+static double Bench_Now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(void)
+{
+    static uint8_t block[BENCH_BLOCK_SIZE];
+    volatile uint32_t sink = 0;
+    uint32_t i = 0;
+    double start = 0;
+    double sum8_ns = 0;
+    double crc32_ns = 0;
+
+    for(i = 0; i < BENCH_BLOCK_SIZE; i++)
+    {
+        block[i] = (uint8_t)(rand() & 0xFF);
+    }
+    printf("check value 0x%08X\n", CRC32_Software(CRC32_INIT, (const uint8_t *)"123456789", 9));
+
+    start = Bench_Now();
+    for(i = 0; i < BENCH_ROUNDS; i++)
+    {
+        block[0] = (uint8_t)i;
+        sink += Bench_Checksum8(0, block, BENCH_BLOCK_SIZE);
+    }
+    sum8_ns = (Bench_Now() - start) * 1e9 / BENCH_ROUNDS * 1024 / BENCH_BLOCK_SIZE;
+
+    start = Bench_Now();
+    for(i = 0; i < BENCH_ROUNDS; i++)
+    {
+        block[0] = (uint8_t)i;
+        sink += CRC32_Software(CRC32_INIT, block, BENCH_BLOCK_SIZE);
+    }
+    crc32_ns = (Bench_Now() - start) * 1e9 / BENCH_ROUNDS * 1024 / BENCH_BLOCK_SIZE;
+
+    printf("%-20s %10s\n", "check", "ns/KB");
+    printf("%-20s %10.0f\n", "checksum8 (v1)", sum8_ns);
+    printf("%-20s %10.0f  x%.1f\n", "crc32 table (v2)", crc32_ns, crc32_ns / sum8_ns);
+
+    return (sink == 0x5A5A5A5A) ? 1 : 0;
+}
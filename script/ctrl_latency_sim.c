@@ -0,0 +1,238 @@
+/*
+***************************************************************************************************
+*                           WiFi Control Loop Latency Simulator (host)
+*
+* File   : ctrl_latency_sim.c
+* Author : Douglas Xie
+* Date   : 2018.03.30
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*
+* Command round trip seen by the client (request sent to respond received) of the old poll
+* loop of WiFi_ControlTask and of the notify wait of WiFi_Ctrl_Idle, by event timeline.
+*   poll:   vTaskDelay(10) after every state, ATE1 alive test after 500 idle states
+*   notify: idle blocks on task notify, alive test after 5s without event
+* Control task sends one respond per state: AT+CIPSEND, '>', frame, wait SEND OK.
+* Traffic:
+*   single: one request at random time, 200ms apart on average
+*   burst:  5 requests at once (app connect), every second
+*   serial: next request when respond is received, like OTA bin packets
+*
+*   gcc -O2 ctrl_latency_sim.c -o ctrl_latency_sim
+*   ./ctrl_latency_sim [rtt_ms] [requests]
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SIM_UART_BPS        92160.0     /* 921600 baud, 10 bits per byte */
+#define SIM_TICK_MS         1.0         /* configTICK_RATE_HZ 1000 */
+#define SIM_PERIOD_MS       10.0        /* old WIFI_TASK_PERIOD */
+#define SIM_ALIVE_IDLE      500         /* old idle states before alive test */
+#define SIM_ALIVE_PERIOD    5000.0      /* WIFI_ALIVE_PERIOD */
+#define SIM_ALIVE_MS        2.0         /* ATE1 and OK */
+#define SIM_CMD_MS          0.3         /* module answers a command */
+#define SIM_HANDLE_MS       0.2         /* receive task and client task, request to respond_queue */
+#define SIM_SWITCH_MS       0.01        /* notify to control task running */
+#define SIM_REQUEST_SIZE    40          /* +IPD head and request frame */
+#define SIM_RESPOND_SIZE    40          /* respond frame */
+#define SIM_REQ_MAX         20000
+
+typedef enum
+{
+    SIM_TRAFFIC_SINGLE = 0,
+    SIM_TRAFFIC_BURST,
+    SIM_TRAFFIC_SERIAL,
+    SIM_TRAFFIC_NUM
+} Sim_Traffic_t;
+
+typedef struct
+{
+    double      sent[SIM_REQ_MAX];      /* client sends request */
+    double      ready[SIM_REQ_MAX];     /* respond is in respond_queue */
+    double      latency[SIM_REQ_MAX];
+    uint32_t    count;                  /* requests known */
+    uint32_t    total;
+    double      end;                    /* last respond received */
+} Sim_Run_t;
+
+static double Sim_Uart(uint32_t length)
+{
+    return length / SIM_UART_BPS * 1000.0;
+}
+
+static double Sim_Random(void)
+{
+    return rand() / (RAND_MAX + 1.0);
+}
+
+static void Sim_Request(Sim_Run_t *run, double sent, double rtt_ms)
+{
+    run->sent[run->count] = sent;
+    run->ready[run->count] = sent + rtt_ms / 2 + Sim_Uart(SIM_REQUEST_SIZE) + SIM_HANDLE_MS;
+    run->count++;
+}
+
+/* vTaskDelay wakes on a tick */
+static double Sim_Delay(double now, double delay)
+{
+    return (double)(int64_t)(now / SIM_TICK_MS) * SIM_TICK_MS + delay;
+}
+
+/*******************************************************************************
+* @Brief   Control Task Timeline
+* @Param   run[in]: requests, open loop ones are all known
+*          traffic[in]: serial traffic adds next request when respond is received
+*          notify[in]: notify wait, else old poll loop
+* @Note    requests are served in order, one per SEND_RESPOND state
+* @Return
+*******************************************************************************/
+static void Sim_Control(Sim_Run_t *run, Sim_Traffic_t traffic, bool notify, double rtt_ms)
+{
+    double now = Sim_Random() * SIM_PERIOD_MS;
+    double data_in = 0;
+    double arrive = 0;
+    uint32_t served = 0;
+    uint32_t idle_count = 0;
+
+    while(served < run->total)
+    {
+        /* WIFI_CTRL_IDLE */
+        if((served < run->count) && (run->ready[served] <= now))
+        {
+            /* WIFI_CTRL_SEND_RESPOND */
+            if(notify == false)
+            {
+                now = Sim_Delay(now, SIM_PERIOD_MS);
+            }
+            data_in = now + Sim_Uart(20) + SIM_CMD_MS + Sim_Uart(SIM_RESPOND_SIZE);
+            arrive = data_in + rtt_ms / 2;
+            run->latency[served] = arrive - run->sent[served];
+            run->end = arrive;
+            now = data_in + SIM_CMD_MS + rtt_ms;
+            served++;
+            idle_count = 0;
+            if((traffic == SIM_TRAFFIC_SERIAL) && (run->count < run->total))
+            {
+                Sim_Request(run, arrive, rtt_ms);
+            }
+        }
+        else if(notify == false)
+        {
+            idle_count++;
+            if(idle_count >= SIM_ALIVE_IDLE)
+            {
+                /* WIFI_CTRL_ALIVE_TEST after the delay of idle state */
+                idle_count = 0;
+                now = Sim_Delay(now, SIM_PERIOD_MS) + SIM_ALIVE_MS;
+            }
+        }
+        else
+        {
+            /* block until respond_queue notify or alive period */
+            if((served < run->count) && (run->ready[served] - now < SIM_ALIVE_PERIOD))
+            {
+                now = run->ready[served] + SIM_SWITCH_MS;
+                continue;
+            }
+            now += SIM_ALIVE_PERIOD + SIM_ALIVE_MS;
+            continue;
+        }
+
+        if(notify == false)
+        {
+            now = Sim_Delay(now, SIM_PERIOD_MS);
+        }
+    }
+}
+
+static int Sim_Compare(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void Sim_Traffic(Sim_Run_t *run, Sim_Traffic_t traffic, uint32_t total, double rtt_ms)
+{
+    double time = 0;
+    uint32_t i = 0;
+
+    run->count = 0;
+    run->total = total;
+    switch(traffic)
+    {
+    case SIM_TRAFFIC_SINGLE:
+        for(i = 0; i < total; i++)
+        {
+            time += 400.0 * Sim_Random();
+            Sim_Request(run, time, rtt_ms);
+        }
+        break;
+
+    case SIM_TRAFFIC_BURST:
+        for(i = 0; i < total; i++)
+        {
+            time = (i / 5) * 1000.0 + 1000.0 * Sim_Random() * ((i % 5) == 0);
+            Sim_Request(run, ((i % 5) == 0) ? time : run->sent[i - 1], rtt_ms);
+        }
+        break;
+
+    case SIM_TRAFFIC_SERIAL:
+    default:
+        Sim_Request(run, 0, rtt_ms);
+        break;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static const char *traffic_name[] = { "single", "burst", "serial" };
+    static Sim_Run_t run;
+    double rtt_ms = 10.0;
+    uint32_t total = 5000;
+    uint32_t t = 0;
+    uint32_t n = 0;
+    uint32_t i = 0;
+    double mean = 0;
+
+    if(argc > 1)
+    {
+        rtt_ms = atof(argv[1]);
+    }
+    if(argc > 2)
+    {
+        total = (uint32_t)atoi(argv[2]);
+        total = (total > SIM_REQ_MAX) ? SIM_REQ_MAX : total;
+    }
+    printf("rtt %.0f ms, %u requests per traffic, round trip in ms\n", rtt_ms, total);
+    printf("%-8s %-8s %8s %8s %8s %8s %10s\n", "traffic", "loop", "mean", "p50", "p99", "max", "request/s");
+
+    for(t = 0; t < SIM_TRAFFIC_NUM; t++)
+    {
+        for(n = 0; n < 2; n++)
+        {
+            srand(t + 1);
+            Sim_Traffic(&run, (Sim_Traffic_t)t, total, rtt_ms);
+            Sim_Control(&run, (Sim_Traffic_t)t, (n == 1), rtt_ms);
+
+            mean = 0;
+            for(i = 0; i < total; i++)
+            {
+                mean += run.latency[i];
+            }
+            mean /= total;
+            qsort(run.latency, total, sizeof(double), Sim_Compare);
+            printf("%-8s %-8s %8.2f %8.2f %8.2f %8.2f %10.1f\n", traffic_name[t], (n == 1) ? "notify" : "poll",
+                   mean, run.latency[total / 2], run.latency[total * 99 / 100], run.latency[total - 1],
+                   total / run.end * 1000.0);
+        }
+    }
+
+    return 0;
+}
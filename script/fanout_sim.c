@@ -0,0 +1,396 @@
+/*
+***************************************************************************************************
+*                           AP Mode Image Fan-out Simulator (host)
+*
+* File   : fanout_sim.c
+* Author : Douglas Xie
+* Date   : 2018.03.30
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*
+* WiFi_Ctrl_FanoutImage against an emulated ESP8266 with several TCP peers. Each peer has its
+* own rate and round trip, module air time is shared. SEND OK has no link id and comes in
+* send order:
+*   busy:   "busy s..." to a CIPSEND while a chunk is in flight, sender falls back to window 1
+*   serial: '>' only after SEND OK of the chunk in flight
+* A dead peer never acks, module reports SEND FAIL after its TCP timeout and takes no other
+* chunk before. A drop peer fails the same way within the event timeout, its SEND FAIL comes
+* while the sender waits for '>' of the link after it. Per link: time the peer got the whole
+* frame, KB/s, and state of fan-out. The same links served one after another (one image push
+* per link) are the baseline. A slow peer must not hold fast peers much longer than with fast
+* peers only, a failing peer no longer than the module is blocked by it, and the fast peers
+* must get the frame. The module also checks that frames of a link come in offset order, a
+* live link has no more than WIFI_LINK_WINDOW chunks waiting for their result, and a busy
+* module makes the sender fall back once per frame.
+*
+* Scheduler and event wait are Send_Fanout of wifi_send.c, the emulated module is behind its
+* hooks.
+*
+*   gcc -O2 -I../Application/Include fanout_sim.c ../Application/Source/wifi_send.c -o fanout_sim
+*   ./fanout_sim [image_kb] [chunk]
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "wifi_send.h"
+
+#define SIM_UART_BPS        92160.0     /* 921600 baud, 10 bits per byte */
+#define SIM_AIR_BPS         400000.0    /* module TCP goodput of all links */
+#define SIM_CMD_MS          0.3         /* module answers a command */
+#define SIM_TIMEOUT_MS      1000.0      /* WIFI_RX_FB_TIMEOUT */
+#define SIM_TCP_FAIL_MS     3000.0      /* module gives up a chunk, SEND FAIL */
+#define SIM_DROP_FAIL_MS    400.0       /* SEND FAIL of a drop peer, within SIM_TIMEOUT_MS */
+#define SIM_FRAME_OVERHEAD  16          /* MSG_CMD_SIZE */
+#define SIM_FILE_INFO_LEN   24          /* WIFI_FILE_INFO_LEN */
+#define SIM_EVENT_MAX       64
+
+typedef struct
+{
+    double          rate;               /* peer goodput, B/s */
+    double          rtt_ms;
+    double          fail_ms;            /* never acks, SEND FAIL after it, 0 when alive */
+    const char      *name;
+} Sim_Peer_t;
+
+typedef struct
+{
+    double          time;
+    WiFi_RxState_t  state;
+    uint8_t         link;               /* chunk of SEND OK or SEND FAIL */
+} Sim_Event_t;
+
+typedef enum
+{
+    SIM_MODULE_BUSY = 0,
+    SIM_MODULE_SERIAL,
+    SIM_MODULE_NUM
+} Sim_ModuleType_t;
+
+typedef struct
+{
+    Sim_ModuleType_t type;
+    const Sim_Peer_t *peer[WIFI_LINK_NUM];
+    double          peer_free[WIFI_LINK_NUM];
+    uint32_t        peer_bytes[WIFI_LINK_NUM];
+    double          peer_done[WIFI_LINK_NUM];    /* peer got the last byte */
+    double          air_free;
+    double          last_ack;
+    uint16_t        expect;             /* CIPSEND length, 0 when no '>' given */
+    uint32_t        peer_offset[WIFI_LINK_NUM];     /* jpg offset of next frame */
+    uint8_t         pending[WIFI_LINK_NUM];         /* chunks waiting for result */
+    uint8_t         max_pending;        /* most chunks of a live link waiting */
+    Sim_Event_t     events[SIM_EVENT_MAX];
+    uint32_t        event_count;
+    double          now;
+} Sim_Module_t;
+
+static Sim_Module_t module;
+static Send_t send;
+static uint8_t client_list[WIFI_LINK_NUM];
+
+static double Sim_Uart(uint32_t length)
+{
+    return length / SIM_UART_BPS * 1000.0;
+}
+
+static void Sim_Post(double time, WiFi_RxState_t state, uint8_t link)
+{
+    uint32_t i = module.event_count;
+
+    /* keep time order, same time keeps post order */
+    while((i > 0) && (module.events[i - 1].time > time))
+    {
+        module.events[i] = module.events[i - 1];
+        i--;
+    }
+    module.events[i].time = time;
+    module.events[i].state = state;
+    module.events[i].link = link;
+    module.event_count++;
+}
+
+/* Sender takes or drops the first event */
+static void Sim_Pop(void)
+{
+    if((module.events[0].state == WIFI_RX_SEND_OK) || (module.events[0].state == WIFI_RX_SEND_FAIL))
+    {
+        module.pending[module.events[0].link]--;
+    }
+    module.event_count--;
+    memmove(module.events, &module.events[1], module.event_count * sizeof(Sim_Event_t));
+}
+
+/* Sender writes AT+CIPSEND=link,length, WiFi_SendCommand drops replies not taken */
+static void Sim_Command(uint8_t link, uint16_t packet, uint16_t length, bool flush, void *context)
+{
+    double ready = 0;
+
+    (void)link;
+    (void)context;
+
+    while((flush == true) && (module.event_count > 0) && (module.events[0].time <= module.now))
+    {
+        Sim_Pop();
+    }
+    module.now += Sim_Uart(20);
+    ready = module.now + SIM_CMD_MS;
+    if((module.type == SIM_MODULE_BUSY) && (module.last_ack > module.now))
+    {
+        Sim_Post(ready, WIFI_RX_BUSY, WIFI_LINK_NUM);
+        return;
+    }
+    module.expect = ((packet == 0) ? SIM_FILE_INFO_LEN : length) + SIM_FRAME_OVERHEAD;
+    Sim_Post(ready, WIFI_RX_ATFB_OK, WIFI_LINK_NUM);
+    if(module.last_ack > ready)
+    {
+        ready = module.last_ack;
+    }
+    Sim_Post(ready, WIFI_RX_SEND_READY, WIFI_LINK_NUM);
+}
+
+/* Sender writes the frame of link */
+static bool Sim_Data(uint8_t link, uint16_t packet, uint32_t offset, uint16_t length, void *context)
+{
+    const Sim_Peer_t *peer = module.peer[link];
+    double start = 0;
+    double ack = 0;
+
+    (void)context;
+    if((offset != module.peer_offset[link]) || ((packet == 0) && (offset != 0)))
+    {
+        return false;
+    }
+    module.peer_offset[link] += (packet == 0) ? 0 : length;
+    length = ((packet == 0) ? SIM_FILE_INFO_LEN : length) + SIM_FRAME_OVERHEAD;
+    if(module.expect != length)
+    {
+        return false;
+    }
+    module.expect = 0;
+
+    module.now += Sim_Uart(length);
+    Sim_Post(module.now + SIM_CMD_MS, WIFI_RX_RECV, WIFI_LINK_NUM);
+
+    module.pending[link]++;
+    if((peer->fail_ms == 0) && (module.pending[link] > module.max_pending))
+    {
+        module.max_pending = module.pending[link];
+    }
+    if(peer->fail_ms > 0)
+    {
+        ack = module.now + peer->fail_ms;
+        ack = (module.last_ack > ack) ? module.last_ack : ack;
+        Sim_Post(ack, WIFI_RX_SEND_FAIL, link);
+    }
+    else
+    {
+        start = module.now;
+        start = (module.air_free > start) ? module.air_free : start;
+        start = (module.peer_free[link] > start) ? module.peer_free[link] : start;
+        module.air_free = start + length / SIM_AIR_BPS * 1000.0;
+        module.peer_free[link] = start + length / peer->rate * 1000.0;
+        module.peer_bytes[link] += length;
+        module.peer_done[link] = module.peer_free[link] + peer->rtt_ms / 2;
+        ack = module.peer_free[link] + peer->rtt_ms;
+        /* results are printed in send order */
+        ack = (module.last_ack > ack) ? module.last_ack : ack;
+        Sim_Post(ack, WIFI_RX_SEND_OK, link);
+    }
+    if(ack > module.last_ack)
+    {
+        module.last_ack = ack;
+    }
+    return true;
+}
+
+static bool Sim_Receive(WiFi_RxState_t *state, void *context)
+{
+    (void)context;
+    if((module.event_count == 0) || (module.events[0].time > module.now + SIM_TIMEOUT_MS))
+    {
+        module.now += SIM_TIMEOUT_MS;
+        return false;
+    }
+    if(module.events[0].time > module.now)
+    {
+        module.now = module.events[0].time;
+    }
+    *state = module.events[0].state;
+    Sim_Pop();
+    return true;
+}
+
+/* No control respond in the simulator, tick is ms of module time */
+static bool Sim_Pending(void *context)
+{
+    (void)context;
+    return false;
+}
+
+static void Sim_Preempt(void *context)
+{
+    (void)context;
+}
+
+static uint32_t Sim_Tick(void *context)
+{
+    (void)context;
+    return (uint32_t)module.now;
+}
+
+static void Sim_Accepted(uint32_t tick, void *context)
+{
+    (void)tick;
+    (void)context;
+}
+
+static bool Sim_Connected(uint8_t link, void *context)
+{
+    (void)context;
+    return client_list[link] == 1;
+}
+
+static const Send_Hook_t sim_hook =
+{
+    Sim_Receive,
+    Sim_Command,
+    Sim_Data,
+    Sim_Pending,
+    Sim_Preempt,
+    Sim_Tick,
+    Sim_Accepted,
+    Sim_Connected,
+};
+
+static void Sim_Reset(Sim_ModuleType_t type, const Sim_Peer_t *peers, uint8_t count)
+{
+    uint8_t i = 0;
+
+    memset(&module, 0, sizeof(module));
+    memset(client_list, 0, sizeof(client_list));
+    Send_Init(&send, &sim_hook, NULL);
+    module.type = type;
+    for(i = 0; i < count; i++)
+    {
+        module.peer[i] = &peers[i];
+        client_list[i] = 1;
+    }
+}
+
+static void Sim_Print(const char *mode, uint8_t link, uint32_t image, WiFi_LinkState_t state)
+{
+    const Sim_Peer_t *peer = module.peer[link];
+    bool got = (peer->fail_ms == 0) && (module.peer_bytes[link] > image);
+
+    printf("  %-10s %-6s %7.0f/%-5.0f %10.0f %8.1f  %s\n", mode, peer->name, peer->rate / 1024, peer->rtt_ms,
+           (got == true) ? module.peer_done[link] : 0.0,
+           (got == true) ? (image / module.peer_done[link] * 1000.0 / 1024) : 0.0,
+           (state == WIFI_LINK_SENT) ? "sent" : (state == WIFI_LINK_FAIL) ? "fail" : "-");
+}
+
+int main(int argc, char **argv)
+{
+    static const Sim_Peer_t fast_peers[] = { { 300000, 10, 0, "fast" }, { 300000, 10, 0, "fast" },
+                                             { 300000, 10, 0, "fast" } };
+    static const Sim_Peer_t slow_peers[] = { { 300000, 10, 0, "fast" }, { 300000, 10, 0, "fast" },
+                                             { 20000, 150, 0, "slow" } };
+    static const Sim_Peer_t dead_peers[] = { { 300000, 10, 0, "fast" }, { 300000, 10, 0, "fast" },
+                                             { 300000, 10, SIM_TCP_FAIL_MS, "dead" } };
+    static const Sim_Peer_t drop_peers[] = { { 300000, 10, 0, "fast" }, { 300000, 10, SIM_DROP_FAIL_MS, "drop" },
+                                             { 300000, 10, 0, "fast" } };
+    static const Sim_Peer_t *scenario[] = { fast_peers, slow_peers, dead_peers, drop_peers };
+    static const char *scenario_name[] = { "3 fast peers", "2 fast + slow", "2 fast + dead", "fast + drop + fast" };
+    static const char *module_name[] = { "busy", "serial" };
+    WiFi_LinkState_t state[WIFI_LINK_NUM];
+    uint32_t image = 40 * 1024;
+    uint16_t chunk = 1000;
+    uint32_t s = 0;
+    uint32_t m = 0;
+    uint8_t link = 0;
+    double fast_alone = 0;
+    double fast_worst = 0;
+    double allowed = 0;
+    bool fast_sent = true;
+    uint32_t fallback = 0;
+    uint32_t failed = 0;
+
+    if(argc > 1)
+    {
+        image = (uint32_t)atoi(argv[1]) * 1024;
+    }
+    if(argc > 2)
+    {
+        chunk = (uint16_t)atoi(argv[2]);
+    }
+    printf("image %u bytes, chunk %u, uart %.0f B/s, air %.0f B/s\n", image, chunk, SIM_UART_BPS, SIM_AIR_BPS);
+
+    for(m = 0; m < SIM_MODULE_NUM; m++)
+    {
+        for(s = 0; s < sizeof(scenario) / sizeof(scenario[0]); s++)
+        {
+            printf("%s module, %s\n", module_name[m], scenario_name[s]);
+            printf("  %-10s %-6s %13s %10s %8s  %s\n", "push", "peer", "KB/s / rtt", "done ms", "KB/s", "state");
+
+            /* one image push per link, one after another */
+            fallback = 0;
+            Sim_Reset((Sim_ModuleType_t)m, scenario[s], 3);
+            for(link = 0; link < 3; link++)
+            {
+                Send_Fanout(&send, (uint8_t)(1 << link), image, chunk);
+                state[link] = send.link[link].state;
+                fallback = (send.fallback > fallback) ? send.fallback : fallback;
+            }
+            for(link = 0; link < 3; link++)
+            {
+                Sim_Print("one by one", link, image, state[link]);
+            }
+
+            Sim_Reset((Sim_ModuleType_t)m, scenario[s], 3);
+            Send_Fanout(&send, 0x07, image, chunk);
+            fallback = (send.fallback > fallback) ? send.fallback : fallback;
+            fast_worst = 0;
+            fast_sent = true;
+            for(link = 0; link < 3; link++)
+            {
+                Sim_Print("fan-out", link, image, send.link[link].state);
+                if((module.peer[link]->rtt_ms == 10) && (module.peer[link]->fail_ms == 0))
+                {
+                    fast_worst = (module.peer_done[link] > fast_worst) ? module.peer_done[link] : fast_worst;
+                    fast_sent = fast_sent && (send.link[link].state == WIFI_LINK_SENT);
+                }
+            }
+
+            /* failing peer blocks the module until SEND FAIL, sender may wait two timeouts more */
+            if(s == 0)
+            {
+                fast_alone = fast_worst;
+            }
+            allowed = fast_alone * 1.25;
+            for(link = 0; link < 3; link++)
+            {
+                if(scenario[s][link].fail_ms > 0)
+                {
+                    allowed += scenario[s][link].fail_ms + 2 * SIM_TIMEOUT_MS;
+                }
+            }
+            if((fast_sent == false) || (fast_worst > allowed))
+            {
+                failed++;
+                printf("  fast peers done at %.0f ms, allowed %.0f ms: FAILED\n", fast_worst, allowed);
+            }
+            if((module.max_pending > WIFI_LINK_WINDOW) || (fallback > 1))
+            {
+                failed++;
+                printf("  %u chunks of a link waiting, %u fallbacks in a frame: FAILED\n", module.max_pending, fallback);
+            }
+        }
+    }
+
+    printf("%u failed\n", failed);
+    return (failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,168 @@
+# -*- coding: utf-8 -*-
+"""
+Description:  read metrics snapshot of wifi camera and print it
+    1. send Get Metrics command to camera tcp server, or take snapshot payload as hex
+    2. check respond frame (protocol v1, checksum8)
+    3. print counters, gauges, latency histograms and boot stage times
+    4. -l: print handler time of each command run so far (Get Latency)
+
+    Snapshot (little endian), same order as metrics.h:
+    version(1) uptime s(4)
+    counter num(1) counters(4 each)
+    gauge num(1) gauges(4 each)
+    hist num(1) bucket num(1) buckets(2 each)
+    boot stage num(1) stage ms(4 each)
+
+    Usage:
+    python metrics_decode.py camera_ip
+    python metrics_decode.py camera_ip -l
+    python metrics_decode.py -x 0101000000...
+
+Created on Tue Mar 27 15:20:08 2018
+
+@author: Douglas Xie
+@email:  douglas2011@qq.com
+"""
+
+import sys
+import socket
+import struct
+
+# protocol define, same as firmware
+MSG_START = b'\x7B' * 5
+MSG_END = b'\xA8' * 5
+MSG_GET_METRICS = 0x17
+MSG_GET_LATENCY = 0x18
+MSG_FB_OK = 0xF0
+CAMERA_TCP_PORT = 2017
+
+METRICS_VERSION = 1
+
+# names by index, newer firmware may append items, they print by index
+COUNTER_NAME = ['wifi tx bytes', 'wifi images', 'wifi image fail', 'wifi retry', 'wifi recover',
+                'wifi rx frames', 'wifi rx drop', 'camera photos', 'camera previews', 'camera errors',
+                'client requests', 'client errors', 'motor feeds', 'wifi rx lap']
+GAUGE_NAME = ['heap free', 'heap min', 'pool small high', 'pool medium high', 'pool large high',
+              'pool fail', 'link rssi', 'link goodput', 'image profile', 'image size', 'chunk size']
+HIST_NAME = ['tx control', 'tx image', 'capture', 'delivery']
+BOOT_NAME = ['config', 'periph', 'kernel', 'lcd', 'sensor', 'module', 'network', 'link']
+
+CMD_FLAG_FLASH = 0x01
+
+# build message frame: start + cmd + index + length + payload + checksum + end
+def pack_message(cmd, payload):
+    body = struct.pack('<BHH', cmd, 0, len(payload)) + payload
+    return MSG_START + body + bytes([sum(body) & 0xFF]) + MSG_END
+
+# read one respond frame, return command and payload
+def read_message(sock):
+    data = b''
+    while True:
+        start = data.find(MSG_START)
+        if start >= 0 and len(data) >= start + 10:
+            cmd, index, length = struct.unpack_from('<BHH', data, start + 5)
+            end = start + 10 + length
+            if len(data) >= end + 6:
+                body = data[start + 5:end]
+                if data[end] != (sum(body) & 0xFF) or data[end + 1:end + 6] != MSG_END:
+                    raise ValueError('bad frame')
+                return cmd, data[start + 10:end]
+        part = sock.recv(1024)
+        if not part:
+            raise ValueError('link closed')
+        data += part
+
+def request(sock, command, payload):
+    sock.sendall(pack_message(command, payload))
+    cmd, payload = read_message(sock)
+    if cmd != MSG_FB_OK and cmd != command:
+        raise ValueError('camera respond 0x%02X' % cmd)
+    return payload
+
+def get_metrics(camera_ip):
+    sock = socket.create_connection((camera_ip, CAMERA_TCP_PORT), timeout=5)
+    payload = request(sock, MSG_GET_METRICS, b'')
+    sock.close()
+    return payload
+
+def bucket_head(buckets):
+    return ' '.join('%6s' % ('<2' if n == 0 else '%d+' % (1 << n)) for n in range(buckets))
+
+# respond is full when next entry does not fit, ask again from last command + 1
+def get_latency(camera_ip):
+    sock = socket.create_connection((camera_ip, CAMERA_TCP_PORT), timeout=5)
+    first = 0
+    head = False
+    while first <= 0xFF:
+        payload = request(sock, MSG_GET_LATENCY, bytes([first]))
+        buckets = payload[0]
+        size = 2 + buckets * 2
+        if not head:
+            print('command ms: %s' % bucket_head(buckets))
+            head = True
+        for pos in range(1, len(payload) - size + 1, size):
+            cmd, flags = payload[pos], payload[pos + 1]
+            hist = struct.unpack_from('<%dH' % buckets, payload, pos + 2)
+            print('  0x%02X %-5s%s' % (cmd, 'flash' if flags & CMD_FLAG_FLASH else '',
+                                      ' '.join('%6d' % v for v in hist)))
+            first = cmd + 1
+        if len(payload) + size <= 256:
+            break
+    sock.close()
+
+def item_name(names, i):
+    return names[i] if i < len(names) else '#%d' % i
+
+def decode(snapshot):
+    version, uptime = struct.unpack_from('<BI', snapshot, 0)
+    if version != METRICS_VERSION:
+        raise ValueError('snapshot version %d' % version)
+    pos = 5
+    print('uptime %d s' % uptime)
+
+    num = snapshot[pos]
+    pos += 1
+    print('counters:')
+    for i, value in enumerate(struct.unpack_from('<%dI' % num, snapshot, pos)):
+        print('  %-20s %10d' % (item_name(COUNTER_NAME, i), value))
+    pos += num * 4
+
+    num = snapshot[pos]
+    pos += 1
+    print('gauges:')
+    for i, value in enumerate(struct.unpack_from('<%dI' % num, snapshot, pos)):
+        if item_name(GAUGE_NAME, i) == 'link rssi':
+            value = struct.unpack('<i', struct.pack('<I', value))[0]
+        print('  %-20s %10d' % (item_name(GAUGE_NAME, i), value))
+    pos += num * 4
+
+    num, buckets = snapshot[pos], snapshot[pos + 1]
+    pos += 2
+    # bucket n counts [2^n, 2^(n+1)) ms, first is 0~1ms, last is open
+    print('latency ms: %s' % bucket_head(buckets))
+    for i in range(num):
+        hist = struct.unpack_from('<%dH' % buckets, snapshot, pos)
+        pos += buckets * 2
+        print('  %-10s%s' % (item_name(HIST_NAME, i), ' '.join('%6d' % v for v in hist)))
+
+    num = snapshot[pos]
+    pos += 1
+    print('boot stage ms:')
+    for i, value in enumerate(struct.unpack_from('<%dI' % num, snapshot, pos)):
+        print('  %-20s %10s' % (item_name(BOOT_NAME, i), value if value != 0 else '-'))
+
+def main():
+    if len(sys.argv) >= 3 and sys.argv[1] == '-x':
+        snapshot = bytes.fromhex(''.join(sys.argv[2:]))
+    elif len(sys.argv) == 3 and sys.argv[2] == '-l':
+        get_latency(sys.argv[1])
+        return
+    elif len(sys.argv) == 2:
+        snapshot = get_metrics(sys.argv[1])
+    else:
+        print(__doc__)
+        return
+    decode(snapshot)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,161 @@
+/*
+***************************************************************************************************
+*                           OTA Flash Write Simulator (host)
+*
+* File   : ota_sim.c
+* Author : Douglas Xie
+* Date   : 2018.03.29
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*
+* End to end time of an OTA by event timeline: erase request, bin packets sent stop and wait
+* (uploader sends next packet after ack), verify. Compares flash write in client task before
+* ack (sync) with write behind by ota write task, buffers = blocks the writer may own.
+* Timings of STM32F437 at 2.7~3.6V (x32 parallelism), datasheet typical:
+*   byte or word program 16us, 128KB sector erase 1s, ota area is 2 sectors.
+* Link is uart 921600 baud to wifi module plus wifi round trip.
+*
+*   gcc -O2 ota_sim.c -o ota_sim
+*   ./ota_sim [image_kb] [rtt_ms]
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define SIM_PACKET_SIZE     4096        /* MSG_MAX_RX_PAYLOAD, packet 0 has 8 bytes info */
+#define SIM_FRAME_OVERHEAD  16          /* MSG_CMD_SIZE */
+#define SIM_LINK_BPS        92160.0     /* 921600 baud, 10 bits per byte */
+#define SIM_PROGRAM_US      16.0        /* one program operation */
+#define SIM_ERASE_MS        2000.0      /* two 128KB sectors */
+#define SIM_HANDLE_MS       0.5         /* decode and respond per packet, not overlapped */
+#define SIM_CRC_NS_BYTE     60.0        /* CRC16_CCITT over flash at verify */
+#define SIM_MAX_BUFFERS     4
+
+typedef struct
+{
+    double total_ms;
+    double stall_ms;                    /* client waited for a free buffer */
+} Sim_Result_t;
+
+/*******************************************************************************
+* @Brief   Simulate one OTA
+* @Param   image[in]: firmware bytes
+*          rtt_ms[in]: wifi round trip
+*          unit[in]: bytes per program operation, 1 byte or 4 word
+*          buffers[in]: 0 sync write, else blocks of ota write task
+* @Note    writer starts next packet as soon as previous is in flash, client
+*          can queue packet i when writer took packet i - (buffers - 1)
+* @Return
+*******************************************************************************/
+static Sim_Result_t Sim_Ota(uint32_t image, double rtt_ms, uint32_t unit, uint32_t buffers)
+{
+    double start[SIM_MAX_BUFFERS] = { 0 };  /* writer start time of last packets, ring */
+    Sim_Result_t result = { 0, 0 };
+    double now = 0;
+    double arrive = 0;
+    double handled = 0;
+    double queued = 0;
+    double write_end = 0;
+    double program = 0;
+    uint32_t sent = 0;
+    uint32_t data = 0;
+    uint32_t length = 0;
+    uint32_t i = 0;
+
+    /* ota request: erase then ack */
+    now = SIM_ERASE_MS + rtt_ms;
+
+    for(i = 0; sent < image; i++)
+    {
+        length = SIM_PACKET_SIZE;
+        data = (i == 0) ? (length - 8) : length;
+        if(data > image - sent)
+        {
+            data = image - sent;
+            length = (i == 0) ? (data + 8) : data;
+        }
+        sent += data;
+        program = ((data + unit - 1) / unit) * SIM_PROGRAM_US / 1000.0;
+
+        arrive = now + (length + SIM_FRAME_OVERHEAD) * 1000.0 / SIM_LINK_BPS + rtt_ms / 2;
+        handled = arrive + SIM_HANDLE_MS;
+
+        if(buffers == 0)
+        {
+            /* program before ack */
+            write_end = handled + program;
+            now = write_end + rtt_ms / 2;
+        }
+        else
+        {
+            /* queue slot is free when writer took packet i - (buffers - 1) */
+            queued = handled;
+            if((buffers > 1) && (i >= buffers - 1) && (start[(i - (buffers - 1)) % SIM_MAX_BUFFERS] > queued))
+            {
+                queued = start[(i - (buffers - 1)) % SIM_MAX_BUFFERS];
+            }
+            else if((buffers == 1) && (write_end > queued))
+            {
+                queued = write_end;
+            }
+            result.stall_ms += queued - handled;
+            start[i % SIM_MAX_BUFFERS] = (write_end > queued) ? write_end : queued;
+            write_end = start[i % SIM_MAX_BUFFERS] + program;
+            now = queued + rtt_ms / 2;
+        }
+    }
+
+    /* verify waits for last write, then crc over image */
+    now += (SIM_FRAME_OVERHEAD * 1000.0 / SIM_LINK_BPS) + rtt_ms / 2;
+    if(write_end > now)
+    {
+        now = write_end;
+    }
+    result.total_ms = now + image * SIM_CRC_NS_BYTE / 1e6 + rtt_ms / 2;
+
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    static const char *name[] = { "sync", "behind x1", "behind x2", "behind x3" };
+    uint32_t image = 200 * 1024;
+    double rtt_ms = 10.0;
+    Sim_Result_t byte_result;
+    Sim_Result_t word_result;
+    double byte_sync = 0;
+    double word_sync = 0;
+    uint32_t n = 0;
+
+    if(argc > 1)
+    {
+        image = (uint32_t)atoi(argv[1]) * 1024;
+    }
+    if(argc > 2)
+    {
+        rtt_ms = atof(argv[2]);
+    }
+    printf("image %u bytes, packet %u bytes, rtt %.1f ms, link %.0f B/s\n",
+           image, SIM_PACKET_SIZE, rtt_ms, SIM_LINK_BPS);
+    printf("%-10s %12s %8s %10s %12s %8s %10s\n",
+           "write", "byte ms", "speed", "stall ms", "word ms", "speed", "stall ms");
+
+    for(n = 0; n < SIM_MAX_BUFFERS; n++)
+    {
+        byte_result = Sim_Ota(image, rtt_ms, 1, n);
+        word_result = Sim_Ota(image, rtt_ms, 4, n);
+        if(n == 0)
+        {
+            byte_sync = byte_result.total_ms;
+            word_sync = word_result.total_ms;
+        }
+        printf("%-10s %12.0f %7.2fx %10.0f %12.0f %7.2fx %10.0f\n", name[n],
+               byte_result.total_ms, byte_sync / byte_result.total_ms, byte_result.stall_ms,
+               word_result.total_ms, word_sync / word_result.total_ms, word_result.stall_ms);
+    }
+
+    return 0;
+}
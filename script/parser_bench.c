@@ -0,0 +1,227 @@
+/*
+***************************************************************************************************
+*                           AT Response Tokenizer Benchmark (host)
+*
+* File   : parser_bench.c
+* Author : Douglas Xie
+* Date   : 2018.03.30
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*
+* Feed module uart traces to wifi_parser in spans of different size, like the receive task
+* drains the ring, and print throughput in bytes/cycle (tsc on x86) and ns/byte.
+* Built-in traces:
+*   control: response lines only (OK, SEND OK, n,CONNECT, busy, echo), keyword table path
+*   ipd:     +IPD of 1460 bytes, payload span path
+*   session: image upload of AP mode, CIPSEND echo and results between short +IPD requests
+* A capture file (raw bytes of module uart) is benchmarked as one more trace.
+*
+*   gcc -O2 -I../Application/Include parser_bench.c ../Application/Source/wifi_parser.c
+*       -o parser_bench
+*   ./parser_bench [capture_file]
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_TSC           1
+#else
+#define BENCH_TSC           0
+#endif
+
+#include "wifi_parser.h"
+
+#define BENCH_TRACE_SIZE    (4 * 1024 * 1024)
+#define BENCH_ROUNDS        8
+
+typedef struct
+{
+    uint32_t    events;
+    uint32_t    sum;
+} Bench_Result_t;
+
+static void Bench_Event(const Parser_Event_t *event, void *context)
+{
+    Bench_Result_t *result = (Bench_Result_t *)context;
+
+    /* touch span like the consumer does */
+    result->events++;
+    if((event->data != NULL) && (event->length > 0))
+    {
+        result->sum += event->data[0] + event->data[event->length - 1];
+    }
+}
+
+static size_t Bench_Append(uint8_t *trace, size_t size, const char *text)
+{
+    size_t length = strlen(text);
+
+    memcpy(&trace[size], text, length);
+    return size + length;
+}
+
+static size_t Bench_Control(uint8_t *trace, size_t max)
+{
+    static const char *lines[] = { "\r\nOK\r\n", "\r\nSEND OK\r\n", "\r\nRecv 2045 bytes\r\n",
+                                   "0,CONNECT\r\n", "3,CLOSED\r\n", "busy s...\r\n", "\r\nERROR\r\n",
+                                   "AT+CIPSEND=0,2045\r\n", "+CIPSTAMAC:\"5c:cf:7f:01:02:03\"\r\n",
+                                   "WIFI GOT IP\r\n", "> " };
+    size_t size = 0;
+    uint32_t n = 0;
+
+    while(size + 64 < max)
+    {
+        size = Bench_Append(trace, size, lines[n % (sizeof(lines) / sizeof(lines[0]))]);
+        n++;
+    }
+    return size;
+}
+
+static size_t Bench_Ipd(uint8_t *trace, size_t max)
+{
+    size_t size = 0;
+    uint16_t i = 0;
+    uint32_t n = 0;
+
+    while(size + 1500 < max)
+    {
+        size = Bench_Append(trace, size, "\r\n+IPD,1,1460:");
+        for(i = 0; i < 1460; i++)
+        {
+            trace[size++] = (uint8_t)(i * 13 + n);
+        }
+        n++;
+    }
+    return size;
+}
+
+static size_t Bench_Session(uint8_t *trace, size_t max)
+{
+    char text[64];
+    size_t size = 0;
+    uint16_t i = 0;
+    uint32_t n = 0;
+
+    while(size + 256 < max)
+    {
+        if((n % 8) == 0)
+        {
+            /* client request frame */
+            sprintf(text, "\r\n+IPD,%u,%u:", n % 5, 16 + n % 32);
+            size = Bench_Append(trace, size, text);
+            for(i = 0; i < 16 + n % 32; i++)
+            {
+                trace[size++] = (uint8_t)(i * 7 + n);
+            }
+        }
+        sprintf(text, "AT+CIPSEND=%u,2045\r\n\r\nOK\r\n> \r\nRecv 2045 bytes\r\n\r\nSEND OK\r\n", n % 5);
+        size = Bench_Append(trace, size, text);
+        n++;
+    }
+    return size;
+}
+
+static double Bench_Now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t Bench_Cycles(void)
+{
+#if BENCH_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void Bench_Trace(const char *name, const uint8_t *trace, size_t size)
+{
+    static const uint16_t spans[] = { 1, 16, 256, 1024 };
+    Parser_t parser;
+    Bench_Result_t result;
+    double start = 0;
+    double elapsed = 0;
+    uint64_t cycles = 0;
+    size_t i = 0;
+    size_t part = 0;
+    uint32_t n = 0;
+    uint32_t round = 0;
+
+    for(n = 0; n < sizeof(spans) / sizeof(spans[0]); n++)
+    {
+        memset(&result, 0, sizeof(result));
+        Parser_Init(&parser, Bench_Event, &result);
+
+        start = Bench_Now();
+        cycles = Bench_Cycles();
+        for(round = 0; round < BENCH_ROUNDS; round++)
+        {
+            for(i = 0; i < size; i += part)
+            {
+                part = size - i;
+                if(part > spans[n])
+                {
+                    part = spans[n];
+                }
+                Parser_Input(&parser, &trace[i], (uint16_t)part);
+            }
+        }
+        cycles = Bench_Cycles() - cycles;
+        elapsed = Bench_Now() - start;
+
+        printf("%-10s %6u %10.1f %10.2f", name, spans[n],
+               size * BENCH_ROUNDS / elapsed / 1e6, elapsed * 1e9 / (size * BENCH_ROUNDS));
+        if(BENCH_TSC)
+        {
+            printf(" %10.3f", (double)size * BENCH_ROUNDS / cycles);
+        }
+        else
+        {
+            printf(" %10s", "-");
+        }
+        printf(" %10.0f\n", result.events / (double)BENCH_ROUNDS);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint8_t *trace = (uint8_t *)malloc(BENCH_TRACE_SIZE);
+    FILE *file = NULL;
+    size_t size = 0;
+
+    printf("%-10s %6s %10s %10s %10s %10s\n", "trace", "span", "MB/s", "ns/byte", "byte/cycle", "events");
+
+    size = Bench_Control(trace, BENCH_TRACE_SIZE);
+    Bench_Trace("control", trace, size);
+    size = Bench_Ipd(trace, BENCH_TRACE_SIZE);
+    Bench_Trace("ipd", trace, size);
+    size = Bench_Session(trace, BENCH_TRACE_SIZE);
+    Bench_Trace("session", trace, size);
+
+    if(argc > 1)
+    {
+        file = fopen(argv[1], "rb");
+        if(file == NULL)
+        {
+            printf("can not open %s\n", argv[1]);
+            free(trace);
+            return 1;
+        }
+        size = fread(trace, 1, BENCH_TRACE_SIZE, file);
+        fclose(file);
+        Bench_Trace("capture", trace, size);
+    }
+
+    free(trace);
+    return 0;
+}
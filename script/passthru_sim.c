@@ -0,0 +1,416 @@
+/*
+***************************************************************************************************
+*                           Station Passthrough Simulator (host)
+*
+* File   : passthru_sim.c
+* Author : Douglas Xie
+* Date   : 2018.03.30
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*
+* Transparent transmission (AT+CIPMODE=1) of station mode against an emulated ESP8266.
+*
+* Upload: image push with one AT+CIPSEND per chunk ('>' after SEND OK of chunk in flight)
+* against passthrough, where frames are streamed after one AT+CIPMODE=1 / AT+CIPSEND.
+*
+* Mode switch: module packs uart data to TCP when the line is silent for 20ms. "+++" is an
+* escape only when it is a packet of its own, and the module takes no AT command in the next
+* second. One session per escape guard / delay: image frames with control responds between
+* them go to the server, server requests come back all the time, then WiFi_Ctrl_ExitPassthrough.
+* Server decodes uplink with wifi_reasm, the device decodes downlink like the receive task:
+* raw frames into wifi_reasm while wifi_passthrough is set, else wifi_parser +IPD to wifi_reasm.
+* With the firmware guard and delay every frame must be decoded, with no stray byte at server,
+* also requests that come as +IPD between module exit and end of the escape delay.
+*
+*   gcc -O2 -DCRC32_HOST -I../Application/Include passthru_sim.c ../Application/Source/wifi_reasm.c
+*       ../Application/Source/wifi_parser.c ../Application/Source/crc32.c -o passthru_sim
+*   ./passthru_sim [image_kb] [rtt_ms]
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "wifi_reasm.h"
+#include "wifi_parser.h"
+
+#define SIM_UART_BPS        92160.0     /* 921600 baud, 10 bits per byte */
+#define SIM_WIFI_BPS        400000.0    /* module TCP goodput to server */
+#define SIM_CMD_MS          0.3         /* module answers a command */
+#define SIM_PACK_MS         20.0        /* module packs uart data after this silence */
+#define SIM_ESCAPE_BUSY_MS  1000.0      /* no AT command taken after "+++" */
+#define SIM_GUARD_MS        50.0        /* WIFI_ESCAPE_GUARD */
+#define SIM_DELAY_MS        1000.0      /* WIFI_ESCAPE_DELAY */
+#define SIM_CHUNK           1000        /* MSG_MAX_TX_PAYLOAD */
+#define SIM_FRAME_OVERHEAD  16          /* MSG_CMD_SIZE */
+#define SIM_PUSH_IMAGE      0x31        /* MSG_PUSH_IMAGE */
+#define SIM_GET_STATE       0x13        /* MSG_GET_STATE */
+#define SIM_FB_OK           0xF0        /* MSG_FB_OK */
+#define SIM_WRITE_MAX       512
+#define SIM_FRAME_MAX       512
+#define SIM_REQUESTS        200
+
+/* One uart write of device */
+typedef struct
+{
+    double          time;
+    const uint8_t   *data;
+    uint16_t        length;
+} Sim_Write_t;
+
+/* Decoded frames of one side */
+typedef struct
+{
+    uint8_t         command[SIM_FRAME_MAX];
+    uint16_t        index[SIM_FRAME_MAX];
+    uint32_t        count;
+} Sim_Frames_t;
+
+typedef struct
+{
+    bool            passthrough;
+    double          exit_time;          /* module back in command mode */
+    bool            cipmode_ok;         /* AT+CIPMODE=0 answered OK */
+} Sim_Module_t;
+
+typedef struct
+{
+    Parser_t        parser;
+    Reasm_t         reasm;
+    uint8_t         buffer[4096];
+    Sim_Frames_t    frames;
+} Sim_Device_t;
+
+static double Sim_Uart(uint32_t length)
+{
+    return length / SIM_UART_BPS * 1000.0;
+}
+
+/* Frame of protocol v1, checksum8 from command to payload end */
+static uint16_t Sim_Frame(uint8_t *frame, uint8_t command, uint16_t index, uint16_t length)
+{
+    uint16_t size = 0;
+    uint16_t i = 0;
+    uint8_t sum = 0;
+
+    memset(frame, REASM_START_CODE, REASM_CODE_LEN);
+    size = REASM_CODE_LEN;
+    frame[size++] = command;
+    frame[size++] = index & 0xFF;
+    frame[size++] = index >> 8;
+    frame[size++] = length & 0xFF;
+    frame[size++] = length >> 8;
+    for(i = 0; i < length; i++)
+    {
+        frame[size++] = (uint8_t)(i * 7 + index);
+    }
+    for(i = REASM_CODE_LEN; i < size; i++)
+    {
+        sum += frame[i];
+    }
+    frame[size++] = sum;
+    memset(&frame[size], REASM_END_CODE, REASM_CODE_LEN);
+    return size + REASM_CODE_LEN;
+}
+
+static void Sim_Collect(const Reasm_Frame_t *frame, void *context)
+{
+    Sim_Frames_t *frames = (Sim_Frames_t *)context;
+
+    if(frames->count < SIM_FRAME_MAX)
+    {
+        frames->command[frames->count] = frame->command;
+        frames->index[frames->count] = frame->index;
+        frames->count++;
+    }
+}
+
+/* Receive task path when wifi_passthrough is not set */
+static void Sim_DeviceEvent(const Parser_Event_t *event, void *context)
+{
+    Sim_Device_t *device = (Sim_Device_t *)context;
+
+    if(event->type == PARSER_EVT_IPD_DATA)
+    {
+        Reasm_Input(&device->reasm, event->data, event->length);
+    }
+}
+
+/*******************************************************************************
+* @Brief   Image Upload Time
+* @Param   image[in]: image bytes
+*          rtt_ms[in]: wifi round trip
+*          passthrough[in]: stream frames, else AT+CIPSEND per chunk
+* @Note    file info frame is sent first, module sends '>' after SEND OK of
+*          the chunk in flight, passthrough does not wait for SEND OK
+* @Return  ms until device is done with the push
+*******************************************************************************/
+static double Sim_Upload(uint32_t image, double rtt_ms, bool passthrough)
+{
+    double now = 0;
+    double ready = 0;
+    double link_free = 0;
+    double ack = 0;
+    uint32_t offset = 0;
+    uint32_t length = 24;               /* file info payload */
+
+    while(offset < image)
+    {
+        if(passthrough == false)
+        {
+            now += Sim_Uart(20);
+            ready = now + SIM_CMD_MS;
+            now = (ack > ready) ? ack : ready;
+        }
+        now += Sim_Uart(length + SIM_FRAME_OVERHEAD);
+        link_free = ((link_free > now) ? link_free : now) + (length + SIM_FRAME_OVERHEAD) / SIM_WIFI_BPS * 1000.0;
+        ack = link_free + rtt_ms;
+        if(passthrough == false)
+        {
+            now += SIM_CMD_MS;
+        }
+        if(length != 24)
+        {
+            offset += length;
+        }
+        length = ((image - offset) > SIM_CHUNK) ? SIM_CHUNK : (image - offset);
+    }
+    if(passthrough == false)
+    {
+        now = (ack > now) ? ack : now;
+    }
+    return now;
+}
+
+/*******************************************************************************
+* @Brief   Module Uart Input in Passthrough
+* @Param   writes[in]: device writes in time order
+*          server[in]: decoder of server side
+* @Note    writes closer than SIM_PACK_MS are one TCP packet, "+++" alone in
+*          a packet ends passthrough, AT command is taken only after escape
+* @Return
+*******************************************************************************/
+static void Sim_ModuleUart(Sim_Module_t *module, const Sim_Write_t *writes, uint32_t count, Reasm_t *server)
+{
+    uint32_t i = 0;
+    uint32_t j = 0;
+    double end = 0;
+
+    for(i = 0; i < count; i = j)
+    {
+        if(module->passthrough == false)
+        {
+            if((writes[i].length == 14) && (memcmp(writes[i].data, "AT+CIPMODE=0\r\n", 14) == 0))
+            {
+                module->cipmode_ok = (writes[i].time >= module->exit_time - SIM_PACK_MS + SIM_ESCAPE_BUSY_MS);
+            }
+            j = i + 1;
+            continue;
+        }
+
+        /* one packet */
+        end = writes[i].time + Sim_Uart(writes[i].length);
+        for(j = i + 1; (j < count) && (writes[j].time - end < SIM_PACK_MS); j++)
+        {
+            end = writes[j].time + Sim_Uart(writes[j].length);
+        }
+        if((j == i + 1) && (writes[i].length == 3) && (memcmp(writes[i].data, "+++", 3) == 0))
+        {
+            module->passthrough = false;
+            module->exit_time = end + SIM_PACK_MS;
+            continue;
+        }
+        for(; i < j; i++)
+        {
+            Reasm_Input(server, writes[i].data, writes[i].length);
+        }
+    }
+}
+
+/*******************************************************************************
+* @Brief   One Passthrough Session
+* @Param   image[in]: image bytes
+*          guard_ms[in]: silence before "+++"
+*          delay_ms[in]: wait after "+++"
+*          seed[in]: respond and request places
+* @Note    prints one row
+* @Return  true if every frame is decoded and module is back in command mode
+*******************************************************************************/
+static bool Sim_Session(uint32_t image, double guard_ms, double delay_ms, uint32_t seed)
+{
+    static uint8_t storage[1024 * 1024];
+    static Sim_Write_t writes[SIM_WRITE_MAX];
+    static uint8_t server_buffer[4096];
+    static Sim_Device_t device;
+    static Sim_Frames_t sent;
+    uint8_t request[64];
+    uint16_t request_length = 0;
+    uint8_t ipd[80];
+    uint16_t ipd_length = 0;
+    Sim_Module_t module = { true, 1e30, false };
+    Sim_Frames_t server_frames;
+    Reasm_t server;
+    uint32_t count = 0;
+    uint32_t used = 0;
+    uint32_t offset = 0;
+    uint32_t i = 0;
+    uint16_t length = 0;
+    uint16_t index = 0;
+    uint32_t in_window = 0;
+    double now = 0;
+    double flag_off = 0;
+    double end = 0;
+    double time = 0;
+    bool same = true;
+    bool done = false;
+
+    srand(seed);
+    memset(&sent, 0, sizeof(sent));
+    memset(&server_frames, 0, sizeof(server_frames));
+    memset(&device, 0, sizeof(device));
+    Reasm_Init(&server, server_buffer, sizeof(server_buffer), Sim_Collect, &server_frames);
+    Parser_Init(&device.parser, Sim_DeviceEvent, &device);
+    Reasm_Init(&device.reasm, device.buffer, sizeof(device.buffer), Sim_Collect, &device.frames);
+
+    /* file info, image packets, responds preempt between packets */
+    for(index = 0; (offset < image) && (count < SIM_WRITE_MAX - 8); index++)
+    {
+        length = (index == 0) ? 24 : (((image - offset) > SIM_CHUNK) ? SIM_CHUNK : (image - offset));
+        writes[count].time = now;
+        writes[count].data = &storage[used];
+        writes[count].length = Sim_Frame(&storage[used], SIM_PUSH_IMAGE, index, length);
+        sent.command[sent.count] = SIM_PUSH_IMAGE;
+        sent.index[sent.count++] = index;
+        now += Sim_Uart(writes[count].length);
+        used += writes[count++].length;
+        offset += (index == 0) ? 0 : length;
+
+        if((rand() % 8) == 0)
+        {
+            writes[count].time = now;
+            writes[count].data = &storage[used];
+            writes[count].length = Sim_Frame(&storage[used], SIM_FB_OK, index, 4);
+            sent.command[sent.count] = SIM_FB_OK;
+            sent.index[sent.count++] = index;
+            now += Sim_Uart(writes[count].length);
+            used += writes[count++].length;
+        }
+    }
+
+    /* WiFi_Ctrl_ExitPassthrough */
+    now += guard_ms;
+    writes[count].time = now;
+    writes[count].data = (const uint8_t *)"+++";
+    writes[count++].length = 3;
+    now += Sim_Uart(3) + delay_ms;
+    flag_off = now;
+    writes[count].time = now;
+    writes[count].data = (const uint8_t *)"AT+CIPMODE=0\r\n";
+    writes[count++].length = 14;
+    Sim_ModuleUart(&module, writes, count, &server);
+
+    /* server requests, raw in module passthrough else +IPD, device routes by its flag */
+    end = flag_off + 500;
+    for(i = 0; i < SIM_REQUESTS; i++)
+    {
+        time = end * i / SIM_REQUESTS + (rand() % 1000) * end / SIM_REQUESTS / 1000;
+        request_length = Sim_Frame(request, SIM_GET_STATE, (uint16_t)i, 4);
+        if((time >= module.exit_time) && (time < flag_off))
+        {
+            in_window++;
+        }
+        if(time < module.exit_time)
+        {
+            memcpy(ipd, request, request_length);
+            ipd_length = request_length;
+        }
+        else
+        {
+            ipd_length = (uint16_t)sprintf((char *)ipd, "\r\n+IPD,%u:", request_length);
+            memcpy(&ipd[ipd_length], request, request_length);
+            ipd_length += request_length;
+        }
+        if(time < flag_off)
+        {
+            Reasm_Input(&device.reasm, ipd, ipd_length);
+        }
+        else
+        {
+            Parser_Input(&device.parser, ipd, ipd_length);
+        }
+    }
+
+    /* server must get device frames in order */
+    same = (server_frames.count == sent.count);
+    for(i = 0; (same == true) && (i < sent.count); i++)
+    {
+        same = (server_frames.command[i] == sent.command[i]) && (server_frames.index[i] == sent.index[i]);
+    }
+    done = (same == true) && (server.dropped == 0) && (module.passthrough == false) &&
+           (module.cipmode_ok == true) && (device.frames.count == SIM_REQUESTS);
+
+    printf("%7.0f %7.0f  %-7s %5u/%-5u %7u %6u/%-5u %7u  %s\n", guard_ms, delay_ms,
+           (module.passthrough == true) ? "stuck" : (module.cipmode_ok == true) ? "ok" : "busy",
+           server_frames.count, sent.count, server.dropped, device.frames.count, SIM_REQUESTS,
+           in_window, (done == true) ? "" : "FAILED");
+    return done;
+}
+
+int main(int argc, char **argv)
+{
+    static const double guards[] = { 0, 10, 30, SIM_GUARD_MS };
+    static const double delays[] = { 10, 500, SIM_DELAY_MS };
+    uint32_t image = 64 * 1024;
+    double rtt_ms = 30.0;
+    double at_ms = 0;
+    double pass_ms = 0;
+    double enter_ms = 0;
+    double exit_ms = 0;
+    uint32_t kb = 0;
+    uint32_t g = 0;
+    uint32_t d = 0;
+    bool firmware_ok = true;
+
+    if(argc > 1)
+    {
+        image = (uint32_t)atoi(argv[1]) * 1024;
+    }
+    if(argc > 2)
+    {
+        rtt_ms = atof(argv[2]);
+    }
+
+    /* enter: AT+CIPMODE=1, AT+CIPSEND; exit: guard, "+++", delay, AT+CIPMODE=0 */
+    enter_ms = Sim_Uart(14) + SIM_CMD_MS + Sim_Uart(12) + SIM_CMD_MS;
+    exit_ms = SIM_GUARD_MS + Sim_Uart(3) + SIM_DELAY_MS + Sim_Uart(14) + SIM_CMD_MS;
+    printf("upload, rtt %.0f ms, chunk %u, enter %.1f ms, exit %.1f ms (at alive test only)\n",
+           rtt_ms, SIM_CHUNK, enter_ms, exit_ms);
+    printf("%8s %12s %12s %8s\n", "image KB", "cipsend ms", "passthru ms", "speed");
+    for(kb = 16; kb <= 256; kb *= 4)
+    {
+        at_ms = Sim_Upload(kb * 1024, rtt_ms, false);
+        pass_ms = Sim_Upload(kb * 1024, rtt_ms, true) + enter_ms;
+        printf("%8u %12.1f %12.1f %7.2fx\n", kb, at_ms, pass_ms, at_ms / pass_ms);
+    }
+
+    printf("\nmode switch, image %u bytes, %u server requests\n", image, SIM_REQUESTS);
+    printf("%7s %7s  %-7s %11s %7s %12s %7s\n", "guard", "delay", "exit", "uplink", "stray", "downlink", "as +IPD");
+    for(g = 0; g < sizeof(guards) / sizeof(guards[0]); g++)
+    {
+        for(d = 0; d < sizeof(delays) / sizeof(delays[0]); d++)
+        {
+            if((Sim_Session(image, guards[g], delays[d], g * 16 + d + 1) == false) &&
+               (guards[g] == SIM_GUARD_MS) && (delays[d] == SIM_DELAY_MS))
+            {
+                firmware_ok = false;
+            }
+        }
+    }
+
+    printf("firmware guard %.0f ms, delay %.0f ms: %s\n", SIM_GUARD_MS, SIM_DELAY_MS,
+           (firmware_ok == true) ? "ok" : "FAILED");
+    return (firmware_ok == true) ? 0 : 1;
+}
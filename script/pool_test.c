@@ -0,0 +1,275 @@
+/*
+***************************************************************************************************
+*                           Message Payload Block Pool Test (host)
+*
+* File   : pool_test.c
+* Author : Douglas Xie
+* Date   : 2018.03.30
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*
+* Block pool of msg_pool.c, built without kernel lock by POOL_HOST. Checks:
+*   - each pool gives block_num distinct aligned blocks inside its storage, then NULL
+*   - used, high water and fail counters, high water is kept after free
+*   - freed block is reused, every block can be taken again after all are freed
+*   - MsgPool_Alloc takes the smallest block that fits and never falls back to a larger
+*     pool, length 0 and too large give NULL
+*   - MsgPool_Free and Pool_Free ignore NULL, foreign, misaligned and other pool pointers
+*     and leave free lists and counters as they were
+*
+*   gcc -O2 -DPOOL_HOST -I../Application/Include pool_test.c ../Application/Source/msg_pool.c
+*       -o pool_test
+*   ./pool_test
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "msg_pool.h"
+
+#define TEST_BLOCK_MAX      8           /* MSG_POOL_SMALL_NUM, most blocks of one pool */
+
+typedef struct
+{
+    Pool_t      *pool;
+    const char  *name;
+    uint16_t    length;                 /* MsgPool_Alloc length that maps to this pool */
+} Test_Pool_t;
+
+static uint32_t failed = 0;
+
+static void Test_Check(bool ok, const char *name, const char *what)
+{
+    if(ok == false)
+    {
+        printf("%s: %s\n", name, what);
+        failed++;
+    }
+}
+
+/* Pool state that a rejected free must not change */
+static bool Test_Same(const Pool_t *a, const Pool_t *b)
+{
+    return (a->free_list == b->free_list) && (a->used == b->used) &&
+           (a->high_water == b->high_water) && (a->fail == b->fail);
+}
+
+/* Take all blocks, check them, run dry, free and take again */
+static void Test_Exhaust(const Test_Pool_t *test)
+{
+    Pool_t *pool = test->pool;
+    uint8_t *block[TEST_BLOCK_MAX + 1];
+    uint8_t *again = NULL;
+    uint16_t i = 0;
+    uint16_t j = 0;
+    bool ok = true;
+
+    for(i = 0; i < pool->block_num; i++)
+    {
+        block[i] = MsgPool_Alloc(test->length);
+        ok = (block[i] != NULL) && (block[i] >= pool->storage) &&
+             (block[i] + pool->block_size <= pool->storage + (uint32_t)pool->block_size * pool->block_num) &&
+             (((uint32_t)(block[i] - pool->storage) % pool->block_size) == 0) &&
+             (((uintptr_t)block[i] & 3) == 0);
+        Test_Check(ok, test->name, "block outside storage or not aligned");
+        for(j = 0; (ok == true) && (j < i); j++)
+        {
+            if(block[j] == block[i])
+            {
+                Test_Check(false, test->name, "same block given twice");
+                ok = false;
+            }
+        }
+        if(ok == false)
+        {
+            return;
+        }
+        /* whole block is writable, the free list link lives in it */
+        memset(block[i], 0xA0 + i, pool->block_size);
+        Test_Check(pool->used == i + 1, test->name, "used count");
+    }
+    Test_Check(pool->high_water == pool->block_num, test->name, "high water at full");
+    Test_Check(pool->fail == 0, test->name, "fail before exhaustion");
+
+    /* exhausted, fail counts every try */
+    Test_Check(MsgPool_Alloc(test->length) == NULL, test->name, "alloc from empty pool");
+    Test_Check(Pool_Alloc(pool) == NULL, test->name, "pool alloc from empty pool");
+    Test_Check(pool->fail == 2, test->name, "fail count of empty pool");
+    Test_Check(pool->used == pool->block_num, test->name, "used changed by failed alloc");
+
+    /* last freed block is given first */
+    MsgPool_Free(block[1]);
+    Test_Check(pool->used == pool->block_num - 1, test->name, "used after free");
+    again = MsgPool_Alloc(test->length);
+    Test_Check(again == block[1], test->name, "freed block not reused");
+    Test_Check(pool->high_water == pool->block_num, test->name, "high water after reuse");
+
+    /* free all, high water is kept, every block comes back */
+    for(i = 0; i < pool->block_num; i++)
+    {
+        MsgPool_Free(block[i]);
+    }
+    Test_Check(pool->used == 0, test->name, "used after free all");
+    Test_Check(pool->high_water == pool->block_num, test->name, "high water lost by free");
+    for(i = 0; i < pool->block_num; i++)
+    {
+        block[TEST_BLOCK_MAX] = MsgPool_Alloc(test->length);
+        for(j = 0; j < pool->block_num; j++)
+        {
+            if(block[j] == block[TEST_BLOCK_MAX])
+            {
+                break;
+            }
+        }
+        Test_Check((block[TEST_BLOCK_MAX] != NULL) && (j < pool->block_num), test->name, "block lost after free all");
+    }
+    Test_Check(MsgPool_Alloc(test->length) == NULL, test->name, "more blocks than block_num");
+    for(i = 0; i < pool->block_num; i++)
+    {
+        MsgPool_Free(block[i]);
+    }
+}
+
+/* Sizes go to the smallest pool that fits, no fall back */
+static void Test_Select(void)
+{
+    uint8_t *block[TEST_BLOCK_MAX];
+    uint8_t *payload = NULL;
+    uint16_t i = 0;
+    uint32_t fail = 0;
+
+    MsgPool_Init();
+    Test_Check(MsgPool_Alloc(0) == NULL, "select", "length 0 gives block");
+    Test_Check((msg_pool_small.fail == 0) && (msg_pool_medium.fail == 0) && (msg_pool_large.fail == 0),
+               "select", "length 0 counted as fail");
+
+    payload = MsgPool_Alloc(1);
+    Test_Check((payload != NULL) && (msg_pool_small.used == 1), "select", "1 byte not in small");
+    MsgPool_Free(payload);
+    payload = MsgPool_Alloc(MSG_POOL_SMALL_SIZE);
+    Test_Check((payload != NULL) && (msg_pool_small.used == 1), "select", "small size not in small");
+    MsgPool_Free(payload);
+    payload = MsgPool_Alloc(MSG_POOL_SMALL_SIZE + 1);
+    Test_Check((payload != NULL) && (msg_pool_medium.used == 1), "select", "small size + 1 not in medium");
+    MsgPool_Free(payload);
+    payload = MsgPool_Alloc(MSG_POOL_MEDIUM_SIZE + 1);
+    Test_Check((payload != NULL) && (msg_pool_large.used == 1), "select", "medium size + 1 not in large");
+    MsgPool_Free(payload);
+    payload = MsgPool_Alloc(MSG_POOL_LARGE_SIZE);
+    Test_Check((payload != NULL) && (msg_pool_large.used == 1), "select", "large size not in large");
+    MsgPool_Free(payload);
+
+    fail = msg_pool_large.fail;
+    Test_Check(MsgPool_Alloc(MSG_POOL_LARGE_SIZE + 1) == NULL, "select", "too large gives block");
+    Test_Check(msg_pool_large.fail == fail + 1, "select", "too large not counted as fail");
+
+    /* small pool empty, respond does not take a medium or large block */
+    for(i = 0; i < MSG_POOL_SMALL_NUM; i++)
+    {
+        block[i] = MsgPool_Alloc(MSG_POOL_SMALL_SIZE);
+    }
+    Test_Check(MsgPool_Alloc(16) == NULL, "select", "small falls back to larger pool");
+    Test_Check((msg_pool_medium.used == 0) && (msg_pool_large.used == 0), "select", "larger pool used by small");
+    for(i = 0; i < MSG_POOL_SMALL_NUM; i++)
+    {
+        MsgPool_Free(block[i]);
+    }
+    Test_Check((msg_pool_small.used == 0) && (msg_pool_medium.used == 0) && (msg_pool_large.used == 0),
+               "select", "blocks left after free");
+}
+
+/* Pointers that are not a block of the pool are ignored */
+static void Test_Foreign(void)
+{
+    static uint32_t other[64];
+    uint8_t local[16];
+    uint8_t *heap = (uint8_t *)malloc(64);
+    uint8_t *small = NULL;
+    uint8_t *large = NULL;
+    Pool_t before[3];
+    void *bad[7];
+    uint16_t i = 0;
+    bool ok = true;
+
+    MsgPool_Init();
+    small = MsgPool_Alloc(MSG_POOL_SMALL_SIZE);
+    large = MsgPool_Alloc(MSG_POOL_LARGE_SIZE);
+
+    bad[0] = NULL;
+    bad[1] = local;
+    bad[2] = heap;
+    bad[3] = other;
+    bad[4] = small + 4;                                             /* inside a used block */
+    bad[5] = large + 1;                                             /* misaligned */
+    bad[6] = msg_pool_small.storage + MSG_POOL_SMALL_SIZE / 2;      /* inside a free block */
+
+    before[0] = msg_pool_small;
+    before[1] = msg_pool_medium;
+    before[2] = msg_pool_large;
+    for(i = 0; i < 7; i++)
+    {
+        MsgPool_Free(bad[i]);
+        ok = Test_Same(&msg_pool_small, &before[0]) && Test_Same(&msg_pool_medium, &before[1]) &&
+             Test_Same(&msg_pool_large, &before[2]);
+        if(ok == false)
+        {
+            printf("foreign: pointer %u taken by MsgPool_Free\n", i);
+            failed++;
+            MsgPool_Init();
+            small = MsgPool_Alloc(MSG_POOL_SMALL_SIZE);
+            large = MsgPool_Alloc(MSG_POOL_LARGE_SIZE);
+            before[0] = msg_pool_small;
+            before[1] = msg_pool_medium;
+            before[2] = msg_pool_large;
+        }
+    }
+
+    /* block of one pool is foreign to the others, storages may be adjacent so edges
+     * are checked on their own pool only */
+    Test_Check(Pool_Free(&msg_pool_medium, small) == false, "foreign", "medium takes small block");
+    Test_Check(Pool_Free(&msg_pool_large, small) == false, "foreign", "large takes small block");
+    Test_Check(Pool_Free(&msg_pool_small, large) == false, "foreign", "small takes large block");
+    Test_Check(Pool_Free(&msg_pool_small, large + 1) == false, "foreign", "small takes misaligned pointer");
+    Test_Check(Pool_Free(&msg_pool_large, large + 4) == false, "foreign", "large takes misaligned pointer");
+    Test_Check(Pool_Free(&msg_pool_small, msg_pool_small.storage - MSG_POOL_SMALL_SIZE) == false,
+               "foreign", "small takes block before storage");
+    Test_Check(Pool_Free(&msg_pool_medium, msg_pool_medium.storage + (uint32_t)MSG_POOL_MEDIUM_SIZE * MSG_POOL_MEDIUM_NUM) == false,
+               "foreign", "medium takes block at end of storage");
+    Test_Check(Test_Same(&msg_pool_small, &before[0]) && Test_Same(&msg_pool_medium, &before[1]) &&
+               Test_Same(&msg_pool_large, &before[2]), "foreign", "pool changed by rejected Pool_Free");
+
+    /* real blocks still go back */
+    Test_Check(Pool_Free(&msg_pool_small, small) == true, "foreign", "small block rejected");
+    Test_Check(Pool_Free(&msg_pool_large, large) == true, "foreign", "large block rejected");
+    Test_Check((msg_pool_small.used == 0) && (msg_pool_large.used == 0), "foreign", "used after free");
+
+    free(heap);
+}
+
+int main(void)
+{
+    Test_Pool_t test[3] =
+    {
+        { &msg_pool_small,  "small",  MSG_POOL_SMALL_SIZE },
+        { &msg_pool_medium, "medium", MSG_POOL_MEDIUM_SIZE },
+        { &msg_pool_large,  "large",  MSG_POOL_LARGE_SIZE },
+    };
+    uint8_t i = 0;
+
+    for(i = 0; i < 3; i++)
+    {
+        MsgPool_Init();
+        Test_Exhaust(&test[i]);
+        printf("%-8s %2u x %4u bytes, high water %u, fail %u\n", test[i].name, test[i].pool->block_num,
+               test[i].pool->block_size, test[i].pool->high_water, test[i].pool->fail);
+    }
+    Test_Select();
+    Test_Foreign();
+
+    printf("%u failed\n", failed);
+    return (failed == 0) ? 0 : 1;
+}
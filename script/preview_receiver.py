@@ -0,0 +1,150 @@
+# -*- coding: utf-8 -*-
+"""
+Description:  receive udp live preview of wifi camera, report fps and fragment loss
+    1. optional: send Set Live Preview command to camera tcp server
+    2. receive datagrams and group fragments by frame id
+    3. frame is complete when all fragments arrive, incomplete frame is dropped
+       when a newer frame id arrives
+    4. print fps and loss every second, optional save last frame to jpg file
+
+    Datagram header (little endian):
+    magic(1, 0xA5) size(1) frame id(2) fragment index(1) fragment count(1) length(2)
+
+    Usage:
+    python preview_receiver.py [port] [camera_ip viewer_ip fps size] [-o last.jpg]
+    e.g. python preview_receiver.py 5000 192.168.4.1 192.168.4.2 5 1
+
+Created on Thu Mar 22 10:12:35 2018
+
+@author: Douglas Xie
+@email:  douglas2011@qq.com
+"""
+
+import sys
+import time
+import socket
+import struct
+
+# protocol define, same as firmware
+MSG_START = b'\x7B' * 5
+MSG_END = b'\xA8' * 5
+MSG_SET_PREVIEW = 0x28
+CAMERA_TCP_PORT = 2017
+
+PREVIEW_MAGIC = 0xA5
+PREVIEW_HEAD = struct.Struct('<BBHBBH')
+
+# frame id is 16bit, newer frame is within half range
+def id_newer(a, b):
+    return ((a - b) & 0xFFFF) != 0 and ((a - b) & 0xFFFF) < 0x8000
+
+# build message frame: start + cmd + index + length + payload + checksum + end
+def pack_message(cmd, payload):
+    body = struct.pack('<BHH', cmd, 0, len(payload)) + payload
+    return MSG_START + body + bytes([sum(body) & 0xFF]) + MSG_END
+
+# send Set Live Preview to camera, port 0 stops preview
+def set_preview(camera_ip, viewer_ip, port, fps, size):
+    payload = socket.inet_aton(viewer_ip) + struct.pack('<HBB', port, fps, size)
+    sock = socket.create_connection((camera_ip, CAMERA_TCP_PORT), timeout=5)
+    sock.sendall(pack_message(MSG_SET_PREVIEW, payload))
+    try:
+        reply = sock.recv(64)
+        print("camera reply: " + reply.hex())
+    except socket.timeout:
+        print("camera no reply")
+    sock.close()
+
+class PreviewStat:
+    def __init__(self):
+        self.frames = 0         # complete frames
+        self.dropped = 0        # incomplete frames
+        self.fragments = 0      # fragments received
+        self.expected = 0       # fragments of finished frames
+        self.bytes = 0
+
+    def reset(self):
+        self.__init__()
+
+def main():
+    args = [a for a in sys.argv[1:] if a != '-o']
+    save_file = None
+    if '-o' in sys.argv:
+        save_file = sys.argv[sys.argv.index('-o') + 1]
+        args.remove(save_file)
+
+    port = int(args[0]) if len(args) > 0 else 5000
+    camera_ip = None
+    if len(args) >= 5:
+        camera_ip, viewer_ip, fps, size = args[1], args[2], int(args[3]), int(args[4])
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(('', port))
+    sock.settimeout(1.0)
+    print("listen udp port %d" % port)
+
+    if camera_ip is not None:
+        set_preview(camera_ip, viewer_ip, port, fps, size)
+
+    stat = PreviewStat()
+    frame_id = None
+    frame_count = 0
+    frame_parts = {}
+    last_id = None          # last finished frame, late fragments are ignored
+    last_report = time.time()
+
+    # close frame in progress, count its fragments
+    def finish_frame():
+        if frame_id is None:
+            return
+        stat.expected += frame_count
+        stat.fragments += len(frame_parts)
+        if len(frame_parts) == frame_count:
+            stat.frames += 1
+            if save_file is not None:
+                with open(save_file, 'wb') as f:
+                    f.write(b''.join(frame_parts[i] for i in range(frame_count)))
+        else:
+            stat.dropped += 1
+
+    try:
+        while True:
+            try:
+                data, addr = sock.recvfrom(2048)
+            except socket.timeout:
+                data = None
+
+            if data is not None and len(data) >= PREVIEW_HEAD.size:
+                magic, size, fid, index, count, length = PREVIEW_HEAD.unpack_from(data)
+                if magic == PREVIEW_MAGIC and index < count and length == len(data) - PREVIEW_HEAD.size:
+                    stat.bytes += length
+                    if (frame_id is None or id_newer(fid, frame_id)) and (last_id is None or id_newer(fid, last_id)):
+                        # newer frame, the one in progress is dropped
+                        finish_frame()
+                        if frame_id is not None:
+                            last_id = frame_id
+                        frame_id, frame_count, frame_parts = fid, count, {}
+                    if fid == frame_id:
+                        frame_parts[index] = data[PREVIEW_HEAD.size:]
+                        if len(frame_parts) == frame_count:
+                            finish_frame()
+                            last_id, frame_id = frame_id, None
+
+            now = time.time()
+            if now - last_report >= 1.0:
+                elapsed = now - last_report
+                loss = 0.0
+                if stat.expected > 0:
+                    loss = 100.0 * (stat.expected - stat.fragments) / stat.expected
+                print("fps %.1f  dropped %d  fragment loss %.1f%%  %.1f KB/s" %
+                      (stat.frames / elapsed, stat.dropped, loss, stat.bytes / elapsed / 1024))
+                stat.reset()
+                last_report = now
+
+    except KeyboardInterrupt:
+        if camera_ip is not None:
+            set_preview(camera_ip, viewer_ip, 0, 0, 0)
+        sock.close()
+
+if __name__ == '__main__':
+    main()
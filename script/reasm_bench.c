@@ -0,0 +1,156 @@
+/*
+***************************************************************************************************
+*                           Client Frame Decoder Benchmark (host)
+*
+* File   : reasm_bench.c
+* Author : Douglas Xie
+* Date   : 2018.03.24
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*
+* Feed a stream of client frames to wifi_reasm in segments of different size and print decode
+* throughput and how many payloads were copied to link buffer (frame spans segments).
+* 1460 is one TCP segment, 1 is the worst case.
+*
+*   gcc -O2 -DCRC32_HOST -I../Application/Include reasm_bench.c ../Application/Source/wifi_reasm.c
+*       ../Application/Source/crc32.c -o reasm_bench
+*   ./reasm_bench [payload_size]
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "wifi_reasm.h"
+
+#define BENCH_STREAM_SIZE   (4 * 1024 * 1024)
+#define BENCH_BUFFER_SIZE   4096        /* MSG_MAX_RX_PAYLOAD */
+
+typedef struct
+{
+    uint8_t     *buffer;
+    uint32_t    frames;
+    uint32_t    copied;
+    uint32_t    sum;
+} Bench_Result_t;
+
+static void Bench_Frame(const Reasm_Frame_t *frame, void *context)
+{
+    Bench_Result_t *result = (Bench_Result_t *)context;
+
+    result->frames++;
+    if((frame->length > 0) && (frame->payload == result->buffer))
+    {
+        result->copied++;
+    }
+    /* touch payload like the consumer does */
+    if(frame->length > 0)
+    {
+        result->sum += frame->payload[0] + frame->payload[frame->length - 1];
+    }
+}
+
+static size_t Bench_Build(uint8_t *data, size_t max, uint16_t payload)
+{
+    size_t size = 0;
+    uint16_t i = 0;
+    uint16_t index = 0;
+    uint8_t sum = 0;
+
+    while(size + payload + REASM_FRAME_OVERHEAD + 3 <= max)
+    {
+        /* a little garbage between frames, like a late ack */
+        if((index % 16) == 0)
+        {
+            data[size++] = 0x0D;
+            data[size++] = 0x0A;
+            data[size++] = REASM_START_CODE;
+        }
+        memset(&data[size], REASM_START_CODE, REASM_CODE_LEN);
+        size += REASM_CODE_LEN;
+        data[size++] = 0x42;
+        data[size++] = index & 0xFF;
+        data[size++] = index >> 8;
+        data[size++] = payload & 0xFF;
+        data[size++] = payload >> 8;
+        sum = 0x42 + (index & 0xFF) + (index >> 8) + (payload & 0xFF) + (payload >> 8);
+        for(i = 0; i < payload; i++)
+        {
+            data[size] = (uint8_t)(i * 7 + index);
+            sum += data[size++];
+        }
+        data[size++] = sum;
+        memset(&data[size], REASM_END_CODE, REASM_CODE_LEN);
+        size += REASM_CODE_LEN;
+        index++;
+    }
+
+    return size;
+}
+
+static double Bench_Now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv)
+{
+    static const uint16_t segments[] = { 1, 16, 256, 1460, 4096 };
+    uint8_t *data = (uint8_t *)malloc(BENCH_STREAM_SIZE);
+    uint8_t *buffer = (uint8_t *)malloc(BENCH_BUFFER_SIZE);
+    uint16_t payload = 200;
+    size_t size = 0;
+    size_t i = 0;
+    size_t part = 0;
+    uint32_t n = 0;
+    Reasm_t reasm;
+    Bench_Result_t result;
+    double start = 0;
+    double elapsed = 0;
+
+    if(argc > 1)
+    {
+        payload = (uint16_t)atoi(argv[1]);
+        if(payload > BENCH_BUFFER_SIZE)
+        {
+            payload = BENCH_BUFFER_SIZE;
+        }
+    }
+    size = Bench_Build(data, BENCH_STREAM_SIZE, payload);
+    printf("stream %zu bytes, payload %u bytes\n", size, payload);
+    printf("%8s %10s %10s %10s %8s %8s\n", "segment", "MB/s", "ns/byte", "frames/s", "copied", "dropped");
+
+    for(n = 0; n < sizeof(segments) / sizeof(segments[0]); n++)
+    {
+        memset(&result, 0, sizeof(result));
+        result.buffer = buffer;
+        Reasm_Init(&reasm, buffer, BENCH_BUFFER_SIZE, Bench_Frame, &result);
+
+        start = Bench_Now();
+        for(i = 0; i < size; i += part)
+        {
+            part = size - i;
+            if(part > segments[n])
+            {
+                part = segments[n];
+            }
+            Reasm_Input(&reasm, &data[i], (uint16_t)part);
+        }
+        elapsed = Bench_Now() - start;
+
+        printf("%8u %10.1f %10.2f %10.0f %7.1f%% %8u\n", segments[n],
+               size / elapsed / 1e6, elapsed * 1e9 / size, result.frames / elapsed,
+               (result.frames > 0) ? (100.0 * result.copied / result.frames) : 0.0, reasm.dropped);
+    }
+
+    free(buffer);
+    free(data);
+    return 0;
+}
@@ -0,0 +1,321 @@
+/*
+***************************************************************************************************
+*                           Client Frame Decoder Fuzz Target (host)
+*
+* File   : reasm_fuzz.c
+* Author : Douglas Xie
+* Date   : 2018.03.24
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*
+* Input is split into segments by the first byte and fed to wifi_reasm, every emitted frame is
+* checked (payload bounds, checksum, end code) and compared to the frames decoded from the whole
+* input in one segment. Segmentation must not change what is decoded or dropped.
+* Top bit of the first byte selects protocol v2 (crc32).
+*
+* libFuzzer:
+*   clang -g -O1 -fsanitize=fuzzer,address -DCRC32_HOST -I../Application/Include
+*         reasm_fuzz.c ../Application/Source/wifi_reasm.c ../Application/Source/crc32.c -o reasm_fuzz
+*   ./reasm_fuzz -max_len=8192
+*
+* Without libFuzzer, random inputs or given files:
+*   gcc -g -O1 -fsanitize=address -DREASM_FUZZ_MAIN -DCRC32_HOST -I../Application/Include
+*       reasm_fuzz.c ../Application/Source/wifi_reasm.c ../Application/Source/crc32.c -o reasm_fuzz
+*   ./reasm_fuzz [iterations | file...]
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "wifi_reasm.h"
+#include "crc32.h"
+
+/* Small storage, so length field beyond it is exercised */
+#define FUZZ_BUFFER_SIZE    256
+#define FUZZ_MAX_FRAMES     1024
+
+typedef struct
+{
+    uint8_t     command;
+    uint16_t    index;
+    uint16_t    length;
+    uint32_t    checksum;
+    uint32_t    hash;
+} Fuzz_Frame_t;
+
+typedef struct
+{
+    const uint8_t   *input;
+    size_t          input_size;
+    uint8_t         *buffer;
+    uint8_t         version;
+    Fuzz_Frame_t    frames[FUZZ_MAX_FRAMES];
+    uint32_t        count;
+} Fuzz_Run_t;
+
+static uint32_t Fuzz_Hash(const uint8_t *data, uint16_t length)
+{
+    uint32_t hash = 2166136261u;
+    uint16_t i = 0;
+
+    for(i = 0; i < length; i++)
+    {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void Fuzz_Frame(const Reasm_Frame_t *frame, void *context)
+{
+    Fuzz_Run_t *run = (Fuzz_Run_t *)context;
+    uint8_t sum = 0;
+    uint8_t head[REASM_HEAD_LEN];
+    uint32_t crc = 0;
+    uint16_t i = 0;
+    bool in_input = false;
+    bool in_buffer = false;
+
+    if(frame->length > FUZZ_BUFFER_SIZE)
+    {
+        abort();
+    }
+
+    sum = frame->command + (frame->index & 0xFF) + (frame->index >> 8) + (frame->length & 0xFF) + (frame->length >> 8);
+    if(frame->length > 0)
+    {
+        /* payload is a view into input or the link buffer, never elsewhere */
+        in_input = (frame->payload >= run->input) && ((frame->payload + frame->length) <= (run->input + run->input_size));
+        in_buffer = (frame->payload >= run->buffer) && ((frame->payload + frame->length) <= (run->buffer + FUZZ_BUFFER_SIZE));
+        if((in_input == false) && (in_buffer == false))
+        {
+            abort();
+        }
+        for(i = 0; i < frame->length; i++)
+        {
+            sum += frame->payload[i];
+        }
+    }
+    else if(frame->payload != NULL)
+    {
+        abort();
+    }
+    if(run->version == REASM_VERSION_2)
+    {
+        head[0] = frame->command;
+        head[1] = frame->index & 0xFF;
+        head[2] = frame->index >> 8;
+        head[3] = frame->length & 0xFF;
+        head[4] = frame->length >> 8;
+        crc = CRC32_Software(CRC32_INIT, head, REASM_HEAD_LEN);
+        if(frame->length > 0)
+        {
+            crc = CRC32_Software(crc, frame->payload, frame->length);
+        }
+        if(crc != frame->checksum)
+        {
+            abort();
+        }
+    }
+    else if(sum != frame->checksum)
+    {
+        abort();
+    }
+
+    if(run->count < FUZZ_MAX_FRAMES)
+    {
+        run->frames[run->count].command = frame->command;
+        run->frames[run->count].index = frame->index;
+        run->frames[run->count].length = frame->length;
+        run->frames[run->count].checksum = frame->checksum;
+        run->frames[run->count].hash = (frame->length > 0) ? Fuzz_Hash(frame->payload, frame->length) : 0;
+    }
+    run->count++;
+}
+
+/* Decode input in segments of given size, 0 is one segment */
+static uint32_t Fuzz_Decode(Fuzz_Run_t *run, const uint8_t *data, size_t size, size_t segment, uint8_t version)
+{
+    Reasm_t reasm;
+    size_t i = 0;
+    size_t part = 0;
+    uint8_t *buffer = (uint8_t *)malloc(FUZZ_BUFFER_SIZE);
+
+    run->input = data;
+    run->input_size = size;
+    run->buffer = buffer;
+    run->version = version;
+    run->count = 0;
+    Reasm_Init(&reasm, buffer, FUZZ_BUFFER_SIZE, Fuzz_Frame, run);
+    Reasm_SetVersion(&reasm, version);
+
+    if(segment == 0)
+    {
+        segment = size;
+    }
+    for(i = 0; i < size; i += part)
+    {
+        part = size - i;
+        if(part > segment)
+        {
+            part = segment;
+        }
+        if(part > 0xFFFF)
+        {
+            part = 0xFFFF;
+        }
+        Reasm_Input(&reasm, &data[i], (uint16_t)part);
+    }
+
+    free(buffer);
+    return reasm.dropped;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    static Fuzz_Run_t whole;
+    static Fuzz_Run_t split;
+    uint32_t dropped_whole = 0;
+    uint32_t dropped_split = 0;
+    uint32_t held = 0;
+    uint32_t i = 0;
+    uint8_t version = REASM_VERSION_1;
+
+    if(size < 1)
+    {
+        return 0;
+    }
+
+    version = (data[0] & 0x80) ? REASM_VERSION_2 : REASM_VERSION_1;
+    dropped_whole = Fuzz_Decode(&whole, &data[1], size - 1, 0, version);
+    dropped_split = Fuzz_Decode(&split, &data[1], size - 1, (data[0] & 0x7F) + 1, version);
+
+    if((whole.count != split.count) || (dropped_whole != dropped_split))
+    {
+        abort();
+    }
+    held = (whole.count < FUZZ_MAX_FRAMES) ? whole.count : FUZZ_MAX_FRAMES;
+    for(i = 0; i < held; i++)
+    {
+        if(memcmp(&whole.frames[i], &split.frames[i], sizeof(Fuzz_Frame_t)) != 0)
+        {
+            abort();
+        }
+    }
+
+    return 0;
+}
+
+#ifdef REASM_FUZZ_MAIN
+/* Random input is built from frame pieces, so some frames are valid */
+static size_t Fuzz_Random(uint8_t *data, size_t max)
+{
+    size_t size = 1;
+    uint16_t length = 0;
+    uint8_t sum = 0;
+    uint32_t crc = 0;
+    uint16_t i = 0;
+    bool v2 = false;
+
+    data[0] = rand() & 0xFF;
+    v2 = ((data[0] & 0x80) != 0);
+    while(size + 32 + FUZZ_BUFFER_SIZE < max)
+    {
+        switch(rand() % 4)
+        {
+        case 0:
+            /* garbage */
+            for(i = rand() % 8; i > 0; i--)
+            {
+                data[size++] = (rand() % 3 == 0) ? 0x7B : (rand() & 0xFF);
+            }
+            break;
+        default:
+            /* frame, sometimes broken */
+            length = rand() % (FUZZ_BUFFER_SIZE + 8);
+            memset(&data[size], REASM_START_CODE, REASM_CODE_LEN);
+            size += REASM_CODE_LEN;
+            data[size++] = rand() & 0xFF;
+            data[size++] = rand() & 0xFF;
+            data[size++] = rand() & 0xFF;
+            data[size++] = length & 0xFF;
+            data[size++] = length >> 8;
+            sum = 0;
+            for(i = 5; i > 0; i--)
+            {
+                sum += data[size - i];
+            }
+            for(i = 0; i < length; i++)
+            {
+                data[size] = rand() & 0xFF;
+                sum += data[size++];
+            }
+            if(v2 == true)
+            {
+                crc = CRC32_Software(CRC32_INIT, &data[size - length - 5], length + 5);
+                crc += (rand() % 8 == 0) ? 1 : 0;
+                data[size++] = crc & 0xFF;
+                data[size++] = (crc >> 8) & 0xFF;
+                data[size++] = (crc >> 16) & 0xFF;
+                data[size++] = (crc >> 24) & 0xFF;
+            }
+            else
+            {
+                data[size++] = (rand() % 8 == 0) ? (uint8_t)(sum + 1) : sum;
+            }
+            memset(&data[size], REASM_END_CODE, REASM_CODE_LEN);
+            size += (rand() % 8 == 0) ? (rand() % REASM_CODE_LEN) : REASM_CODE_LEN;
+            break;
+        }
+        if(rand() % 16 == 0)
+        {
+            break;
+        }
+    }
+
+    return size;
+}
+
+int main(int argc, char **argv)
+{
+    static uint8_t data[16384];
+    size_t size = 0;
+    long iterations = 100000;
+    long n = 0;
+    FILE *file = NULL;
+    int i = 0;
+
+    if((argc > 1) && (atol(argv[1]) == 0))
+    {
+        for(i = 1; i < argc; i++)
+        {
+            file = fopen(argv[i], "rb");
+            if(file == NULL)
+            {
+                continue;
+            }
+            size = fread(data, 1, sizeof(data), file);
+            fclose(file);
+            LLVMFuzzerTestOneInput(data, size);
+        }
+        printf("%d files ok\n", argc - 1);
+        return 0;
+    }
+
+    if(argc > 1)
+    {
+        iterations = atol(argv[1]);
+    }
+    srand(1);
+    for(n = 0; n < iterations; n++)
+    {
+        size = Fuzz_Random(data, sizeof(data));
+        LLVMFuzzerTestOneInput(data, size);
+    }
+    printf("%ld random inputs ok\n", iterations);
+    return 0;
+}
+#endif
@@ -0,0 +1,870 @@
+/*
+***************************************************************************************************
+*                           WiFi Link Recovery Emulator (host)
+*
+* File   : recover_sim.c
+* Author : Douglas Xie
+* Date   : 2018.03.30
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*
+* Setup states of WiFi_ControlTask and WiFi_Ctrl_Recover of wifi_task.c against an emulated
+* ESP8266 with injected faults, time from fault to idle with link up is measured per tier.
+* Module answers AT commands with typical delays, firmware timeouts are the real ones.
+* Faults:
+*   link:   server closes TCP link, reopen of link is enough
+*   ap:     router is off for 1.5s, WIFI DISCONNECT and CLOSED are printed
+*   server: server is down for 8s, reset once then only reopen link, AP is still joined
+*   stack:  module TCP/IP stack stuck, CIPSTART and CWJAP fail until AT+RST
+*   hang:   module does not answer until its watchdog reboots it after 8s, found by alive test
+* Policies:
+*   reset:  every fault sets module up again from uart, like before the tiers
+*   tier:   tiered recovery, join by scan
+*   fast:   tiered recovery, join cached BSSID (WIFI_FAST_JOIN)
+*   static: fast join and cached lease, no DHCP (WIFI_STATIC_IP)
+*
+* Tiered policy must not be slower than reset-only for the same fault, except the failed link
+* reopen it tries first. Server fault is also run for outages of 2s to 20s, mean time to idle
+* of tiers must be lower than of reset-only.
+*
+*   gcc -O2 recover_sim.c -o recover_sim
+*   ./recover_sim
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SIM_RX_FB_TIMEOUT   1000.0      /* WIFI_RX_FB_TIMEOUT */
+#define SIM_RESET_DELAY     1000.0      /* WIFI_RESET_DELAY */
+#define SIM_ALIVE_PERIOD    5000.0      /* WIFI_ALIVE_PERIOD */
+#define SIM_JOIN_REPEAT     3           /* WIFI_JOIN_REPEAT */
+#define SIM_RATE_SAVED      3000000UL   /* module rate saved by AT+UART_DEF */
+#define SIM_RATE_DEFAULT    115200UL    /* WIFI_BAUDRATE_DEFAULT */
+#define SIM_RATE_NUM        4           /* WIFI_BAUDRATE_NUM */
+#define SIM_LIMIT_MS        120000.0    /* give up, fault is not recovered */
+
+/* Module timing, ms */
+#define EMU_AT_MS           5.0         /* short command */
+#define EMU_CWSAP_MS        300.0       /* soft AP restart */
+#define EMU_BOOT_MS         400.0       /* AT+RST or watchdog to ready */
+#define EMU_SCAN_JOIN_MS    2500.0      /* scan all channels and join */
+#define EMU_FAST_JOIN_MS    600.0       /* join given BSSID */
+#define EMU_JOIN_FAIL_MS    4000.0      /* module gives up join */
+#define EMU_DHCP_MS         800.0       /* GOT IP after join */
+#define EMU_CONNECT_MS      60.0        /* TCP handshake to server */
+#define EMU_CONNECT_FAIL_MS 1000.0      /* server refused or unreachable */
+#define EMU_HANG_MS         8000.0      /* watchdog reboot of hung module */
+#define EMU_AP_OFF_MS       1500.0
+#define EMU_SERVER_OFF_MS   8000.0
+#define EMU_OUTAGE_MIN      2000.0      /* server outage sweep */
+#define EMU_OUTAGE_MAX      20000.0
+#define EMU_OUTAGE_STEP     137.0
+#define EMU_ALIVE_PHASE     2500.0      /* fault happens in the middle of idle period */
+
+typedef enum
+{
+    SIM_CTRL_ECHO,
+    SIM_CTRL_SETUP_UART,
+    SIM_CTRL_GET_MAC,
+    SIM_CTRL_SETUP_AP,
+    SIM_CTRL_START_SERVER,
+    SIM_CTRL_SETUP_STATION,
+    SIM_CTRL_START_CLIENT,
+    SIM_CTRL_CONNECT_AP,
+    SIM_CTRL_GET_IP,
+    SIM_CTRL_ALIVE_TEST,
+    SIM_CTRL_IDLE,
+} Sim_CtrlState_t;
+
+typedef enum
+{
+    SIM_RECOVER_NONE = 0,
+    SIM_RECOVER_LINK,
+    SIM_RECOVER_JOIN,
+    SIM_RECOVER_RESET,
+    SIM_RECOVER_TIER_NUM
+} Sim_Recover_t;
+
+typedef enum
+{
+    EMU_NONE = 0,               /* no answer in timeout */
+    EMU_OK,
+    EMU_ERROR,
+} Emu_Result_t;
+
+typedef enum
+{
+    EMU_EVENT_NONE = 0,
+    EMU_EVENT_CLOSED,           /* CLOSED */
+    EMU_EVENT_DISCONNECT,       /* WIFI DISCONNECT */
+} Emu_Event_t;
+
+typedef enum
+{
+    SIM_FAULT_LINK = 0,
+    SIM_FAULT_AP,
+    SIM_FAULT_SERVER,
+    SIM_FAULT_STACK,
+    SIM_FAULT_HANG,
+    SIM_FAULT_NUM
+} Sim_Fault_t;
+
+typedef enum
+{
+    SIM_POLICY_RESET = 0,
+    SIM_POLICY_TIER,
+    SIM_POLICY_FAST,
+    SIM_POLICY_STATIC,
+    SIM_POLICY_NUM
+} Sim_Policy_t;
+
+/* Emulated module, router and server */
+typedef struct
+{
+    double          now;                /* ms from fault */
+    uint32_t        rate;               /* mcu uart rate */
+    double          hang_until;         /* no answer, then watchdog reboot */
+    bool            stack_stuck;        /* until AT+RST */
+    bool            joined;
+    bool            dhcp;
+    bool            tcp_up;
+    bool            server_up;          /* AP mode TCP server */
+    double          ap_off_until;
+    double          server_off;         /* server outage of server fault */
+    double          server_off_until;
+    Emu_Event_t     event[4];
+    uint8_t         event_count;
+} Emu_t;
+
+/* Firmware state of wifi_task.c */
+typedef struct
+{
+    bool            station;
+    bool            tiered;
+    bool            fast_join;          /* WIFI_FAST_JOIN */
+    bool            static_ip;          /* WIFI_STATIC_IP */
+    bool            join_cached;        /* app_config.wifi_join.channel != 0 */
+    bool            tcp_client_connected;
+    Sim_Recover_t   recover_tier;
+    bool            recover_reset;      /* wifi_recover_reset */
+    double          recover_tick;
+    double          probe_time;         /* first failed link reopen done */
+    bool            done;
+    double          done_time;
+    Sim_Recover_t   done_tier;
+    char            trace[32];          /* tiers tried */
+} Sim_t;
+
+static Emu_t emu;
+static Sim_t sim;
+
+/* Module reboot, mode and soft AP are kept in flash, auto connect is off */
+static void Emu_Boot(void)
+{
+    emu.stack_stuck = false;
+    emu.joined = false;
+    emu.dhcp = true;
+    emu.tcp_up = false;
+    emu.server_up = false;
+}
+
+/*******************************************************************************
+* @Brief   Emulated Module Command
+* @Param   cmd[in]: AT command without CRLF
+*          timeout[in]: firmware wait for result
+* @Note    late answer after timeout is dropped like WiFi_FlushReply
+* @Return  result, EMU_NONE on timeout
+*******************************************************************************/
+static Emu_Result_t Emu_Command(const char *cmd, double timeout)
+{
+    Emu_Result_t result = EMU_OK;
+    double delay = EMU_AT_MS;
+    double join = 0;
+    double up = 0;
+
+    if((emu.hang_until > 0) && (emu.now >= emu.hang_until))
+    {
+        emu.hang_until = 0;
+        Emu_Boot();
+    }
+    if((emu.hang_until > 0) || (emu.rate != SIM_RATE_SAVED))
+    {
+        emu.now += timeout;
+        return EMU_NONE;
+    }
+
+    if(strncmp(cmd, "AT+CWSAP=", 9) == 0)
+    {
+        delay = EMU_CWSAP_MS;
+    }
+    else if(strncmp(cmd, "AT+RST", 6) == 0)
+    {
+        Emu_Boot();
+    }
+    else if(strncmp(cmd, "AT+CIPSERVER=", 13) == 0)
+    {
+        emu.server_up = (emu.stack_stuck == false);
+        result = (emu.server_up == true) ? EMU_OK : EMU_ERROR;
+    }
+    else if(strncmp(cmd, "AT+CWDHCP=", 10) == 0)
+    {
+        emu.dhcp = true;
+    }
+    else if(strncmp(cmd, "AT+CIPSTA=", 10) == 0)
+    {
+        emu.dhcp = false;
+    }
+    else if(strncmp(cmd, "AT+CIPSTA?", 10) == 0)
+    {
+        /* OK with ip 0.0.0.0 when not joined is taken as failed */
+        result = (emu.joined == true) ? EMU_OK : EMU_ERROR;
+    }
+    else if(strncmp(cmd, "AT+CWJAP=", 9) == 0)
+    {
+        /* module keeps trying until router is back or it gives up */
+        join = (strchr(cmd, ':') != NULL) ? EMU_FAST_JOIN_MS : EMU_SCAN_JOIN_MS;
+        up = (emu.ap_off_until > emu.now) ? (emu.ap_off_until - emu.now) : 0;
+        delay = up + join + ((emu.dhcp == true) ? EMU_DHCP_MS : 0);
+        emu.joined = (emu.stack_stuck == false) && (delay <= EMU_JOIN_FAIL_MS);
+        if(emu.joined == false)
+        {
+            delay = EMU_JOIN_FAIL_MS;
+            result = EMU_ERROR;
+        }
+    }
+    else if(strncmp(cmd, "AT+CIPSTART=", 12) == 0)
+    {
+        emu.tcp_up = (emu.stack_stuck == false) && (emu.joined == true) &&
+                     (emu.now >= emu.ap_off_until) && (emu.now >= emu.server_off_until);
+        delay = (emu.tcp_up == true) ? EMU_CONNECT_MS : EMU_CONNECT_FAIL_MS;
+        result = (emu.tcp_up == true) ? EMU_OK : EMU_ERROR;
+    }
+    else if(strncmp(cmd, "AT+CIPCLOSE", 11) == 0)
+    {
+        result = (emu.tcp_up == true) ? EMU_OK : EMU_ERROR;
+        emu.tcp_up = false;
+    }
+
+    if(delay > timeout)
+    {
+        emu.now += timeout;
+        return EMU_NONE;
+    }
+    emu.now += delay;
+    return result;
+}
+
+static void Emu_Fault(Sim_Fault_t fault, double server_off)
+{
+    memset(&emu, 0, sizeof(emu));
+    emu.server_off = server_off;
+    emu.rate = SIM_RATE_SAVED;
+    emu.joined = sim.station;
+    emu.dhcp = (sim.static_ip == false);
+    emu.tcp_up = sim.station;
+    emu.server_up = (sim.station == false);
+    /* idle state is blocked since the last event */
+    emu.now = -EMU_ALIVE_PHASE;
+
+    switch(fault)
+    {
+    case SIM_FAULT_LINK:
+        emu.tcp_up = false;
+        emu.event[emu.event_count++] = EMU_EVENT_CLOSED;
+        break;
+
+    case SIM_FAULT_AP:
+        emu.joined = false;
+        emu.tcp_up = false;
+        emu.ap_off_until = EMU_AP_OFF_MS;
+        emu.event[emu.event_count++] = EMU_EVENT_DISCONNECT;
+        emu.event[emu.event_count++] = EMU_EVENT_CLOSED;
+        break;
+
+    case SIM_FAULT_SERVER:
+        emu.tcp_up = false;
+        emu.server_off_until = emu.server_off;
+        emu.event[emu.event_count++] = EMU_EVENT_CLOSED;
+        break;
+
+    case SIM_FAULT_STACK:
+        emu.tcp_up = false;
+        emu.stack_stuck = true;
+        emu.event[emu.event_count++] = EMU_EVENT_CLOSED;
+        break;
+
+    case SIM_FAULT_HANG:
+    default:
+        emu.hang_until = EMU_HANG_MS;
+        break;
+    }
+}
+
+/* Same as WiFi_Ctrl_Echo of wifi_task.c */
+static bool Sim_Echo(void)
+{
+    return Emu_Command("ATE1", SIM_RX_FB_TIMEOUT) == EMU_OK;
+}
+
+/* Same as WiFi_Ctrl_SetupUART of wifi_task.c, module keeps the saved top rate so no step up */
+static bool Sim_SetupUART(void)
+{
+    static const uint32_t rate_list[SIM_RATE_NUM] = { 921600UL, 1500000UL, 2000000UL, 3000000UL };
+    uint32_t probe_list[SIM_RATE_NUM + 2];
+    uint8_t i = 0;
+
+    probe_list[0] = SIM_RATE_SAVED;
+    probe_list[1] = SIM_RATE_DEFAULT;
+    for(i = 0; i < SIM_RATE_NUM; i++)
+    {
+        probe_list[i + 2] = rate_list[i];
+    }
+    for(i = 0; i < (SIM_RATE_NUM + 2); i++)
+    {
+        if((i > 0) && (probe_list[i] == probe_list[0]))
+        {
+            continue;
+        }
+        /* same as WiFi_ProbeBaudrate */
+        emu.rate = probe_list[i];
+        if((Sim_Echo() == true) || (Sim_Echo() == true))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Same as AT+RST and WiFi_WaitReady of wifi_task.c */
+static bool Sim_Reset(void)
+{
+    if(Emu_Command("AT+RST", SIM_RX_FB_TIMEOUT) != EMU_OK)
+    {
+        return false;
+    }
+    emu.now += (EMU_BOOT_MS < SIM_RESET_DELAY) ? EMU_BOOT_MS : SIM_RESET_DELAY;
+    return true;
+}
+
+/* Same as WiFi_Ctrl_SetupAP of wifi_task.c */
+static bool Sim_SetupAP(bool reset)
+{
+    bool rtn_state = false;
+
+    rtn_state = (Emu_Command("AT+CWMODE=2", SIM_RX_FB_TIMEOUT) == EMU_OK);
+    if(rtn_state == true)
+    {
+        rtn_state = (Emu_Command("AT+CWSAP=\"AniTech_\"", SIM_RX_FB_TIMEOUT) == EMU_OK);
+    }
+    if((rtn_state == true) && (reset == true))
+    {
+        rtn_state = Sim_Reset();
+    }
+    return rtn_state;
+}
+
+/* Same as WiFi_Ctrl_StartTcpServer of wifi_task.c */
+static bool Sim_StartTcpServer(void)
+{
+    bool rtn_state = false;
+
+    rtn_state = (Emu_Command("AT+CIPMUX=1", SIM_RX_FB_TIMEOUT) == EMU_OK);
+    if(rtn_state == true)
+    {
+        Emu_Command("AT+CIPSERVERMAXCONN=4", SIM_RX_FB_TIMEOUT);
+        rtn_state = (Emu_Command("AT+CIPSERVER=1,2017", SIM_RX_FB_TIMEOUT) == EMU_OK);
+    }
+    if(rtn_state == true)
+    {
+        rtn_state = (Emu_Command("AT+CIPSTO=300", SIM_RX_FB_TIMEOUT) == EMU_OK);
+    }
+    return rtn_state;
+}
+
+/* Same as WiFi_Ctrl_SetupStation of wifi_task.c */
+static bool Sim_SetupStation(void)
+{
+    bool rtn_state = false;
+
+    rtn_state = (Emu_Command("AT+CWMODE=1", SIM_RX_FB_TIMEOUT) == EMU_OK);
+    if(rtn_state == true)
+    {
+        rtn_state = (Emu_Command("AT+CWAUTOCONN=0", SIM_RX_FB_TIMEOUT) == EMU_OK);
+    }
+    if(rtn_state == true)
+    {
+        rtn_state = Sim_Reset();
+    }
+    return rtn_state;
+}
+
+/* Same as WiFi_Ctrl_ConnectAP of wifi_task.c */
+static bool Sim_ConnectAP(void)
+{
+    bool rtn_state = false;
+    bool fast_join = (sim.fast_join == true) && (sim.join_cached == true);
+    bool static_ip = (sim.static_ip == true) && (fast_join == true);
+
+    if(static_ip == true)
+    {
+        rtn_state = (Emu_Command("AT+CIPSTA=\"192.168.1.20\"", SIM_RX_FB_TIMEOUT) == EMU_OK);
+    }
+    else
+    {
+        rtn_state = (Emu_Command("AT+CWDHCP=1,1", SIM_RX_FB_TIMEOUT) == EMU_OK);
+    }
+
+    if(rtn_state == true)
+    {
+        if(fast_join == true)
+        {
+            rtn_state = (Emu_Command("AT+CWJAP=\"ssid\",\"pass\",\"5c:cf:7f:01:02:03\"", SIM_RX_FB_TIMEOUT * 5) == EMU_OK);
+        }
+        else
+        {
+            rtn_state = (Emu_Command("AT+CWJAP=\"ssid\",\"pass\"", SIM_RX_FB_TIMEOUT * 5) == EMU_OK);
+        }
+        if((rtn_state == false) && (fast_join == true))
+        {
+            sim.join_cached = false;
+        }
+    }
+    return rtn_state;
+}
+
+/* Same as WiFi_Ctrl_GetIP and WiFi_Ctrl_SaveJoinInfo of wifi_task.c */
+static bool Sim_GetIP(void)
+{
+    if(Emu_Command("AT+CIPSTA?", SIM_RX_FB_TIMEOUT) != EMU_OK)
+    {
+        return false;
+    }
+    if(Emu_Command("AT+CWJAP?", SIM_RX_FB_TIMEOUT) == EMU_OK)
+    {
+        sim.join_cached = sim.fast_join;
+    }
+    return true;
+}
+
+/* Same as WiFi_Ctrl_StartTcpClient of wifi_task.c */
+static bool Sim_StartTcpClient(void)
+{
+    bool rtn_state = false;
+
+    rtn_state = (Emu_Command("AT+CIPMUX=0", SIM_RX_FB_TIMEOUT) == EMU_OK);
+    if(rtn_state == true)
+    {
+        rtn_state = (Emu_Command("AT+CIPSTART=\"TCP\",\"server\",2017", SIM_RX_FB_TIMEOUT * 5) == EMU_OK);
+        sim.tcp_client_connected = rtn_state;
+    }
+    return rtn_state;
+}
+
+/*******************************************************************************
+* @Brief   Link Recovery
+* @Param   tier[in]: lowest tier can fix the fault
+* @Note    Same as WiFi_Ctrl_Recover of wifi_task.c, reset policy always picks
+*          reset tier like the firmware before tiers
+* @Return  next control state
+*******************************************************************************/
+static Sim_CtrlState_t Sim_Recover(Sim_Recover_t tier)
+{
+    Sim_CtrlState_t next_state = SIM_CTRL_SETUP_UART;
+    Sim_Recover_t lowest = SIM_RECOVER_NONE;
+    size_t length = strlen(sim.trace);
+
+    if(sim.tiered == false)
+    {
+        tier = SIM_RECOVER_RESET;
+    }
+    lowest = tier;
+
+    if(sim.recover_tier == SIM_RECOVER_NONE)
+    {
+        sim.recover_tick = emu.now;
+    }
+    else if(tier <= sim.recover_tier)
+    {
+        tier = (Sim_Recover_t)(sim.recover_tier + 1);
+    }
+    if(tier >= SIM_RECOVER_TIER_NUM)
+    {
+        tier = lowest;
+    }
+    else if((tier == SIM_RECOVER_JOIN) && (lowest == SIM_RECOVER_LINK) && (sim.station == true) &&
+            (Emu_Command("AT+CIPSTA?", SIM_RX_FB_TIMEOUT) == EMU_OK))
+    {
+        tier = (sim.recover_reset == true) ? SIM_RECOVER_LINK : SIM_RECOVER_RESET;
+    }
+    if(tier == SIM_RECOVER_RESET)
+    {
+        sim.recover_reset = true;
+    }
+    if((sim.recover_tier == SIM_RECOVER_LINK) && (sim.probe_time == 0))
+    {
+        sim.probe_time = emu.now;
+    }
+    sim.recover_tier = tier;
+    if(length + 2 < sizeof(sim.trace))
+    {
+        sprintf(&sim.trace[length], "%s%d", (length > 0) ? " " : "", tier);
+    }
+
+    switch(tier)
+    {
+    case SIM_RECOVER_LINK:
+        if(sim.station == true)
+        {
+            if(sim.tcp_client_connected == true)
+            {
+                Emu_Command("AT+CIPCLOSE", SIM_RX_FB_TIMEOUT);
+            }
+            sim.tcp_client_connected = false;
+            next_state = SIM_CTRL_START_CLIENT;
+        }
+        else
+        {
+            next_state = SIM_CTRL_START_SERVER;
+        }
+        break;
+
+    case SIM_RECOVER_JOIN:
+        next_state = (sim.station == true) ? SIM_CTRL_CONNECT_AP : SIM_CTRL_SETUP_AP;
+        break;
+
+    default:
+        next_state = SIM_CTRL_SETUP_UART;
+        break;
+    }
+
+    return next_state;
+}
+
+/* Same as WiFi_RecoverDone of wifi_task.c, station events of recovery are stale */
+static void Sim_RecoverDone(void)
+{
+    if(sim.recover_tier != SIM_RECOVER_NONE)
+    {
+        sim.done = true;
+        sim.done_time = emu.now;
+        sim.done_tier = sim.recover_tier;
+        sim.recover_tier = SIM_RECOVER_NONE;
+        sim.recover_reset = false;
+    }
+    if(sim.station == true)
+    {
+        emu.event_count = 0;
+    }
+}
+
+/* Same as WiFi_Ctrl_Idle of wifi_task.c, events of fault come at time 0 */
+static Sim_CtrlState_t Sim_Idle(void)
+{
+    Emu_Event_t event = EMU_EVENT_NONE;
+
+    if((emu.event_count > 0) && (emu.now < 0))
+    {
+        emu.now = 0;
+    }
+    if(emu.event_count == 0)
+    {
+        emu.now += SIM_ALIVE_PERIOD;
+        return SIM_CTRL_ALIVE_TEST;
+    }
+
+    event = emu.event[0];
+    emu.event_count--;
+    memmove(&emu.event[0], &emu.event[1], emu.event_count * sizeof(emu.event[0]));
+    sim.tcp_client_connected = false;
+    if(event == EMU_EVENT_DISCONNECT)
+    {
+        return Sim_Recover(SIM_RECOVER_JOIN);
+    }
+    return Sim_Recover(SIM_RECOVER_LINK);
+}
+
+/*******************************************************************************
+* @Brief   Control Task Timeline
+* @Param
+* @Note    Same setup and recovery branches as WiFi_ControlTask of wifi_task.c,
+*          runs until recovery is done or time limit
+* @Return  true if recovered
+*******************************************************************************/
+static bool Sim_ControlTask(void)
+{
+    Sim_CtrlState_t state = SIM_CTRL_IDLE;
+    uint8_t join_counter = 0;
+
+    while((sim.done == false) && (emu.now < SIM_LIMIT_MS))
+    {
+        switch(state)
+        {
+        case SIM_CTRL_ECHO:
+            state = (Sim_Echo() == true) ? SIM_CTRL_GET_MAC : SIM_CTRL_SETUP_UART;
+            break;
+
+        case SIM_CTRL_SETUP_UART:
+            Sim_SetupUART();
+            state = SIM_CTRL_ECHO;
+            break;
+
+        case SIM_CTRL_GET_MAC:
+            if(Emu_Command("AT+CIPSTAMAC?", SIM_RX_FB_TIMEOUT) == EMU_OK)
+            {
+                state = (sim.station == true) ? SIM_CTRL_SETUP_STATION : SIM_CTRL_SETUP_AP;
+            }
+            else
+            {
+                state = SIM_CTRL_SETUP_UART;
+            }
+            break;
+
+        case SIM_CTRL_SETUP_AP:
+            if(Sim_SetupAP(sim.recover_tier != SIM_RECOVER_JOIN) == true)
+            {
+                state = SIM_CTRL_START_SERVER;
+            }
+            else
+            {
+                state = Sim_Recover(SIM_RECOVER_JOIN);
+            }
+            break;
+
+        case SIM_CTRL_START_SERVER:
+            if(Sim_StartTcpServer() == true)
+            {
+                Sim_RecoverDone();
+                state = SIM_CTRL_IDLE;
+            }
+            else
+            {
+                state = Sim_Recover(SIM_RECOVER_LINK);
+            }
+            break;
+
+        case SIM_CTRL_SETUP_STATION:
+            if(Sim_SetupStation() == true)
+            {
+                join_counter = 0;
+                state = SIM_CTRL_CONNECT_AP;
+            }
+            else
+            {
+                state = Sim_Recover(SIM_RECOVER_JOIN);
+            }
+            break;
+
+        case SIM_CTRL_CONNECT_AP:
+            if(Sim_ConnectAP() == true)
+            {
+                state = SIM_CTRL_GET_IP;
+            }
+            else if((sim.recover_tier == SIM_RECOVER_JOIN) || (++join_counter >= SIM_JOIN_REPEAT))
+            {
+                join_counter = 0;
+                state = Sim_Recover(SIM_RECOVER_JOIN);
+            }
+            break;
+
+        case SIM_CTRL_GET_IP:
+            if(Sim_GetIP() == true)
+            {
+                join_counter = 0;
+                state = SIM_CTRL_START_CLIENT;
+            }
+            else if((sim.recover_tier == SIM_RECOVER_JOIN) || (++join_counter >= SIM_JOIN_REPEAT))
+            {
+                join_counter = 0;
+                state = Sim_Recover(SIM_RECOVER_JOIN);
+            }
+            else
+            {
+                state = SIM_CTRL_CONNECT_AP;
+            }
+            break;
+
+        case SIM_CTRL_START_CLIENT:
+            if(Sim_StartTcpClient() == true)
+            {
+                Sim_RecoverDone();
+                state = SIM_CTRL_IDLE;
+            }
+            else
+            {
+                state = Sim_Recover(SIM_RECOVER_LINK);
+            }
+            break;
+
+        case SIM_CTRL_ALIVE_TEST:
+            state = (Sim_Echo() == true) ? SIM_CTRL_IDLE : Sim_Recover(SIM_RECOVER_RESET);
+            break;
+
+        case SIM_CTRL_IDLE:
+        default:
+            state = Sim_Idle();
+            break;
+        }
+    }
+
+    /* link is really up, not only the state machine */
+    return (sim.done == true) && ((emu.tcp_up == true) || (emu.server_up == true));
+}
+
+/* Trace of server fault: link, reset once, then only link */
+static bool Sim_ServerTrace(void)
+{
+    uint32_t i = 0;
+
+    if(strncmp(sim.trace, "1 3", 3) != 0)
+    {
+        return false;
+    }
+    for(i = 3; sim.trace[i] != '\0'; i += 2)
+    {
+        if(strncmp(&sim.trace[i], " 1", 2) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* One fault against one policy, true if link is really up again */
+static bool Sim_Run(uint32_t mode, Sim_Fault_t fault, Sim_Policy_t policy, double server_off)
+{
+    memset(&sim, 0, sizeof(sim));
+    sim.station = (mode == 0);
+    sim.tiered = (policy != SIM_POLICY_RESET);
+    sim.fast_join = (policy >= SIM_POLICY_FAST);
+    sim.static_ip = (policy == SIM_POLICY_STATIC);
+    sim.join_cached = sim.fast_join;
+    sim.tcp_client_connected = sim.station;
+    Emu_Fault(fault, server_off);
+
+    return Sim_ControlTask();
+}
+
+int main(void)
+{
+    static const char *fault_name[] = { "link", "ap", "server", "stack", "hang" };
+    static const char *policy_name[] = { "reset", "tier", "fast", "static" };
+    /* tier that fixes the fault per tiered policy, scan join can not finish in the module join
+     * time while router boots so AP fault of tier policy ends in reset, server fault by trace */
+    static const Sim_Recover_t expect[SIM_FAULT_NUM][SIM_POLICY_NUM] =
+    {
+        { SIM_RECOVER_RESET, SIM_RECOVER_LINK,  SIM_RECOVER_LINK,  SIM_RECOVER_LINK  },
+        { SIM_RECOVER_RESET, SIM_RECOVER_RESET, SIM_RECOVER_JOIN,  SIM_RECOVER_JOIN  },
+        { SIM_RECOVER_RESET, SIM_RECOVER_NONE,  SIM_RECOVER_NONE,  SIM_RECOVER_NONE  },
+        { SIM_RECOVER_RESET, SIM_RECOVER_RESET, SIM_RECOVER_RESET, SIM_RECOVER_RESET },
+        { SIM_RECOVER_RESET, SIM_RECOVER_RESET, SIM_RECOVER_RESET, SIM_RECOVER_RESET },
+    };
+    double result[2][SIM_FAULT_NUM][SIM_POLICY_NUM];
+    double mean[SIM_POLICY_NUM];
+    double probe = 0;
+    double off = 0;
+    uint32_t count = 0;
+    uint32_t failed = 0;
+    uint32_t mode = 0;
+    uint32_t f = 0;
+    uint32_t p = 0;
+    bool ok = false;
+
+    printf("%-8s %-6s %-7s %10s %10s %10s  %s\n", "mode", "fault", "policy", "detect ms", "probe ms", "idle ms", "tiers");
+    for(mode = 0; mode < 2; mode++)
+    {
+        for(f = 0; f < SIM_FAULT_NUM; f++)
+        {
+            /* soft AP has no link loss event, only alive test finds a fault */
+            if((mode == 1) && (f != SIM_FAULT_HANG))
+            {
+                continue;
+            }
+            for(p = 0; p < SIM_POLICY_NUM; p++)
+            {
+                if((mode == 1) && (p > SIM_POLICY_TIER))
+                {
+                    continue;
+                }
+                ok = Sim_Run(mode, (Sim_Fault_t)f, (Sim_Policy_t)p, EMU_SERVER_OFF_MS);
+                result[mode][f][p] = sim.done_time;
+                probe = sim.probe_time;
+                if((ok == true) && (sim.tiered == true))
+                {
+                    if(expect[f][p] != SIM_RECOVER_NONE)
+                    {
+                        ok = (sim.done_tier == expect[f][p]);
+                    }
+                    else
+                    {
+                        ok = Sim_ServerTrace();
+                    }
+                    /* tiers may only lose the link reopen they try first */
+                    if(sim.done_time - probe > result[mode][f][SIM_POLICY_RESET])
+                    {
+                        ok = false;
+                    }
+                }
+                printf("%-8s %-6s %-7s %10.0f %10.0f %10.0f  %-16s %s\n", (mode == 0) ? "station" : "soft ap",
+                       fault_name[f], policy_name[p], sim.recover_tick, probe, sim.done_time, sim.trace,
+                       (ok == true) ? "" : "FAILED");
+                failed += (ok == true) ? 0 : 1;
+            }
+        }
+    }
+
+    /* cheap tier and fast join must pay off where they apply */
+    if(result[0][SIM_FAULT_LINK][SIM_POLICY_FAST] >= result[0][SIM_FAULT_LINK][SIM_POLICY_RESET])
+    {
+        printf("link reopen is not faster than reset\n");
+        failed++;
+    }
+    if(result[0][SIM_FAULT_AP][SIM_POLICY_FAST] >= result[0][SIM_FAULT_AP][SIM_POLICY_RESET])
+    {
+        printf("rejoin is not faster than reset\n");
+        failed++;
+    }
+    if((result[0][SIM_FAULT_AP][SIM_POLICY_FAST] >= result[0][SIM_FAULT_AP][SIM_POLICY_TIER]) ||
+       (result[0][SIM_FAULT_AP][SIM_POLICY_STATIC] >= result[0][SIM_FAULT_AP][SIM_POLICY_FAST]))
+    {
+        printf("fast join or static ip is not faster\n");
+        failed++;
+    }
+
+    /* time to idle of one outage depends on where retries fall, mean over outages does not */
+    memset(mean, 0, sizeof(mean));
+    for(off = EMU_OUTAGE_MIN; off <= EMU_OUTAGE_MAX; off += EMU_OUTAGE_STEP)
+    {
+        for(p = 0; p < SIM_POLICY_NUM; p++)
+        {
+            if(Sim_Run(0, SIM_FAULT_SERVER, (Sim_Policy_t)p, off) == false)
+            {
+                printf("server outage %.0f ms %s not recovered\n", off, policy_name[p]);
+                failed++;
+            }
+            mean[p] += sim.done_time;
+        }
+        count++;
+    }
+    printf("server outage %.0f to %.0f ms, mean idle ms:", EMU_OUTAGE_MIN, EMU_OUTAGE_MAX);
+    for(p = 0; p < SIM_POLICY_NUM; p++)
+    {
+        mean[p] /= count;
+        printf(" %s %.0f", policy_name[p], mean[p]);
+    }
+    printf("\n");
+    for(p = SIM_POLICY_TIER; p < SIM_POLICY_NUM; p++)
+    {
+        if(mean[p] >= mean[SIM_POLICY_RESET])
+        {
+            printf("server outage of %s is not faster than reset\n", policy_name[p]);
+            failed++;
+        }
+    }
+
+    printf("%u failed\n", failed);
+    return (failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,394 @@
+/*
+***************************************************************************************************
+*                           WiFi Receive Engine Replay (host)
+*
+* File   : rx_replay.c
+* Author : Douglas Xie
+* Date   : 2018.03.30
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*
+* Replay an ESP8266 byte stream through the receive engine of wifi_task: circular dma writes
+* the ring storage, idle line and half/full transfer wake the drain, ring is drained in bulk
+* to wifi_parser. Bursts (bytes between two idle lines) have random size, so lines, +IPD heads
+* and payload are cut at every place and the ring wraps. Events must be the same as parsing
+* the whole stream at once. Also prints interrupts per KB of the old one byte dma re-arm and
+* of the ring engine.
+*
+* Lap check: drain is held back for random time, the dma head and half/full events must flag
+* a lap exactly when dma wrote a whole ring or more since last drain.
+*
+* Stream is a recorded capture (raw bytes of module uart), or a built-in session when no file.
+*
+*   gcc -O2 -I../Application/Include rx_replay.c ../Application/Source/ring_buffer.c
+*       ../Application/Source/wifi_parser.c -o rx_replay
+*   ./rx_replay [capture_file] [rounds]
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ring_buffer.h"
+#include "wifi_parser.h"
+
+#define REPLAY_RING_SIZE    2048        /* WIFI_RX_RING_SIZE */
+#define REPLAY_BURST_MAX    1460        /* one TCP segment from module */
+#define REPLAY_STREAM_MAX   (1024 * 1024)
+#define REPLAY_EVENT_MAX    65536
+
+/* Event with payload folded into a hash, span cuts do not change it */
+typedef struct
+{
+    uint8_t     type;
+    uint8_t     link_id;
+    uint16_t    length;
+    uint32_t    hash;
+} Replay_Event_t;
+
+typedef struct
+{
+    Replay_Event_t  *events;
+    uint32_t        count;
+    uint32_t        ipd_hash;
+    uint32_t        type_count[PARSER_EVT_IPD_DONE + 1];
+} Replay_Log_t;
+
+static uint32_t Replay_Hash(uint32_t hash, const uint8_t *data, uint16_t length)
+{
+    uint16_t i = 0;
+
+    for(i = 0; i < length; i++)
+    {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void Replay_Event(const Parser_Event_t *event, void *context)
+{
+    Replay_Log_t *log = (Replay_Log_t *)context;
+    Replay_Event_t *item = NULL;
+
+    log->type_count[event->type]++;
+    if(event->type == PARSER_EVT_IPD_DATA)
+    {
+        log->ipd_hash = Replay_Hash(log->ipd_hash, event->data, event->length);
+        return;
+    }
+    if(log->count >= REPLAY_EVENT_MAX)
+    {
+        return;
+    }
+    item = &log->events[log->count++];
+    item->type = (uint8_t)event->type;
+    item->link_id = event->link_id;
+    item->length = event->length;
+    if(event->type == PARSER_EVT_IPD_DONE)
+    {
+        item->hash = log->ipd_hash;
+    }
+    else
+    {
+        item->hash = Replay_Hash(2166136261u, event->data, (event->data != NULL) ? event->length : 0);
+    }
+    if(event->type == PARSER_EVT_IPD_HEAD)
+    {
+        log->ipd_hash = 2166136261u;
+    }
+}
+
+static size_t Replay_Append(uint8_t *stream, size_t size, const char *text)
+{
+    size_t length = strlen(text);
+
+    memcpy(&stream[size], text, length);
+    return size + length;
+}
+
+/* Module side of one AP session: link connect, requests as +IPD, image chunks sent */
+static size_t Replay_Session(uint8_t *stream, size_t max)
+{
+    char text[64];
+    size_t size = 0;
+    uint16_t length = 0;
+    uint16_t i = 0;
+    uint16_t n = 0;
+    uint16_t chunk = 0;
+
+    size = Replay_Append(stream, size, "ready\r\nWIFI CONNECTED\r\nWIFI GOT IP\r\n0,CONNECT\r\n");
+    for(n = 0; (size + 4096 < max); n++)
+    {
+        /* client request frame, payload is binary and may hold \r\n and "OK" */
+        length = (uint16_t)(16 + (n * 37) % 1200);
+        sprintf(text, "\r\n+IPD,%d,%d:", n % 5, length);
+        size = Replay_Append(stream, size, text);
+        for(i = 0; i < length; i++)
+        {
+            stream[size++] = (i % 97 == 0) ? '\r' : (i % 89 == 0) ? '\n' : (uint8_t)(i * 13 + n);
+        }
+        if((n % 7) == 0)
+        {
+            size = Replay_Append(stream, size, "\r\nOK\r\n");
+        }
+
+        /* image chunk upload, echo of command and send result */
+        chunk = (uint16_t)(1016 + (n % 3) * 500);
+        sprintf(text, "AT+CIPSEND=%d,%d\r\n\r\nOK\r\n> ", n % 5, chunk);
+        size = Replay_Append(stream, size, text);
+        sprintf(text, "\r\nRecv %d bytes\r\n", chunk);
+        size = Replay_Append(stream, size, text);
+        size = Replay_Append(stream, size, ((n % 11) == 10) ? "\r\nSEND FAIL\r\n" : "\r\nSEND OK\r\n");
+        if((n % 13) == 12)
+        {
+            size = Replay_Append(stream, size, "busy s...\r\n\r\nERROR\r\n");
+        }
+        if((n % 17) == 16)
+        {
+            sprintf(text, "%d,CLOSED\r\n%d,CONNECT\r\n", n % 5, n % 5);
+            size = Replay_Append(stream, size, text);
+        }
+    }
+    return size;
+}
+
+/* Circular dma into ring storage, drain at idle line and half/full transfer */
+static uint32_t Replay_Dma(const uint8_t *stream, size_t size, Replay_Log_t *log, uint32_t seed)
+{
+    static uint8_t storage[REPLAY_RING_SIZE];
+    Ring_Buffer_t ring;
+    Parser_t parser;
+    uint8_t *pdata = NULL;
+    uint16_t length = 0;
+    uint16_t dma_pos = 0;
+    uint32_t interrupts = 0;
+    size_t burst = 0;
+    size_t i = 0;
+
+    Ring_Init(&ring, storage, REPLAY_RING_SIZE);
+    Parser_Init(&parser, Replay_Event, log);
+    srand(seed);
+
+    for(i = 0; i < size; i += burst)
+    {
+        burst = 1 + (size_t)rand() % ((rand() & 1) ? 16 : REPLAY_BURST_MAX);
+        if(burst > size - i)
+        {
+            burst = size - i;
+        }
+        while(burst > 0)
+        {
+            /* dma runs to next half of ring at most, that is a HT or TC interrupt */
+            length = (uint16_t)((dma_pos < REPLAY_RING_SIZE / 2) ? (REPLAY_RING_SIZE / 2 - dma_pos) : (REPLAY_RING_SIZE - dma_pos));
+            if(length > burst)
+            {
+                length = (uint16_t)burst;
+            }
+            memcpy(&storage[dma_pos], &stream[i], length);
+            dma_pos = (uint16_t)((dma_pos + length) % REPLAY_RING_SIZE);
+            i += length;
+            burst -= length;
+            interrupts++;
+
+            /* receive task: dma position is the head, drain in bulk */
+            Ring_SetHead(&ring, dma_pos);
+            while((length = Ring_Peek(&ring, &pdata)) > 0)
+            {
+                Parser_Input(&parser, pdata, length);
+                Ring_Skip(&ring, length);
+            }
+        }
+        burst = 0;
+    }
+    return interrupts;
+}
+
+/* Drain held back at random, lap flag against bytes written since last drain.
+ * Head is read before the last bytes of a burst at times, their interrupt is counted
+ * first and the bytes belong to next drain */
+static uint32_t Replay_Lap(uint32_t seed, uint32_t drains)
+{
+    static uint8_t storage[REPLAY_RING_SIZE];
+    Ring_Buffer_t ring;
+    uint16_t dma_pos = 0;
+    uint16_t head = 0;
+    uint16_t length = 0;
+    uint32_t events = 0;
+    uint32_t unread = 0;
+    uint32_t written = 0;
+    uint32_t burst = 0;
+    uint32_t late = 0;
+    uint32_t n = 0;
+    uint32_t laps = 0;
+    uint32_t failed = 0;
+    bool lapped = false;
+
+    Ring_Init(&ring, storage, REPLAY_RING_SIZE);
+    srand(seed);
+
+    for(n = 0; n < drains; n++)
+    {
+        /* up to about two rings between drains, exact ring sizes now and then */
+        burst = (rand() & 3) ? (uint32_t)rand() % REPLAY_RING_SIZE :
+                (rand() & 1) ? (uint32_t)REPLAY_RING_SIZE * (1 + rand() % 2) - (uint32_t)rand() % 2 :
+                (uint32_t)rand() % (REPLAY_RING_SIZE * 2 + 1);
+        late = ((rand() & 7) == 0) ? 1 + (uint32_t)rand() % 8 : 0;
+        if(late > burst)
+        {
+            late = burst;
+        }
+        while(burst > 0)
+        {
+            /* drain reads head here, dma goes on */
+            if(burst == late)
+            {
+                head = dma_pos;
+                written = unread;
+                unread = 0;
+            }
+
+            /* interrupt at half and end of ring */
+            length = (uint16_t)((dma_pos < REPLAY_RING_SIZE / 2) ? (REPLAY_RING_SIZE / 2 - dma_pos) : (REPLAY_RING_SIZE - dma_pos));
+            if(length > ((burst > late) ? (burst - late) : burst))
+            {
+                length = (uint16_t)((burst > late) ? (burst - late) : burst);
+            }
+            dma_pos = (uint16_t)((dma_pos + length) % REPLAY_RING_SIZE);
+            if((dma_pos % (REPLAY_RING_SIZE / 2)) == 0)
+            {
+                events++;
+            }
+            unread += length;
+            burst -= length;
+        }
+        if(late == 0)
+        {
+            head = dma_pos;
+            written = unread;
+            unread = 0;
+        }
+
+        lapped = Ring_SetHeadDma(&ring, head, events);
+        if(lapped != (written >= REPLAY_RING_SIZE))
+        {
+            if(failed < 4)
+            {
+                printf("seed %u drain %u: %u bytes written, lap flag %d\n", seed, n, written, lapped);
+            }
+            failed++;
+        }
+        laps += (lapped == true) ? 1 : 0;
+        Ring_Skip(&ring, Ring_Count(&ring));
+    }
+    return (laps == 0) ? failed + 1 : failed;
+}
+
+static bool Replay_Same(const Replay_Log_t *a, const Replay_Log_t *b)
+{
+    uint32_t i = 0;
+
+    if(a->count != b->count)
+    {
+        printf("event count %u != %u\n", a->count, b->count);
+        return false;
+    }
+    for(i = 0; i < a->count; i++)
+    {
+        if(memcmp(&a->events[i], &b->events[i], sizeof(Replay_Event_t)) != 0)
+        {
+            printf("event %u differs: type %u/%u link %u/%u length %u/%u\n", i,
+                   a->events[i].type, b->events[i].type, a->events[i].link_id, b->events[i].link_id,
+                   a->events[i].length, b->events[i].length);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    static const char *name[] = { "none", "line", "overflow", "ok", "error", "fail", "busy", "ready",
+                                  "send ready", "recv", "send ok", "send fail", "closed",
+                                  "link connect", "link closed", "wifi connected", "wifi got ip",
+                                  "wifi disconnect", "ipd head", "ipd data", "ipd done" };
+    uint8_t *stream = (uint8_t *)malloc(REPLAY_STREAM_MAX);
+    Replay_Log_t whole;
+    Replay_Log_t replay;
+    Parser_t parser;
+    FILE *file = NULL;
+    size_t size = 0;
+    size_t i = 0;
+    uint32_t rounds = 100;
+    uint32_t n = 0;
+    uint32_t interrupts = 0;
+    uint32_t failed = 0;
+
+    memset(&whole, 0, sizeof(whole));
+    whole.events = (Replay_Event_t *)malloc(REPLAY_EVENT_MAX * sizeof(Replay_Event_t));
+    replay.events = (Replay_Event_t *)malloc(REPLAY_EVENT_MAX * sizeof(Replay_Event_t));
+
+    if((argc > 1) && (strcmp(argv[1], "-") != 0))
+    {
+        file = fopen(argv[1], "rb");
+        if(file == NULL)
+        {
+            printf("can not open %s\n", argv[1]);
+            return 1;
+        }
+        size = fread(stream, 1, REPLAY_STREAM_MAX, file);
+        fclose(file);
+    }
+    else
+    {
+        size = Replay_Session(stream, REPLAY_STREAM_MAX / 4);
+    }
+    if(argc > 2)
+    {
+        rounds = (uint32_t)atoi(argv[2]);
+    }
+
+    /* reference: whole stream in one input */
+    Parser_Init(&parser, Replay_Event, &whole);
+    for(i = 0; i < size; i += 0xFFFF)
+    {
+        Parser_Input(&parser, &stream[i], (uint16_t)(((size - i) > 0xFFFF) ? 0xFFFF : (size - i)));
+    }
+
+    for(n = 0; n < rounds; n++)
+    {
+        memset(replay.type_count, 0, sizeof(replay.type_count));
+        replay.count = 0;
+        replay.ipd_hash = 0;
+        interrupts = Replay_Dma(stream, size, &replay, n + 1);
+        if(Replay_Same(&whole, &replay) == false)
+        {
+            printf("seed %u: events differ from whole stream\n", n + 1);
+            failed++;
+        }
+        if(Replay_Lap(n + 1, 10000) != 0)
+        {
+            printf("seed %u: lap check wrong\n", n + 1);
+            failed++;
+        }
+    }
+
+    printf("stream %zu bytes, %u events, %u rounds, %u failed\n", size, whole.count, rounds, failed);
+    for(i = 1; i <= PARSER_EVT_IPD_DONE; i++)
+    {
+        if(whole.type_count[i] > 0)
+        {
+            printf("  %-16s %8u\n", name[i], whole.type_count[i]);
+        }
+    }
+    printf("%-24s %10s\n", "receive", "irq/KB");
+    printf("%-24s %10.0f\n", "dma re-arm per byte", 1024.0);
+    printf("%-24s %10.1f  (last round)\n", "ring, idle + half/full", interrupts * 1024.0 / size);
+
+    free(replay.events);
+    free(whole.events);
+    free(stream);
+    return (failed == 0) ? 0 : 1;
+}
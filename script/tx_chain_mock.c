@@ -0,0 +1,305 @@
+/*
+***************************************************************************************************
+*                           UART DMA Transmit Chain Mock (host)
+*
+* File   : tx_chain_mock.c
+* Author : Douglas Xie
+* Date   : 2018.03.30
+***************************************************************************************************
+* Copyright (C) 2017-2018 Douglas Xie.  All rights reserved.
+***************************************************************************************************
+*
+* Transmit chain of wifi_txchain.c, used by WiFi_SendChain and HAL_UART_TxCpltCallback of
+* wifi_task.c, over a mock of uart dma and of the task notify value given as its hooks. Dma
+* moves one buffer at uart rate to the wire and calls TxChain_Complete like the tx complete
+* interrupt, task notify keeps bits and pending state like FreeRTOS.
+* Random chains (1 to WIFI_TX_CHAIN_SIZE buffers, empty buffers, 1 byte buffers) check:
+*   - wire bytes are the chain buffers in order, empty buffer skipped, total for tx metric
+*   - one tx done notify per chain, after the last byte
+*   - rx / respond notify bits during the chain do not end the wait and are kept for the
+*     control task
+*   - a stalled dma times out, is aborted, and the next chain is not ended by it, also when
+*     the tx complete interrupt comes between the timeout and the abort
+* Also prints cpu time of the old busy wait on UART_FLAG_TC per buffer and of the chain.
+*
+*   gcc -O2 -I../Application/Include tx_chain_mock.c ../Application/Source/wifi_txchain.c
+*       -o tx_chain_mock
+*   ./tx_chain_mock [chains]
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "wifi_txchain.h"
+
+#define MOCK_UART_BPS       92160.0     /* 921600 baud, 10 bits per byte */
+#define MOCK_ISR_US         2.0         /* tx complete interrupt and dma restart */
+#define MOCK_TX_TIMEOUT     200         /* WIFI_TX_TIMEOUT, ms */
+#define MOCK_NOTIFY_TX_DONE (1UL << 0)  /* WIFI_NOTIFY_TX_DONE */
+#define MOCK_NOTIFY_RX      (1UL << 1)  /* WIFI_NOTIFY_RX */
+#define MOCK_NOTIFY_RESPOND (1UL << 2)  /* WIFI_NOTIFY_RESPOND */
+#define MOCK_WIRE_SIZE      (64 * 1024)
+
+/* Uart dma, task notify and time */
+typedef struct
+{
+    double          now;                /* ms */
+    bool            busy;
+    double          done_time;          /* dma transfer complete */
+    bool            stall;              /* next transfer never completes */
+    bool            late;               /* stalled transfer completes just before abort */
+    uint8_t         wire[MOCK_WIRE_SIZE];
+    uint32_t        wire_length;
+    const uint8_t   *dma_data;
+    uint16_t        dma_length;
+    uint32_t        notify_value;
+    bool            notify_pending;
+    uint32_t        tx_done_count;
+    double          tx_done_time;
+    double          other_time;         /* rx / respond notify posted by other task */
+    uint32_t        other_bits;
+    uint32_t        isr_count;
+} Mock_t;
+
+static Mock_t mock;
+static TxChain_t tx_chain;
+
+static double Mock_Wire(uint32_t length)
+{
+    return length / MOCK_UART_BPS * 1000.0;
+}
+
+/* HAL_UART_Transmit_DMA */
+static bool Mock_TransmitDma(const uint8_t *data, uint16_t length, void *context)
+{
+    (void)context;
+    if((mock.busy == true) || (length == 0))
+    {
+        return false;
+    }
+    mock.busy = true;
+    mock.dma_data = data;
+    mock.dma_length = length;
+    mock.done_time = (mock.stall == true) ? 1e30 : (mock.now + Mock_Wire(length));
+    return true;
+}
+
+/* HAL_UART_AbortTransmit */
+static void Mock_AbortTransmit(void *context)
+{
+    (void)context;
+    if((mock.late == true) && (mock.busy == true))
+    {
+        /* tx complete interrupt runs before abort, it may start the next buffer */
+        memcpy(&mock.wire[mock.wire_length], mock.dma_data, mock.dma_length);
+        mock.wire_length += mock.dma_length;
+        mock.busy = false;
+        mock.late = false;
+        mock.isr_count++;
+        TxChain_Complete(&tx_chain);
+    }
+    mock.busy = false;
+    mock.stall = false;
+}
+
+static void Mock_NotifyFromIsr(uint32_t bits)
+{
+    mock.notify_value |= bits;
+    mock.notify_pending = true;
+}
+
+/* xTaskNotifyFromISR of tx complete interrupt to the sender */
+static void Mock_TxNotify(uint32_t bits, void *context)
+{
+    (void)context;
+    if((bits & MOCK_NOTIFY_TX_DONE) != 0)
+    {
+        mock.tx_done_count++;
+        mock.tx_done_time = mock.now;
+    }
+    Mock_NotifyFromIsr(bits);
+}
+
+/* Run dma and other task until time limit or a notify is pending */
+static void Mock_Run(double limit)
+{
+    while(mock.notify_pending == false)
+    {
+        if((mock.other_bits != 0) && (mock.other_time <= limit) &&
+           ((mock.busy == false) || (mock.other_time <= mock.done_time)))
+        {
+            mock.now = (mock.other_time > mock.now) ? mock.other_time : mock.now;
+            Mock_NotifyFromIsr(mock.other_bits);
+            mock.other_bits = 0;
+        }
+        else if((mock.busy == true) && (mock.done_time <= limit))
+        {
+            mock.now = mock.done_time;
+            memcpy(&mock.wire[mock.wire_length], mock.dma_data, mock.dma_length);
+            mock.wire_length += mock.dma_length;
+            mock.busy = false;
+            mock.isr_count++;
+            TxChain_Complete(&tx_chain);
+        }
+        else
+        {
+            mock.now = limit;
+            break;
+        }
+    }
+}
+
+/* xTaskNotifyWait of FreeRTOS on mock time, timeout in ms */
+static bool Mock_NotifyWait(uint32_t clear_entry, uint32_t clear_exit, uint32_t *value, uint32_t timeout, void *context)
+{
+    bool rtn_state = false;
+
+    (void)context;
+    if(mock.notify_pending == false)
+    {
+        mock.notify_value &= ~clear_entry;
+        if(timeout > 0)
+        {
+            Mock_Run(mock.now + timeout);
+        }
+    }
+    if(mock.notify_pending == true)
+    {
+        rtn_state = true;
+    }
+    if(value != NULL)
+    {
+        *value = mock.notify_value;
+    }
+    if(rtn_state == true)
+    {
+        mock.notify_value &= ~clear_exit;
+    }
+    mock.notify_pending = false;
+    return rtn_state;
+}
+
+static const TxChain_Hook_t mock_hook =
+{
+    Mock_TransmitDma,
+    Mock_AbortTransmit,
+    Mock_NotifyWait,
+    Mock_TxNotify,
+};
+
+int main(int argc, char **argv)
+{
+    static uint8_t pool[TXCHAIN_SIZE][4096];
+    TxChain_Desc_t chain[TXCHAIN_SIZE];
+    uint8_t expect[MOCK_WIRE_SIZE];
+    uint32_t expect_length = 0;
+    uint32_t total = 0;
+    uint32_t chains = 10000;
+    uint32_t n = 0;
+    uint32_t i = 0;
+    uint8_t count = 0;
+    uint32_t failed = 0;
+    uint32_t stalled = 0;
+    uint32_t posted = 0;
+    uint32_t kept = 0;
+    uint32_t buffers = 0;
+    uint64_t bytes = 0;
+    double start = 0;
+    bool stall = false;
+    bool other = false;
+    bool done = false;
+
+    if(argc > 1)
+    {
+        chains = (uint32_t)atoi(argv[1]);
+    }
+    srand(1);
+    TxChain_Init(&tx_chain, &mock_hook, NULL, MOCK_NOTIFY_TX_DONE, MOCK_TX_TIMEOUT);
+
+    for(n = 0; n < chains; n++)
+    {
+        /* random chain: header, payload of any size, empty or 1 byte buffers */
+        count = (uint8_t)(1 + rand() % TXCHAIN_SIZE);
+        expect_length = 0;
+        for(i = 0; i < count; i++)
+        {
+            chain[i].data = pool[i];
+            chain[i].length = (uint16_t)(((rand() % 5) == 0) ? (rand() % 2) : (rand() % 4096));
+            memset(pool[i], (int)(n * 4 + i), chain[i].length);
+            memcpy(&expect[expect_length], chain[i].data, chain[i].length);
+            expect_length += chain[i].length;
+        }
+
+        /* control task is notified for rx or respond while it waits */
+        mock.other_bits = 0;
+        other = ((rand() % 2) == 0);
+        if(other == true)
+        {
+            mock.other_time = mock.now + Mock_Wire(rand() % (expect_length + 1));
+            mock.other_bits = ((rand() % 2) == 0) ? MOCK_NOTIFY_RX : MOCK_NOTIFY_RESPOND;
+        }
+        stall = ((n % 97) == 96) && (expect_length > 0);
+        mock.stall = stall;
+        mock.late = (stall == true) && (((n / 97) % 2) == 0);
+        mock.wire_length = 0;
+        mock.tx_done_count = 0;
+        mock.isr_count = 0;
+        mock.notify_value &= ~(MOCK_NOTIFY_RX | MOCK_NOTIFY_RESPOND);
+        start = mock.now;
+
+        done = TxChain_Send(&tx_chain, chain, count, &total);
+
+        if(stall == true)
+        {
+            /* timeout, dma aborted, no done notify */
+            stalled++;
+            if((done == true) || (total != 0) || (mock.tx_done_count > 1) || (mock.busy == true) || (mock.now - start < MOCK_TX_TIMEOUT))
+            {
+                printf("chain %u: stalled dma not timed out\n", n);
+                failed++;
+            }
+            continue;
+        }
+        if((done == false) || (mock.wire_length != expect_length) || (total != expect_length) ||
+           (memcmp(mock.wire, expect, expect_length) != 0))
+        {
+            printf("chain %u: wire differs, %u of %u bytes\n", n, mock.wire_length, expect_length);
+            failed++;
+            continue;
+        }
+        if((expect_length > 0) && ((mock.tx_done_count != 1) || (mock.tx_done_time < start + Mock_Wire(expect_length) - 1e-9)))
+        {
+            printf("chain %u: %u done notify, at %.3f ms of %.3f\n", n, mock.tx_done_count,
+                   mock.tx_done_time - start, Mock_Wire(expect_length));
+            failed++;
+            continue;
+        }
+        posted += (other == true) ? 1 : 0;
+        if(mock.other_bits != 0)
+        {
+            /* posted after the chain, deliver it now */
+            Mock_Run(mock.other_time);
+            Mock_NotifyWait(0, 0, NULL, 0, NULL);
+        }
+        if((other == true) && ((mock.notify_value & (MOCK_NOTIFY_RX | MOCK_NOTIFY_RESPOND)) != 0))
+        {
+            kept++;
+        }
+        buffers += mock.isr_count;
+        bytes += expect_length;
+    }
+
+    if(kept != posted)
+    {
+        printf("rx/respond bit lost in %u chains\n", posted - kept);
+        failed++;
+    }
+    printf("%u chains, %u stalled, rx/respond bit kept %u/%u, %u failed\n", chains, stalled, kept, posted, failed);
+    printf("%-26s %12s\n", "transmit", "cpu us/KB");
+    printf("%-26s %12.1f\n", "busy wait per buffer", Mock_Wire(1024) * 1000.0);
+    printf("%-26s %12.1f\n", "dma chain, isr per buffer", (bytes > 0) ? (buffers * MOCK_ISR_US / (bytes / 1024.0)) : 0.0);
+    return (failed == 0) ? 0 : 1;
+}